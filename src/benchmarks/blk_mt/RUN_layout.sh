@@ -0,0 +1,89 @@
+#! /bin/bash
+#
+# Copyright (c) 2015, Intel Corporation
+#
+# Redistribution and use in source and binary forms, with or without
+# modification, are permitted provided that the following conditions
+# are met:
+#
+#     * Redistributions of source code must retain the above copyright
+#       notice, this list of conditions and the following disclaimer.
+#
+#     * Redistributions in binary form must reproduce the above copyright
+#       notice, this list of conditions and the following disclaimer in
+#       the documentation and/or other materials provided with the
+#       distribution.
+#
+#     * Neither the name of Intel Corporation nor the names of its
+#       contributors may be used to endorse or promote products derived
+#       from this software without specific prior written permission.
+#
+# THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+# "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+# LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+# A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+# OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+# SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+# LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+# DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+# THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+# (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+# OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#
+# RUN_layout.sh -- compare packed and cache line aligned BTT run-time state
+#
+# Builds libpmem, libpmemblk and blk_mt into a temporary directory with the
+# per-lane run-time state of the BTT packed (BTT_RUNTIME_ALIGN=8) and
+# aligned to cache lines (the default), and runs the write and read tests
+# with each, for 1 to MAX_THREADS threads.  The objects in the source tree
+# are left alone.
+#
+
+MAX_THREADS=`nproc`
+OPERATIONS_PER_THREAD=100000
+BLK_SIZE=512
+BLK_FILE="./blkfile.tmp"
+FILE_SIZE=1024 #MB
+SRC_DIR=`cd ../.. && pwd`
+BUILD_DIR=`mktemp -d`
+
+trap "rm -rf $BUILD_DIR" EXIT
+
+build_layout() {
+	dir=$BUILD_DIR/$1
+	shift
+	mkdir -p $dir
+	make -s -C $SRC_DIR/libpmem OBJDIR=$dir \
+		EXTRA_CFLAGS="$EXTRA_CFLAGS" > /dev/null 2>&1 &&
+	make -s -C $SRC_DIR/libpmemblk OBJDIR=$dir LDFLAGS=-L$dir \
+		EXTRA_CFLAGS="$EXTRA_CFLAGS $*" > /dev/null 2>&1 &&
+	${CC:-cc} -std=gnu99 -Wall -O3 -I$SRC_DIR/include -I. \
+		-o $dir/blk_mt blk_mt.c workers.c \
+		-L$dir -lpmemblk -lpmem -lpthread -lrt || exit 1
+}
+
+for layout in packed aligned ; do
+	case $layout in
+	packed)		build_layout $layout -DBTT_RUNTIME_ALIGN=8 ;;
+	aligned)	build_layout $layout ;;
+	esac
+
+	export LD_LIBRARY_PATH=$BUILD_DIR/$layout
+	BLK_MT=$BUILD_DIR/$layout/blk_mt
+
+	rm -f $BLK_FILE
+	$BLK_MT -b $BLK_SIZE -s $FILE_SIZE -c $MAX_THREADS $BLK_FILE
+
+	OUT=benchmark_mt_pmemblk_$layout.out
+	rm -f $OUT
+	for i in `seq $MAX_THREADS` ; do
+		echo $layout: blk_mt -b $BLK_SIZE -s $FILE_SIZE \
+			-o $OPERATIONS_PER_THREAD $i $BLK_FILE
+		$BLK_MT -b $BLK_SIZE -s $FILE_SIZE \
+			-o $OPERATIONS_PER_THREAD $i $BLK_FILE >> $OUT
+	done
+done
+
+rm -f $BLK_FILE
+paste -d '' benchmark_mt_pmemblk_packed.out benchmark_mt_pmemblk_aligned.out
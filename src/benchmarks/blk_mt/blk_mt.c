@@ -83,6 +83,13 @@ static struct argp_option options[] = {
 		{ "ops-per-thread", 'o', "OPS", 0, "Number of "
 			"operations performed in each thread. Use "
 			"at least 50. Default 100" },
+		{ "map-blocks", 'm', 0, 0, "Read blocks with "
+			"pmemblk_map_block instead of copying them" },
+		{ "vector", 'v', "COUNT", 0, "Read and write runs of "
+			"COUNT blocks with pmemblk_readv/writev" },
+		{ "mixed", 'x', "COUNT", 0, "Run a single test in which half "
+			"of the threads write and half read the first COUNT "
+			"blocks" },
 		{ 0 }
 };
 
@@ -90,6 +97,12 @@ static struct argp argp = { options, parse_opt, args_doc, doc };
 
 static worker pmem_workers[WORKER_COUNT_MAX] = { w_worker, r_worker };
 
+static worker pmem_map_workers[WORKER_COUNT_MAX] = { w_worker, mr_worker };
+
+static worker pmem_vec_workers[WORKER_COUNT_MAX] = { wv_worker, rv_worker };
+
+static worker pmem_mixed_workers[WORKER_COUNT_MAX] = { x_worker, NULL };
+
 static worker file_workers[WORKER_COUNT_MAX] = { wf_worker, rf_worker };
 
 int
@@ -117,6 +130,9 @@ main(int argc, char *argv[])
 	worker_params[0].block_size = arguments.block_size;
 	worker_params[0].num_ops = arguments.num_ops;
 	worker_params[0].file_lanes = arguments.thread_count;
+	worker_params[0].vec_size = arguments.vec_size;
+	worker_params[0].hot_blocks = arguments.hot_blocks;
+	worker_params[0].map_blocks = arguments.map_blocks;
 
 	/* file_size is provided in MB */
 	unsigned long long file_size_bytes = arguments.file_size * 1024 * 1024;
@@ -165,6 +181,12 @@ main(int argc, char *argv[])
 		worker_params[0].num_blocks = pmemblk_nblock(
 				worker_params[0].handle);
 		thread_workers = pmem_workers;
+		if (arguments.map_blocks)
+			thread_workers = pmem_map_workers;
+		else if (arguments.vec_size)
+			thread_workers = pmem_vec_workers;
+		if (arguments.hot_blocks)
+			thread_workers = pmem_mixed_workers;
 	}
 
 	/* propagate params to each info_t */
@@ -197,7 +219,7 @@ main(int argc, char *argv[])
 		}
 	}
 
-	for (int i = 0; i < WORKER_COUNT_MAX; ++i) {
+	for (int i = 0; i < WORKER_COUNT_MAX && thread_workers[i]; ++i) {
 		clock_gettime(CLOCK_MONOTONIC, &perf_meas.start_time);
 		if (run_threads(thread_workers[i], arguments.thread_count,
 				worker_params) != 0) {
@@ -318,6 +340,11 @@ parse_opt(int key, char *arg, struct argp_state *state)
 					"be chosen simultaneously");
 			ret = FAILURE;
 		}
+		if (arguments->map_blocks) {
+			warnx("The -m and -i options cannot "
+					"be chosen simultaneously");
+			ret = FAILURE;
+		}
 		break;
 	case 'c':
 		arguments->prep_blk_file = 1;
@@ -327,6 +354,32 @@ parse_opt(int key, char *arg, struct argp_state *state)
 			ret = FAILURE;
 		}
 		break;
+	case 'm':
+		arguments->map_blocks = 1;
+		if (arguments->file_io) {
+			warnx("The -m and -i options cannot "
+					"be chosen simultaneously");
+			ret = FAILURE;
+		}
+		break;
+	case 'v':
+		arguments->vec_size = strtoul(arg, NULL, 0);
+		if (arguments->vec_size < 1 || arguments->file_io ||
+				arguments->map_blocks) {
+			warnx("The -v option needs a count of at least 1 "
+					"and cannot be chosen with -i or -m");
+			ret = FAILURE;
+		}
+		break;
+	case 'x':
+		arguments->hot_blocks = strtoul(arg, NULL, 0);
+		if (arguments->hot_blocks < 1 || arguments->file_io ||
+				arguments->vec_size) {
+			warnx("The -x option needs a count of at least 1 "
+					"and cannot be chosen with -i or -v");
+			ret = FAILURE;
+		}
+		break;
 	case 'o':
 		arguments->num_ops = strtoul(arg, NULL, 0);
 		if (arguments->num_ops < 50) {
@@ -51,4 +51,7 @@ struct blk_arguments {
 	unsigned int file_size;
 	int file_io;
 	int prep_blk_file;
+	int map_blocks;
+	unsigned int vec_size;
+	unsigned int hot_blocks;
 };
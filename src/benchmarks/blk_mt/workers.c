@@ -63,6 +63,132 @@ r_worker(void *arg)
 	return NULL;
 }
 
+/*
+ * mr_worker -- read worker function mapping the blocks instead of copying
+ */
+void *
+mr_worker(void *arg)
+{
+	struct worker_info *my_info = arg;
+	volatile unsigned char sink;
+
+	for (int i = 0; i < my_info->num_ops; i++) {
+		off_t lba = rand_r(&my_info->seed) % my_info->num_blocks;
+
+		/* map, touch the block, unmap */
+		const unsigned char *block =
+			pmemblk_map_block(my_info->handle, lba);
+		if (block == NULL) {
+			warn("map       lba %zu", lba);
+			continue;
+		}
+		sink = block[0];
+		if (pmemblk_unmap_block(my_info->handle, block) < 0) {
+			warn("unmap     lba %zu", lba);
+		}
+	}
+	(void) sink;
+	return NULL;
+}
+
+/*
+ * vec_worker -- (internal) read or write runs of vec_size blocks
+ *
+ * Each run starts at a random block, num_ops counts blocks.
+ */
+static void
+vec_worker(struct worker_info *my_info, int write)
+{
+	unsigned vec_size = my_info->vec_size;
+	unsigned char *bufs = malloc(vec_size * my_info->block_size);
+	struct pmemblk_iovec iov[vec_size];
+
+	if (bufs == NULL)
+		err(1, "malloc");
+	memset(bufs, 1, vec_size * my_info->block_size);
+
+	for (int i = 0; i < my_info->num_ops; i += vec_size) {
+		off_t lba = rand_r(&my_info->seed) % my_info->num_blocks;
+
+		for (int j = 0; j < vec_size; j++) {
+			iov[j].buf = bufs + j * my_info->block_size;
+			iov[j].blockno = (lba + j) % my_info->num_blocks;
+		}
+
+		if (write) {
+			if (pmemblk_writev(my_info->handle, iov, vec_size) < 0)
+				warn("writev    lba %zu", lba);
+		} else {
+			if (pmemblk_readv(my_info->handle, iov, vec_size) < 0)
+				warn("readv     lba %zu", lba);
+		}
+	}
+
+	free(bufs);
+}
+
+/*
+ * rv_worker -- read worker function reading vectors of blocks
+ */
+void *
+rv_worker(void *arg)
+{
+	vec_worker(arg, 0);
+	return NULL;
+}
+
+/*
+ * wv_worker -- write worker function writing vectors of blocks
+ */
+void *
+wv_worker(void *arg)
+{
+	vec_worker(arg, 1);
+	return NULL;
+}
+
+/*
+ * x_worker -- mixed worker function
+ *
+ * Threads with an even index write and threads with an odd index read
+ * random blocks out of the first hot_blocks, so writers keep freeing
+ * blocks that readers still hold.
+ */
+void *
+x_worker(void *arg)
+{
+	struct worker_info *my_info = arg;
+	unsigned char buf[my_info->block_size];
+	volatile unsigned char sink;
+	int write = my_info->thread_index % 2 == 0;
+
+	memset(buf, 1, my_info->block_size);
+
+	for (int i = 0; i < my_info->num_ops; i++) {
+		off_t lba = rand_r(&my_info->seed) % my_info->hot_blocks;
+
+		if (write) {
+			if (pmemblk_write(my_info->handle, buf, lba) < 0)
+				warn("write     lba %zu", lba);
+		} else if (my_info->map_blocks) {
+			const unsigned char *block =
+				pmemblk_map_block(my_info->handle, lba);
+			if (block == NULL) {
+				warn("map       lba %zu", lba);
+				continue;
+			}
+			sink = block[0];
+			if (pmemblk_unmap_block(my_info->handle, block) < 0)
+				warn("unmap     lba %zu", lba);
+		} else {
+			if (pmemblk_read(my_info->handle, buf, lba) < 0)
+				warn("read      lba %zu", lba);
+		}
+	}
+	(void) sink;
+	return NULL;
+}
+
 /*
  * w_worker -- write worker function
  */
@@ -49,12 +49,31 @@ struct worker_info {
 	PMEMblkpool *handle;
 	int file_desc;
 	unsigned int file_lanes;
+	unsigned int vec_size;
+	unsigned int hot_blocks;
+	int map_blocks;
 };
 
 /*
  * worker -- read worker function for pmem
  */
 void *r_worker(void *arg);
+/*
+ * mr_worker -- read worker function for pmem, mapping blocks
+ */
+void *mr_worker(void *arg);
+/*
+ * rv_worker -- read worker function for pmem, reading vectors
+ */
+void *rv_worker(void *arg);
+/*
+ * wv_worker -- write worker function for pmem, writing vectors
+ */
+void *wv_worker(void *arg);
+/*
+ * x_worker -- mixed worker function for pmem, see -x
+ */
+void *x_worker(void *arg);
 /*
  * worker -- write worker function for pmem
  */
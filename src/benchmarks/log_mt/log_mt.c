@@ -73,6 +73,7 @@ static struct argp_option options[] = {
 			"(default: 1)"},
 	{"element",      'e', "SIZE",  0, "Element size "
 			"(default: 512 bytes)"},
+	{"compress",     'c', 0,       0, "Compressed log"},
 	{0}
 };
 
@@ -104,6 +105,7 @@ main(int argc, char *argv[])
 	size_t psize;
 	int fails = 0;
 	double exec_time;
+	double append_time = 0;
 	PMEMlogpool *plp = NULL;
 
 	/* default program settings */
@@ -112,7 +114,8 @@ main(int argc, char *argv[])
 		.rand = false,
 		.vec_size = DEF_VEC_SIZE,
 		.el_size = DEF_EL_SIZE,
-		.fileio_mode = false
+		.fileio_mode = false,
+		.compress = false
 	};
 
 	/* parse command line arguments */
@@ -129,8 +132,13 @@ main(int argc, char *argv[])
 			psize = PMEMLOG_MIN_POOL;
 		}
 
-		if ((plp = pmemlog_create(args.file_name, psize, FILE_MODE))
-				== NULL) {
+		if (args.compress)
+			plp = pmemlog_create_compressed(args.file_name, psize,
+					FILE_MODE);
+		else
+			plp = pmemlog_create(args.file_name, psize, FILE_MODE);
+
+		if (plp == NULL) {
 			perror("pmemlog_open");
 			exit(1);
 		}
@@ -161,6 +169,19 @@ main(int argc, char *argv[])
 			err(1, "Tasks execution failed");
 		printf("%f;%f;",
 				exec_time, args.ops_count / exec_time);
+		if (i == 0)
+			append_time = exec_time;
+	}
+
+	if (args.compress) {
+		struct pmemlog_usage usage;
+
+		/* the walk flushed the data still staged */
+		if (pmemlog_usage(plp, &usage) < 0)
+			err(1, "pmemlog_usage");
+
+		printf("%f;%f;", usage.logical / append_time / 1000000,
+				100.0 - 100.0 * usage.used / usage.logical);
 	}
 
 	printf("\n");
@@ -220,6 +241,9 @@ parse_opt(int key, char *arg, struct argp_state *state)
 	case 'i':
 		args->fileio_mode = true;
 		break;
+	case 'c':
+		args->compress = true;
+		break;
 	case ARGP_KEY_ARG:
 		switch (state->arg_num) {
 		case 0:
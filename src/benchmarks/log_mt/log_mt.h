@@ -47,5 +47,6 @@ struct prog_args {
 	int threads_count;
 	int ops_count;
 	bool fileio_mode;
+	bool compress;
 	char *file_name;
 };
@@ -45,6 +45,7 @@
 #define	STATE_BUF_LEN 32
 
 static int process_data(const void *buf, size_t len, void *arg);
+static void fill_text(char *buf, size_t len, int seed);
 static void *do_thread(void *arg);
 
 /*
@@ -112,6 +113,7 @@ run_threads(struct prog_args *args, thread_f task, void *arg, double *exec_time)
 		}
 
 		thread_info[i].buf_size = args->el_size * args->vec_size;
+		fill_text(thread_info[i].buf, thread_info[i].buf_size, i);
 
 		if ((thread_info[i].iov = (struct iovec *)
 				malloc(args->vec_size *
@@ -289,6 +291,29 @@ task_fileiolog_read(void *arg)
 	return EXIT_SUCCESS;
 }
 
+/*
+ * fill_text -- fills a buffer with lines of telemetry-like text
+ */
+static void
+fill_text(char *buf, size_t len, int seed)
+{
+	char line[80];
+	size_t pos = 0;
+
+	for (int n = 0; pos < len; ++n) {
+		size_t line_len = snprintf(line, sizeof (line),
+				"ts=%d thread=%d seq=%d value=%d status=ok\n",
+				1000000 + n * 10, seed, n,
+				(seed * 31 + n * 7) % 1000);
+
+		if (line_len > len - pos)
+			line_len = len - pos;
+
+		memcpy(buf + pos, line, line_len);
+		pos += line_len;
+	}
+}
+
 /*
  * process_data -- callback function for the pmemlog_walk()
  */
@@ -0,0 +1,141 @@
+/*
+ * Copyright (c) 2015, Intel Corporation
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in
+ *       the documentation and/or other materials provided with the
+ *       distribution.
+ *
+ *     * Neither the name of Intel Corporation nor the names of its
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * pmem_init.c -- libpmem load-time initialization benchmark
+ *
+ * usage: For usage type pmem_init --help.
+ *
+ * Loads and unloads libpmem using dlopen(3)/dlclose(3) the given number
+ * of times, so the time measured is dominated by the library constructors
+ * (CPU feature detection etc.), which run on every load.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <dlfcn.h>
+#include <argp.h>
+#include <err.h>
+
+#define	NSEC_IN_SEC 1000000000
+#define	DEF_LIBRARY "libpmem.so.1"
+#define	DEF_LOADS 1000
+
+/* program arguments */
+struct prog_args {
+	const char *library;
+	int loads;
+};
+
+static error_t parse_opt(int key, char *arg, struct argp_state *state);
+
+const char *argp_program_version = "pmem_init_benchmark 1.0";
+static char doc[] = "libpmem load-time initialization benchmark";
+static char args_doc[] = "[LOADS_COUNT]";
+
+static struct argp_option options[] = {
+	{"library", 'l', "PATH", 0, "Library to load "
+			"(default: " DEF_LIBRARY ")"},
+	{0}
+};
+
+static struct argp argp = { options, parse_opt, args_doc, doc };
+
+int
+main(int argc, char *argv[])
+{
+	struct prog_args args = {
+		.library = DEF_LIBRARY,
+		.loads = DEF_LOADS
+	};
+
+	if (argp_parse(&argp, argc, argv, 0, 0, &args) != 0) {
+		exit(1);
+	}
+
+	struct timespec start, stop;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	for (int i = 0; i < args.loads; ++i) {
+		void *handle = dlopen(args.library, RTLD_NOW | RTLD_LOCAL);
+		if (handle == NULL)
+			errx(1, "dlopen: %s", dlerror());
+
+		if (dlclose(handle) != 0)
+			errx(1, "dlclose: %s", dlerror());
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &stop);
+
+	double exec_time = (double)(stop.tv_sec - start.tv_sec) +
+		(double)(stop.tv_nsec - start.tv_nsec) / NSEC_IN_SEC;
+
+	printf("%f;%f;%f\n", exec_time, args.loads / exec_time,
+			exec_time * 1000000 / args.loads);
+
+	exit(0);
+}
+
+/*
+ * parse_opt -- command line arguments parsing function
+ */
+static error_t
+parse_opt(int key, char *arg, struct argp_state *state)
+{
+	struct prog_args *args = state->input;
+	char *tailptr;
+
+	switch (key) {
+	case 'l':
+		args->library = arg;
+		break;
+	case ARGP_KEY_ARG:
+		if (state->arg_num > 0) {
+			argp_usage(state);
+			return ARGP_ERR_UNKNOWN;
+		}
+		args->loads = strtol(arg, &tailptr, 10);
+		if (*tailptr != 0 || args->loads <= 0) {
+			fprintf(stderr,
+				"Invalid loads count: %s\n",
+				arg);
+			argp_usage(state);
+			return EXIT_FAILURE;
+		}
+		break;
+	default:
+		return ARGP_ERR_UNKNOWN;
+	}
+
+	return 0;
+}
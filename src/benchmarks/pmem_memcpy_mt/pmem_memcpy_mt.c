@@ -0,0 +1,197 @@
+/*
+ * Copyright (c) 2015, Intel Corporation
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in
+ *       the documentation and/or other materials provided with the
+ *       distribution.
+ *
+ *     * Neither the name of Intel Corporation nor the names of its
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * pmem_memcpy_mt.c -- multi-threaded pmem copy benchmark
+ *
+ * usage: For usage type pmem_memcpy_mt --help.
+ *
+ * Copies a buffer of the given size into a memory mapped file using
+ * pmem_memcpy_persist_mt() with the given number of threads, the given
+ * number of times, and reports the achieved bandwidth.  With one thread
+ * the copy is the same as pmem_memcpy_persist().
+ */
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <argp.h>
+#include <err.h>
+#include <libpmem.h>
+
+#define	NSEC_IN_SEC 1000000000
+#define	MB (1 << 20)
+#define	DEF_SIZE 1024
+#define	DEF_RUNS 10
+
+/* program arguments */
+struct prog_args {
+	size_t size;		/* size of each copy in MB */
+	int runs;
+	unsigned nthreads;
+	const char *file;
+};
+
+static error_t parse_opt(int key, char *arg, struct argp_state *state);
+
+const char *argp_program_version = "pmem_memcpy_mt_benchmark 1.0";
+static char doc[] = "multi-threaded pmem copy benchmark";
+static char args_doc[] = "NUM_THREADS FILE";
+
+static struct argp_option options[] = {
+	{"size", 's', "MB", 0, "Size of each copy in MB "
+			"(default: 1024)"},
+	{"runs", 'r', "NUM", 0, "Number of copies (default: 10)"},
+	{0}
+};
+
+static struct argp argp = { options, parse_opt, args_doc, doc };
+
+int
+main(int argc, char *argv[])
+{
+	struct prog_args args = {
+		.size = DEF_SIZE,
+		.runs = DEF_RUNS
+	};
+
+	if (argp_parse(&argp, argc, argv, 0, 0, &args) != 0) {
+		exit(1);
+	}
+
+	size_t len = args.size * MB;
+
+	int fd = open(args.file, O_CREAT|O_RDWR, 0666);
+	if (fd < 0)
+		err(1, "%s", args.file);
+
+	if (posix_fallocate(fd, 0, len) != 0)
+		errx(1, "posix_fallocate %s failed", args.file);
+
+	char *dest = pmem_map(fd);
+	if (dest == NULL)
+		err(1, "pmem_map %s", args.file);
+	close(fd);
+
+	if (!pmem_is_pmem(dest, len))
+		fprintf(stderr, "warning: %s is not pmem\n", args.file);
+
+	char *src = malloc(len);
+	if (src == NULL)
+		err(1, "malloc");
+	memset(src, 0xc5, len);
+
+	/* fault in the destination, so page faults aren't measured */
+	pmem_memset_persist(dest, 0, len);
+
+	struct timespec start, stop;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	for (int i = 0; i < args.runs; ++i)
+		pmem_memcpy_persist_mt(dest, src, len, args.nthreads);
+
+	clock_gettime(CLOCK_MONOTONIC, &stop);
+
+	double exec_time = (double)(stop.tv_sec - start.tv_sec) +
+		(double)(stop.tv_nsec - start.tv_nsec) / NSEC_IN_SEC;
+
+	printf("%u;%f;%f\n", args.nthreads, exec_time,
+			(double)len * args.runs / MB / exec_time);
+
+	free(src);
+	pmem_unmap(dest, len);
+
+	exit(0);
+}
+
+/*
+ * parse_opt -- command line arguments parsing function
+ */
+static error_t
+parse_opt(int key, char *arg, struct argp_state *state)
+{
+	struct prog_args *args = state->input;
+	char *tailptr;
+
+	switch (key) {
+	case 's':
+		args->size = strtoul(arg, &tailptr, 10);
+		if (*tailptr != 0 || args->size == 0) {
+			fprintf(stderr, "Invalid size: %s\n", arg);
+			argp_usage(state);
+			return EXIT_FAILURE;
+		}
+		break;
+	case 'r':
+		args->runs = strtol(arg, &tailptr, 10);
+		if (*tailptr != 0 || args->runs <= 0) {
+			fprintf(stderr, "Invalid number of runs: %s\n", arg);
+			argp_usage(state);
+			return EXIT_FAILURE;
+		}
+		break;
+	case ARGP_KEY_ARG:
+		switch (state->arg_num) {
+		case 0:
+			args->nthreads = strtoul(arg, &tailptr, 10);
+			if (*tailptr != 0 || args->nthreads == 0) {
+				fprintf(stderr,
+					"Invalid number of threads: %s\n",
+					arg);
+				argp_usage(state);
+				return EXIT_FAILURE;
+			}
+			break;
+		case 1:
+			args->file = arg;
+			break;
+		default:
+			argp_usage(state);
+			return ARGP_ERR_UNKNOWN;
+		}
+		break;
+	case ARGP_KEY_END:
+		if (state->arg_num < 2)
+			argp_usage(state);
+		break;
+	default:
+		return ARGP_ERR_UNKNOWN;
+	}
+
+	return 0;
+}
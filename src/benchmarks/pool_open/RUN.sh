@@ -0,0 +1,65 @@
+#! /bin/bash
+#
+# Copyright (c) 2015, Intel Corporation
+#
+# Redistribution and use in source and binary forms, with or without
+# modification, are permitted provided that the following conditions
+# are met:
+#
+#     * Redistributions of source code must retain the above copyright
+#       notice, this list of conditions and the following disclaimer.
+#
+#     * Redistributions in binary form must reproduce the above copyright
+#       notice, this list of conditions and the following disclaimer in
+#       the documentation and/or other materials provided with the
+#       distribution.
+#
+#     * Neither the name of Intel Corporation nor the names of its
+#       contributors may be used to endorse or promote products derived
+#       from this software without specific prior written permission.
+#
+# THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+# "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+# LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+# A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+# OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+# SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+# LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+# DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+# THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+# (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+# OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+
+#
+# RUN.sh -- script for running the pool_open benchmark
+#
+# Opens the same pool with each of the mapping options, so the time
+# spent faulting the mapping in can be compared.
+#
+
+SIZE=1024 #MB
+READS=100000
+PMEM_FILE="./pmemfile.tmp"
+POOL_OPEN_OUT=pool_open.out
+[ -n "$1" ] && PMEM_FILE=$1
+
+rm -f $POOL_OPEN_OUT $PMEM_FILE
+
+# create the pool, so the first run doesn't pay for it
+./pool_open -s $SIZE -r 0 $PMEM_FILE > /dev/null
+
+for opts in "" \
+	"PMEM_MAP_PREFAULT=1" \
+	"PMEM_MAP_PREFAULT=4" \
+	"PMEM_MAP_HUGEPAGE=1" \
+	"PMEM_MAP_HUGEPAGE=1 PMEM_MAP_PREFAULT=4" \
+	"PMEM_MAP_ALIGN=2M PMEM_MAP_HUGEPAGE=1 PMEM_MAP_PREFAULT=4"; do
+	echo $opts ./pool_open -s $SIZE -r $READS $PMEM_FILE
+	echo -n "$opts;" >> $POOL_OPEN_OUT
+	env $opts ./pool_open -s $SIZE -r $READS $PMEM_FILE >> $POOL_OPEN_OUT
+done
+
+rm -f $PMEM_FILE
+
+cat $POOL_OPEN_OUT
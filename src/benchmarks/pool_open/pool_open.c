@@ -0,0 +1,212 @@
+/*
+ * Copyright (c) 2015, Intel Corporation
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in
+ *       the documentation and/or other materials provided with the
+ *       distribution.
+ *
+ *     * Neither the name of Intel Corporation nor the names of its
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * pool_open.c -- cold open to first I/O benchmark
+ *
+ * usage: For usage type pool_open --help.
+ *
+ * Creates a PMEMBLK pool of the given size, unless the file exists
+ * already, then measures how long it takes to open the pool and do the
+ * first read of a random block, followed by the given number of random
+ * reads.  The pool is mapped according to the PMEM_MAP_ALIGN,
+ * PMEM_MAP_HUGEPAGE and PMEM_MAP_PREFAULT environment variables, so the
+ * time spent faulting the mapping in shows up either in the open or in
+ * the reads.
+ */
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <argp.h>
+#include <err.h>
+#include <libpmemblk.h>
+
+#define	NSEC_IN_SEC 1000000000
+#define	MB (1 << 20)
+#define	DEF_SIZE 1024
+#define	DEF_BSIZE 512
+#define	DEF_READS 100000
+#define	FILE_MODE 0666
+
+/* program arguments */
+struct prog_args {
+	size_t size;		/* pool size in MB */
+	size_t bsize;
+	long reads;
+	const char *file;
+};
+
+static error_t parse_opt(int key, char *arg, struct argp_state *state);
+
+const char *argp_program_version = "pool_open_benchmark 1.0";
+static char doc[] = "PMEMBLK cold open to first I/O benchmark";
+static char args_doc[] = "FILE";
+
+static struct argp_option options[] = {
+	{"size", 's', "MB", 0, "Pool size in MB (default: 1024)"},
+	{"block-size", 'b', "SIZE", 0, "Block size in bytes "
+			"(default: 512)"},
+	{"reads", 'r', "NUM", 0, "Number of random reads after the first "
+			"one (default: 100000)"},
+	{0}
+};
+
+static struct argp argp = { options, parse_opt, args_doc, doc };
+
+/*
+ * elapsed -- return the time between two timestamps in seconds
+ */
+static double
+elapsed(const struct timespec *start, const struct timespec *stop)
+{
+	return (double)(stop->tv_sec - start->tv_sec) +
+		(double)(stop->tv_nsec - start->tv_nsec) / NSEC_IN_SEC;
+}
+
+int
+main(int argc, char *argv[])
+{
+	struct prog_args args = {
+		.size = DEF_SIZE,
+		.bsize = DEF_BSIZE,
+		.reads = DEF_READS
+	};
+
+	if (argp_parse(&argp, argc, argv, 0, 0, &args) != 0) {
+		exit(1);
+	}
+
+	PMEMblkpool *pbp;
+
+	if (access(args.file, F_OK) != 0) {
+		pbp = pmemblk_create(args.file, args.bsize,
+				args.size * MB, FILE_MODE);
+		if (pbp == NULL)
+			err(1, "pmemblk_create %s", args.file);
+		pmemblk_close(pbp);
+	}
+
+	char *buf = malloc(args.bsize);
+	if (buf == NULL)
+		err(1, "malloc");
+
+	srand(time(NULL));
+
+	struct timespec start, open, first, stop;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	if ((pbp = pmemblk_open(args.file, args.bsize)) == NULL)
+		err(1, "pmemblk_open %s", args.file);
+
+	clock_gettime(CLOCK_MONOTONIC, &open);
+
+	size_t nblock = pmemblk_nblock(pbp);
+	if (pmemblk_read(pbp, buf, rand() % nblock) < 0)
+		err(1, "pmemblk_read");
+
+	clock_gettime(CLOCK_MONOTONIC, &first);
+
+	for (long i = 0; i < args.reads; ++i)
+		if (pmemblk_read(pbp, buf, rand() % nblock) < 0)
+			err(1, "pmemblk_read");
+
+	clock_gettime(CLOCK_MONOTONIC, &stop);
+
+	double open_time = elapsed(&start, &open);
+	double first_time = elapsed(&open, &first);
+	double reads_time = elapsed(&first, &stop);
+
+	printf("%f;%f;%f;%f\n", open_time, first_time,
+			open_time + first_time,
+			reads_time > 0 ? args.reads / reads_time : 0);
+
+	pmemblk_close(pbp);
+	free(buf);
+
+	exit(0);
+}
+
+/*
+ * parse_opt -- command line arguments parsing function
+ */
+static error_t
+parse_opt(int key, char *arg, struct argp_state *state)
+{
+	struct prog_args *args = state->input;
+	char *tailptr;
+
+	switch (key) {
+	case 's':
+		args->size = strtoul(arg, &tailptr, 10);
+		if (*tailptr != 0 || args->size == 0) {
+			fprintf(stderr, "Invalid size: %s\n", arg);
+			argp_usage(state);
+			return EXIT_FAILURE;
+		}
+		break;
+	case 'b':
+		args->bsize = strtoul(arg, &tailptr, 10);
+		if (*tailptr != 0 || args->bsize == 0) {
+			fprintf(stderr, "Invalid block size: %s\n", arg);
+			argp_usage(state);
+			return EXIT_FAILURE;
+		}
+		break;
+	case 'r':
+		args->reads = strtol(arg, &tailptr, 10);
+		if (*tailptr != 0 || args->reads < 0) {
+			fprintf(stderr, "Invalid number of reads: %s\n", arg);
+			argp_usage(state);
+			return EXIT_FAILURE;
+		}
+		break;
+	case ARGP_KEY_ARG:
+		if (state->arg_num != 0)
+			argp_usage(state);
+		args->file = arg;
+		break;
+	case ARGP_KEY_END:
+		if (state->arg_num < 1)
+			argp_usage(state);
+		break;
+	default:
+		return ARGP_ERR_UNKNOWN;
+	}
+
+	return 0;
+}
@@ -46,6 +46,7 @@
 #include <stdint.h>
 #include <endian.h>
 #include <errno.h>
+#include <pthread.h>
 
 #include "util.h"
 #include "out.h"
@@ -55,6 +56,8 @@
 #define	GIGABYTE ((uintptr_t)1 << 30)
 #define	TERABYTE ((uintptr_t)1 << 40)
 
+#define	PREFAULT_MAX_THREADS 64	/* most threads used to prefault a mapping */
+
 /* library-wide page size */
 unsigned long Pagesize;
 
@@ -66,6 +69,92 @@ Free_func Free = free;
 Realloc_func Realloc = realloc;
 Strdup_func Strdup = strdup;
 
+/*
+ * no one needs to hear about new and removed mappings by default
+ */
+Mmap_notify_func Mmap_notify = NULL;
+
+/*
+ * options for util_map(), set from the environment by util_init()
+ */
+static size_t Map_align;	/* required alignment, 0 for just a hint */
+static int Map_hugepage;	/* ask for transparent huge pages */
+static unsigned Map_prefault;	/* threads prefaulting new mappings */
+static int Map_prefault_write;	/* prefault for writing, not reading */
+
+/*
+ * util_parse_align -- (internal) parse an alignment like "2M" or "1G"
+ *
+ * Returns 0 if the string isn't a power of two multiple of the page size.
+ */
+static size_t
+util_parse_align(const char *str)
+{
+	char *endp;
+	size_t align = strtoull(str, &endp, 10);
+
+	if (endp == str)
+		return 0;
+
+	switch (*endp) {
+	case 'K':
+		align <<= 10;
+		endp++;
+		break;
+	case 'M':
+		align <<= 20;
+		endp++;
+		break;
+	case 'G':
+		align <<= 30;
+		endp++;
+		break;
+	}
+
+	if (*endp != '\0' || align < Pagesize || (align & (align - 1)))
+		return 0;
+
+	return align;
+}
+
+/*
+ * util_map_opts_init -- (internal) read the util_map() options
+ */
+static void
+util_map_opts_init(void)
+{
+	char *e = getenv("PMEM_MAP_ALIGN");
+	if (e) {
+		if ((Map_align = util_parse_align(e)) == 0)
+			LOG(1, "invalid PMEM_MAP_ALIGN \"%s\"", e);
+		else
+			LOG(3, "PMEM_MAP_ALIGN set to %zu", Map_align);
+	}
+
+	e = getenv("PMEM_MAP_HUGEPAGE");
+	if (e && strcmp(e, "1") == 0) {
+		LOG(3, "PMEM_MAP_HUGEPAGE enabled huge pages");
+		Map_hugepage = 1;
+	}
+
+	e = getenv("PMEM_MAP_PREFAULT");
+	if (e) {
+		char *endp;
+		unsigned long val = strtoul(e, &endp, 10);
+		int write = *endp == 'w';
+		if (*e == '\0' || endp[write] != '\0' ||
+				val > PREFAULT_MAX_THREADS)
+			LOG(1, "invalid PMEM_MAP_PREFAULT \"%s\"", e);
+		else {
+			Map_prefault = (unsigned)val;
+			Map_prefault_write = write;
+			LOG(3, "PMEM_MAP_PREFAULT set to %u%s",
+					Map_prefault,
+					write ? " for writing" : "");
+		}
+	}
+}
+
 /*
  * util_init -- initialize the utils
  *
@@ -75,8 +164,10 @@ void
 util_init(void)
 {
 	LOG(3, NULL);
-	if (Pagesize == 0)
+	if (Pagesize == 0) {
 		Pagesize = (unsigned long) sysconf(_SC_PAGESIZE);
+		util_map_opts_init();
+	}
 }
 
 /*
@@ -104,14 +195,14 @@ util_set_alloc_funcs(void *(*malloc_func)(size_t size),
  * and looks for the first unused address in the process address space that is:
  * - greater or equal 1TB,
  * - large enough to hold range of given length,
- * - 1GB aligned.
+ * - aligned to align (1GB unless PMEM_MAP_ALIGN says otherwise).
  *
  * Asking for aligned address like this will allow the DAX code to use large
  * mappings.  It is not an error if mmap() ignores the hint and chooses
  * different address.
  */
 static char *
-util_map_hint(size_t len)
+util_map_hint(size_t len, size_t align)
 {
 	FILE *fp;
 	if ((fp = fopen("/proc/self/maps", "r")) == NULL) {
@@ -141,9 +232,7 @@ util_map_hint(size_t len)
 			}
 
 			if (hi > raddr) {
-				/* align to 1GB */
-				raddr = (char *)roundup((uintptr_t)hi,
-						GIGABYTE);
+				raddr = (char *)roundup((uintptr_t)hi, align);
 				LOG(4, "nearest aligned addr %p", raddr);
 			}
 
@@ -169,6 +258,126 @@ util_map_hint(size_t len)
 	return raddr;
 }
 
+/*
+ * util_map_aligned -- (internal) map a file at an address aligned to align
+ *
+ * Reserves an address range large enough to contain an aligned range of
+ * the given length, maps the file over the aligned part of it and gives
+ * back the rest.
+ */
+static void *
+util_map_aligned(int fd, size_t len, size_t align, int flags)
+{
+	LOG(3, "fd %d len %zu align %zu", fd, len, align);
+
+	size_t mlen = roundup(len, Pagesize);
+	char *resv;
+
+	if ((resv = mmap(NULL, mlen + align, PROT_NONE,
+			MAP_PRIVATE|MAP_ANONYMOUS|MAP_NORESERVE,
+					-1, 0)) == MAP_FAILED) {
+		LOG(1, "!mmap %zu bytes", mlen + align);
+		return MAP_FAILED;
+	}
+
+	char *base = (char *)roundup((uintptr_t)resv, align);
+
+	if (mmap(base, len, PROT_READ|PROT_WRITE, flags|MAP_FIXED,
+			fd, 0) == MAP_FAILED) {
+		LOG(1, "!mmap %zu bytes", len);
+		int oerrno = errno;
+		(void) munmap(resv, mlen + align);
+		errno = oerrno;
+		return MAP_FAILED;
+	}
+
+	if (base > resv)
+		(void) munmap(resv, base - resv);
+	if (resv + align > base)
+		(void) munmap(base + mlen, resv + align - base);
+
+	return base;
+}
+
+/*
+ * prefault_range -- (internal) range prefaulted by one thread
+ */
+struct prefault_range {
+	char *addr;
+	size_t len;
+	int write;		/* fault the pages in writable */
+	int started;		/* thread was created */
+	pthread_t thread;
+};
+
+/*
+ * util_prefault_range -- (internal) touch every page of a range
+ *
+ * Writable pages are touched by atomically adding zero, which faults them
+ * in for writing without changing anything.
+ */
+static void *
+util_prefault_range(void *arg)
+{
+	struct prefault_range *r = arg;
+
+	LOG(4, "addr %p len %zu write %d", r->addr, r->len, r->write);
+
+	for (size_t off = 0; off < r->len; off += Pagesize) {
+		if (r->write)
+			__sync_fetch_and_add(r->addr + off, 0);
+		else
+			(void) *(volatile char *)(r->addr + off);
+	}
+
+	return NULL;
+}
+
+/*
+ * util_prefault -- (internal) fault in a new mapping using nthreads threads
+ *
+ * The range is split into page-aligned parts, one per thread.  The calling
+ * thread takes the first part, and also the part of any thread that
+ * couldn't be created.
+ */
+static void
+util_prefault(char *addr, size_t len, unsigned nthreads, int write)
+{
+	LOG(3, "addr %p len %zu nthreads %u write %d", addr, len, nthreads,
+			write);
+
+	struct prefault_range r[PREFAULT_MAX_THREADS];
+	size_t part = roundup(len / nthreads + 1, Pagesize);
+	unsigned n = (unsigned)((len + part - 1) / part);
+
+	for (unsigned i = 0; i < n; i++) {
+		r[i].addr = addr + i * part;
+		r[i].len = (i == n - 1) ? len - i * part : part;
+		r[i].write = write;
+	}
+
+	if (n == 0)
+		return;
+
+	for (unsigned i = 1; i < n; i++) {
+		if ((errno = pthread_create(&r[i].thread, NULL,
+				util_prefault_range, &r[i]))) {
+			LOG(1, "!pthread_create");
+			r[i].started = 0;
+		} else
+			r[i].started = 1;
+	}
+
+	util_prefault_range(&r[0]);
+
+	for (unsigned i = 1; i < n; i++) {
+		if (!r[i].started)
+			util_prefault_range(&r[i]);
+		else if ((errno = pthread_join(r[i].thread, NULL)))
+			LOG(1, "!pthread_join");
+	}
+}
+
 /*
  * util_map -- memory map a file
  *
@@ -176,6 +385,10 @@ util_map_hint(size_t len)
  * appropriate arguments and includes our trace points.
  *
  * If cow is set, the file is mapped copy-on-write.
+ *
+ * The PMEM_MAP_ALIGN, PMEM_MAP_HUGEPAGE and PMEM_MAP_PREFAULT environment
+ * variables, read by util_init(), make the mapping aligned, backed by
+ * huge pages and faulted in up front, respectively.
  */
 void *
 util_map(int fd, size_t len, int cow)
@@ -184,17 +397,60 @@ util_map(int fd, size_t len, int cow)
 
 	LOG(3, "fd %d len %zu cow %d", fd, len, cow);
 
-	void *addr = util_map_hint(len);
+	int flags = (cow) ? MAP_PRIVATE|MAP_NORESERVE : MAP_SHARED;
+
+	/*
+	 * A single thread prefaulting for reading is what MAP_POPULATE
+	 * does on a shared mapping, except that it would fault the pages in
+	 * before they can be marked for huge pages, and it would copy all
+	 * of a copy-on-write mapping.
+	 */
+	int populate = Map_prefault == 1 && !Map_prefault_write &&
+			!Map_hugepage && !cow;
+
+	void *addr = util_map_hint(len, Map_align ? Map_align : GIGABYTE);
+
+	/*
+	 * With a required alignment the first mapping may be thrown away,
+	 * so only the one which is kept gets populated.
+	 */
+	int fflags = (populate && !Map_align) ? flags|MAP_POPULATE : flags;
+	if (populate)
+		flags |= MAP_POPULATE;
 
 	if ((base = mmap(addr, len, PROT_READ|PROT_WRITE,
-			(cow) ? MAP_PRIVATE|MAP_NORESERVE : MAP_SHARED,
-					fd, 0)) == MAP_FAILED) {
+			fflags, fd, 0)) == MAP_FAILED) {
 		LOG(1, "!mmap %zu bytes", len);
 		return NULL;
 	}
 
+	if (Map_align && ((uintptr_t)base & (Map_align - 1))) {
+		LOG(4, "%p not aligned to %zu, remapping", base, Map_align);
+		(void) munmap(base, len);
+		if ((base = util_map_aligned(fd, len, Map_align,
+				flags)) == MAP_FAILED)
+			return NULL;
+	} else if (fflags != flags && mmap(base, len, PROT_READ|PROT_WRITE,
+			flags|MAP_FIXED, fd, 0) == MAP_FAILED) {
+		LOG(1, "!mmap %zu bytes", len);
+		int oerrno = errno;
+		(void) munmap(base, len);
+		errno = oerrno;
+		return NULL;
+	}
+
 	LOG(3, "mapped at %p", base);
 
+	if (Map_hugepage && madvise(base, len, MADV_HUGEPAGE) < 0)
+		LOG(1, "!madvise MADV_HUGEPAGE");
+
+	if (Map_prefault && !populate)
+		util_prefault(base, len, Map_prefault,
+				Map_prefault_write && !cow);
+
+	if (Mmap_notify)
+		Mmap_notify(base, len);
+
 	return base;
 }
 
@@ -213,6 +469,8 @@ util_unmap(void *addr, size_t len)
 
 	if (retval < 0)
 		LOG(1, "!munmap");
+	else if (Mmap_notify)
+		Mmap_notify(addr, len);
 
 	return retval;
 }
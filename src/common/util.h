@@ -47,6 +47,14 @@ Free_func Free;
 Realloc_func Realloc;
 Strdup_func Strdup;
 
+/*
+ * optional hook called by util_map() and util_unmap() with the range
+ * whose mapping has just changed
+ */
+typedef void (*Mmap_notify_func)(void *addr, size_t len);
+
+Mmap_notify_func Mmap_notify;
+
 void util_set_alloc_funcs(
 		void *(*malloc_func)(size_t size),
 		void (*free_func)(void *ptr),
@@ -48,21 +48,57 @@ extern "C" {
 #endif
 
 #include <sys/types.h>
+#include <sys/uio.h>
 
 void *pmem_map(int fd);
+int pmem_unmap(void *addr, size_t len);
 int pmem_is_pmem(void *addr, size_t len);
 void pmem_persist(void *addr, size_t len);
+void pmem_persist_v(const struct iovec *iov, int iovcnt);
+void pmem_domain_begin(void);
+void pmem_domain_flush(void *addr, size_t len);
+void pmem_domain_commit(void);
 int pmem_msync(void *addr, size_t len);
 void pmem_flush(void *addr, size_t len);
+void pmem_flush_v(const struct iovec *iov, int iovcnt);
 void pmem_drain(void);
 int pmem_has_hw_drain(void);
 void *pmem_memmove_persist(void *pmemdest, const void *src, size_t len);
 void *pmem_memcpy_persist(void *pmemdest, const void *src, size_t len);
 void *pmem_memset_persist(void *pmemdest, int c, size_t len);
+void *pmem_memcpy_persist_mt(void *pmemdest, const void *src, size_t len,
+	unsigned nthreads);
 void *pmem_memmove_nodrain(void *pmemdest, const void *src, size_t len);
 void *pmem_memcpy_nodrain(void *pmemdest, const void *src, size_t len);
 void *pmem_memset_nodrain(void *pmemdest, int c, size_t len);
 
+/*
+ * statistics collected by libpmem, see pmem_stats_get()
+ */
+struct pmem_stats {
+	size_t size;	/* set to sizeof (struct pmem_stats) by the caller */
+
+	unsigned long long flushes;		/* cache flush operations */
+	unsigned long long flush_lines;		/* cache lines flushed */
+	unsigned long long drains;		/* pmem_drain() calls */
+	unsigned long long msyncs;		/* pmem_msync() calls */
+	unsigned long long msync_bytes;		/* bytes passed to msync() */
+
+	/* bytes copied by each memmove engine */
+	unsigned long long memmove_normal_bytes;	/* memmove + flush */
+	unsigned long long memmove_sse2_bytes;		/* 16-byte movnt */
+	unsigned long long memmove_avx2_bytes;		/* 32-byte movnt */
+	unsigned long long memmove_avx512f_bytes;	/* 64-byte movnt */
+
+	/* bytes set by each memset engine */
+	unsigned long long memset_normal_bytes;		/* memset + flush */
+	unsigned long long memset_sse2_bytes;		/* 16-byte movnt */
+	unsigned long long memset_avx2_bytes;		/* 32-byte movnt */
+	unsigned long long memset_avx512f_bytes;	/* 64-byte movnt */
+};
+
+void pmem_stats_get(struct pmem_stats *stats);
+
 /*
  * PMEM_MAJOR_VERSION and PMEM_MINOR_VERSION provide the current version of the
  * libpmem API as provided by this header file.  Applications can verify that
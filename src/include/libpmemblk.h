@@ -71,6 +71,15 @@ const char *pmemblk_check_version(
 
 #define	PMEMBLK_MIN_BLK ((size_t)512)
 
+/*
+ * a block and the buffer to read it into or write it from,
+ * see pmemblk_readv() and pmemblk_writev()
+ */
+struct pmemblk_iovec {
+	void *buf;
+	off_t blockno;
+};
+
 PMEMblkpool *pmemblk_open(const char *path, size_t bsize);
 PMEMblkpool *pmemblk_create(const char *path, size_t bsize,
 		size_t poolsize, mode_t mode);
@@ -78,7 +87,13 @@ void pmemblk_close(PMEMblkpool *pbp);
 int pmemblk_check(const char *path);
 size_t pmemblk_nblock(PMEMblkpool *pbp);
 int pmemblk_read(PMEMblkpool *pbp, void *buf, off_t blockno);
+const void *pmemblk_map_block(PMEMblkpool *pbp, off_t blockno);
+int pmemblk_unmap_block(PMEMblkpool *pbp, const void *addr);
 int pmemblk_write(PMEMblkpool *pbp, const void *buf, off_t blockno);
+int pmemblk_readv(PMEMblkpool *pbp, const struct pmemblk_iovec *iov,
+	int iovcnt);
+int pmemblk_writev(PMEMblkpool *pbp, const struct pmemblk_iovec *iov,
+	int iovcnt);
 int pmemblk_set_zero(PMEMblkpool *pbp, off_t blockno);
 int pmemblk_set_error(PMEMblkpool *pbp, off_t blockno);
 
@@ -73,18 +73,48 @@ const char *pmemlog_check_version(
  */
 #define	PMEMLOG_MIN_POOL ((size_t)(1024 * 1024 * 2)) /* min pool size: 2MB */
 
+/*
+ * how much data a log holds, see pmemlog_usage()
+ */
+struct pmemlog_usage {
+	size_t nbyte;		/* usable space, as pmemlog_nbyte() returns */
+	size_t used;		/* space taken by the data */
+	size_t logical;		/* data appended, before compression */
+	size_t staged;		/* data appended, not compressed yet */
+};
+
+/* flags for pmemlog_create_records() */
+#define	PMEMLOG_RECORD_CACHELINE 0x1	/* align records to cache lines */
+
 PMEMlogpool *pmemlog_open(const char *path);
 PMEMlogpool *pmemlog_create(const char *path, size_t poolsize, mode_t mode);
+PMEMlogpool *pmemlog_create_circular(const char *path, size_t poolsize,
+	mode_t mode);
+PMEMlogpool *pmemlog_create_records(const char *path, size_t poolsize,
+	mode_t mode, int flags);
+PMEMlogpool *pmemlog_create_lanes(const char *path, size_t poolsize,
+	mode_t mode, unsigned nlanes);
+PMEMlogpool *pmemlog_create_compressed(const char *path, size_t poolsize,
+	mode_t mode);
 void pmemlog_close(PMEMlogpool *plp);
 int pmemlog_check(const char *path);
 size_t pmemlog_nbyte(PMEMlogpool *plp);
 int pmemlog_append(PMEMlogpool *plp, const void *buf, size_t count);
 int pmemlog_appendv(PMEMlogpool *plp, const struct iovec *iov, int iovcnt);
 off_t pmemlog_tell(PMEMlogpool *plp);
+int pmemlog_usage(PMEMlogpool *plp, struct pmemlog_usage *usage);
 void pmemlog_rewind(PMEMlogpool *plp);
+off_t pmemlog_trim(PMEMlogpool *plp, off_t offset);
+int pmemlog_flush(PMEMlogpool *plp);
 void pmemlog_walk(PMEMlogpool *plp, size_t chunksize,
 	int (*process_chunk)(const void *buf, size_t len, void *arg),
 	void *arg);
+int pmemlog_walk_records(PMEMlogpool *plp,
+	int (*process_record)(const void *buf, size_t len, void *arg),
+	void *arg);
+ssize_t pmemlog_read_from(PMEMlogpool *plp, off_t offset, void *buf,
+	size_t count);
+off_t pmemlog_wait(PMEMlogpool *plp, off_t offset, int timeout);
 
 /*
  * Passing NULL to pmemlog_set_funcs() tells libpmemlog to continue to use the
@@ -0,0 +1,429 @@
+/*
+ * Copyright (c) 2015, Intel Corporation
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in
+ *       the documentation and/or other materials provided with the
+ *       distribution.
+ *
+ *     * Neither the name of Intel Corporation nor the names of its
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * memcpy_mt.c -- multi-threaded copy to pmem
+ *
+ * pmem_memcpy_persist_mt() splits a large copy into parts whose
+ * boundaries fall on page boundaries of the destination, so no two
+ * threads flush the same cache line.  The parts are copied by a small
+ * pool of worker threads, created on first use, and by the calling
+ * thread itself.  Each part is copied with pmem_memcpy_nodrain()
+ * followed by an SFENCE, so the flushes and non-temporal stores of every
+ * thread have completed before the calling thread issues the single
+ * pmem_drain() for the whole copy.
+ *
+ * When the kernel reports which NUMA node the destination lives on, the
+ * workers bind themselves to the CPUs of that node before copying.
+ */
+
+#define	_GNU_SOURCE
+
+#include <sys/syscall.h>
+#include <sys/param.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sched.h>
+#include <pthread.h>
+#include <xmmintrin.h>
+
+#include "libpmem.h"
+
+#include "pmem.h"
+#include "util.h"
+#include "out.h"
+
+#ifndef MPOL_F_NODE
+#define	MPOL_F_NODE (1<<0)	/* get_mempolicy(2) flags */
+#define	MPOL_F_ADDR (1<<1)
+#endif
+
+#define	MT_MAX_THREADS 32	/* size of the worker pool, caller included */
+#define	MT_DEFAULT_THREADS 8	/* used when caller passes nthreads 0 */
+#define	MT_MIN_PART (1 << 20)	/* copies are not split below this size */
+#define	MT_MAX_NODES 64		/* NUMA nodes the workers can bind to */
+
+static struct {
+	pthread_mutex_t call_lock;	/* one multi-threaded copy at a time */
+	pthread_mutex_t lock;		/* protects everything below */
+	pthread_cond_t work_cond;	/* signalled when parts are available */
+	pthread_cond_t done_cond;	/* signalled when all parts are done */
+	pthread_t workers[MT_MAX_THREADS - 1];
+	unsigned nworkers;		/* workers started */
+	int stop;			/* workers should exit */
+
+	/* the copy in progress */
+	char *dest;
+	const char *src;
+	size_t len;
+	size_t part;			/* size of each part */
+	size_t skew;			/* offset of dest into its page */
+	unsigned nparts;
+	unsigned next;			/* next part to be copied */
+	unsigned ndone;			/* parts already copied */
+	int node;			/* NUMA node of dest, -1 if unknown */
+} Mt = {
+	.call_lock = PTHREAD_MUTEX_INITIALIZER,
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+	.work_cond = PTHREAD_COND_INITIALIZER,
+	.done_cond = PTHREAD_COND_INITIALIZER,
+	.node = -1,
+};
+
+/*
+ * mt_addr_node -- (internal) return the NUMA node of addr, or -1
+ */
+static int
+mt_addr_node(void *addr)
+{
+	int node;
+
+	if (syscall(SYS_get_mempolicy, &node, NULL, 0, addr,
+				MPOL_F_NODE | MPOL_F_ADDR) < 0) {
+		LOG(4, "!get_mempolicy");
+		return -1;
+	}
+
+	if (node < 0 || node >= MT_MAX_NODES)
+		return -1;
+
+	return node;
+}
+
+/*
+ * mt_node_cpus -- (internal) read the list of CPUs of a NUMA node from sysfs
+ *
+ * Returns the number of CPUs found, 0 on any error.
+ */
+static int
+mt_node_cpus(int node, cpu_set_t *cpus)
+{
+	char path[64];
+	snprintf(path, sizeof (path),
+			"/sys/devices/system/node/node%d/cpulist", node);
+
+	FILE *fp;
+	if ((fp = fopen(path, "r")) == NULL) {
+		LOG(4, "!%s", path);
+		return 0;
+	}
+
+	CPU_ZERO(cpus);
+
+	/* the format is a comma separated list of ranges, e.g. "0-3,8-11" */
+	unsigned lo;
+	unsigned hi;
+	while (fscanf(fp, "%u", &lo) == 1) {
+		hi = lo;
+		int c = fgetc(fp);
+		if (c == '-') {
+			if (fscanf(fp, "%u", &hi) != 1)
+				break;
+			c = fgetc(fp);
+		}
+
+		for (unsigned cpu = lo; cpu <= hi && cpu < CPU_SETSIZE; cpu++)
+			CPU_SET(cpu, cpus);
+
+		if (c != ',')
+			break;
+	}
+
+	fclose(fp);
+
+	return CPU_COUNT(cpus);
+}
+
+/*
+ * mt_bind -- (internal) bind the calling worker to the CPUs of a node
+ */
+static void
+mt_bind(int node)
+{
+	static cpu_set_t node_cpus[MT_MAX_NODES];
+	static int node_ncpus[MT_MAX_NODES];	/* 0 unknown, -1 unusable */
+
+	if (node_ncpus[node] == 0) {
+		cpu_set_t cpus;
+		int ncpus = mt_node_cpus(node, &cpus);
+
+		/* benign race, all the workers come up with the same answer */
+		if (ncpus > 0)
+			node_cpus[node] = cpus;
+		node_ncpus[node] = ncpus > 0 ? ncpus : -1;
+	}
+
+	if (node_ncpus[node] < 0)
+		return;
+
+	if ((errno = pthread_setaffinity_np(pthread_self(),
+				sizeof (node_cpus[node]), &node_cpus[node])))
+		LOG(4, "!pthread_setaffinity_np");
+	else
+		LOG(4, "bound to node %d", node);
+}
+
+/*
+ * mt_copy_part -- (internal) copy one part, without the drain
+ */
+static void
+mt_copy_part(char *dest, const char *src, size_t len, size_t part,
+		size_t skew, unsigned i)
+{
+	/* part i ends on a page boundary of dest, the first one starts early */
+	size_t off = i ? (size_t)i * part - skew : 0;
+	size_t end = (size_t)(i + 1) * part - skew;
+	size_t n = (end < len ? end : len) - off;
+
+	LOG(15, "part %u off %zu len %zu", i, off, n);
+
+	pmem_memcpy_nodrain(dest + off, src + off, n);
+
+	/* wait for this thread's flushes and non-temporal stores */
+	_mm_sfence();
+}
+
+/*
+ * mt_run -- (internal) copy parts of the current copy until none are left
+ *
+ * Called with Mt.lock held, returns with it held.
+ */
+static void
+mt_run(void)
+{
+	while (Mt.next < Mt.nparts) {
+		unsigned i = Mt.next++;
+		char *dest = Mt.dest;
+		const char *src = Mt.src;
+		size_t len = Mt.len;
+		size_t part = Mt.part;
+		size_t skew = Mt.skew;
+
+		if ((errno = pthread_mutex_unlock(&Mt.lock)))
+			LOG(1, "!pthread_mutex_unlock");
+
+		mt_copy_part(dest, src, len, part, skew, i);
+
+		if ((errno = pthread_mutex_lock(&Mt.lock)))
+			FATAL("!pthread_mutex_lock");
+
+		if (++Mt.ndone == Mt.nparts)
+			pthread_cond_signal(&Mt.done_cond);
+	}
+}
+
+/*
+ * mt_worker -- (internal) worker thread of the copy pool
+ */
+static void *
+mt_worker(void *arg)
+{
+	int bound_node = -1;
+
+	if ((errno = pthread_mutex_lock(&Mt.lock)))
+		FATAL("!pthread_mutex_lock");
+
+	for (;;) {
+		while (!Mt.stop && Mt.next >= Mt.nparts)
+			pthread_cond_wait(&Mt.work_cond, &Mt.lock);
+
+		if (Mt.stop)
+			break;
+
+		if (Mt.node >= 0 && Mt.node != bound_node) {
+			bound_node = Mt.node;
+
+			if ((errno = pthread_mutex_unlock(&Mt.lock)))
+				LOG(1, "!pthread_mutex_unlock");
+
+			mt_bind(bound_node);
+
+			if ((errno = pthread_mutex_lock(&Mt.lock)))
+				FATAL("!pthread_mutex_lock");
+		}
+
+		mt_run();
+	}
+
+	if ((errno = pthread_mutex_unlock(&Mt.lock)))
+		LOG(1, "!pthread_mutex_unlock");
+
+	return NULL;
+}
+
+/*
+ * mt_atfork_child -- (internal) forget the workers, which don't survive fork
+ */
+static void
+mt_atfork_child(void)
+{
+	pthread_mutex_init(&Mt.call_lock, NULL);
+	pthread_mutex_init(&Mt.lock, NULL);
+	pthread_cond_init(&Mt.work_cond, NULL);
+	pthread_cond_init(&Mt.done_cond, NULL);
+	Mt.nworkers = 0;
+	Mt.nparts = 0;
+	Mt.next = 0;
+	Mt.ndone = 0;
+}
+
+/*
+ * mt_start_workers -- (internal) grow the worker pool to nworkers threads
+ *
+ * Called with Mt.lock held.  Failing to start a worker isn't an error,
+ * the copy is just done by fewer threads.
+ */
+static void
+mt_start_workers(unsigned nworkers)
+{
+	static int atfork_registered;
+
+	if (!atfork_registered) {
+		if ((errno = pthread_atfork(NULL, NULL, mt_atfork_child))) {
+			LOG(1, "!pthread_atfork");
+			return;
+		}
+		atfork_registered = 1;
+	}
+
+	while (Mt.nworkers < nworkers) {
+		if ((errno = pthread_create(&Mt.workers[Mt.nworkers], NULL,
+					mt_worker, NULL))) {
+			LOG(1, "!pthread_create");
+			return;
+		}
+
+		Mt.nworkers++;
+		LOG(4, "started copy worker %u", Mt.nworkers);
+	}
+}
+
+/*
+ * pmem_memcpy_persist_mt -- memcpy to pmem using multiple threads
+ */
+void *
+pmem_memcpy_persist_mt(void *pmemdest, const void *src, size_t len,
+		unsigned nthreads)
+{
+	LOG(15, "pmemdest %p src %p len %zu nthreads %u",
+			pmemdest, src, len, nthreads);
+
+	if (nthreads == 0)
+		nthreads = MT_DEFAULT_THREADS;
+	if (nthreads > MT_MAX_THREADS)
+		nthreads = MT_MAX_THREADS;
+
+	size_t maxparts = len / MT_MIN_PART;
+	unsigned nparts = nthreads < maxparts ? nthreads : (unsigned)maxparts;
+
+	if (nparts <= 1)
+		return pmem_memcpy_persist(pmemdest, src, len);
+
+	/*
+	 * parts are whole pages of dest, counted from the page dest is in,
+	 * and large enough for the skew not to take one more part
+	 */
+	size_t skew = (uintptr_t)pmemdest & (Pagesize - 1);
+	size_t part = roundup((skew + len + nparts - 1) / nparts, Pagesize);
+	nparts = (unsigned)((skew + len + part - 1) / part);
+
+	int node = mt_addr_node(pmemdest);
+
+	if ((errno = pthread_mutex_lock(&Mt.call_lock)))
+		FATAL("!pthread_mutex_lock");
+	if ((errno = pthread_mutex_lock(&Mt.lock)))
+		FATAL("!pthread_mutex_lock");
+
+	mt_start_workers(nparts - 1);
+
+	Mt.dest = pmemdest;
+	Mt.src = src;
+	Mt.len = len;
+	Mt.part = part;
+	Mt.skew = skew;
+	Mt.nparts = nparts;
+	Mt.next = 0;
+	Mt.ndone = 0;
+	Mt.node = node;
+
+	LOG(4, "%u parts of %zu bytes, %u workers, node %d",
+			nparts, part, Mt.nworkers, node);
+
+	pthread_cond_broadcast(&Mt.work_cond);
+
+	/* the calling thread copies too */
+	mt_run();
+
+	while (Mt.ndone < Mt.nparts)
+		pthread_cond_wait(&Mt.done_cond, &Mt.lock);
+
+	if ((errno = pthread_mutex_unlock(&Mt.lock)))
+		LOG(1, "!pthread_mutex_unlock");
+	if ((errno = pthread_mutex_unlock(&Mt.call_lock)))
+		LOG(1, "!pthread_mutex_unlock");
+
+	/* every part has been fenced by the thread which copied it */
+	pmem_drain();
+
+	return pmemdest;
+}
+
+/*
+ * memcpy_mt_fini -- stop the copy workers when the library is unloaded
+ */
+__attribute__((destructor))
+static void
+memcpy_mt_fini(void)
+{
+	LOG(3, NULL);
+
+	if ((errno = pthread_mutex_lock(&Mt.lock))) {
+		LOG(1, "!pthread_mutex_lock");
+		return;
+	}
+
+	Mt.stop = 1;
+	pthread_cond_broadcast(&Mt.work_cond);
+	unsigned nworkers = Mt.nworkers;
+	Mt.nworkers = 0;
+
+	if ((errno = pthread_mutex_unlock(&Mt.lock)))
+		LOG(1, "!pthread_mutex_unlock");
+
+	for (unsigned i = 0; i < nworkers; i++)
+		if ((errno = pthread_join(Mt.workers[i], NULL)))
+			LOG(1, "!pthread_join");
+}
@@ -91,6 +91,15 @@
  *
  *	Use the flush flow above for the copied portion (including PCOMMIT).
  *
+ *	When AVX2 or AVX-512 are available, the MOVNT portion of the copy
+ *	uses the 256-bit or 512-bit wide versions of MOVNTDQ, falling back
+ *	to the 128-bit version for whatever is left at the end.
+ *
+ *	Ranges shorter than the movnt threshold (256 bytes by default,
+ *	see PMEM_MOVNT_THRESHOLD) are copied using the flow below instead,
+ *	since for small ranges the regular stores followed by a flush
+ *	are cheaper than the non-temporal stores.
+ *
  * To memcpy a range of memory to pmem when MOVNT is not available:
  *
  *	Just pass the call to the normal memcpy() followed by pmem_persist().
@@ -169,6 +178,10 @@
  * initialization time.  This is achieved using function pointers that are
  * setup by pmem_init() when the library loads.
  *
+ * The supported instructions are detected using the CPUID instruction,
+ * which avoids any file I/O in the constructor.  Parsing the flags in
+ * /proc/cpuinfo is only used as a fallback (or when PMEM_NO_CPUID=1).
+ *
  * 	Func_predrain_fence is used by pmem_drain() to call one of:
  * 		predrain_fence_empty()
  * 		predrain_fence_sfence()
@@ -185,10 +198,22 @@
  *	Func_memmove_nodrain is used by memmove_nodrain() to call one of:
  *		memmove_nodrain_normal()
  *		memmove_nodrain_movnt()
+ *		memmove_nodrain_movnt_avx2()
+ *		memmove_nodrain_movnt_avx512f()
  *
  *	Func_memset_nodrain is used by memset_nodrain() to call one of:
  *		memset_nodrain_normal()
  *		memset_nodrain_movnt()
+ *		memset_nodrain_movnt_avx2()
+ *		memset_nodrain_movnt_avx512f()
+ *
+ *	When non-temporal stores are available, Func_memmove_nodrain and
+ *	Func_memset_nodrain point to the hybrid versions instead:
+ *		memmove_nodrain_hybrid()
+ *		memset_nodrain_hybrid()
+ *	which use the normal versions for ranges shorter than the movnt
+ *	threshold and call one of the movnt versions above (through
+ *	Func_memmove_movnt and Func_memset_movnt) for longer ranges.
  *
  * DEBUG LOGGING
  *
@@ -199,11 +224,19 @@
 
 #include <sys/mman.h>
 #include <sys/stat.h>
+#include <sys/sysmacros.h>
+#include <sys/uio.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <stddef.h>
 #include <stdint.h>
 #include <string.h>
+#include <time.h>
 #include <xmmintrin.h>
+#include <immintrin.h>
+#include <cpuid.h>
+#include <pthread.h>
+#include <errno.h>
 
 #include "libpmem.h"
 
@@ -240,10 +273,177 @@
 #define	MOVNT_MASK	(MOVNT_SIZE -1)
 #define	MOVNT_SHIFT	4
 
+#define	AVX2_CHUNK_SIZE		256 /* 8*32 */
+#define	AVX2_CHUNK_SHIFT	8
+#define	AVX2_CHUNK_MASK		(AVX2_CHUNK_SIZE - 1)
+
+#define	AVX512F_CHUNK_SIZE	512 /* 8*64 */
+#define	AVX512F_CHUNK_SHIFT	9
+#define	AVX512F_CHUNK_MASK	(AVX512F_CHUNK_SIZE - 1)
+
 #define	PROCMAXLEN 2048 /* maximum expected line length in /proc files */
 
+#define	MOVNT_THRESHOLD	256 /* default size to switch to non-temporal stores */
+
+#define	CALIBRATE_MIN	64	/* smallest size tried by calibration */
+#define	CALIBRATE_MAX	65536	/* largest size tried by calibration */
+#define	CALIBRATE_BYTES	(1 << 20) /* bytes copied per calibration step */
+
 static int Has_hw_drain;
 
+/*
+ * Statistics are counted per thread, in thread-local storage, so counting
+ * doesn't add any cache line sharing between threads.  Each thread's
+ * counters are added to the Stats_threads list the first time the thread
+ * counts anything.  When a thread exits, its counters are folded into
+ * Stats_exited.  pmem_stats_get() adds them all up.
+ *
+ * Nothing is counted unless PMEM_STATS or PMEM_STATS_DUMP is set, so the
+ * flush and copy paths don't pay for the thread-local accesses otherwise.
+ */
+struct thread_stats {
+	struct pmem_stats s;
+	int registered;
+	struct thread_stats *prev;
+	struct thread_stats *next;
+};
+
+static __thread struct thread_stats Tstats;
+
+static pthread_mutex_t Stats_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct thread_stats *Stats_threads;	/* live threads */
+static struct pmem_stats Stats_exited;		/* sum of exited threads */
+static pthread_key_t Stats_key;
+static int Stats_key_valid;
+static int Stats_enabled;	/* set once by pmem_init() */
+static int Stats_dump;		/* print the statistics on exit */
+
+#define	STATS_ADD(field, n) do {\
+	if (Stats_enabled) {\
+		if (!Tstats.registered)\
+			stats_register();\
+		Tstats.s.field += (n);\
+	}\
+} while (0)
+
+/* the first counter in struct pmem_stats, following its size */
+#define	STATS_FIRST offsetof(struct pmem_stats, flushes)
+
+/*
+ * stats_sum -- (internal) add one set of counters to another
+ *
+ * All the members of struct pmem_stats following its size are unsigned
+ * long long counters, so they are added up as an array.
+ */
+static void
+stats_sum(struct pmem_stats *sum, const struct pmem_stats *s)
+{
+	unsigned long long *dst =
+		(unsigned long long *)((char *)sum + STATS_FIRST);
+	const unsigned long long *src =
+		(const unsigned long long *)((const char *)s + STATS_FIRST);
+
+	for (size_t i = 0; i < (sizeof (*s) - STATS_FIRST) / sizeof (*src); i++)
+		dst[i] += src[i];
+}
+
+/*
+ * stats_thread_exit -- (internal) fold an exiting thread's counters
+ */
+static void
+stats_thread_exit(void *arg)
+{
+	struct thread_stats *ts = arg;
+
+	if ((errno = pthread_mutex_lock(&Stats_lock))) {
+		LOG(1, "!pthread_mutex_lock");
+		return;
+	}
+
+	stats_sum(&Stats_exited, &ts->s);
+
+	if (ts->prev)
+		ts->prev->next = ts->next;
+	else
+		Stats_threads = ts->next;
+	if (ts->next)
+		ts->next->prev = ts->prev;
+	ts->registered = 0;
+
+	if ((errno = pthread_mutex_unlock(&Stats_lock)))
+		LOG(1, "!pthread_mutex_unlock");
+}
+
+/*
+ * stats_register -- (internal) add the calling thread's counters to the list
+ */
+static void
+stats_register(void)
+{
+	LOG(4, NULL);
+
+	if ((errno = pthread_mutex_lock(&Stats_lock))) {
+		LOG(1, "!pthread_mutex_lock");
+		return;
+	}
+
+	Tstats.prev = NULL;
+	Tstats.next = Stats_threads;
+	if (Stats_threads)
+		Stats_threads->prev = &Tstats;
+	Stats_threads = &Tstats;
+	Tstats.registered = 1;
+
+	if ((errno = pthread_mutex_unlock(&Stats_lock)))
+		LOG(1, "!pthread_mutex_unlock");
+
+	if (Stats_key_valid &&
+		(errno = pthread_setspecific(Stats_key, &Tstats)))
+		LOG(1, "!pthread_setspecific");
+}
+
+/*
+ * pmem_stats_get -- return the counters summed up over all threads
+ *
+ * The caller sets stats->size to the size of the structure it knows.
+ * Only that much is filled in, so a program built against an older,
+ * smaller struct pmem_stats keeps working.  Counters the library doesn't
+ * have are zeroed.
+ */
+void
+pmem_stats_get(struct pmem_stats *stats)
+{
+	LOG(3, "stats %p size %zu", stats, stats->size);
+
+	size_t size = stats->size;
+	if (size < STATS_FIRST) {
+		LOG(1, "invalid size %zu", size);
+		return;
+	}
+
+	struct pmem_stats sum;
+	memset(&sum, 0, sizeof (sum));
+
+	if ((errno = pthread_mutex_lock(&Stats_lock))) {
+		LOG(1, "!pthread_mutex_lock");
+		return;
+	}
+
+	stats_sum(&sum, &Stats_exited);
+	for (struct thread_stats *ts = Stats_threads; ts; ts = ts->next)
+		stats_sum(&sum, &ts->s);
+
+	if ((errno = pthread_mutex_unlock(&Stats_lock)))
+		LOG(1, "!pthread_mutex_unlock");
+
+	if (size > sizeof (sum)) {
+		memset((char *)stats + sizeof (sum), 0, size - sizeof (sum));
+		size = sizeof (sum);
+	}
+	memcpy((char *)stats + STATS_FIRST, (char *)&sum + STATS_FIRST,
+			size - STATS_FIRST);
+}
+
 /*
  * pmem_has_hw_drain -- return whether or not HW drain (PCOMMIT) was found
  */
@@ -325,6 +525,8 @@ static void (*Func_drain)(void) = drain_no_pcommit;
 void
 pmem_drain(void)
 {
+	STATS_ADD(drains, 1);
+
 	Func_drain();
 }
 
@@ -345,6 +547,10 @@ flush_clflush(void *addr, size_t len)
 	for (uptr = (uintptr_t)addr & ~(FLUSH_ALIGN - 1);
 		uptr < (uintptr_t)addr + len; uptr += FLUSH_ALIGN)
 		_mm_clflush((char *)uptr);
+
+	STATS_ADD(flushes, 1);
+	STATS_ADD(flush_lines, (uptr - ((uintptr_t)addr & ~(FLUSH_ALIGN - 1))) /
+			FLUSH_ALIGN);
 }
 
 /*
@@ -365,6 +571,10 @@ flush_clwb(void *addr, size_t len)
 		uptr < (uintptr_t)addr + len; uptr += FLUSH_ALIGN) {
 		_mm_clwb((char *)uptr);
 	}
+
+	STATS_ADD(flushes, 1);
+	STATS_ADD(flush_lines, (uptr - ((uintptr_t)addr & ~(FLUSH_ALIGN - 1))) /
+			FLUSH_ALIGN);
 }
 
 /*
@@ -385,6 +595,10 @@ flush_clflushopt(void *addr, size_t len)
 		uptr < (uintptr_t)addr + len; uptr += FLUSH_ALIGN) {
 		_mm_clflushopt((char *)uptr);
 	}
+
+	STATS_ADD(flushes, 1);
+	STATS_ADD(flush_lines, (uptr - ((uintptr_t)addr & ~(FLUSH_ALIGN - 1))) /
+			FLUSH_ALIGN);
 }
 
 /*
@@ -417,6 +631,242 @@ pmem_persist(void *addr, size_t len)
 	pmem_drain();
 }
 
+/*
+ * flush_range -- (internal) cache-line aligned range used by pmem_flush_v()
+ */
+struct flush_range {
+	uintptr_t lo;
+	uintptr_t hi;
+};
+
+#define	FLUSH_V_NRANGES 16	/* ranges pmem_flush_v() sorts on the stack */
+
+/*
+ * flush_range_cmp -- (internal) qsort comparator for struct flush_range
+ */
+static int
+flush_range_cmp(const void *a, const void *b)
+{
+	const struct flush_range *ra = a;
+	const struct flush_range *rb = b;
+
+	if (ra->lo < rb->lo)
+		return -1;
+	return ra->lo > rb->lo;
+}
+
+/*
+ * pmem_flush_v -- flush processor cache for a set of ranges
+ *
+ * The ranges are rounded out to cache lines, sorted and merged where
+ * they overlap or touch, so each cache line is flushed once and
+ * adjacent ranges are flushed in a single pass.
+ */
+void
+pmem_flush_v(const struct iovec *iov, int iovcnt)
+{
+	LOG(15, "iov %p iovcnt %d", iov, iovcnt);
+
+	if (iovcnt <= 0)
+		return;
+
+	if (iovcnt == 1) {
+		pmem_flush(iov[0].iov_base, iov[0].iov_len);
+		return;
+	}
+
+	struct flush_range stack_ranges[FLUSH_V_NRANGES];
+	struct flush_range *ranges = stack_ranges;
+
+	if (iovcnt > FLUSH_V_NRANGES &&
+		(ranges = Malloc(iovcnt * sizeof (*ranges))) == NULL) {
+		LOG(1, "!Malloc");
+
+		/* still correct, just without merging */
+		for (int i = 0; i < iovcnt; i++)
+			pmem_flush(iov[i].iov_base, iov[i].iov_len);
+		return;
+	}
+
+	int nranges = 0;
+	for (int i = 0; i < iovcnt; i++) {
+		if (iov[i].iov_len == 0)
+			continue;
+
+		uintptr_t lo = (uintptr_t)iov[i].iov_base;
+		ranges[nranges].lo = lo & ~(FLUSH_ALIGN - 1);
+		ranges[nranges].hi = (lo + iov[i].iov_len + FLUSH_ALIGN - 1) &
+						~(FLUSH_ALIGN - 1);
+		nranges++;
+	}
+
+	int npasses = 0;
+	if (nranges > 0) {
+		qsort(ranges, nranges, sizeof (*ranges), flush_range_cmp);
+
+		struct flush_range cur = ranges[0];
+		for (int i = 1; i < nranges; i++) {
+			if (ranges[i].lo <= cur.hi) {
+				/* overlapping or adjacent, extend current */
+				if (ranges[i].hi > cur.hi)
+					cur.hi = ranges[i].hi;
+				continue;
+			}
+
+			Func_flush((void *)cur.lo, cur.hi - cur.lo);
+			npasses++;
+			cur = ranges[i];
+		}
+		Func_flush((void *)cur.lo, cur.hi - cur.lo);
+		npasses++;
+	}
+
+	LOG(15, "merged %d ranges into %d", nranges, npasses);
+
+	if (ranges != stack_ranges)
+		Free(ranges);
+}
+
+/*
+ * pmem_persist_v -- make any cached changes to a set of pmem ranges persistent
+ */
+void
+pmem_persist_v(const struct iovec *iov, int iovcnt)
+{
+	LOG(15, "iov %p iovcnt %d", iov, iovcnt);
+
+	pmem_flush_v(iov, iovcnt);
+	pmem_drain();
+}
+
+/*
+ * Persist domains let a thread flush any number of ranges and drain once
+ * at an explicit commit point.  pmem_domain_flush() called outside of a
+ * domain behaves like pmem_persist(), so code which may or may not be
+ * called inside a domain can use it unconditionally.  Domains nest, only
+ * the outermost pmem_domain_commit() drains.
+ *
+ * In the debug version, setting PMEM_DOMAIN_CHECK=1 makes the library
+ * remember a checksum of each range flushed inside a domain and verify,
+ * at commit time, that nothing was stored to it after it was flushed.
+ */
+#define	DOMAIN_CHECK_MAX 64	/* ranges tracked per thread when checking */
+
+#ifdef DEBUG
+struct domain_range {
+	const void *addr;
+	size_t len;
+	uint64_t sum;
+};
+
+static int Domain_check;	/* PMEM_DOMAIN_CHECK is set */
+#endif
+
+static __thread struct {
+	unsigned depth;		/* nesting level of open domains */
+	unsigned nflushed;	/* ranges flushed but not drained yet */
+#ifdef DEBUG
+	unsigned nchecked;
+	struct domain_range checked[DOMAIN_CHECK_MAX];
+#endif
+} Domain;
+
+#ifdef DEBUG
+/*
+ * domain_sum -- (internal) checksum a range flushed inside a domain
+ */
+static uint64_t
+domain_sum(const void *addr, size_t len)
+{
+	const unsigned char *p = addr;
+	uint64_t sum = 14695981039346656037ULL;		/* FNV-1a */
+
+	while (len--) {
+		sum ^= *p++;
+		sum *= 1099511628211ULL;
+	}
+
+	return sum;
+}
+#endif
+
+/*
+ * pmem_domain_begin -- open a persist domain for the calling thread
+ */
+void
+pmem_domain_begin(void)
+{
+	LOG(15, "depth %u", Domain.depth);
+
+	Domain.depth++;
+}
+
+/*
+ * pmem_domain_flush -- flush a range, draining at the domain commit
+ */
+void
+pmem_domain_flush(void *addr, size_t len)
+{
+	LOG(15, "addr %p len %zu", addr, len);
+
+	pmem_flush(addr, len);
+
+	if (Domain.depth == 0) {
+		pmem_drain();
+		return;
+	}
+
+	Domain.nflushed++;
+
+#ifdef DEBUG
+	if (Domain_check) {
+		if (Domain.nchecked < DOMAIN_CHECK_MAX) {
+			struct domain_range *r =
+				&Domain.checked[Domain.nchecked++];
+			r->addr = addr;
+			r->len = len;
+			r->sum = domain_sum(addr, len);
+		} else {
+			LOG(4, "too many ranges, not checking %p", addr);
+		}
+	}
+#endif
+}
+
+/*
+ * pmem_domain_commit -- close a persist domain, draining if outermost
+ */
+void
+pmem_domain_commit(void)
+{
+	LOG(15, "depth %u nflushed %u", Domain.depth, Domain.nflushed);
+
+	if (Domain.depth == 0) {
+		LOG(1, "no persist domain to commit");
+		return;
+	}
+
+	if (--Domain.depth)
+		return;
+
+#ifdef DEBUG
+	for (unsigned i = 0; i < Domain.nchecked; i++) {
+		struct domain_range *r = &Domain.checked[i];
+
+		if (domain_sum(r->addr, r->len) != r->sum)
+			FATAL("store to range %p len %zu after it was flushed "
+				"and before the domain was committed",
+				r->addr, r->len);
+	}
+	Domain.nchecked = 0;
+#endif
+
+	if (Domain.nflushed) {
+		pmem_drain();
+		Domain.nflushed = 0;
+	}
+}
+
 /*
  * pmem_msync -- flush to persistence via msync
  *
@@ -441,6 +891,9 @@ pmem_msync(void *addr, size_t len)
 	/* round addr down to page boundary */
 	uintptr_t uptr = (uintptr_t)addr & ~(Pagesize - 1);
 
+	STATS_ADD(msyncs, 1);
+	STATS_ADD(msync_bytes, len);
+
 	int ret;
 	if ((ret = msync((void *)uptr, len, MS_SYNC)) < 0)
 		LOG(1, "!msync");
@@ -471,150 +924,365 @@ is_pmem_never(void *addr, size_t len)
 }
 
 /*
- * is_pmem_proc -- (internal) use /proc to implement pmem_is_pmem()
+ * The result of scanning /proc/self/smaps is kept in a process-wide
+ * table of ranges, sorted by address, each tagged with whether the
+ * "mixed map" vmflag was set for it.  pmem_is_pmem() lookups are done
+ * against the table; smaps is re-read only when a lookup hits a range
+ * the table doesn't know about.
+ *
+ * Ranges are dropped from the table when they're mapped or unmapped
+ * through util_map() and util_unmap(), but mappings can come and go in
+ * many other ways, like a plain munmap() of a pmem_map() range.  So the
+ * table is never trusted to say a range is pmem: each such range is
+ * first checked to still be the same mapping of the same file, see
+ * is_pmem_range_valid().  A stale "not pmem" answer is only slower, never
+ * wrong, and isn't checked.
+ */
+struct is_pmem_range {
+	uintptr_t lo;		/* beginning of range */
+	uintptr_t hi;		/* end of range (exclusive) */
+	dev_t dev;		/* device of the mapped file */
+	ino_t ino;		/* inode of the mapped file */
+	int is_pmem;		/* mm flag was set for range */
+};
+
+static struct {
+	pthread_rwlock_t lock;
+	struct is_pmem_range *ranges;
+	unsigned nranges;
+	unsigned maxranges;
+} Is_pmem_cache = {
+	.lock = PTHREAD_RWLOCK_INITIALIZER,
+};
+
+/*
+ * is_pmem_range_valid -- (internal) check a cached range is still mapped
+ *
+ * /proc/self/map_files has an entry named after the bounds of each
+ * mapping of a file, and stat() follows it to the mapped file.  If the
+ * entry exists and the file is the one smaps showed, the range is still
+ * the mapping that was cached.  When map_files can't be used, for
+ * instance without the privileges it requires, the range is reported
+ * as invalid, and smaps is read again.
+ */
+static int
+is_pmem_range_valid(const struct is_pmem_range *r)
+{
+	char path[PROCMAXLEN];
+	snprintf(path, PROCMAXLEN, "/proc/self/map_files/%lx-%lx",
+			(unsigned long)r->lo, (unsigned long)r->hi);
+
+	struct stat stbuf;
+	if (stat(path, &stbuf) < 0) {
+		LOG(4, "!%s", path);
+		return 0;
+	}
+
+	if (stbuf.st_dev != r->dev || stbuf.st_ino != r->ino) {
+		LOG(4, "range %p-%p maps another file",
+				(void *)r->lo, (void *)r->hi);
+		return 0;
+	}
+
+	return 1;
+}
+
+/*
+ * is_pmem_cache_lookup -- (internal) check range against the smaps cache
  *
- * This function returns true only if the entire range can be confirmed
- * as being direct access persistent memory.  Finding any part of the
- * range is not direct access, or failing to look up the information
- * because it is unmapped or because any sort of error happens, just
- * results in returning false.
+ * Returns 1 if the cache covers the entire range [lo, hi), in which case
+ * *is_pmem is set to the answer, otherwise returns 0.  A range which is
+ * found to be not pmem is answered even if the rest of it isn't cached.
+ * With verify set, the ranges found to be pmem must also pass
+ * is_pmem_range_valid(), or the range is treated as not cached.
  *
- * This function works by lookup up the range in /proc/self/smaps and
- * verifying the "mixed map" vmflag is set for that range.  While this
- * isn't exactly the same as direct access, there is no DAX flag in
- * the vmflags and the mixed map flag is only true on regular files when
- * DAX is in-use, so it serves the purpose.
+ * Must be called with Is_pmem_cache.lock held.
+ */
+static int
+is_pmem_cache_lookup(uintptr_t lo, uintptr_t hi, int verify, int *is_pmem)
+{
+	struct is_pmem_range *r = Is_pmem_cache.ranges;
+	unsigned nranges = Is_pmem_cache.nranges;
+
+	/* binary search for the first range ending above lo */
+	unsigned first = 0;
+	unsigned last = nranges;
+	while (first < last) {
+		unsigned mid = first + (last - first) / 2;
+
+		if (r[mid].hi <= lo)
+			first = mid + 1;
+		else
+			last = mid;
+	}
+
+	/* walk the (contiguous) ranges covering [lo, hi) */
+	uintptr_t caddr = lo;
+	for (unsigned i = first; i < nranges && caddr < hi; i++) {
+		if (r[i].lo > caddr)
+			break;		/* hole in the cache */
+
+		if (!r[i].is_pmem) {
+			LOG(4, "range %p-%p has no mm flag",
+					(void *)r[i].lo, (void *)r[i].hi);
+			*is_pmem = 0;
+			return 1;
+		}
+
+		caddr = r[i].hi;
+	}
+
+	if (caddr >= hi && verify) {
+		for (unsigned i = first; i < nranges && r[i].lo < hi; i++)
+			if (!is_pmem_range_valid(&r[i]))
+				return 0;
+	}
+
+	if (caddr < hi) {
+		LOG(4, "no cached range for addr %p", (void *)caddr);
+		return 0;
+	}
+
+	*is_pmem = 1;
+	return 1;
+}
+
+/*
+ * is_pmem_cache_fill -- (internal) (re)load the cache from /proc/self/smaps
  *
- * The range passed in may overlap with multiple entries in the smaps list
- * so this function loops through the smaps entries until the entire range
- * is verified as direct access, or until it is clear the answer is false
- * in which case it stops the loop and returns immediately.
+ * Must be called with Is_pmem_cache.lock held for writing.
  */
 static int
-is_pmem_proc(void *addr, size_t len)
+is_pmem_cache_fill(void)
 {
-	char *caddr = addr;
+	LOG(3, NULL);
 
 	FILE *fp;
 	if ((fp = fopen("/proc/self/smaps", "r")) == NULL) {
 		LOG(1, "!/proc/self/smaps");
-		return 0;
+		return -1;
 	}
 
-	int retval = 0;		/* assume false until proven otherwise */
+	Is_pmem_cache.nranges = 0;
+
 	char line[PROCMAXLEN];	/* for fgets() */
-	char *lo = NULL;	/* beginning of current range in smaps file */
-	char *hi = NULL;	/* end of current range in smaps file */
-	int needmm = 0;		/* looking for mm flag for current range */
+	char *lo;		/* beginning of current range in smaps file */
+	char *hi;		/* end of current range in smaps file */
+	unsigned major;		/* device of the file mapped by the range */
+	unsigned minor;
+	unsigned long ino;	/* inode of the file mapped by the range */
 	while (fgets(line, PROCMAXLEN, fp) != NULL) {
 		static const char vmflags[] = "VmFlags:";
 		static const char mm[] = " mm";
 
 		/* check for range line */
-		if (sscanf(line, "%p-%p", &lo, &hi) == 2) {
-			if (needmm) {
-				/* last range matched, but no mm flag found */
-				LOG(4, "never found mm flag");
-				break;
-			} else if (caddr < lo) {
-				/* never found the range for caddr */
-				LOG(4, "no match for addr %p", caddr);
-				break;
-			} else if (caddr < hi) {
-				/* start address is in this range */
-				size_t rangelen = hi - caddr;
-
-				/* remember that matching has started */
-				needmm = 1;
-
-				/* calculate remaining range to search for */
-				if (len > rangelen) {
-					len -= rangelen;
-					caddr += rangelen;
-					LOG(4, "matched %zu bytes in range "
-							"%p-%p, %zu left over",
-							rangelen, lo, hi, len);
-				} else {
-					len = 0;
-					LOG(4, "matched all bytes in range "
-							"%p-%p", lo, hi);
+		int n = sscanf(line, "%p-%p %*s %*s %x:%x %lu",
+				&lo, &hi, &major, &minor, &ino);
+		if (n >= 2) {
+			if (Is_pmem_cache.nranges == Is_pmem_cache.maxranges) {
+				unsigned maxranges = Is_pmem_cache.maxranges ?
+					Is_pmem_cache.maxranges * 2 : 64;
+				struct is_pmem_range *ranges =
+					Realloc(Is_pmem_cache.ranges,
+					maxranges * sizeof (*ranges));
+
+				if (ranges == NULL) {
+					LOG(1, "!Realloc");
+					Is_pmem_cache.nranges = 0;
+					fclose(fp);
+					return -1;
 				}
+
+				Is_pmem_cache.ranges = ranges;
+				Is_pmem_cache.maxranges = maxranges;
 			}
-		} else if (needmm && strncmp(line, vmflags,
+
+			struct is_pmem_range *r =
+				&Is_pmem_cache.ranges[Is_pmem_cache.nranges++];
+			r->lo = (uintptr_t)lo;
+			r->hi = (uintptr_t)hi;
+			r->dev = n == 5 ? makedev(major, minor) : 0;
+			r->ino = n == 5 ? ino : 0;
+			r->is_pmem = 0;
+		} else if (Is_pmem_cache.nranges && strncmp(line, vmflags,
 					sizeof (vmflags) - 1) == 0) {
 			if (strstr(&line[sizeof (vmflags) - 1], mm) != NULL) {
-				LOG(4, "mm flag found");
-				if (len == 0) {
-					/* entire range matched */
-					retval = 1;
-					break;
-				}
-				needmm = 0;	/* saw what was needed */
-			} else {
-				/* mm flag not set for some or all of range */
-				LOG(4, "range has no mm flag");
-				break;
+				struct is_pmem_range *r = &Is_pmem_cache.ranges[
+					Is_pmem_cache.nranges - 1];
+
+				LOG(4, "mm flag found for range %p-%p",
+					(void *)r->lo, (void *)r->hi);
+				r->is_pmem = 1;
 			}
 		}
 	}
 
 	fclose(fp);
 
-	LOG(3, "returning %d", retval);
-	return retval;
+	LOG(4, "cached %u ranges", Is_pmem_cache.nranges);
+	return 0;
 }
 
 /*
- * pmem_is_pmem() calls through Func_is_pmem to do the work.  Although
- * initialized to is_pmem_never(), once the existence of the clflush
- * feature is confirmed by pmem_init() at library initialization time,
- * Func_is_pmem is set to is_pmem_proc().  That's the most common case
- * on modern hardware.
- */
-static int (*Func_is_pmem)(void *addr, size_t len) = is_pmem_never;
-
-/*
- * pmem_is_pmem -- return true if entire range is persistent Memory
+ * is_pmem_cache_invalidate -- (internal) drop cached ranges overlapping range
+ *
+ * Called by util_map() and util_unmap(), via Mmap_notify, whenever a
+ * mapping is created or removed.
  */
-int
-pmem_is_pmem(void *addr, size_t len)
+static void
+is_pmem_cache_invalidate(void *addr, size_t len)
 {
-	return Func_is_pmem(addr, len);
-}
+	LOG(3, "addr %p len %zu", addr, len);
 
-/*
- * pmem_map -- map the entire file for read/write access
- */
-void *
-pmem_map(int fd)
-{
-	LOG(3, "fd %d", fd);
+	uintptr_t lo = (uintptr_t)addr;
+	uintptr_t hi = lo + len;
 
-	struct stat stbuf;
-	if (fstat(fd, &stbuf) < 0) {
-		LOG(1, "!fstat");
-		return NULL;
+	if ((errno = pthread_rwlock_wrlock(&Is_pmem_cache.lock))) {
+		LOG(1, "!pthread_rwlock_wrlock");
+		return;
 	}
 
-	void *addr;
-	if ((addr = util_map(fd, stbuf.st_size, 0)) == NULL)
-		return NULL;    /* util_map() set errno, called LOG */
-
-	LOG(3, "returning %p", addr);
-	return addr;
-}
-
-/*
- * memmove_nodrain_normal -- (internal) memmove to pmem without hw drain
- */
-static void *
-memmove_nodrain_normal(void *pmemdest, const void *src, size_t len)
-{
-	LOG(15, "pmemdest %p src %p len %zu", pmemdest, src, len);
+	struct is_pmem_range *r = Is_pmem_cache.ranges;
+	unsigned n = 0;
+	for (unsigned i = 0; i < Is_pmem_cache.nranges; i++) {
+		if (r[i].hi <= lo || r[i].lo >= hi)
+			r[n++] = r[i];
+		else
+			LOG(4, "dropping range %p-%p",
+					(void *)r[i].lo, (void *)r[i].hi);
+	}
+	Is_pmem_cache.nranges = n;
 
-	void *retval = memmove(pmemdest, src, len);
-	pmem_flush(pmemdest, len);
-	return retval;
+	if ((errno = pthread_rwlock_unlock(&Is_pmem_cache.lock)))
+		LOG(1, "!pthread_rwlock_unlock");
+}
+
+/*
+ * is_pmem_proc -- (internal) use /proc to implement pmem_is_pmem()
+ *
+ * This function returns true only if the entire range can be confirmed
+ * as being direct access persistent memory.  Finding any part of the
+ * range is not direct access, or failing to look up the information
+ * because it is unmapped or because any sort of error happens, just
+ * results in returning false.
+ *
+ * This function works by lookup up the range in /proc/self/smaps and
+ * verifying the "mixed map" vmflag is set for that range.  While this
+ * isn't exactly the same as direct access, there is no DAX flag in
+ * the vmflags and the mixed map flag is only true on regular files when
+ * DAX is in-use, so it serves the purpose.
+ *
+ * The range passed in may overlap with multiple entries in the smaps list
+ * so the whole of it must be covered by cached ranges with the mm flag.
+ * When part of the range isn't in the cache, or a cached range can't be
+ * confirmed to still be the same mapping, smaps is scanned again (once)
+ * before deciding the range isn't mapped.
+ */
+static int
+is_pmem_proc(void *addr, size_t len)
+{
+	uintptr_t lo = (uintptr_t)addr;
+	uintptr_t hi = lo + (len ? len : 1);	/* addr itself must be mapped */
+	int retval = 0;		/* assume false until proven otherwise */
+
+	if ((errno = pthread_rwlock_rdlock(&Is_pmem_cache.lock))) {
+		LOG(1, "!pthread_rwlock_rdlock");
+		return 0;
+	}
+
+	int found = is_pmem_cache_lookup(lo, hi, 1, &retval);
+
+	if ((errno = pthread_rwlock_unlock(&Is_pmem_cache.lock)))
+		LOG(1, "!pthread_rwlock_unlock");
+
+	if (found) {
+		LOG(3, "returning %d", retval);
+		return retval;
+	}
+
+	if ((errno = pthread_rwlock_wrlock(&Is_pmem_cache.lock))) {
+		LOG(1, "!pthread_rwlock_wrlock");
+		return 0;
+	}
+
+	/* another thread may have refreshed the cache in the meantime */
+	if (!is_pmem_cache_lookup(lo, hi, 1, &retval)) {
+		if (is_pmem_cache_fill() < 0 ||
+				!is_pmem_cache_lookup(lo, hi, 0, &retval))
+			retval = 0;
+	}
+
+	if ((errno = pthread_rwlock_unlock(&Is_pmem_cache.lock)))
+		LOG(1, "!pthread_rwlock_unlock");
+
+	LOG(3, "returning %d", retval);
+	return retval;
+}
+
+/*
+ * pmem_is_pmem() calls through Func_is_pmem to do the work.  Although
+ * initialized to is_pmem_never(), once the existence of the clflush
+ * feature is confirmed by pmem_init() at library initialization time,
+ * Func_is_pmem is set to is_pmem_proc().  That's the most common case
+ * on modern hardware.
+ */
+static int (*Func_is_pmem)(void *addr, size_t len) = is_pmem_never;
+
+/*
+ * pmem_is_pmem -- return true if entire range is persistent Memory
+ */
+int
+pmem_is_pmem(void *addr, size_t len)
+{
+	return Func_is_pmem(addr, len);
+}
+
+/*
+ * pmem_map -- map the entire file for read/write access
+ */
+void *
+pmem_map(int fd)
+{
+	LOG(3, "fd %d", fd);
+
+	struct stat stbuf;
+	if (fstat(fd, &stbuf) < 0) {
+		LOG(1, "!fstat");
+		return NULL;
+	}
+
+	void *addr;
+	if ((addr = util_map(fd, stbuf.st_size, 0)) == NULL)
+		return NULL;    /* util_map() set errno, called LOG */
+
+	LOG(3, "returning %p", addr);
+	return addr;
+}
+
+/*
+ * pmem_unmap -- delete a mapping created by pmem_map()
+ */
+int
+pmem_unmap(void *addr, size_t len)
+{
+	LOG(3, "addr %p len %zu", addr, len);
+
+	return util_unmap(addr, len);
+}
+
+/*
+ * memmove_nodrain_normal -- (internal) memmove to pmem without hw drain
+ */
+static void *
+memmove_nodrain_normal(void *pmemdest, const void *src, size_t len)
+{
+	LOG(15, "pmemdest %p src %p len %zu", pmemdest, src, len);
+
+	STATS_ADD(memmove_normal_bytes, len);
+
+	void *retval = memmove(pmemdest, src, len);
+	pmem_flush(pmemdest, len);
+	return retval;
 }
 
 /*
@@ -638,6 +1306,8 @@ memmove_nodrain_movnt(void *pmemdest, const void *src, size_t len)
 	if (src == pmemdest)
 		return pmemdest;
 
+	STATS_ADD(memmove_sse2_bytes, len);
+
 	if ((uintptr_t)dest1 - (uintptr_t)src >= len) {
 		/*
 		 * Copy the range in the forward direction.
@@ -823,12 +1493,258 @@ memmove_nodrain_movnt(void *pmemdest, const void *src, size_t len)
 	return pmemdest;
 }
 
+/*
+ * memmove_nodrain_movnt_avx2 -- (internal) memmove to pmem without hw drain,
+ *	movnt using 256-bit AVX2 stores
+ *
+ * The bulk of the range is copied in 256-byte chunks.  Whatever is left
+ * over (less than a chunk) is handed to memmove_nodrain_movnt(), which
+ * already knows how to deal with the small tails.
+ */
+__attribute__((target("avx2")))
+static void *
+memmove_nodrain_movnt_avx2(void *pmemdest, const void *src, size_t len)
+{
+	LOG(15, "pmemdest %p src %p len %zu", pmemdest, src, len);
+
+	__m256i ymm0, ymm1, ymm2, ymm3, ymm4, ymm5, ymm6, ymm7;
+	size_t i;
+	__m256i *d;
+	__m256i *s;
+	char *dest1 = pmemdest;
+	const char *src1 = src;
+	size_t cnt;
+
+	if (len < AVX2_CHUNK_SIZE || src == pmemdest)
+		return memmove_nodrain_movnt(pmemdest, src, len);
+
+	size_t total = len;	/* the tail is counted by the SSE2 version */
+
+	if ((uintptr_t)dest1 - (uintptr_t)src1 >= len) {
+		/* copy the range in the forward direction */
+
+		/* copy up to FLUSH_ALIGN boundary */
+		cnt = (uint64_t)dest1 & ALIGN_MASK;
+		if (cnt > 0) {
+			cnt = FLUSH_ALIGN - cnt;
+			memmove(dest1, src1, cnt);
+			pmem_flush(dest1, cnt);
+			dest1 += cnt;
+			src1 += cnt;
+			len -= cnt;
+		}
+
+		d = (__m256i *)dest1;
+		s = (__m256i *)src1;
+
+		cnt = len >> AVX2_CHUNK_SHIFT;
+		for (i = 0; i < cnt; i++) {
+			ymm0 = _mm256_loadu_si256(s);
+			ymm1 = _mm256_loadu_si256(s + 1);
+			ymm2 = _mm256_loadu_si256(s + 2);
+			ymm3 = _mm256_loadu_si256(s + 3);
+			ymm4 = _mm256_loadu_si256(s + 4);
+			ymm5 = _mm256_loadu_si256(s + 5);
+			ymm6 = _mm256_loadu_si256(s + 6);
+			ymm7 = _mm256_loadu_si256(s + 7);
+			s += 8;
+			_mm256_stream_si256(d,		ymm0);
+			_mm256_stream_si256(d + 1,	ymm1);
+			_mm256_stream_si256(d + 2,	ymm2);
+			_mm256_stream_si256(d + 3,	ymm3);
+			_mm256_stream_si256(d + 4,	ymm4);
+			_mm256_stream_si256(d + 5,	ymm5);
+			_mm256_stream_si256(d + 6,	ymm6);
+			_mm256_stream_si256(d + 7,	ymm7);
+			d += 8;
+		}
+
+		dest1 = (char *)d;
+		src1 = (char *)s;
+		len &= AVX2_CHUNK_MASK;
+	} else {
+		/*
+		 * Copy the range in the backward direction, leaving
+		 * the (unaligned) beginning of the range for the tail copy.
+		 */
+		char *dend = dest1 + len;
+		const char *send = src1 + len;
+
+		cnt = (uint64_t)dend & ALIGN_MASK;
+		if (cnt > 0) {
+			dend -= cnt;
+			send -= cnt;
+			memmove(dend, send, cnt);
+			pmem_flush(dend, cnt);
+			len -= cnt;
+		}
+
+		d = (__m256i *)dend;
+		s = (__m256i *)send;
+
+		cnt = len >> AVX2_CHUNK_SHIFT;
+		for (i = 0; i < cnt; i++) {
+			ymm0 = _mm256_loadu_si256(s - 1);
+			ymm1 = _mm256_loadu_si256(s - 2);
+			ymm2 = _mm256_loadu_si256(s - 3);
+			ymm3 = _mm256_loadu_si256(s - 4);
+			ymm4 = _mm256_loadu_si256(s - 5);
+			ymm5 = _mm256_loadu_si256(s - 6);
+			ymm6 = _mm256_loadu_si256(s - 7);
+			ymm7 = _mm256_loadu_si256(s - 8);
+			s -= 8;
+			_mm256_stream_si256(d - 1, ymm0);
+			_mm256_stream_si256(d - 2, ymm1);
+			_mm256_stream_si256(d - 3, ymm2);
+			_mm256_stream_si256(d - 4, ymm3);
+			_mm256_stream_si256(d - 5, ymm4);
+			_mm256_stream_si256(d - 6, ymm5);
+			_mm256_stream_si256(d - 7, ymm6);
+			_mm256_stream_si256(d - 8, ymm7);
+			d -= 8;
+		}
+
+		len &= AVX2_CHUNK_MASK;
+	}
+
+	STATS_ADD(memmove_avx2_bytes, total - len);
+
+	/* copy the remaining (<256 bytes) using the SSE2 version */
+	if (len != 0)
+		memmove_nodrain_movnt(dest1, src1, len);
+
+	return pmemdest;
+}
+
+/*
+ * memmove_nodrain_movnt_avx512f -- (internal) memmove to pmem without
+ *	hw drain, movnt using 512-bit AVX-512 stores
+ *
+ * Same as memmove_nodrain_movnt_avx2(), but in 512-byte chunks.
+ */
+__attribute__((target("avx512f")))
+static void *
+memmove_nodrain_movnt_avx512f(void *pmemdest, const void *src, size_t len)
+{
+	LOG(15, "pmemdest %p src %p len %zu", pmemdest, src, len);
+
+	__m512i zmm0, zmm1, zmm2, zmm3, zmm4, zmm5, zmm6, zmm7;
+	size_t i;
+	__m512i *d;
+	__m512i *s;
+	char *dest1 = pmemdest;
+	const char *src1 = src;
+	size_t cnt;
+
+	if (len < AVX512F_CHUNK_SIZE || src == pmemdest)
+		return memmove_nodrain_movnt(pmemdest, src, len);
+
+	size_t total = len;	/* the tail is counted by the SSE2 version */
+
+	if ((uintptr_t)dest1 - (uintptr_t)src1 >= len) {
+		/* copy the range in the forward direction */
+
+		/* copy up to FLUSH_ALIGN boundary */
+		cnt = (uint64_t)dest1 & ALIGN_MASK;
+		if (cnt > 0) {
+			cnt = FLUSH_ALIGN - cnt;
+			memmove(dest1, src1, cnt);
+			pmem_flush(dest1, cnt);
+			dest1 += cnt;
+			src1 += cnt;
+			len -= cnt;
+		}
+
+		d = (__m512i *)dest1;
+		s = (__m512i *)src1;
+
+		cnt = len >> AVX512F_CHUNK_SHIFT;
+		for (i = 0; i < cnt; i++) {
+			zmm0 = _mm512_loadu_si512(s);
+			zmm1 = _mm512_loadu_si512(s + 1);
+			zmm2 = _mm512_loadu_si512(s + 2);
+			zmm3 = _mm512_loadu_si512(s + 3);
+			zmm4 = _mm512_loadu_si512(s + 4);
+			zmm5 = _mm512_loadu_si512(s + 5);
+			zmm6 = _mm512_loadu_si512(s + 6);
+			zmm7 = _mm512_loadu_si512(s + 7);
+			s += 8;
+			_mm512_stream_si512(d,		zmm0);
+			_mm512_stream_si512(d + 1,	zmm1);
+			_mm512_stream_si512(d + 2,	zmm2);
+			_mm512_stream_si512(d + 3,	zmm3);
+			_mm512_stream_si512(d + 4,	zmm4);
+			_mm512_stream_si512(d + 5,	zmm5);
+			_mm512_stream_si512(d + 6,	zmm6);
+			_mm512_stream_si512(d + 7,	zmm7);
+			d += 8;
+		}
+
+		dest1 = (char *)d;
+		src1 = (char *)s;
+		len &= AVX512F_CHUNK_MASK;
+	} else {
+		/*
+		 * Copy the range in the backward direction, leaving
+		 * the (unaligned) beginning of the range for the tail copy.
+		 */
+		char *dend = dest1 + len;
+		const char *send = src1 + len;
+
+		cnt = (uint64_t)dend & ALIGN_MASK;
+		if (cnt > 0) {
+			dend -= cnt;
+			send -= cnt;
+			memmove(dend, send, cnt);
+			pmem_flush(dend, cnt);
+			len -= cnt;
+		}
+
+		d = (__m512i *)dend;
+		s = (__m512i *)send;
+
+		cnt = len >> AVX512F_CHUNK_SHIFT;
+		for (i = 0; i < cnt; i++) {
+			zmm0 = _mm512_loadu_si512(s - 1);
+			zmm1 = _mm512_loadu_si512(s - 2);
+			zmm2 = _mm512_loadu_si512(s - 3);
+			zmm3 = _mm512_loadu_si512(s - 4);
+			zmm4 = _mm512_loadu_si512(s - 5);
+			zmm5 = _mm512_loadu_si512(s - 6);
+			zmm6 = _mm512_loadu_si512(s - 7);
+			zmm7 = _mm512_loadu_si512(s - 8);
+			s -= 8;
+			_mm512_stream_si512(d - 1, zmm0);
+			_mm512_stream_si512(d - 2, zmm1);
+			_mm512_stream_si512(d - 3, zmm2);
+			_mm512_stream_si512(d - 4, zmm3);
+			_mm512_stream_si512(d - 5, zmm4);
+			_mm512_stream_si512(d - 6, zmm5);
+			_mm512_stream_si512(d - 7, zmm6);
+			_mm512_stream_si512(d - 8, zmm7);
+			d -= 8;
+		}
+
+		len &= AVX512F_CHUNK_MASK;
+	}
+
+	STATS_ADD(memmove_avx512f_bytes, total - len);
+
+	/* copy the remaining (<512 bytes) using the SSE2 version */
+	if (len != 0)
+		memmove_nodrain_movnt(dest1, src1, len);
+
+	return pmemdest;
+}
+
 /*
  * pmem_memmove_nodrain() calls through Func_memmove_nodrain to do the work.
  * Although initialized to memmove_nodrain_normal(), once the existence of the
  * sse2 feature is confirmed by pmem_init() at library initialization time,
  * Func_memmove_nodrain is set to memmove_nodrain_movnt().  That's the most
- * common case on modern hardware that supports persistent memory.
+ * common case on modern hardware that supports persistent memory.  When
+ * the avx2 or avx512f features are also present, the wider versions
+ * memmove_nodrain_movnt_avx2() or memmove_nodrain_movnt_avx512f() are used.
  */
 static void *(*Func_memmove_nodrain)
 	(void *pmemdest, const void *src, size_t len) = memmove_nodrain_normal;
@@ -887,6 +1803,8 @@ memset_nodrain_normal(void *pmemdest, int c, size_t len)
 {
 	LOG(15, "pmemdest %p c 0x%x len %zu", pmemdest, c, len);
 
+	STATS_ADD(memset_normal_bytes, len);
+
 	void *retval = memset(pmemdest, c, len);
 	pmem_flush(pmemdest, len);
 	return retval;
@@ -906,6 +1824,8 @@ memset_nodrain_movnt(void *pmemdest, int c, size_t len)
 	__m128i xmm0;
 	__m128i *d;
 
+	STATS_ADD(memset_sse2_bytes, len);
+
 	/* memset up to the next FLUSH_ALIGN boundary */
 	cnt = (uint64_t)dest1 & ALIGN_MASK;
 	if (cnt != 0) {
@@ -975,12 +1895,126 @@ memset_nodrain_movnt(void *pmemdest, int c, size_t len)
 	return pmemdest;
 }
 
+/*
+ * memset_nodrain_movnt_avx2 -- (internal) memset to pmem without hw drain,
+ *	movnt using 256-bit AVX2 stores
+ */
+__attribute__((target("avx2")))
+static void *
+memset_nodrain_movnt_avx2(void *pmemdest, int c, size_t len)
+{
+	LOG(15, "pmemdest %p c 0x%x len %zu", pmemdest, c, len);
+
+	size_t i;
+	char *dest1 = pmemdest;
+	size_t cnt;
+	__m256i ymm0;
+	__m256i *d;
+
+	if (len < AVX2_CHUNK_SIZE)
+		return memset_nodrain_movnt(pmemdest, c, len);
+
+	size_t total = len;	/* the tail is counted by the SSE2 version */
+
+	/* memset up to the next FLUSH_ALIGN boundary */
+	cnt = (uint64_t)dest1 & ALIGN_MASK;
+	if (cnt != 0) {
+		cnt = FLUSH_ALIGN - cnt;
+		memset(dest1, c, cnt);
+		pmem_flush(dest1, cnt);
+		len -= cnt;
+		dest1 += cnt;
+	}
+
+	ymm0 = _mm256_set1_epi8((char)c);
+
+	d = (__m256i *)dest1;
+	cnt = len >> AVX2_CHUNK_SHIFT;
+	for (i = 0; i < cnt; i++) {
+		_mm256_stream_si256(d, ymm0);
+		_mm256_stream_si256(d + 1, ymm0);
+		_mm256_stream_si256(d + 2, ymm0);
+		_mm256_stream_si256(d + 3, ymm0);
+		_mm256_stream_si256(d + 4, ymm0);
+		_mm256_stream_si256(d + 5, ymm0);
+		_mm256_stream_si256(d + 6, ymm0);
+		_mm256_stream_si256(d + 7, ymm0);
+		d += 8;
+	}
+
+	/* memset the remaining (<256 bytes) using the SSE2 version */
+	len &= AVX2_CHUNK_MASK;
+	STATS_ADD(memset_avx2_bytes, total - len);
+	if (len != 0)
+		memset_nodrain_movnt(d, c, len);
+
+	return pmemdest;
+}
+
+/*
+ * memset_nodrain_movnt_avx512f -- (internal) memset to pmem without
+ *	hw drain, movnt using 512-bit AVX-512 stores
+ */
+__attribute__((target("avx512f")))
+static void *
+memset_nodrain_movnt_avx512f(void *pmemdest, int c, size_t len)
+{
+	LOG(15, "pmemdest %p c 0x%x len %zu", pmemdest, c, len);
+
+	size_t i;
+	char *dest1 = pmemdest;
+	size_t cnt;
+	__m512i zmm0;
+	__m512i *d;
+
+	if (len < AVX512F_CHUNK_SIZE)
+		return memset_nodrain_movnt(pmemdest, c, len);
+
+	size_t total = len;	/* the tail is counted by the SSE2 version */
+
+	/* memset up to the next FLUSH_ALIGN boundary */
+	cnt = (uint64_t)dest1 & ALIGN_MASK;
+	if (cnt != 0) {
+		cnt = FLUSH_ALIGN - cnt;
+		memset(dest1, c, cnt);
+		pmem_flush(dest1, cnt);
+		len -= cnt;
+		dest1 += cnt;
+	}
+
+	zmm0 = _mm512_set1_epi32((c & 0xff) * 0x01010101);
+
+	d = (__m512i *)dest1;
+	cnt = len >> AVX512F_CHUNK_SHIFT;
+	for (i = 0; i < cnt; i++) {
+		_mm512_stream_si512(d, zmm0);
+		_mm512_stream_si512(d + 1, zmm0);
+		_mm512_stream_si512(d + 2, zmm0);
+		_mm512_stream_si512(d + 3, zmm0);
+		_mm512_stream_si512(d + 4, zmm0);
+		_mm512_stream_si512(d + 5, zmm0);
+		_mm512_stream_si512(d + 6, zmm0);
+		_mm512_stream_si512(d + 7, zmm0);
+		d += 8;
+	}
+
+	/* memset the remaining (<512 bytes) using the SSE2 version */
+	len &= AVX512F_CHUNK_MASK;
+	STATS_ADD(memset_avx512f_bytes, total - len);
+	if (len != 0)
+		memset_nodrain_movnt(d, c, len);
+
+	return pmemdest;
+}
+
 /*
  * pmem_memset_nodrain() calls through Func_memset_nodrain to do the work.
  * Although initialized to memset_nodrain_normal(), once the existence of the
  * sse2 feature is confirmed by pmem_init() at library initialization time,
  * Func_memset_nodrain is set to memset_nodrain_movnt().  That's the most
- * common case on modern hardware that supports persistent memory.
+ * common case on modern hardware that supports persistent memory.  When
+ * the avx2 or avx512f features are also present, the wider versions
+ * memset_nodrain_movnt_avx2() or memset_nodrain_movnt_avx512f() are used.
  */
 static void *(*Func_memset_nodrain)
 	(void *pmemdest, int c, size_t len) = memset_nodrain_normal;
@@ -1007,6 +2041,258 @@ pmem_memset_persist(void *pmemdest, int c, size_t len)
 	return retval;
 }
 
+/*
+ * Func_memmove_movnt and Func_memset_movnt hold the movnt versions of
+ * memmove and memset chosen by pmem_init(), for use by the hybrid versions
+ * below.  Ranges shorter than Movnt_threshold bytes use the normal versions.
+ */
+static void *(*Func_memmove_movnt)
+	(void *pmemdest, const void *src, size_t len) = memmove_nodrain_movnt;
+static void *(*Func_memset_movnt)
+	(void *pmemdest, int c, size_t len) = memset_nodrain_movnt;
+static size_t Movnt_threshold = MOVNT_THRESHOLD;
+
+/*
+ * memmove_nodrain_hybrid -- (internal) memmove to pmem without hw drain,
+ *	normal or movnt depending on the length
+ */
+static void *
+memmove_nodrain_hybrid(void *pmemdest, const void *src, size_t len)
+{
+	LOG(15, "pmemdest %p src %p len %zu", pmemdest, src, len);
+
+	if (len < Movnt_threshold)
+		return memmove_nodrain_normal(pmemdest, src, len);
+
+	return Func_memmove_movnt(pmemdest, src, len);
+}
+
+/*
+ * memset_nodrain_hybrid -- (internal) memset to pmem without hw drain,
+ *	normal or movnt depending on the length
+ */
+static void *
+memset_nodrain_hybrid(void *pmemdest, int c, size_t len)
+{
+	LOG(15, "pmemdest %p c 0x%x len %zu", pmemdest, c, len);
+
+	if (len < Movnt_threshold)
+		return memset_nodrain_normal(pmemdest, c, len);
+
+	return Func_memset_movnt(pmemdest, c, len);
+}
+
+/*
+ * calibrate_time -- (internal) return the time in ns it takes to copy
+ *	CALIBRATE_BYTES in len-sized pieces with the given memmove version
+ */
+static uint64_t
+calibrate_time(void *(*memmove_func)(void *, const void *, size_t),
+		char *dest, const char *src, size_t len)
+{
+	struct timespec start, stop;
+	size_t off;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (off = 0; off < CALIBRATE_BYTES; off += len) {
+		memmove_func(dest + (off & (CALIBRATE_MAX - 1)), src, len);
+		pmem_drain();
+	}
+	clock_gettime(CLOCK_MONOTONIC, &stop);
+
+	return (uint64_t)(stop.tv_sec - start.tv_sec) * 1000000000 +
+		(uint64_t)stop.tv_nsec - (uint64_t)start.tv_nsec;
+}
+
+/*
+ * calibrate_movnt_threshold -- (internal) find the movnt threshold
+ *
+ * Copies the same amount of data using the normal and the movnt versions
+ * of memmove for growing sizes, and returns the first size for which the
+ * movnt version wins.  Since the only memory available at this point is
+ * regular DRAM, the result is an approximation of the crossover on pmem.
+ */
+static size_t
+calibrate_movnt_threshold(void)
+{
+	LOG(3, NULL);
+
+	char *buf = Malloc(2 * CALIBRATE_MAX + FLUSH_ALIGN);
+	if (buf == NULL) {
+		LOG(1, "!Malloc");
+		return MOVNT_THRESHOLD;
+	}
+
+	/* the destination is 2 * CALIBRATE_MAX, the source just the first */
+	char *dest = (char *)(((uintptr_t)buf + ALIGN_MASK) & ~ALIGN_MASK);
+	char *src = dest + CALIBRATE_MAX;
+	memset(dest, 0, 2 * CALIBRATE_MAX);
+
+	size_t len;
+	for (len = CALIBRATE_MIN; len <= CALIBRATE_MAX / 2; len <<= 1) {
+		uint64_t normal = calibrate_time(memmove_nodrain_normal,
+				dest, src, len);
+		uint64_t movnt = calibrate_time(Func_memmove_movnt,
+				dest, src, len);
+
+		LOG(4, "len %zu normal %juns movnt %juns", len,
+				(uintmax_t)normal, (uintmax_t)movnt);
+
+		if (movnt <= normal)
+			break;
+	}
+
+	Free(buf);
+
+	/* don't count the calibration in the statistics */
+	if (Stats_enabled)
+		memset(&Tstats.s, 0, sizeof (Tstats.s));
+
+	return len;
+}
+
+/*
+ * CPU features used by pmem_init(), as detected by cpu_features_cpuid()
+ * or cpu_features_proc()
+ */
+#define	CPU_CLFLUSH	0x0001
+#define	CPU_CLWB	0x0002
+#define	CPU_CLFLUSHOPT	0x0004
+#define	CPU_PCOMMIT	0x0008
+#define	CPU_SSE2	0x0010
+#define	CPU_AVX2	0x0020
+#define	CPU_AVX512F	0x0040
+
+/* cpuid leaf 1 */
+#define	CPUID_EDX_CLFLUSH	(1U << 19)
+#define	CPUID_EDX_SSE2		(1U << 26)
+#define	CPUID_ECX_OSXSAVE	(1U << 27)
+
+/* cpuid leaf 7, subleaf 0 */
+#define	CPUID_EBX_AVX2		(1U << 5)
+#define	CPUID_EBX_AVX512F	(1U << 16)
+#define	CPUID_EBX_PCOMMIT	(1U << 22)
+#define	CPUID_EBX_CLFLUSHOPT	(1U << 23)
+#define	CPUID_EBX_CLWB		(1U << 24)
+
+/* register state enabled by the OS, as reported by xgetbv */
+#define	XCR0_AVX	0x06	/* SSE and AVX state */
+#define	XCR0_AVX512	0xe6	/* SSE, AVX, opmask and ZMM state */
+
+/*
+ * cpu_features_cpuid -- (internal) detect CPU features using cpuid
+ *
+ * Returns -1 if the cpuid instruction can't be used to get the features,
+ * in which case the caller falls back to parsing /proc/cpuinfo.
+ *
+ * The AVX2 and AVX-512F features are only reported when the OS has
+ * enabled the corresponding register state, which is what the kernel
+ * does for the flags shown in /proc/cpuinfo as well.
+ */
+static int
+cpu_features_cpuid(unsigned *features)
+{
+	unsigned eax, ebx, ecx, edx;
+	unsigned maxleaf = __get_cpuid_max(0, NULL);
+
+	if (maxleaf < 1) {
+		LOG(3, "cpuid not supported");
+		return -1;
+	}
+
+	*features = 0;
+
+	__cpuid(1, eax, ebx, ecx, edx);
+
+	if (edx & CPUID_EDX_CLFLUSH)
+		*features |= CPU_CLFLUSH;
+	if (edx & CPUID_EDX_SSE2)
+		*features |= CPU_SSE2;
+
+	uint64_t xcr0 = 0;
+	if (ecx & CPUID_ECX_OSXSAVE) {
+		unsigned lo, hi;
+		__asm__ volatile("xgetbv" : "=a" (lo), "=d" (hi) : "c" (0));
+		xcr0 = ((uint64_t)hi << 32) | lo;
+	}
+
+	if (maxleaf >= 7) {
+		__cpuid_count(7, 0, eax, ebx, ecx, edx);
+
+		if (ebx & CPUID_EBX_CLWB)
+			*features |= CPU_CLWB;
+		if (ebx & CPUID_EBX_CLFLUSHOPT)
+			*features |= CPU_CLFLUSHOPT;
+		if (ebx & CPUID_EBX_PCOMMIT)
+			*features |= CPU_PCOMMIT;
+		if ((ebx & CPUID_EBX_AVX2) &&
+				(xcr0 & XCR0_AVX) == XCR0_AVX)
+			*features |= CPU_AVX2;
+		if ((ebx & CPUID_EBX_AVX512F) &&
+				(xcr0 & XCR0_AVX512) == XCR0_AVX512)
+			*features |= CPU_AVX512F;
+	}
+
+	LOG(4, "cpuid features 0x%x", *features);
+	return 0;
+}
+
+/*
+ * cpu_features_proc -- (internal) detect CPU features using /proc/cpuinfo
+ */
+static unsigned
+cpu_features_proc(void)
+{
+	static const struct {
+		const char *flag;
+		unsigned feature;
+	} proc_flags[] = {
+		{ " clflush ",		CPU_CLFLUSH },
+		{ " clwb ",		CPU_CLWB },
+		{ " clflushopt ",	CPU_CLFLUSHOPT },
+		{ " pcommit ",		CPU_PCOMMIT },
+		{ " sse2 ",		CPU_SSE2 },
+		{ " avx2 ",		CPU_AVX2 },
+		{ " avx512f ",		CPU_AVX512F },
+	};
+
+	unsigned features = 0;
+
+	FILE *fp;
+	if ((fp = fopen("/proc/cpuinfo", "r")) == NULL) {
+		LOG(1, "!/proc/cpuinfo");
+		return 0;
+	}
+
+	char line[PROCMAXLEN];	/* for fgets() */
+
+	while (fgets(line, PROCMAXLEN, fp) != NULL) {
+		static const char flags[] = "flags\t\t: ";
+
+		if (strncmp(flags, line, sizeof (flags) - 1) == 0) {
+			/* start of list of flags */
+			char *flags = &line[sizeof (flags) - 1];
+
+			/* change ending newline to space delimiter */
+			char *nl = strrchr(line, '\n');
+			if (nl)
+				*nl = ' ';
+
+			int i;
+			for (i = 0; i < sizeof (proc_flags) /
+					sizeof (proc_flags[0]); i++)
+				if (strstr(flags, proc_flags[i].flag) != NULL)
+					features |= proc_flags[i].feature;
+
+			break;
+		}
+	}
+
+	fclose(fp);
+
+	return features;
+}
+
 /*
  * pmem_init -- load-time initialization for pmem.c
  *
@@ -1021,98 +2307,157 @@ pmem_init(void)
 	LOG(3, NULL);
 	util_init();
 
+	char *e = getenv("PMEM_STATS");
+	if (e && strcmp(e, "1") == 0)
+		Stats_enabled = 1;
+	e = getenv("PMEM_STATS_DUMP");
+	if (e && strcmp(e, "1") == 0)
+		Stats_enabled = Stats_dump = 1;
+	if (Stats_enabled)
+		LOG(3, "PMEM_STATS enabled statistics");
+
+	if ((errno = pthread_key_create(&Stats_key, stats_thread_exit)))
+		LOG(1, "!pthread_key_create");
+	else
+		Stats_key_valid = 1;
+
 	/* detect supported cache flush features */
-	FILE *fp;
-	if ((fp = fopen("/proc/cpuinfo", "r")) == NULL) {
-		LOG(1, "!/proc/cpuinfo");
-	} else {
-		char line[PROCMAXLEN];	/* for fgets() */
-
-		while (fgets(line, PROCMAXLEN, fp) != NULL) {
-			static const char flags[] = "flags\t\t: ";
-			static const char clflush[] = " clflush ";
-			static const char clwb[] = " clwb ";
-			static const char clflushopt[] = " clflushopt ";
-			static const char pcommit[] = " pcommit ";
-			static const char sse2[] = " sse2 ";
-
-			if (strncmp(flags, line, sizeof (flags) - 1) == 0) {
-				/* start of list of flags */
-				char *flags = &line[sizeof (flags) - 1];
-
-				/* change ending newline to space delimiter */
-				char *nl = strrchr(line, '\n');
-				if (nl)
-					*nl = ' ';
-
-				if (strstr(flags, clflush) != NULL) {
-					Func_is_pmem = is_pmem_proc;
-					LOG(3, "clflush supported");
-				}
+	unsigned features = 0;
+	e = getenv("PMEM_NO_CPUID");
+	if (e && strcmp(e, "1") == 0) {
+		LOG(3, "PMEM_NO_CPUID forced /proc/cpuinfo");
+		features = cpu_features_proc();
+	} else if (cpu_features_cpuid(&features) < 0) {
+		LOG(3, "cpuid not usable, using /proc/cpuinfo");
+		features = cpu_features_proc();
+	}
 
-				if (strstr(flags, clwb) != NULL) {
-					LOG(3, "clwb supported");
-
-					char *e = getenv("PMEM_NO_CLWB");
-					if (e && strcmp(e, "1") == 0)
-						LOG(3, "PMEM_NO_CLWB "
-							"forced no clwb");
-					else {
-						Func_flush = flush_clwb;
-						Func_predrain_fence =
-							predrain_fence_sfence;
-					}
-				}
+	/* keep the pmem_is_pmem() range cache in sync with our mappings */
+	Mmap_notify = is_pmem_cache_invalidate;
 
-				if (strstr(flags, clflushopt) != NULL) {
-					LOG(3, "clflushopt supported");
-
-					char *e = getenv("PMEM_NO_CLFLUSHOPT");
-					if (e && strcmp(e, "1") == 0)
-						LOG(3, "PMEM_NO_CLFLUSHOPT "
-							"forced no clflushopt");
-					else {
-						Func_flush = flush_clflushopt;
-						Func_predrain_fence =
-							predrain_fence_sfence;
-					}
-				}
+	if (features & CPU_CLFLUSH) {
+		Func_is_pmem = is_pmem_proc;
+		LOG(3, "clflush supported");
+	}
 
-				if (strstr(flags, pcommit) != NULL) {
-					LOG(3, "pcommit supported");
-
-					char *e = getenv("PMEM_NO_PCOMMIT");
-					if (e && strcmp(e, "1") == 0)
-						LOG(3, "PMEM_NO_PCOMMIT "
-							"forced no pcommit");
-					else {
-						Func_drain = drain_pcommit;
-						Has_hw_drain = 1;
-					}
-				}
+	if (features & CPU_CLWB) {
+		LOG(3, "clwb supported");
 
-				if (strstr(flags, sse2) != NULL) {
-					LOG(3, "movnt supported");
-
-					char *e = getenv("PMEM_NO_MOVNT");
-					if (e && strcmp(e, "1") == 0)
-						LOG(3, "PMEM_NO_MOVNT "
-							"forced no movnt");
-					else {
-						Func_memmove_nodrain =
-							memmove_nodrain_movnt;
-						Func_memset_nodrain =
-							memset_nodrain_movnt;
-					}
-				}
+		e = getenv("PMEM_NO_CLWB");
+		if (e && strcmp(e, "1") == 0)
+			LOG(3, "PMEM_NO_CLWB forced no clwb");
+		else {
+			Func_flush = flush_clwb;
+			Func_predrain_fence = predrain_fence_sfence;
+		}
+	}
+
+	if (features & CPU_CLFLUSHOPT) {
+		LOG(3, "clflushopt supported");
+
+		e = getenv("PMEM_NO_CLFLUSHOPT");
+		if (e && strcmp(e, "1") == 0)
+			LOG(3, "PMEM_NO_CLFLUSHOPT forced no clflushopt");
+		else {
+			Func_flush = flush_clflushopt;
+			Func_predrain_fence = predrain_fence_sfence;
+		}
+	}
+
+	if (features & CPU_PCOMMIT) {
+		LOG(3, "pcommit supported");
+
+		e = getenv("PMEM_NO_PCOMMIT");
+		if (e && strcmp(e, "1") == 0)
+			LOG(3, "PMEM_NO_PCOMMIT forced no pcommit");
+		else {
+			Func_drain = drain_pcommit;
+			Has_hw_drain = 1;
+		}
+	}
+
+	int movnt = 0;	/* sse2 movnt in use */
+	int avx = 0;	/* avx2 movnt in use */
+
+	if (features & CPU_SSE2) {
+		LOG(3, "movnt supported");
+
+		e = getenv("PMEM_NO_MOVNT");
+		if (e && strcmp(e, "1") == 0)
+			LOG(3, "PMEM_NO_MOVNT forced no movnt");
+		else {
+			Func_memmove_nodrain = memmove_nodrain_movnt;
+			Func_memset_nodrain = memset_nodrain_movnt;
+			movnt = 1;
+		}
+	}
+
+	if (movnt && (features & CPU_AVX2)) {
+		LOG(3, "avx2 supported");
+
+		e = getenv("PMEM_NO_AVX");
+		if (e && strcmp(e, "1") == 0)
+			LOG(3, "PMEM_NO_AVX forced no avx");
+		else {
+			Func_memmove_nodrain = memmove_nodrain_movnt_avx2;
+			Func_memset_nodrain = memset_nodrain_movnt_avx2;
+			avx = 1;
+		}
+	}
+
+	if (avx && (features & CPU_AVX512F)) {
+		LOG(3, "avx512f supported");
 
-				break;
+		e = getenv("PMEM_NO_AVX512F");
+		if (e && strcmp(e, "1") == 0)
+			LOG(3, "PMEM_NO_AVX512F forced no avx512f");
+		else {
+			Func_memmove_nodrain = memmove_nodrain_movnt_avx512f;
+			Func_memset_nodrain = memset_nodrain_movnt_avx512f;
+		}
+	}
+
+	/*
+	 * When the movnt versions are in use, route the short ranges to
+	 * the normal versions through the hybrid versions, unless the
+	 * threshold is set to zero using PMEM_MOVNT_THRESHOLD.  Setting
+	 * PMEM_MOVNT_THRESHOLD=auto measures the threshold instead.
+	 */
+	if (Func_memmove_nodrain != memmove_nodrain_normal) {
+		Func_memmove_movnt = Func_memmove_nodrain;
+		Func_memset_movnt = Func_memset_nodrain;
+
+		e = getenv("PMEM_MOVNT_THRESHOLD");
+		if (e && strcmp(e, "auto") == 0) {
+			Movnt_threshold = calibrate_movnt_threshold();
+			LOG(3, "calibrated movnt threshold %zu",
+					Movnt_threshold);
+		} else if (e) {
+			char *endp;
+			unsigned long long val = strtoull(e, &endp, 10);
+			if (*e == '\0' || *endp != '\0')
+				LOG(1, "invalid PMEM_MOVNT_THRESHOLD %s", e);
+			else {
+				Movnt_threshold = (size_t)val;
+				LOG(3, "PMEM_MOVNT_THRESHOLD set movnt "
+					"threshold %zu", Movnt_threshold);
 			}
 		}
 
-		fclose(fp);
+		if (Movnt_threshold != 0) {
+			Func_memmove_nodrain = memmove_nodrain_hybrid;
+			Func_memset_nodrain = memset_nodrain_hybrid;
+		}
 	}
 
+#ifdef DEBUG
+	e = getenv("PMEM_DOMAIN_CHECK");
+	if (e && strcmp(e, "1") == 0) {
+		LOG(3, "PMEM_DOMAIN_CHECK enabled persist domain checking");
+		Domain_check = 1;
+	}
+#endif
+
 	/*
 	 * For debugging/testing, allow pmem_is_pmem() to be forced
 	 * to always true or never true using environment variable
@@ -1133,3 +2478,57 @@ pmem_init(void)
 			Func_is_pmem = is_pmem_always;
 	}
 }
+
+/*
+ * stats_dump -- (internal) print the statistics to stderr
+ */
+static void
+stats_dump(void)
+{
+	struct pmem_stats s;
+	s.size = sizeof (s);
+	pmem_stats_get(&s);
+
+	fprintf(stderr, "libpmem statistics:\n"
+		"flushes %llu\n"
+		"flush_lines %llu\n"
+		"drains %llu\n"
+		"msyncs %llu\n"
+		"msync_bytes %llu\n"
+		"memmove_normal_bytes %llu\n"
+		"memmove_sse2_bytes %llu\n"
+		"memmove_avx2_bytes %llu\n"
+		"memmove_avx512f_bytes %llu\n"
+		"memset_normal_bytes %llu\n"
+		"memset_sse2_bytes %llu\n"
+		"memset_avx2_bytes %llu\n"
+		"memset_avx512f_bytes %llu\n",
+		s.flushes, s.flush_lines,
+		s.drains, s.msyncs, s.msync_bytes,
+		s.memmove_normal_bytes, s.memmove_sse2_bytes,
+		s.memmove_avx2_bytes, s.memmove_avx512f_bytes,
+		s.memset_normal_bytes, s.memset_sse2_bytes,
+		s.memset_avx2_bytes, s.memset_avx512f_bytes);
+}
+
+/*
+ * pmem_fini -- libpmem cleanup routine
+ *
+ * Called automatically when the process terminates or the library
+ * is unloaded.
+ */
+__attribute__((destructor))
+static void
+pmem_fini(void)
+{
+	LOG(3, NULL);
+
+	if (Stats_dump)
+		stats_dump();
+
+	if (Stats_key_valid) {
+		Stats_key_valid = 0;
+		if ((errno = pthread_key_delete(Stats_key)))
+			LOG(1, "!pthread_key_delete");
+	}
+}
@@ -53,17 +53,40 @@
 #include "btt.h"
 #include "blk.h"
 
+static __thread unsigned Lane;	/* last lane of this thread plus one */
+
 /*
  * lane_enter -- (internal) acquire a unique lane number
+ *
+ * A thread first tries the lane it used last time, so that it keeps
+ * hitting the same flog entry and lock, then any other lane that happens
+ * to be free.  Only when all lanes are busy does it block, on its own lane.
  */
 static int
 lane_enter(PMEMblkpool *pbp)
 {
 	int mylane;
 
-	mylane = __sync_fetch_and_add(&pbp->next_lane, 1) % pbp->nlane;
+	if (Lane == 0)
+		Lane = __sync_fetch_and_add(&pbp->next_lane, 1) + 1;
+
+	mylane = (Lane - 1) % pbp->nlane;
 
-	/* lane selected, grab the per-lane lock */
+	for (int i = 0; i < pbp->nlane; i++) {
+		int lane = (mylane + i) % pbp->nlane;
+
+		errno = pthread_mutex_trylock(&pbp->locks[lane]);
+		if (errno == 0) {
+			Lane = lane + 1;
+			return lane;
+		}
+		if (errno != EBUSY) {
+			LOG(1, "!pthread_mutex_trylock");
+			return -1;
+		}
+	}
+
+	/* all lanes busy, wait for this thread's own lane */
 	if ((errno = pthread_mutex_lock(&pbp->locks[mylane]))) {
 		LOG(1, "!pthread_mutex_lock");
 		return -1;
@@ -84,6 +107,35 @@ lane_exit(PMEMblkpool *pbp, int mylane)
 	errno = oerrno;
 }
 
+/*
+ * lanes_enter -- (internal) acquire up to n unique lane numbers
+ *
+ * The first lane is acquired like lane_enter() does, the other ones only
+ * if they happen to be free, so a batch doesn't wait for more lanes.
+ *
+ * Returns the number of lanes acquired, otherwise -1/errno.
+ */
+static int
+lanes_enter(PMEMblkpool *pbp, int *lanes, int n)
+{
+	if ((lanes[0] = lane_enter(pbp)) < 0)
+		return -1;
+
+	int nlanes = 1;
+
+	for (int i = 1; i < pbp->nlane && nlanes < n; i++) {
+		int lane = (lanes[0] + i) % pbp->nlane;
+
+		errno = pthread_mutex_trylock(&pbp->locks[lane]);
+		if (errno == 0)
+			lanes[nlanes++] = lane;
+		else if (errno != EBUSY)
+			LOG(1, "!pthread_mutex_trylock");
+	}
+
+	return nlanes;
+}
+
 /*
  * nsread -- (internal) read data from the namespace encapsulating the BTT
  *
@@ -155,8 +207,9 @@ nswrite(void *ns, int lane, const void *buf, size_t count, off_t off)
 		LOG(1, "!pthread_mutex_unlock");
 #endif
 
+	/* drain is deferred if btt opened a persist domain */
 	if (pbp->is_pmem)
-		pmem_persist(dest, count);
+		pmem_domain_flush(dest, count);
 	else
 		pmem_msync(dest, count);
 
@@ -289,6 +342,7 @@ pmemblk_map_common(int fd, size_t poolsize, size_t bsize, int rdonly,
 	/* things free by "goto err" if not NULL */
 	struct btt *bttp = NULL;
 	pthread_mutex_t *locks = NULL;
+	void *zero_block = NULL;
 
 	void *addr;
 	if ((addr = util_map(fd, poolsize, rdonly)) == NULL) {
@@ -435,6 +489,13 @@ pmemblk_map_common(int fd, size_t poolsize, size_t bsize, int rdonly,
 
 	pbp->locks = locks;
 
+	if ((zero_block = Malloc(bsize)) == NULL) {
+		LOG(1, "!Malloc for zero block");
+		goto err;
+	}
+	memset(zero_block, 0, bsize);
+	pbp->zero_block = zero_block;
+
 #ifdef DEBUG
 	/* initialize debug lock */
 	if ((errno = pthread_mutex_init(&pbp->write_lock, NULL))) {
@@ -462,9 +523,11 @@ err:
 	int oerrno = errno;
 	if (locks)
 		Free((void *)locks);
+	if (zero_block)
+		Free(zero_block);
 	if (bttp)
 		btt_fini(bttp);
-	util_unmap(addr, poolsize);
+	pmem_unmap(addr, poolsize);
 	errno = oerrno;
 	return NULL;
 }
@@ -526,13 +589,15 @@ pmemblk_close(PMEMblkpool *pbp)
 			pthread_mutex_destroy(&pbp->locks[i]);
 		Free((void *)pbp->locks);
 	}
+	if (pbp->zero_block)
+		Free(pbp->zero_block);
 
 #ifdef DEBUG
 	/* destroy debug lock */
 	pthread_mutex_destroy(&pbp->write_lock);
 #endif
 
-	util_unmap(pbp->addr, pbp->size);
+	pmem_unmap(pbp->addr, pbp->size);
 }
 
 /*
@@ -554,16 +619,49 @@ pmemblk_read(PMEMblkpool *pbp, void *buf, off_t blockno)
 {
 	LOG(3, "pbp %p buf %p blockno %lld", pbp, buf, (long long)blockno);
 
-	int lane = lane_enter(pbp);
+	/* reads don't need a lane, btt_read() tracks them on its own */
+	return btt_read(pbp->bttp, blockno, buf);
+}
 
-	if (lane < 0)
-		return -1;
+/*
+ * pmemblk_map_block -- map a block in a block memory pool for reading
+ */
+const void *
+pmemblk_map_block(PMEMblkpool *pbp, off_t blockno)
+{
+	LOG(3, "pbp %p blockno %lld", pbp, (long long)blockno);
 
-	int err = btt_read(pbp->bttp, lane, blockno, buf);
+	void *addr;
 
-	lane_exit(pbp, lane);
+	if (btt_map_block(pbp->bttp, blockno, &addr) < 0)
+		return NULL;
 
-	return err;
+	/* blocks without a data block read as zeros */
+	if (addr == NULL)
+		addr = pbp->zero_block;
+
+	return addr;
+}
+
+/*
+ * pmemblk_unmap_block -- release a block mapped by pmemblk_map_block()
+ */
+int
+pmemblk_unmap_block(PMEMblkpool *pbp, const void *addr)
+{
+	LOG(3, "pbp %p addr %p", pbp, addr);
+
+	if (addr == pbp->zero_block)
+		return 0;
+
+	if ((char *)addr < (char *)pbp->data ||
+			(char *)addr >= (char *)pbp->data + pbp->datasize) {
+		LOG(1, "addr %p not in data area", addr);
+		errno = EINVAL;
+		return -1;
+	}
+
+	return btt_unmap_block(pbp->bttp, (char *)addr - (char *)pbp->data);
 }
 
 /*
@@ -592,6 +690,75 @@ pmemblk_write(PMEMblkpool *pbp, const void *buf, off_t blockno)
 	return err;
 }
 
+/*
+ * pmemblk_readv -- read a number of blocks in a block memory pool
+ */
+int
+pmemblk_readv(PMEMblkpool *pbp, const struct pmemblk_iovec *iov, int iovcnt)
+{
+	LOG(3, "pbp %p iov %p iovcnt %d", pbp, iov, iovcnt);
+
+	for (int i = 0; i < iovcnt; i++)
+		if (btt_read(pbp->bttp, iov[i].blockno, iov[i].buf) < 0)
+			return -1;
+
+	return 0;
+}
+
+/*
+ * pmemblk_writev -- write a number of blocks in a block memory pool
+ */
+int
+pmemblk_writev(PMEMblkpool *pbp, const struct pmemblk_iovec *iov, int iovcnt)
+{
+	LOG(3, "pbp %p iov %p iovcnt %d", pbp, iov, iovcnt);
+
+	if (pbp->rdonly) {
+		LOG(1, "EROFS (pool is read-only)");
+		errno = EROFS;
+		return -1;
+	}
+
+	/* check all the blocks before writing any of them */
+	size_t nblock = btt_nlba(pbp->bttp);
+	for (int i = 0; i < iovcnt; i++)
+		if (iov[i].blockno < 0 || (size_t)iov[i].blockno >= nblock) {
+			LOG(1, "blockno %lld out of range",
+					(long long)iov[i].blockno);
+			errno = EINVAL;
+			return -1;
+		}
+
+	if (iovcnt <= 0)
+		return 0;
+
+	int lanes[pbp->nlane];
+	int nlanes = lanes_enter(pbp, lanes, iovcnt);
+
+	if (nlanes < 0)
+		return -1;
+
+	/* write as many blocks at a time as lanes were acquired */
+	struct btt_iovec biov[nlanes];
+	int err = 0;
+
+	for (int i = 0; i < iovcnt && err == 0; i += nlanes) {
+		int n = MIN(nlanes, iovcnt - i);
+
+		for (int j = 0; j < n; j++) {
+			biov[j].lba = iov[i + j].blockno;
+			biov[j].buf = iov[i + j].buf;
+		}
+
+		err = btt_writev(pbp->bttp, lanes, nlanes, biov, n);
+	}
+
+	for (int i = 0; i < nlanes; i++)
+		lane_exit(pbp, lanes[i]);
+
+	return err;
+}
+
 /*
  * pmemblk_set_zero -- zero a block in a block memory pool
  */
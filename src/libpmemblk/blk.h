@@ -64,8 +64,9 @@ struct pmemblk {
 	size_t nlba;			/* number of LBAs in pool */
 	struct btt *bttp;		/* btt handle */
 	int nlane;			/* number of lanes */
-	unsigned next_lane;		/* used to rotate through lanes */
+	unsigned next_lane;		/* first lanes of new threads */
 	pthread_mutex_t *locks;		/* one per lane */
+	void *zero_block;		/* mapped for blocks reading as zeros */
 
 #ifdef DEBUG
 	/* held during read/write mprotected sections */
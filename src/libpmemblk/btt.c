@@ -64,8 +64,15 @@
  *
  *	btt_read	Reads a single block at a given LBA
  *
+ *	btt_map_block	Pins the block at a given LBA and returns its address
+ *
+ *	btt_unmap_block	Unpins a block returned by btt_map_block
+ *
  *	btt_write	Writes a single block (atomically) at a given LBA
  *
+ *	btt_writev	Writes a number of blocks (each atomically) using
+ *			a number of lanes
+ *
  *	btt_set_zero	Sets a block to read back as zeros
  *
  *	btt_set_error	Sets a block to return error on read
@@ -75,8 +82,10 @@
  *	btt_fini	Frees run-time state, done using namespace
  *
  * If the caller is multi-threaded, it must only allow btt_nlane() threads
- * to enter this module at a time, each assigned a unique "lane" number
- * between 0 and btt_nlane() - 1.
+ * to write to this module at a time, each assigned a unique "lane" number
+ * between 0 and btt_nlane() - 1.  btt_writev() takes a set of such lanes.
+ * Reads don't take a lane, any number of threads may call btt_read()
+ * concurrently.
  *
  * There are a number of static routines defined in this module.  Here's
  * a brief overview of the most important routines:
@@ -117,11 +126,16 @@
  *			doing a read), when the metadata indicates the
  *			block should read as zeros.
  *
+ *	rtt_wait	Wait for reads of a free block to finish before a
+ *			write reuses it.
+ *
  *	build_rtt	These routines construct the run-time tracking
  *	build_map_locks	data structures used during I/O.
  */
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <limits.h>
 #include <sys/param.h>
 #include <unistd.h>
 #include <errno.h>
@@ -129,12 +143,26 @@
 #include <stdint.h>
 #include <pthread.h>
 #include <endian.h>
+#include <emmintrin.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
 
+#include "libpmem.h"
 #include "out.h"
 #include "util.h"
 #include "btt.h"
 #include "btt_layout.h"
 
+/*
+ * Alignment of the run-time state that different lanes and threads write
+ * to, so none of them share a cache line.  Building with a smaller value,
+ * like -DBTT_RUNTIME_ALIGN=8, packs it instead, for comparison, see
+ * benchmarks/blk_mt/RUN_layout.sh.
+ */
+#ifndef BTT_RUNTIME_ALIGN
+#define	BTT_RUNTIME_ALIGN 64
+#endif
+
 /*
  * The opaque btt handle containing state tracked by this module
  * for the btt namespace.  This is created by btt_init(), handed to
@@ -168,6 +196,12 @@ struct btt {
 	uint64_t nlba;			/* total number of external LBAs */
 	int narena;			/* number of arenas */
 
+	/*
+	 * Number of writes sleeping in rtt_wait(), so a read only has to
+	 * wake them up when there are any.
+	 */
+	int volatile rtt_waiters;
+
 	/* run-time state kept for each arena */
 	struct arena {
 		uint32_t flags;		/* arena flags (btt_info) */
@@ -196,30 +230,50 @@ struct btt {
 		 * it writes to before atomically making it the new
 		 * active block for an external LBA.
 		 *
-		 * The read path doesn't use the flog at all.
+		 * The read path doesn't use the flog at all.  Each lane's
+		 * entry takes a cache line of its own.
 		 */
 		struct flog_runtime {
 			struct btt_flog flog;	/* current info */
 			off_t entries[2];	/* offsets for flog pair */
 			int next;		/* next write (0 or 1) */
-		} *flogs;
+		} __attribute__((aligned(BTT_RUNTIME_ALIGN))) *flogs;
 
 		/*
-		 * Read tracking table.  Indexed by lane.
+		 * Read tracking table.  One slot per outstanding read.
 		 *
 		 * Before using a free block found in the flog, the write path
 		 * scans the rtt to see if there are any outstanding reads on
 		 * that block (reads that started before the block was freed by
 		 * a concurrent write).  Unused slots in the rtt are indicated
 		 * by setting the error bit, BTT_MAP_ENTRY_ERROR, so that the
-		 * entry won't match any post-map LBA when checked.
+		 * entry won't match any post-map LBA when checked.  A read
+		 * claims a slot by swapping its entry in for the error bit,
+		 * see rtt_enter().  Slots held by btt_map_block() have the
+		 * error bit cleared from the entry instead, see RTT_PINNED(),
+		 * so writes have to look at the slots with that bit set.
+		 * The table is padded with unused slots to a multiple of
+		 * RTT_SCAN_WIDTH, see rtt_find().  Slots stay packed so
+		 * the scan is short, instead threads start looking for a
+		 * free slot in different cache lines, see rtt_enter().
 		 */
 		uint32_t volatile *rtt;
+		uint32_t volatile rtt_nused;	/* slots ever claimed */
+		uint32_t volatile rtt_npinned;	/* slots of mapped blocks */
 
 		/*
-		 * Map locking.  Indexed by pre-map LBA modulo nlane.
+		 * Serializes btt_unmap_block(), see there.
 		 */
-		pthread_mutex_t *map_locks;
+		pthread_mutex_t unmap_lock;
+
+		/*
+		 * Map locking.  Indexed by the cache line of the map entry
+		 * modulo nfree, see map_lock().  Each lock takes a cache
+		 * line of its own.
+		 */
+		struct map_lock {
+			pthread_mutex_t lock;
+		} __attribute__((aligned(BTT_RUNTIME_ALIGN))) *map_locks;
 
 		/*
 		 * Arena info block locking.
@@ -248,9 +302,10 @@ struct btt {
 static const char Sig[] = "BTT_ARENA_INFO\0";
 
 /*
- * Zeroed out flog entry, used when initializing the flog.
+ * Tuning of the read tracking table scan done by writes, see rtt_wait().
  */
-static const struct btt_flog Zflog;
+#define	RTT_SCAN_WIDTH 4	/* slots compared at once by rtt_find() */
+#define	RTT_SPIN_MAX 128	/* longest pause loop before rtt_sleep() */
 
 /*
  * Lookup table and macro for looking up sequence numbers.  These are
@@ -533,44 +588,64 @@ read_flog_pair(struct btt *bttp, int lane, struct arena *arenap,
 }
 
 /*
- * flog_update -- (internal) write out an updated flog entry
+ * flog_stage -- (internal) write out the first half of a flog entry
  *
  * The flog entries are not checksummed.  Instead, increasing sequence
  * numbers are used to atomically switch the active flog entry between
  * the first and second struct btt_flog in each slot.  In order for this
  * to work, the sequence number must be updated only after all the other
  * fields in the flog are updated.  So the writes to the flog are broken
- * into two writes, one for the first three fields (lba, old_map, new_map)
- * and, only after those fields are known to be written durably, the
- * second write for the seq field is done.
+ * into two writes, one for the first two fields (lba, old_map) done
+ * here, and, only after those fields are known to be written durably,
+ * the second write for the new_map and seq fields done by flog_activate().
+ *
+ * The new entry is constructed in *new_flogp, in little-endian byte order.
  *
  * Returns 0 on success, otherwise -1/errno.
  */
 static int
-flog_update(struct btt *bttp, int lane, struct arena *arenap,
+flog_stage(struct btt *bttp, int lane, struct arena *arenap,
+		struct btt_flog *new_flogp,
 		uint32_t lba, uint32_t old_map, uint32_t new_map)
 {
 	LOG(3, "bttp %p lane %d arenap %p lba %u old_map %u new_map %u",
 			bttp, lane, arenap, lba, old_map, new_map);
 
-	/* construct new flog entry in little-endian byte order */
-	struct btt_flog new_flog;
-	new_flog.lba = htole32(lba);
-	new_flog.old_map = htole32(old_map);
-	new_flog.new_map = htole32(new_map);
-	new_flog.seq = htole32(NSEQ(arenap->flogs[lane].flog.seq));
+	new_flogp->lba = htole32(lba);
+	new_flogp->old_map = htole32(old_map);
+	new_flogp->new_map = htole32(new_map);
+	new_flogp->seq = htole32(NSEQ(arenap->flogs[lane].flog.seq));
 
 	off_t new_flog_off =
 		arenap->flogs[lane].entries[arenap->flogs[lane].next];
 
 	/* write out first two fields first */
-	if ((*bttp->ns_cbp->nswrite)(bttp->ns, lane, &new_flog,
-				sizeof (uint32_t) * 2, new_flog_off) < 0)
-		return -1;
-	new_flog_off += sizeof (uint32_t) * 2;
+	return (*bttp->ns_cbp->nswrite)(bttp->ns, lane, new_flogp,
+				sizeof (uint32_t) * 2, new_flog_off);
+}
+
+/*
+ * flog_activate -- (internal) make a flog entry written by flog_stage active
+ *
+ * Returns 0 on success, otherwise -1/errno.
+ */
+static int
+flog_activate(struct btt *bttp, int lane, struct arena *arenap,
+		const struct btt_flog *new_flogp)
+{
+	uint32_t lba = le32toh(new_flogp->lba);
+	uint32_t old_map = le32toh(new_flogp->old_map);
+	uint32_t new_map = le32toh(new_flogp->new_map);
+
+	LOG(3, "bttp %p lane %d arenap %p lba %u old_map %u new_map %u",
+			bttp, lane, arenap, lba, old_map, new_map);
+
+	off_t new_flog_off =
+		arenap->flogs[lane].entries[arenap->flogs[lane].next] +
+		sizeof (uint32_t) * 2;
 
 	/* write out new_map and seq field to make it active */
-	if ((*bttp->ns_cbp->nswrite)(bttp->ns, lane, &new_flog.new_map,
+	if ((*bttp->ns_cbp->nswrite)(bttp->ns, lane, &new_flogp->new_map,
 				sizeof (uint32_t) * 2, new_flog_off) < 0)
 		return -1;
 
@@ -594,6 +669,35 @@ flog_update(struct btt *bttp, int lane, struct arena *arenap,
 	return 0;
 }
 
+/*
+ * flog_update -- (internal) write out an updated flog entry
+ *
+ * Returns 0 on success, otherwise -1/errno.
+ */
+static int
+flog_update(struct btt *bttp, int lane, struct arena *arenap,
+		uint32_t lba, uint32_t old_map, uint32_t new_map)
+{
+	LOG(3, "bttp %p lane %d arenap %p lba %u old_map %u new_map %u",
+			bttp, lane, arenap, lba, old_map, new_map);
+
+	struct btt_flog new_flog;
+	int err = flog_stage(bttp, lane, arenap, &new_flog,
+			lba, old_map, new_map);
+
+	/*
+	 * Drain the first half, along with the data block btt_write() wrote
+	 * in the same persist domain, before the seq field makes the entry
+	 * active.
+	 */
+	pmem_domain_commit();
+
+	if (err < 0)
+		return -1;
+
+	return flog_activate(bttp, lane, arenap, &new_flog);
+}
+
 /*
  * arena_setf -- (internal) updates the given flag for the arena info block
  */
@@ -674,6 +778,35 @@ set_arena_error(struct btt *bttp, struct arena *arenap, int lane)
 	return arena_setf(bttp, arenap, lane, BTTINFO_FLAG_ERROR);
 }
 
+/*
+ * runtime_alloc -- (internal) allocate run-time state aligned for lanes
+ *
+ * The memory is aligned to BTT_RUNTIME_ALIGN, which Malloc() doesn't
+ * guarantee, and must be freed with runtime_free().
+ */
+static void *
+runtime_alloc(size_t size)
+{
+	char *base = Malloc(size + sizeof (void *) + BTT_RUNTIME_ALIGN - 1);
+	if (base == NULL)
+		return NULL;
+
+	uintptr_t addr = roundup((uintptr_t)base + sizeof (void *),
+			BTT_RUNTIME_ALIGN);
+	((void **)addr)[-1] = base;
+
+	return (void *)addr;
+}
+
+/*
+ * runtime_free -- (internal) free memory allocated by runtime_alloc()
+ */
+static void
+runtime_free(void *ptr)
+{
+	Free(((void **)ptr)[-1]);
+}
+
 /*
  * read_flogs -- (internal) load up all the flog entries for an arena
  *
@@ -682,7 +815,7 @@ set_arena_error(struct btt *bttp, struct arena *arenap, int lane)
 static int
 read_flogs(struct btt *bttp, int lane, struct arena *arenap)
 {
-	if ((arenap->flogs = Malloc(bttp->nfree *
+	if ((arenap->flogs = runtime_alloc(bttp->nfree *
 			sizeof (struct flog_runtime))) == NULL) {
 		LOG(1, "!Malloc for %d flog entries", bttp->nfree);
 		return -1;
@@ -718,22 +851,32 @@ read_flogs(struct btt *bttp, int lane, struct arena *arenap)
  *
  * Zero is returned on success, otherwise -1/errno.
  *
- * The rtt is big enough to hold an entry for each free block (nfree)
- * since nlane can't be bigger than nfree.  nlane may end up smaller,
- * in which case some of the high rtt entries will be unused.
+ * The rtt holds an entry for each free block (nfree), which bounds the
+ * number of reads in flight per arena.  Reads don't hold a lane, so
+ * all of the entries are used no matter how small nlane is.
  */
 static int
 build_rtt(struct btt *bttp, struct arena *arenap)
 {
-	if ((arenap->rtt = Malloc(bttp->nfree * sizeof (uint32_t)))
-							== NULL) {
+	uint32_t nslots = roundup(bttp->nfree, RTT_SCAN_WIDTH);
+
+	if ((arenap->rtt = runtime_alloc(nslots * sizeof (uint32_t))) == NULL) {
 		LOG(1, "!Malloc for %d rtt entries", bttp->nfree);
 		return -1;
 	}
-	for (int lane = 0; lane < bttp->nfree; lane++)
+	for (int lane = 0; lane < nslots; lane++)
 		arenap->rtt[lane] = BTT_MAP_ENTRY_ERROR;
+	arenap->rtt_nused = 0;
+	arenap->rtt_npinned = 0;
 	__sync_synchronize();
 
+	if ((errno = pthread_mutex_init(&arenap->unmap_lock, NULL))) {
+		LOG(1, "!pthread_mutex_init");
+		runtime_free((void *)arenap->rtt);
+		arenap->rtt = NULL;
+		return -1;
+	}
+
 	return 0;
 }
 
@@ -745,14 +888,13 @@ build_rtt(struct btt *bttp, struct arena *arenap)
 static int
 build_map_locks(struct btt *bttp, struct arena *arenap)
 {
-	if ((arenap->map_locks =
-			Malloc(bttp->nfree * sizeof (*arenap->map_locks)))
-							== NULL) {
+	if ((arenap->map_locks = runtime_alloc(bttp->nfree *
+			sizeof (*arenap->map_locks))) == NULL) {
 		LOG(1, "!Malloc for %d map_lock entries", bttp->nfree);
 		return -1;
 	}
 	for (int lane = 0; lane < bttp->nfree; lane++)
-		pthread_mutex_init(&arenap->map_locks[lane], NULL);
+		pthread_mutex_init(&arenap->map_locks[lane].lock, NULL);
 
 	return 0;
 }
@@ -838,11 +980,14 @@ err:
 	if (bttp->arenas) {
 		for (int i = 0; i < bttp->narena; i++) {
 			if (bttp->arenas[i].flogs)
-				Free(bttp->arenas[i].flogs);
-			if (bttp->arenas[i].rtt)
-				Free((void *)bttp->arenas[i].rtt);
+				runtime_free(bttp->arenas[i].flogs);
+			if (bttp->arenas[i].rtt) {
+				pthread_mutex_destroy(
+					&bttp->arenas[i].unmap_lock);
+				runtime_free((void *)bttp->arenas[i].rtt);
+			}
 			if (bttp->arenas[i].map_locks)
-				Free((void *)bttp->arenas[i].map_locks);
+				runtime_free(bttp->arenas[i].map_locks);
 		}
 		Free(bttp->arenas);
 		bttp->arenas = NULL;
@@ -989,41 +1134,53 @@ write_layout(struct btt *bttp, int lane, int write)
 				return -1;
 		}
 
-		/* write out the initial flog */
-		off_t flog_entry_off = arena_off + flogoff;
+		/*
+		 * Build the initial flog in memory and write it out with
+		 * a single nswrite, so the whole area is flushed in one pass
+		 * instead of flushing and draining each entry separately.
+		 * Nothing here depends on the order the entries become
+		 * persistent, as the flog isn't used until the BTT info
+		 * block below is written.
+		 */
+		size_t flog_pair_size = roundup(2 * sizeof (struct btt_flog),
+				BTT_FLOG_PAIR_ALIGN);
+		size_t flog_write_size = bttp->nfree * flog_pair_size;
+		char *flog_buf;
+		if ((flog_buf = Malloc(flog_write_size)) == NULL) {
+			LOG(1, "!Malloc for flog");
+			return -1;
+		}
+		memset(flog_buf, '\0', flog_write_size);
+
 		uint32_t next_free_lba = external_nlba;
 		for (int i = 0; i < bttp->nfree; i++) {
-			struct btt_flog flog;
-			flog.lba = 0;
-			flog.old_map = flog.new_map =
-				htole32(next_free_lba | BTT_MAP_ENTRY_ZERO);
-			flog.seq = htole32(1);
+			struct btt_flog *flogp = (struct btt_flog *)
+					(flog_buf + i * flog_pair_size);
 
 			/*
-			 * Write both btt_flog structs in the pair, writing
-			 * the second one as all zeros.
+			 * Fill in the first btt_flog struct in the pair,
+			 * leaving the second one as all zeros.
 			 */
+			flogp->lba = 0;
+			flogp->old_map = flogp->new_map =
+				htole32(next_free_lba | BTT_MAP_ENTRY_ZERO);
+			flogp->seq = htole32(1);
+
 			LOG(6, "flog[%d] entry off %lld initial %u + zero = %u",
-					i, (long long)flog_entry_off,
+					i, (long long)(arena_off + flogoff +
+						i * flog_pair_size),
 					next_free_lba,
 					next_free_lba | BTT_MAP_ENTRY_ZERO);
-			if ((*bttp->ns_cbp->nswrite)(bttp->ns, lane, &flog,
-					sizeof (flog), flog_entry_off) < 0)
-				return -1;
-			flog_entry_off += sizeof (flog);
-
-			LOG(6, "flog[%d] entry off %lld zeros",
-					i, (long long)flog_entry_off);
-			if ((*bttp->ns_cbp->nswrite)(bttp->ns, lane, &Zflog,
-					sizeof (Zflog), flog_entry_off) < 0)
-				return -1;
-			flog_entry_off += sizeof (flog);
-			flog_entry_off = roundup(flog_entry_off,
-					BTT_FLOG_PAIR_ALIGN);
 
 			next_free_lba++;
 		}
 
+		int err = (*bttp->ns_cbp->nswrite)(bttp->ns, lane, flog_buf,
+				flog_write_size, arena_off + flogoff);
+		Free(flog_buf);
+		if (err < 0)
+			return -1;
+
 		/*
 		 * Construct the BTT info block and write it out
 		 * at both the beginning and end of the arena.
@@ -1300,9 +1457,10 @@ btt_init(uint64_t rawsize, uint32_t lbasize, uint8_t parent_uuid[],
 /*
  * btt_nlane -- return the number of "lanes" for this btt namespace
  *
- * The number of lanes is the number of threads allowed in this module
- * concurrently for a given btt.  Each thread executing this code must
- * have a unique "lane" number assigned to it between 0 and btt_nlane() - 1.
+ * The number of lanes is the number of threads allowed to write to this
+ * module concurrently for a given btt.  Each thread executing a write
+ * must have a unique "lane" number assigned to it between 0 and
+ * btt_nlane() - 1.  Reads don't need a lane.
  */
 int
 btt_nlane(struct btt *bttp)
@@ -1326,22 +1484,222 @@ btt_nlba(struct btt *bttp)
 	return bttp->nlba;
 }
 
+static unsigned Rtt_threads;		/* threads that used the rtt so far */
+static __thread unsigned Rtt_slot;	/* where to look for a free slot + 1 */
+
 /*
- * btt_read -- read a block from a btt namespace
+ * RTT_SLOTS_PER_LINE -- number of rtt slots in a cache line
+ */
+#define	RTT_SLOTS_PER_LINE (BTT_RUNTIME_ALIGN / sizeof (uint32_t))
+
+/*
+ * RTT_PINNED -- the rtt slot value of a block mapped by btt_map_block()
+ *
+ * A read stores a normal map entry in its slot, with both the error and
+ * the zero bit set.  A mapped block is stored with just the zero bit, so
+ * btt_unmap_block() can't mistake the slot of a read still re-checking
+ * the map for a mapping, and a single compare and swap both checks and
+ * releases a slot.  Either way (slot | BTT_MAP_ENTRY_ERROR) is the entry.
+ */
+#define	RTT_PINNED(entry) ((entry) & ~BTT_MAP_ENTRY_ERROR)
+
+/*
+ * rtt_enter -- (internal) claim a read tracking table slot for entry
+ *
+ * Any slot holding BTT_MAP_ENTRY_ERROR is free.  The search starts at the
+ * slot this thread used last, so that concurrent readers spread over the
+ * table instead of all racing for the first free slot.  The first search
+ * of each thread starts in the next cache line after the one the previous
+ * thread started in, so threads don't share one as long as there are
+ * enough lines, and mostly keep to their own afterwards.  If all slots are
+ * in use, which takes more than nfree concurrent reads, wait for one to
+ * be released, scanning the table again with a growing pause in between,
+ * or fail with EBUSY if wait is false.  rtt_nused is raised
+ * to cover the slot before the caller re-checks the map, so writers only
+ * need to scan that many slots.
+ *
+ * Returns the slot on success, otherwise NULL/errno.
+ */
+static uint32_t volatile *
+rtt_enter(struct btt *bttp, struct arena *arenap, uint32_t entry, int wait)
+{
+	if (Rtt_slot == 0) {
+		unsigned n = __sync_fetch_and_add(&Rtt_threads, 1) *
+				RTT_SLOTS_PER_LINE;
+		Rtt_slot = n + n / bttp->nfree + 1;
+	}
+
+	unsigned start = Rtt_slot - 1;
+	unsigned spins = 1;
+
+	for (;;) {
+		for (unsigned i = start; i < start + bttp->nfree; i++) {
+			unsigned slot = i % bttp->nfree;
+
+			if (arenap->rtt[slot] != BTT_MAP_ENTRY_ERROR ||
+					!__sync_bool_compare_and_swap(
+						&arenap->rtt[slot],
+						BTT_MAP_ENTRY_ERROR, entry))
+				continue;
+
+			Rtt_slot = slot + 1;
+
+			uint32_t nused;
+			while ((nused = arenap->rtt_nused) <= slot &&
+					!__sync_bool_compare_and_swap(
+						&arenap->rtt_nused, nused,
+						slot + 1))
+				;
+
+			return &arenap->rtt[slot];
+		}
+
+		if (!wait)
+			break;
+
+		/* back off between the scans, like rtt_wait() does */
+		for (unsigned i = 0; i < spins; i++)
+			_mm_pause();
+		if (spins <= RTT_SPIN_MAX)
+			spins <<= 1;
+	}
+
+	LOG(1, "all %u rtt slots in use", bttp->nfree);
+	errno = EBUSY;
+	return NULL;
+}
+
+/*
+ * rtt_set -- (internal) store a new value in a claimed rtt slot
+ *
+ * Writes sleeping on the slot in rtt_wait() sleep until its value
+ * changes, so every store to a claimed slot has to wake them up, if
+ * there are any.  The barrier orders the store before the check of
+ * rtt_waiters, which rtt_wait() raises before it goes to sleep, so either
+ * the write sees the new value or the read sees the write waiting.
+ */
+static void
+rtt_set(struct btt *bttp, uint32_t volatile *rttp, uint32_t val)
+{
+	*rttp = val;
+	__sync_synchronize();
+
+	if (bttp->rtt_waiters)
+		syscall(SYS_futex, rttp, FUTEX_WAKE_PRIVATE, INT_MAX,
+				NULL, NULL, 0);
+}
+
+/*
+ * rtt_exit -- (internal) release a read tracking table slot, if any
+ */
+static void
+rtt_exit(struct btt *bttp, uint32_t volatile *rttp)
+{
+	if (rttp == NULL)
+		return;
+
+	rtt_set(bttp, rttp, BTT_MAP_ENTRY_ERROR);
+}
+
+/*
+ * rtt_find -- (internal) find the next rtt slot holding entry
+ *
+ * Compares RTT_SCAN_WIDTH slots at a time, starting with the group slot
+ * falls in, and matches both the slots of reads and of mapped blocks.
+ * Returns the first slot found, otherwise a slot number >= nused.
+ */
+static uint32_t
+rtt_find(struct arena *arenap, uint32_t slot, uint32_t nused, uint32_t entry)
+{
+	const __m128i err = _mm_set1_epi32(BTT_MAP_ENTRY_ERROR);
+	const __m128i ent = _mm_set1_epi32((int)entry);
+
+	for (slot &= ~(RTT_SCAN_WIDTH - 1); slot < nused;
+			slot += RTT_SCAN_WIDTH) {
+		__m128i v = _mm_loadu_si128((const void *)&arenap->rtt[slot]);
+		__m128i eq = _mm_cmpeq_epi32(_mm_or_si128(v, err), ent);
+		int mask = _mm_movemask_ps(_mm_castsi128_ps(eq));
+
+		if (mask)
+			return slot + __builtin_ctz(mask);
+	}
+
+	return nused;
+}
+
+/*
+ * rtt_sleep -- (internal) sleep until an rtt slot no longer holds val
+ */
+static void
+rtt_sleep(struct btt *bttp, uint32_t volatile *rttp, uint32_t val)
+{
+	__sync_fetch_and_add(&bttp->rtt_waiters, 1);
+
+	int oerrno = errno;
+	if (syscall(SYS_futex, rttp, FUTEX_WAIT_PRIVATE, val,
+				NULL, NULL, 0) < 0 &&
+			errno != EAGAIN && errno != EINTR)
+		LOG(1, "!futex");
+	errno = oerrno;
+
+	__sync_fetch_and_sub(&bttp->rtt_waiters, 1);
+}
+
+/*
+ * rtt_wait -- (internal) wait for all reads of a free block to finish
+ *
+ * A write must not reuse its free block while reads that started before
+ * the block was freed are still using it.  Those show up in the rtt, and
+ * rtt_nused bounds the slots to look at.  A read is short, so the write
+ * spins on a slot for a while, backing off with pause instructions, and
+ * only then goes to sleep until rtt_set() changes the slot, which is what
+ * happens when the read was preempted.  Reads that start after the scan
+ * passed their slot see the map change and retry, see rtt_pin().
+ */
+static void
+rtt_wait(struct btt *bttp, struct arena *arenap, uint32_t free_entry)
+{
+	uint32_t nused = arenap->rtt_nused;
+	uint32_t slot = 0;
+
+	while ((slot = rtt_find(arenap, slot, nused, free_entry)) < nused) {
+		uint32_t volatile *rttp = &arenap->rtt[slot];
+		uint32_t val;
+		unsigned spins = 1;
+
+		while (((val = *rttp) | BTT_MAP_ENTRY_ERROR) == free_entry) {
+			if (spins <= RTT_SPIN_MAX) {
+				for (unsigned i = 0; i < spins; i++)
+					_mm_pause();
+				spins <<= 1;
+			} else
+				rtt_sleep(bttp, rttp, val);
+		}
+
+		slot++;
+	}
+}
+
+/*
+ * rtt_pin -- (internal) look up the data block of an LBA and pin it
+ *
+ * On success, *offp is the offset of the data block and *rttpp is the rtt
+ * slot that keeps writes from reusing it until released with rtt_exit().
+ * If the LBA reads as zeros, there is no data block and *rttpp is NULL.
  *
  * Returns 0 on success, otherwise -1/errno.
  */
-int
-btt_read(struct btt *bttp, int lane, uint64_t lba, void *buf)
+static int
+rtt_pin(struct btt *bttp, uint64_t lba, int wait,
+		uint32_t volatile **rttpp, off_t *offp)
 {
-	LOG(3, "bttp %p lane %d lba %ju", bttp, lane, lba);
+	int lane = -1;		/* reads have no lane, for the callbacks */
 
-	if (invalid_lba(bttp, lba))
-		return -1;
+	*rttpp = NULL;
 
 	/* if there's no layout written yet, all reads come back as zeros */
 	if (!bttp->laidout)
-		return zero_block(bttp, buf);
+		return 0;
 
 	/* find which arena LBA lives in, and the offset to the map entry */
 	struct arena *arenap;
@@ -1358,6 +1716,7 @@ btt_read(struct btt *bttp, int lane, uint64_t lba, void *buf)
 	 * block read.
 	 */
 	uint32_t entry;
+	uint32_t volatile *rttp = NULL;
 
 	if ((*bttp->ns_cbp->nsread)(bttp->ns, lane, &entry,
 				sizeof (entry), map_entry_off) < 0)
@@ -1371,13 +1730,16 @@ btt_read(struct btt *bttp, int lane, uint64_t lba, void *buf)
 	 */
 	while (1) {
 		if (map_entry_is_error(entry)) {
+			rtt_exit(bttp, rttp);
 			LOG(1, "EIO due to map entry error flag");
 			errno = EIO;
 			return -1;
 		}
 
-		if (map_entry_is_zero_or_initial(entry))
-			return zero_block(bttp, buf);
+		if (map_entry_is_zero_or_initial(entry)) {
+			rtt_exit(bttp, rttp);
+			return 0;
+		}
 
 		/*
 		 * Record the post-map LBA in the read tracking table during
@@ -1388,8 +1750,13 @@ btt_read(struct btt *bttp, int lane, uint64_t lba, void *buf)
 		 * No need to mask off ERROR and ZERO bits since the above
 		 * checks make sure they are clear at this point.
 		 */
-		arenap->rtt[lane] = entry;
-		__sync_synchronize();
+		if (rttp == NULL) {
+			if ((rttp = rtt_enter(bttp, arenap, entry, wait))
+					== NULL)
+				return -1;
+			__sync_synchronize();
+		} else
+			rtt_set(bttp, rttp, entry);
 
 		/*
 		 * In case this thread was preempted between reading entry and
@@ -1402,7 +1769,7 @@ btt_read(struct btt *bttp, int lane, uint64_t lba, void *buf)
 		uint32_t latest_entry;
 		if ((*bttp->ns_cbp->nsread)(bttp->ns, lane, &latest_entry,
 				sizeof (latest_entry), map_entry_off) < 0) {
-			arenap->rtt[lane] = BTT_MAP_ENTRY_ERROR;
+			rtt_exit(bttp, rttp);
 			return -1;
 		}
 
@@ -1415,20 +1782,199 @@ btt_read(struct btt *bttp, int lane, uint64_t lba, void *buf)
 	}
 
 	/*
-	 * It is safe to read the block now, since the rtt protects the
+	 * It is safe to use the block now, since the rtt protects the
 	 * block from getting re-allocated to something else by a write.
 	 */
-	off_t data_block_off =
-		arenap->dataoff + entry * arenap->internal_lbasize;
-	int readret = (*bttp->ns_cbp->nsread)(bttp->ns, lane, buf,
+	*rttpp = rttp;
+	*offp = arenap->dataoff + (off_t)(entry & BTT_MAP_ENTRY_LBA_MASK) *
+		arenap->internal_lbasize;
+
+	return 0;
+}
+
+/*
+ * btt_read -- read a block from a btt namespace
+ *
+ * The read doesn't need a lane, it's tracked in a slot of the rtt
+ * for as long as it uses the data block.
+ *
+ * Returns 0 on success, otherwise -1/errno.
+ */
+int
+btt_read(struct btt *bttp, uint64_t lba, void *buf)
+{
+	LOG(3, "bttp %p lba %ju", bttp, lba);
+
+	if (invalid_lba(bttp, lba))
+		return -1;
+
+	uint32_t volatile *rttp;
+	off_t data_block_off;
+
+	if (rtt_pin(bttp, lba, 1, &rttp, &data_block_off) < 0)
+		return -1;
+
+	if (rttp == NULL)
+		return zero_block(bttp, buf);
+
+	int readret = (*bttp->ns_cbp->nsread)(bttp->ns, -1, buf,
 					bttp->lbasize, data_block_off);
 
 	/* done with read, so clear out rtt entry */
-	arenap->rtt[lane] = BTT_MAP_ENTRY_ERROR;
+	rtt_exit(bttp, rttp);
 
 	return readret;
 }
 
+/*
+ * rtt_npin_max -- (internal) number of rtt slots btt_map_block() may hold
+ *
+ * Reads wait for a free slot for as long as it takes, so mapped blocks
+ * must not take up all of the slots of an arena, or a thread reading
+ * while holding them would wait forever.  A slot is kept for the reads
+ * of each lane, but no more than half of them, so blocks can be mapped
+ * no matter how many lanes there are.
+ */
+static uint32_t
+rtt_npin_max(struct btt *bttp)
+{
+	return bttp->nfree - MIN((uint32_t)bttp->nlane, bttp->nfree / 2);
+}
+
+/*
+ * btt_map_block -- map the data block of an LBA for direct reads
+ *
+ * Instead of copying the block like btt_read() does, this returns the
+ * address of the data block, as provided by the nsmap callback, in *addrp.
+ * The block stays pinned in the rtt, so it isn't reused by writes to the
+ * LBA, until the caller passes its offset to btt_unmap_block().  Writes
+ * that happen to pick the pinned block wait for it, so pins should be
+ * short-lived, and the caller must not write while holding them.  If the
+ * LBA reads as zeros, there is no data block and *addrp is set to NULL.
+ *
+ * Returns 0 on success, otherwise -1/errno.  EBUSY means all the rtt
+ * slots that may be pinned are, see rtt_npin_max().
+ */
+int
+btt_map_block(struct btt *bttp, uint64_t lba, void **addrp)
+{
+	LOG(3, "bttp %p lba %ju", bttp, lba);
+
+	if (invalid_lba(bttp, lba))
+		return -1;
+
+	uint32_t volatile *rttp;
+	off_t data_block_off;
+
+	if (rtt_pin(bttp, lba, 0, &rttp, &data_block_off) < 0)
+		return -1;
+
+	if (rttp == NULL) {
+		*addrp = NULL;
+		return 0;
+	}
+
+	/* the LBA was just looked up, so this can't fail */
+	struct arena *arenap;
+	uint32_t premap_lba;
+	lba_to_arena_lba(bttp, lba, &arenap, &premap_lba);
+
+	if (__sync_add_and_fetch(&arenap->rtt_npinned, 1) >
+			rtt_npin_max(bttp)) {
+		__sync_fetch_and_sub(&arenap->rtt_npinned, 1);
+		rtt_exit(bttp, rttp);
+		LOG(1, "%u rtt slots pinned already", rtt_npin_max(bttp));
+		errno = EBUSY;
+		return -1;
+	}
+
+	ssize_t len = (*bttp->ns_cbp->nsmap)(bttp->ns, -1, addrp,
+			bttp->lbasize, data_block_off);
+
+	if (len < (ssize_t)bttp->lbasize) {
+		if (len >= 0) {
+			LOG(1, "short mapping of the data block at %lld",
+					(long long)data_block_off);
+			errno = EINVAL;
+		}
+		__sync_fetch_and_sub(&arenap->rtt_npinned, 1);
+		rtt_exit(bttp, rttp);
+		return -1;
+	}
+
+	rtt_set(bttp, rttp, RTT_PINNED(*rttp));
+
+	LOG(3, "mapped data block at %lld", (long long)data_block_off);
+	return 0;
+}
+
+/*
+ * btt_unmap_block -- unpin a data block mapped by btt_map_block()
+ *
+ * off is the namespace offset of the mapped address.  Slots pinning the
+ * same block are interchangeable, so any one of them is released.  Only
+ * slots marked with RTT_PINNED() are considered: a read may hold the same
+ * entry while it re-checks the map, and that slot isn't ours to release.
+ *
+ * Since any slot will do, a concurrent unmap of the same block may take
+ * the slot this one would have found and leave only slots the scan has
+ * already passed.  Unmaps are serialized per arena for that reason, so
+ * the pinned slots can't move during the scan.  Mapping blocks and
+ * reading them take no lock.
+ *
+ * Returns 0 on success, otherwise -1/errno.
+ */
+int
+btt_unmap_block(struct btt *bttp, off_t off)
+{
+	LOG(3, "bttp %p off %lld", bttp, (long long)off);
+
+	for (int i = 0; off >= 0 && i < bttp->narena; i++) {
+		struct arena *arenap = &bttp->arenas[i];
+		uint64_t size = (uint64_t)arenap->internal_nlba *
+				arenap->internal_lbasize;
+
+		if ((uint64_t)off < arenap->dataoff ||
+				(uint64_t)off >= arenap->dataoff + size)
+			continue;
+
+		uint64_t data_off = (uint64_t)off - arenap->dataoff;
+		if (data_off % arenap->internal_lbasize)
+			break;
+
+		uint32_t entry = (uint32_t)(data_off /
+				arenap->internal_lbasize);
+		entry = RTT_PINNED(entry | BTT_MAP_ENTRY_NORMAL);
+
+		if ((errno = pthread_mutex_lock(&arenap->unmap_lock))) {
+			LOG(1, "!pthread_mutex_lock");
+			return -1;
+		}
+
+		int found = 0;
+		uint32_t nused = arenap->rtt_nused;
+		for (uint32_t slot = 0; slot < nused; slot++)
+			if (arenap->rtt[slot] == entry) {
+				rtt_exit(bttp, &arenap->rtt[slot]);
+				__sync_fetch_and_sub(&arenap->rtt_npinned, 1);
+				found = 1;
+				break;
+			}
+
+		if ((errno = pthread_mutex_unlock(&arenap->unmap_lock)))
+			LOG(1, "!pthread_mutex_unlock");
+
+		if (found)
+			return 0;
+
+		break;
+	}
+
+	LOG(1, "no mapped data block at %lld", (long long)off);
+	errno = EINVAL;
+	return -1;
+}
+
 /*
  * map_lock -- (internal) grab the map_lock and read a map entry
  */
@@ -1451,7 +1997,8 @@ map_lock(struct btt *bttp, int lane, struct arena *arenap,
 	 */
 	int map_lock_num = premap_lba * BTT_MAP_ENTRY_SIZE / BTT_MAP_LOCK_ALIGN
 		% bttp->nfree;
-	if ((errno = pthread_mutex_lock(&arenap->map_locks[map_lock_num]))) {
+	pthread_mutex_t *lockp = &arenap->map_locks[map_lock_num].lock;
+	if ((errno = pthread_mutex_lock(lockp))) {
 		LOG(1, "!pthread_mutex_lock");
 		return -1;
 	}
@@ -1460,8 +2007,7 @@ map_lock(struct btt *bttp, int lane, struct arena *arenap,
 	if ((*bttp->ns_cbp->nsread)(bttp->ns, lane, entryp,
 				sizeof (uint32_t), map_entry_off) < 0) {
 		int oerrno = errno;
-		if ((errno = pthread_mutex_unlock(
-					&arenap->map_locks[map_lock_num])))
+		if ((errno = pthread_mutex_unlock(lockp)))
 			LOG(1, "!pthread_mutex_unlock");
 		errno = oerrno;
 		return -1;
@@ -1490,8 +2036,9 @@ map_abort(struct btt *bttp, int lane, struct arena *arenap, uint32_t premap_lba)
 
 	int map_lock_num = premap_lba * BTT_MAP_ENTRY_SIZE / BTT_MAP_LOCK_ALIGN
 		% bttp->nfree;
+	pthread_mutex_t *lockp = &arenap->map_locks[map_lock_num].lock;
 	int oerrno = errno;
-	if ((errno = pthread_mutex_unlock(&arenap->map_locks[map_lock_num])))
+	if ((errno = pthread_mutex_unlock(lockp)))
 		LOG(1, "!pthread_mutex_unlock");
 	errno = oerrno;
 }
@@ -1515,8 +2062,9 @@ map_unlock(struct btt *bttp, int lane, struct arena *arenap,
 	int map_lock_num = premap_lba * BTT_MAP_ENTRY_SIZE / BTT_MAP_LOCK_ALIGN
 		% bttp->nfree;
 
+	pthread_mutex_t *lockp = &arenap->map_locks[map_lock_num].lock;
 	int oerrno = errno;
-	if ((errno = pthread_mutex_unlock(&arenap->map_locks[map_lock_num])))
+	if ((errno = pthread_mutex_unlock(lockp)))
 		LOG(1, "!pthread_mutex_unlock");
 	errno = oerrno;
 
@@ -1591,24 +2139,34 @@ btt_write(struct btt *bttp, int lane, uint64_t lba, const void *buf)
 				arenap->flogs[lane].flog.old_map);
 
 	/* wait for other threads to finish any reads on free block */
-	for (int i = 0; i < bttp->nlane; i++)
-		while (arenap->rtt[i] == free_entry)
-			;
+	rtt_wait(bttp, arenap, free_entry);
+
+	/*
+	 * The data block and the first half of the flog entry only have to
+	 * be persistent before the flog entry is made active, in no
+	 * particular order, so they share a persist domain and a single
+	 * drain.  The domain is committed by flog_update().
+	 */
+	pmem_domain_begin();
 
 	/* it is now safe to perform write to the free block */
-	off_t data_block_off = arenap->dataoff + (free_entry &
+	off_t data_block_off = arenap->dataoff + (off_t)(free_entry &
 			BTT_MAP_ENTRY_LBA_MASK) * arenap->internal_lbasize;
 	if ((*bttp->ns_cbp->nswrite)(bttp->ns, lane, buf,
-				bttp->lbasize, data_block_off) < 0)
+				bttp->lbasize, data_block_off) < 0) {
+		pmem_domain_commit();
 		return -1;
+	}
 
 	/*
 	 * Make the new block active atomically by updating the on-media flog
 	 * and then updating the map.
 	 */
 	uint32_t old_entry;
-	if (map_lock(bttp, lane, arenap, &old_entry, premap_lba) < 0)
+	if (map_lock(bttp, lane, arenap, &old_entry, premap_lba) < 0) {
+		pmem_domain_commit();
 		return -1;
+	}
 
 	old_entry = le32toh(old_entry);
 
@@ -1633,6 +2191,288 @@ btt_write(struct btt *bttp, int lane, uint64_t lba, const void *buf)
 	return 0;
 }
 
+/*
+ * A block of a batch written by btt_writev(), while it's written.
+ */
+struct batch_write {
+	struct arena *arenap;
+	uint32_t premap_lba;
+	int map_lock_num;	/* map lock covering the map entry */
+	int locked;		/* this block took the map lock */
+	int lane;		/* lane, whose free block is written */
+	uint32_t free_entry;	/* map entry of that free block */
+	const void *buf;
+	struct btt_flog flog;	/* new flog entry */
+};
+
+/*
+ * batch_write_cmp -- (internal) order blocks by arena and map lock
+ */
+static int
+batch_write_cmp(const void *a, const void *b)
+{
+	const struct batch_write *wa = a;
+	const struct batch_write *wb = b;
+
+	if (wa->arenap != wb->arenap)
+		return wa->arenap < wb->arenap ? -1 : 1;
+
+	return wa->map_lock_num - wb->map_lock_num;
+}
+
+/*
+ * batch_unlock -- (internal) drop the map locks taken for a batch
+ */
+static void
+batch_unlock(struct batch_write *w, int n)
+{
+	int oerrno = errno;
+
+	for (int i = 0; i < n; i++) {
+		struct map_lock *mlp =
+			&w[i].arenap->map_locks[w[i].map_lock_num];
+
+		if (w[i].locked && (errno = pthread_mutex_unlock(&mlp->lock)))
+			LOG(1, "!pthread_mutex_unlock");
+	}
+
+	errno = oerrno;
+}
+
+/*
+ * batch_write -- (internal) write a batch of blocks, one per lane
+ *
+ * This does what btt_write() does for each block, but one step at a time
+ * for all blocks, so each of the three points where the blocks written so
+ * far have to be persistent takes a single drain for the whole batch:
+ * the data blocks and the first half of the flog entries, then the
+ * second half making the flog entries active, and finally the map entries.
+ * A block is written atomically once its flog entry is active, like with
+ * btt_write().  The map locks are taken in the order of the sorted batch
+ * so batches never deadlock on them, and the LBAs in the batch must be
+ * different.
+ *
+ * Returns 0 on success, otherwise -1/errno.
+ */
+static int
+batch_write(struct btt *bttp, struct batch_write *w, int n)
+{
+	LOG(3, "bttp %p n %d", bttp, n);
+
+	qsort(w, n, sizeof (*w), batch_write_cmp);
+
+	/* write the data to the free blocks, see btt_write() */
+	pmem_domain_begin();
+
+	for (int i = 0; i < n; i++) {
+		struct arena *arenap = w[i].arenap;
+		uint32_t free_entry = w[i].free_entry;
+
+		rtt_wait(bttp, arenap, free_entry);
+
+		off_t data_block_off = arenap->dataoff + (off_t)(free_entry &
+			BTT_MAP_ENTRY_LBA_MASK) * arenap->internal_lbasize;
+		if ((*bttp->ns_cbp->nswrite)(bttp->ns, w[i].lane, w[i].buf,
+					bttp->lbasize, data_block_off) < 0) {
+			pmem_domain_commit();
+			return -1;
+		}
+	}
+
+	/* lock the map entries and write the first half of the flog entries */
+	int err = 0;
+	int i;
+	for (i = 0; i < n; i++) {
+		struct arena *arenap = w[i].arenap;
+
+		w[i].locked = i == 0 || arenap != w[i - 1].arenap ||
+				w[i].map_lock_num != w[i - 1].map_lock_num;
+
+		if (w[i].locked && (errno = pthread_mutex_lock(
+				&arenap->map_locks[w[i].map_lock_num].lock))) {
+			LOG(1, "!pthread_mutex_lock");
+			w[i].locked = 0;
+			err = -1;
+			break;
+		}
+
+		uint32_t old_entry;
+		off_t map_entry_off = arenap->mapoff +
+				BTT_MAP_ENTRY_SIZE * w[i].premap_lba;
+		if ((*bttp->ns_cbp->nsread)(bttp->ns, w[i].lane, &old_entry,
+				sizeof (uint32_t), map_entry_off) < 0) {
+			i++;
+			err = -1;
+			break;
+		}
+
+		old_entry = le32toh(old_entry);
+		if (map_entry_is_initial(old_entry))
+			old_entry = w[i].premap_lba | BTT_MAP_ENTRY_NORMAL;
+
+		if (flog_stage(bttp, w[i].lane, arenap, &w[i].flog,
+				w[i].premap_lba, old_entry,
+				w[i].free_entry) < 0) {
+			i++;
+			err = -1;
+			break;
+		}
+	}
+
+	pmem_domain_commit();
+
+	if (err < 0) {
+		batch_unlock(w, i);
+		return -1;
+	}
+
+	/* make the flog entries active */
+	pmem_domain_begin();
+
+	int nactive;
+	for (nactive = 0; nactive < n; nactive++)
+		if (flog_activate(bttp, w[nactive].lane, w[nactive].arenap,
+				&w[nactive].flog) < 0)
+			break;
+
+	pmem_domain_commit();
+
+	int oerrno = errno;
+
+	/*
+	 * And finally update the map.  If activating a flog entry failed,
+	 * the ones before it are active all the same: their lanes now hand
+	 * out the old blocks of those LBAs as free blocks, so their map
+	 * entries must move to the new blocks before the map is unlocked.
+	 */
+	pmem_domain_begin();
+
+	for (i = 0; i < nactive; i++) {
+		uint32_t entry = htole32(w[i].free_entry);
+		off_t map_entry_off = w[i].arenap->mapoff +
+				BTT_MAP_ENTRY_SIZE * w[i].premap_lba;
+
+		if ((*bttp->ns_cbp->nswrite)(bttp->ns, w[i].lane, &entry,
+				sizeof (uint32_t), map_entry_off) < 0)
+			break;
+	}
+
+	pmem_domain_commit();
+
+	batch_unlock(w, n);
+
+	if (i < nactive) {
+		/*
+		 * A critical write error occurred, set the arena's
+		 * info block error bit.
+		 */
+		set_arena_error(bttp, w[i].arenap, w[i].lane);
+		errno = EIO;
+		return -1;
+	}
+
+	if (nactive < n) {
+		errno = oerrno;
+		return -1;
+	}
+
+	return 0;
+}
+
+/*
+ * btt_writev -- write a number of blocks to a btt namespace
+ *
+ * The caller passes nlanes unique lanes, which this routine may use all
+ * at the same time.  The blocks are written in batches of up to nlanes
+ * blocks by batch_write().  A block written to an LBA which appears
+ * earlier in the same batch starts a new batch, so that blocks written
+ * to the same LBA more than once end up with the last data written.
+ *
+ * Returns 0 on success, otherwise -1/errno.  On failure, the blocks
+ * before the failing batch are written, and each block of that batch
+ * was either written or not.
+ */
+int
+btt_writev(struct btt *bttp, const int *lanes, int nlanes,
+		const struct btt_iovec *iov, int iovcnt)
+{
+	LOG(3, "bttp %p nlanes %d iovcnt %d", bttp, nlanes, iovcnt);
+
+	for (int i = 0; i < iovcnt; i++)
+		if (invalid_lba(bttp, iov[i].lba))
+			return -1;
+
+	if (iovcnt == 0)
+		return 0;
+
+	/* first write through here will initialize the metadata layout */
+	if (!bttp->laidout) {
+		int err = 0;
+
+		if ((errno = pthread_mutex_lock(&bttp->layout_write_mutex))) {
+			LOG(1, "!pthread_mutex_lock");
+			return -1;
+		}
+		if (!bttp->laidout)
+			err = write_layout(bttp, lanes[0], 1);
+
+		int oerrno = errno;
+		if ((errno = pthread_mutex_unlock(&bttp->layout_write_mutex)))
+			LOG(1, "!pthread_mutex_unlock");
+		errno = oerrno;
+
+		if (err < 0)
+			return err;
+	}
+
+	struct batch_write w[nlanes];
+
+	for (int i = 0; i < iovcnt; ) {
+		int n;
+
+		for (n = 0; n < nlanes && i < iovcnt; n++, i++) {
+			int dup = 0;
+			for (int j = i - n; j < i; j++)
+				if (iov[j].lba == iov[i].lba)
+					dup = 1;
+			if (dup)
+				break;
+
+			struct arena *arenap;
+			uint32_t premap_lba;
+			if (lba_to_arena_lba(bttp, iov[i].lba,
+					&arenap, &premap_lba) < 0)
+				return -1;
+
+			/* if the arena is in an error state, no writing */
+			if (arenap->flags & BTTINFO_FLAG_ERROR_MASK) {
+				LOG(1, "EIO due to btt_info error flags 0x%x",
+					arenap->flags &
+					BTTINFO_FLAG_ERROR_MASK);
+				errno = EIO;
+				return -1;
+			}
+
+			int lane = lanes[n];
+
+			w[n].arenap = arenap;
+			w[n].premap_lba = premap_lba;
+			w[n].map_lock_num = premap_lba * BTT_MAP_ENTRY_SIZE /
+					BTT_MAP_LOCK_ALIGN % bttp->nfree;
+			w[n].lane = lane;
+			w[n].free_entry = (arenap->flogs[lane].flog.old_map &
+					BTT_MAP_ENTRY_LBA_MASK) |
+					BTT_MAP_ENTRY_NORMAL;
+			w[n].buf = iov[i].buf;
+		}
+
+		if (batch_write(bttp, w, n) < 0)
+			return -1;
+	}
+
+	return 0;
+}
+
 /*
  * map_entry_setf -- (internal) set a given flag on a map entry
  *
@@ -1910,11 +2750,14 @@ btt_fini(struct btt *bttp)
 	if (bttp->arenas) {
 		for (int i = 0; i < bttp->narena; i++) {
 			if (bttp->arenas[i].flogs)
-				Free(bttp->arenas[i].flogs);
-			if (bttp->arenas[i].rtt)
-				Free((void *)bttp->arenas[i].rtt);
-			if (bttp->arenas[i].rtt)
-				Free((void *)bttp->arenas[i].map_locks);
+				runtime_free(bttp->arenas[i].flogs);
+			if (bttp->arenas[i].rtt) {
+				pthread_mutex_destroy(
+					&bttp->arenas[i].unmap_lock);
+				runtime_free((void *)bttp->arenas[i].rtt);
+			}
+			if (bttp->arenas[i].map_locks)
+				runtime_free(bttp->arenas[i].map_locks);
 		}
 		Free(bttp->arenas);
 	}
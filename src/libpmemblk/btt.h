@@ -34,6 +34,12 @@
  * btt.h -- btt module definitions
  */
 
+/* a block to write, for btt_writev() */
+struct btt_iovec {
+	uint64_t lba;
+	const void *buf;
+};
+
 /* callback functions passed to btt_init() */
 struct ns_callback {
 	int (*nsread)(void *ns, int lane,
@@ -52,8 +58,12 @@ struct btt *btt_init(uint64_t rawsize, uint32_t lbasize, uint8_t parent_uuid[],
 		int maxlane, void *ns, const struct ns_callback *ns_cbp);
 int btt_nlane(struct btt *bttp);
 size_t btt_nlba(struct btt *bttp);
-int btt_read(struct btt *bttp, int lane, uint64_t lba, void *buf);
+int btt_read(struct btt *bttp, uint64_t lba, void *buf);
+int btt_map_block(struct btt *bttp, uint64_t lba, void **addrp);
+int btt_unmap_block(struct btt *bttp, off_t off);
 int btt_write(struct btt *bttp, int lane, uint64_t lba, const void *buf);
+int btt_writev(struct btt *bttp, const int *lanes, int nlanes,
+		const struct btt_iovec *iov, int iovcnt);
 int btt_set_zero(struct btt *bttp, int lane, uint64_t lba);
 int btt_set_error(struct btt *bttp, int lane, uint64_t lba);
 int btt_check(struct btt *bttp);
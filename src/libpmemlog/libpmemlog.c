@@ -36,6 +36,8 @@
 
 #include <stdio.h>
 #include <stdint.h>
+#include <stdlib.h>
+#include <pthread.h>
 
 #include "libpmemlog.h"
 
@@ -43,6 +45,8 @@
 #include "out.h"
 #include "log.h"
 
+unsigned long Group_commit_usec;	/* see pmemlog_commit_wait() */
+
 /*
  * log_init -- load-time initialization for log
  *
@@ -57,6 +61,18 @@ libpmemlog_init(void)
 			PMEMLOG_MINOR_VERSION);
 	LOG(3, NULL);
 	util_init();
+
+	char *e = getenv("PMEMLOG_GROUP_COMMIT_USEC");
+	if (e) {
+		char *endp;
+		unsigned long val = strtoul(e, &endp, 10);
+		if (*e == '\0' || *endp != '\0')
+			LOG(1, "invalid PMEMLOG_GROUP_COMMIT_USEC %s", e);
+		else {
+			Group_commit_usec = val;
+			LOG(3, "PMEMLOG_GROUP_COMMIT_USEC set to %lu", val);
+		}
+	}
 }
 
 /*
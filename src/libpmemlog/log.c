@@ -39,6 +39,7 @@
 #include <sys/types.h>
 #include <sys/param.h>
 #include <unistd.h>
+#include <stddef.h>
 #include <errno.h>
 #include <time.h>
 #include <stdint.h>
@@ -52,500 +53,2648 @@
 #include "util.h"
 #include "out.h"
 #include "log.h"
+#include "lz.h"
 
 /*
- * pmemlog_map_common -- (internal) map a log memory pool
- *
- * This routine does all the work, but takes a rdonly flag so internal
- * calls can map a read-only pool if required.
- *
- * If empty flag is set, the file is assumed to be a new memory pool, and
- * a new pool header is created.  Otherwise, a valid header must exist.
+ * log_append_init -- (internal) set up the state of concurrent appends
  */
-static PMEMlogpool *
-pmemlog_map_common(int fd, size_t poolsize, int rdonly, int empty)
+static int
+log_append_init(PMEMlogpool *plp)
 {
-	LOG(3, "fd %d poolsize %zu rdonly %d empty %d",
-			fd, poolsize, rdonly, empty);
+	struct log_append *ap;
 
-	void *addr;
-	if ((addr = util_map(fd, poolsize, rdonly)) == NULL) {
-		(void) close(fd);
-		return NULL;	/* util_map() set errno, called LOG */
+	if ((ap = Malloc(sizeof (*ap))) == NULL) {
+		LOG(1, "!Malloc for the append state");
+		return -1;
 	}
 
-	(void) close(fd);
+	ap->tail = le64toh(plp->write_offset);
+	ap->published = ap->tail;
+	ap->done = NULL;
+	ap->committing = 0;
+	ap->walkers = 0;
+	ap->writers = 0;
+	ap->writing = 0;
+	ap->waiters = 0;
+	ap->seq = 0;
+	ap->lane_locks = NULL;
+	ap->stage = NULL;
+	ap->staged = 0;
+	ap->frame = NULL;
+	ap->logical = 0;
+
+	if ((errno = pthread_mutex_init(&ap->lock, NULL))) {
+		LOG(1, "!pthread_mutex_init");
+		goto err_free;
+	}
 
-	/* check if the mapped region is located in persistent memory */
-	int is_pmem = pmem_is_pmem(addr, poolsize);
+	if ((errno = pthread_cond_init(&ap->cond, NULL))) {
+		LOG(1, "!pthread_cond_init");
+		goto err_mutex;
+	}
 
-	/* opaque info lives at the beginning of mapped memory pool */
-	struct pmemlog *plp = addr;
+	if ((errno = pthread_cond_init(&ap->batch, NULL))) {
+		LOG(1, "!pthread_cond_init");
+		goto err_cond;
+	}
 
-	if (!empty) {
-		struct pool_hdr hdr;
+	if ((errno = pthread_cond_init(&ap->walked, NULL))) {
+		LOG(1, "!pthread_cond_init");
+		goto err_batch;
+	}
 
-		memcpy(&hdr, &plp->hdr, sizeof (hdr));
+	if ((errno = pthread_cond_init(&ap->appended, NULL))) {
+		LOG(1, "!pthread_cond_init");
+		goto err_walked;
+	}
 
-		if (!util_convert_hdr(&hdr)) {
-			errno = EINVAL;
-			goto err;
-		}
+#ifdef DEBUG
+	/* initialize debug lock */
+	if ((errno = pthread_mutex_init(&ap->write_lock, NULL))) {
+		LOG(1, "!pthread_mutex_init");
+		goto err_appended;
+	}
+#endif
 
-		/*
-		 * valid header found
-		 */
-		if (strncmp(hdr.signature, LOG_HDR_SIG, POOL_HDR_SIG_LEN)) {
-			LOG(1, "wrong pool type: \"%s\"", hdr.signature);
-			errno = EINVAL;
-			goto err;
-		}
+	if (plp->lanes != NULL) {
+		uint64_t nlanes = le64toh(plp->nlanes);
 
-		if (hdr.major != LOG_FORMAT_MAJOR) {
-			LOG(1, "log pool version %d (library expects %d)",
-				hdr.major, LOG_FORMAT_MAJOR);
-			errno = EINVAL;
-			goto err;
+		if ((ap->lane_locks = Malloc(nlanes *
+				sizeof (*ap->lane_locks))) == NULL) {
+			LOG(1, "!Malloc for lane locks");
+			goto err_write_lock;
 		}
 
-		uint64_t hdr_start = le64toh(plp->start_offset);
-		uint64_t hdr_end = le64toh(plp->end_offset);
-		uint64_t hdr_write = le64toh(plp->write_offset);
+		for (uint64_t i = 0; i < nlanes; i++)
+			if ((errno = pthread_mutex_init(&ap->lane_locks[i],
+					NULL))) {
+				LOG(1, "!pthread_mutex_init");
+				while (i--)
+					pthread_mutex_destroy(
+						&ap->lane_locks[i]);
+				Free(ap->lane_locks);
+				goto err_write_lock;
+			}
+	}
 
-		if ((hdr_start != roundup(sizeof (*plp),
-					LOG_FORMAT_DATA_ALIGN)) ||
-			(hdr_end != poolsize) || (hdr_start > hdr_end)) {
-			LOG(1, "wrong start/end offsets (start: %ju end: %ju), "
-				"pool size %zu",
-				hdr_start, hdr_end, poolsize);
-			errno = EINVAL;
-			goto err;
+	if (plp->compressed) {
+		if ((ap->stage = Malloc(LOG_FRAME_SIZE)) == NULL ||
+				(ap->frame = Malloc(LOG_FRAME_SIZE)) == NULL) {
+			LOG(1, "!Malloc for the stage");
+			goto err_stage;
 		}
 
-		if ((hdr_write > hdr_end) || (hdr_write < hdr_start)) {
-			LOG(1, "wrong write offset "
-				"(start: %ju end: %ju write: %ju)",
-				hdr_start, hdr_end, hdr_write);
-			errno = EINVAL;
-			goto err;
+		if ((errno = pthread_mutex_init(&ap->stage_lock, NULL))) {
+			LOG(1, "!pthread_mutex_init");
+			goto err_stage;
 		}
+	}
 
-		LOG(3, "start: %ju, end: %ju, write: %ju",
-			hdr_start, hdr_end, hdr_write);
-
-		int retval = util_feature_check(&hdr, LOG_FORMAT_INCOMPAT,
-							LOG_FORMAT_RO_COMPAT,
-							LOG_FORMAT_COMPAT);
-		if (retval < 0)
-		    goto err;
-		else if (retval == 0)
-		    rdonly = 1;
-	} else {
-		LOG(3, "creating new log memory pool");
+	plp->appendp = ap;
+	return 0;
 
-		ASSERTeq(rdonly, 0);
+err_stage:
+	Free(ap->frame);
+	Free(ap->stage);
+	if (ap->lane_locks != NULL) {
+		for (uint64_t i = 0; i < le64toh(plp->nlanes); i++)
+			pthread_mutex_destroy(&ap->lane_locks[i]);
+		Free(ap->lane_locks);
+	}
+err_write_lock:
+#ifdef DEBUG
+	pthread_mutex_destroy(&ap->write_lock);
+err_appended:
+#endif
+	pthread_cond_destroy(&ap->appended);
+err_walked:
+	pthread_cond_destroy(&ap->walked);
+err_batch:
+	pthread_cond_destroy(&ap->batch);
+err_cond:
+	pthread_cond_destroy(&ap->cond);
+err_mutex:
+	pthread_mutex_destroy(&ap->lock);
+err_free:
+	Free(ap);
+	return -1;
+}
 
-		struct pool_hdr *hdrp = &plp->hdr;
+/*
+ * log_append_fini -- (internal) tear down the state of concurrent appends
+ */
+static void
+log_append_fini(PMEMlogpool *plp)
+{
+	struct log_append *ap = plp->appendp;
 
-		/* check if the pool header is all zero */
-		if (!util_is_zeroed(hdrp, sizeof (*hdrp))) {
-			LOG(1, "Non-empty file detected");
-			errno = EINVAL;
-			goto err;
-		}
+	if (ap->stage != NULL) {
+		if ((errno = pthread_mutex_destroy(&ap->stage_lock)))
+			LOG(1, "!pthread_mutex_destroy");
+		Free(ap->frame);
+		Free(ap->stage);
+	}
 
-		/* create required metadata first */
-		plp->start_offset = htole64(roundup(sizeof (*plp),
-						LOG_FORMAT_DATA_ALIGN));
-		plp->end_offset = htole64(poolsize);
-		plp->write_offset = plp->start_offset;
+	if (ap->lane_locks != NULL) {
+		for (uint64_t i = 0; i < le64toh(plp->nlanes); i++)
+			if ((errno = pthread_mutex_destroy(
+					&ap->lane_locks[i])))
+				LOG(1, "!pthread_mutex_destroy");
+		Free(ap->lane_locks);
+	}
 
-		/* store non-volatile part of pool's descriptor */
-		pmem_msync(&plp->start_offset, 3 * sizeof (uint64_t));
+#ifdef DEBUG
+	if ((errno = pthread_mutex_destroy(&ap->write_lock)))
+		LOG(1, "!pthread_mutex_destroy");
+#endif
+	if ((errno = pthread_cond_destroy(&ap->appended)))
+		LOG(1, "!pthread_cond_destroy");
+	if ((errno = pthread_cond_destroy(&ap->walked)))
+		LOG(1, "!pthread_cond_destroy");
+	if ((errno = pthread_cond_destroy(&ap->batch)))
+		LOG(1, "!pthread_cond_destroy");
+	if ((errno = pthread_cond_destroy(&ap->cond)))
+		LOG(1, "!pthread_cond_destroy");
+	if ((errno = pthread_mutex_destroy(&ap->lock)))
+		LOG(1, "!pthread_mutex_destroy");
+	Free(ap);
+}
 
-		/* create pool header */
-		strncpy(hdrp->signature, LOG_HDR_SIG, POOL_HDR_SIG_LEN);
-		hdrp->major = htole32(LOG_FORMAT_MAJOR);
-		hdrp->compat_features = htole32(LOG_FORMAT_COMPAT);
-		hdrp->incompat_features = htole32(LOG_FORMAT_INCOMPAT);
-		hdrp->ro_compat_features = htole32(LOG_FORMAT_RO_COMPAT);
-		uuid_generate(hdrp->uuid);
-		hdrp->crtime = htole64((uint64_t)time(NULL));
-		util_checksum(hdrp, sizeof (*hdrp), &hdrp->checksum, 1);
+/*
+ * pmemlog_set_offset -- (internal) persistently update a descriptor offset
+ */
+static void
+pmemlog_set_offset(PMEMlogpool *plp, uint64_t *offp, uint64_t value)
+{
+	/* unprotect the pool descriptor (debug version only) */
+	RANGE_RW(plp->addr + sizeof (struct pool_hdr), LOG_FORMAT_DATA_ALIGN);
 
-		/* store pool's header */
-		pmem_msync(hdrp, sizeof (*hdrp));
-	}
+	*offp = htole64(value);
+	if (plp->is_pmem)
+		pmem_persist(offp, sizeof (*offp));
+	else
+		pmem_msync(offp, sizeof (*offp));
 
-	/*
-	 * Use some of the memory pool area for run-time info.  This
-	 * run-time state is never loaded from the file, it is always
-	 * created here, so no need to worry about byte-order.
-	 */
-	plp->addr = addr;
-	plp->size = poolsize;
-	plp->rdonly = rdonly;
-	plp->is_pmem = is_pmem;
+	/* set the write-protection again (debug version only) */
+	RANGE_RO(plp->addr + sizeof (struct pool_hdr), LOG_FORMAT_DATA_ALIGN);
+}
 
-	if ((plp->rwlockp = Malloc(sizeof (*plp->rwlockp))) == NULL) {
-		LOG(1, "!Malloc for a RW lock");
-		goto err;
-	}
+/*
+ * log_head_valid -- (internal) true if a linear log has its head_offset set
+ *
+ * A linear log whose head_offset is past its write_offset was being
+ * compacted when the pool was last closed, see pmemlog_trim(), and the
+ * one with a head_offset of zero was never trimmed, like the pools of the
+ * libraries that predate it.  Any other head_offset outside of the data
+ * can't have been stored by a trim either, so it's taken for garbage
+ * rather than failing the open.  In all these cases, the data starts at
+ * the start_offset.
+ */
+static inline int
+log_head_valid(PMEMlogpool *plp)
+{
+	uint64_t head = le64toh(plp->head_offset);
 
-	if ((errno = pthread_rwlock_init(plp->rwlockp, NULL))) {
-		LOG(1, "!pthread_rwlock_init");
-		goto err_free;
-	}
+	return head >= le64toh(plp->start_offset) &&
+		head <= le64toh(plp->write_offset);
+}
 
-	/*
-	 * If possible, turn off all permissions on the pool header page.
-	 *
-	 * The prototype PMFS doesn't allow this when large pages are in
-	 * use. It is not considered an error if this fails.
-	 */
-	util_range_none(addr, sizeof (struct pool_hdr));
+/*
+ * log_head -- (internal) position of the oldest data in a log
+ *
+ * Once a compaction has moved the write_offset, the data is at the start
+ * of the log, whatever the head_offset, see log_compact().
+ */
+static inline uint64_t
+log_head(PMEMlogpool *plp)
+{
+	if (plp->circular)
+		return le64toh(plp->head_offset);
 
-	/* the rest should be kept read-only (debug version only) */
-	RANGE_RO(addr + sizeof (struct pool_hdr),
-			poolsize - sizeof (struct pool_hdr));
+	if (plp->compact_offset != 0 &&
+			plp->compact_offset == plp->write_offset)
+		return le64toh(plp->start_offset);
 
-	LOG(3, "plp %p", plp);
-	return plp;
+	if (log_head_valid(plp))
+		return le64toh(plp->head_offset);
 
-err_free:
-	Free((void *)plp->rwlockp);
-err:
-	LOG(4, "error clean up");
-	int oerrno = errno;
-	util_unmap(addr, poolsize);
-	errno = oerrno;
-	return NULL;
+	return le64toh(plp->start_offset);
 }
 
 /*
- * pmemlog_create -- create a log memory pool
+ * log_compact -- (internal) move the data of a linear log to its start
+ *
+ * The head_offset is persistent before the compact_offset is set, so
+ * the data gets copied to the space already discarded and stays where it
+ * was until the write_offset is moved to the compact_offset.  Each step
+ * can be done again after a crash, by log_trim_recover().
  */
-PMEMlogpool *
-pmemlog_create(const char *path, size_t poolsize, mode_t mode)
+static void
+log_compact(PMEMlogpool *plp)
 {
-	LOG(3, "path %s poolsize %zu mode %d", path, poolsize, mode);
+	uint64_t start = le64toh(plp->start_offset);
+	uint64_t head = le64toh(plp->head_offset);
+	uint64_t write_offset = le64toh(plp->write_offset);
+	uint64_t compact = le64toh(plp->compact_offset);
+
+	if (write_offset != compact) {
+		uint64_t kept = compact - start;
+
+		/* no compaction stores such offsets */
+		if (!log_head_valid(plp) || compact < start ||
+				write_offset - head != kept ||
+				start + kept > head) {
+			LOG(1, "wrong compact offset "
+				"(start: %ju head: %ju write: %ju "
+				"compact: %ju)", start, head, write_offset,
+				compact);
+			pmemlog_set_offset(plp, &plp->compact_offset, 0);
+			return;
+		}
 
-	int fd;
-	if (poolsize != 0) {
-		/* create a new memory pool file */
-		fd = util_pool_create(path, poolsize, PMEMLOG_MIN_POOL, mode);
-	} else {
-		/* open an existing file */
-		fd = util_pool_open(path, &poolsize, PMEMLOG_MIN_POOL);
+		LOG(4, "compacting %ju bytes", kept);
+
+		/* unprotect the space copied to (debug version only) */
+		RANGE_RW(plp->addr + start, kept);
+
+		if (plp->is_pmem)
+			pmem_memcpy_persist(plp->addr + start,
+					plp->addr + head, kept);
+		else {
+			memcpy(plp->addr + start, plp->addr + head, kept);
+			pmem_msync(plp->addr + start, kept);
+		}
+
+		/* protect the space again (debug version only) */
+		RANGE_RO(plp->addr + start, kept);
+
+		pmemlog_set_offset(plp, &plp->write_offset, compact);
 	}
-	if (fd == -1)
-		return NULL;	/* errno set by util_pool_create/open() */
 
-	return pmemlog_map_common(fd, poolsize, 0, 1);
+	pmemlog_set_offset(plp, &plp->head_offset, start);
+	pmemlog_set_offset(plp, &plp->compact_offset, 0);
 }
 
 /*
- * pmemlog_open -- open an existing log memory pool
+ * log_trim_recover -- (internal) recover the head_offset of a linear log
+ *
+ * Called at open time, like log_records_recover(), before an append can
+ * move the write_offset of a linear log past a stale head_offset.  It
+ * finishes a compaction interrupted by a crash, and resets a head_offset
+ * left past the write_offset by an interrupted rewind.
  */
-PMEMlogpool *
-pmemlog_open(const char *path)
+static void
+log_trim_recover(PMEMlogpool *plp)
 {
-	LOG(3, "path %s", path);
+	if (plp->compact_offset != 0) {
+		LOG(3, "finishing compaction of the log");
+		log_compact(plp);
+		return;
+	}
 
-	size_t poolsize = 0;
-	int fd;
+	if (log_head_valid(plp))
+		return;
 
-	if ((fd = util_pool_open(path, &poolsize, PMEMLOG_MIN_POOL)) == -1)
-		return NULL;	/* errno set by util_pool_open() */
+	LOG(3, "head offset %ju reset", le64toh(plp->head_offset));
 
-	return pmemlog_map_common(fd, poolsize, 0, 0);
+	pmemlog_set_offset(plp, &plp->head_offset,
+			le64toh(plp->start_offset));
 }
 
 /*
- * pmemlog_close -- close a log memory pool
+ * In a log of framed records, each append writes a single record: a
+ * struct log_record header holding the size of the payload and the
+ * checksum of both, the payload itself and zeroed padding up to the
+ * record alignment.  Records are appended concurrently, like plain data,
+ * and pmemlog_walk_records() passes pointers to their payloads right in
+ * the pool.  A record at the end of the log that doesn't match its
+ * checksum is a torn append, which is cut off when the pool is opened
+ * (log_records_end()).
  */
-void
-pmemlog_close(PMEMlogpool *plp)
+
+/*
+ * log_record_stride -- (internal) space taken by a record
+ */
+static inline uint64_t
+log_record_stride(PMEMlogpool *plp, uint64_t size)
 {
-	LOG(3, "plp %p", plp);
+	return roundup(sizeof (struct log_record) + size, plp->record_align);
+}
 
-	if ((errno = pthread_rwlock_destroy(plp->rwlockp)))
-		LOG(1, "!pthread_rwlock_destroy");
-	Free((void *)plp->rwlockp);
-	util_unmap(plp->addr, plp->size);
+/*
+ * log_record_valid -- (internal) verify the checksum of a record
+ */
+static int
+log_record_valid(struct log_record *rec, uint64_t size)
+{
+	return util_checksum(rec, sizeof (*rec) + roundup(size, 4),
+			&rec->checksum, 0);
 }
 
 /*
- * pmemlog_nbyte -- return usable size of a log memory pool
+ * log_records_end -- (internal) find the end of the intact records
+ *
+ * Follows the record headers from the head of the log up to the
+ * write_offset and returns the offset past the last intact record.
+ * Only the checksum of the last record is verified, unless all is set.
  */
-size_t
-pmemlog_nbyte(PMEMlogpool *plp)
+static uint64_t
+log_records_end(PMEMlogpool *plp, int all)
 {
-	LOG(3, "plp %p", plp);
+	uint64_t write_offset = le64toh(plp->write_offset);
+	uint64_t offset = log_head(plp);
+
+	while (offset < write_offset) {
+		struct log_record *rec = plp->addr + offset;
+		uint64_t left = write_offset - offset;
+		uint64_t size;
+
+		if (left < sizeof (*rec) ||
+				(size = le64toh(rec->size)) > left ||
+				log_record_stride(plp, size) > left) {
+			LOG(1, "record at %ju runs past the write offset",
+					offset);
+			break;
+		}
 
-	if ((errno = pthread_rwlock_rdlock(plp->rwlockp))) {
-		LOG(1, "!pthread_rwlock_rdlock");
-		return (size_t)-1;
-	}
+		uint64_t next = offset + log_record_stride(plp, size);
 
-	size_t size = le64toh(plp->end_offset) - le64toh(plp->start_offset);
-	LOG(4, "plp %p nbyte %zu", plp, size);
+		if ((all || next == write_offset) &&
+				!log_record_valid(rec, size)) {
+			LOG(1, "bad checksum of record at %ju", offset);
+			break;
+		}
 
-	if ((errno = pthread_rwlock_unlock(plp->rwlockp)))
-		LOG(1, "!pthread_rwlock_unlock");
+		offset = next;
+	}
 
-	return size;
+	return offset;
 }
 
 /*
- * pmemlog_persist -- (internal) persist data, then metadata
+ * log_records_recover -- (internal) cut off a torn record at the end
  *
- * On entry, the write lock should be held.
+ * Called at open time, after the run-time state is set up: updating the
+ * write_offset write protects the pool descriptor (debug version only).
  */
 static void
-pmemlog_persist(PMEMlogpool *plp, uint64_t new_write_offset)
+log_records_recover(PMEMlogpool *plp)
 {
-	uint64_t old_write_offset = le64toh(plp->write_offset);
-	size_t length = new_write_offset - old_write_offset;
+	uint64_t end = log_records_end(plp, 0);
 
-	/* unprotect the log space range (debug version only) */
-	RANGE_RW(plp->addr + old_write_offset, length);
+	if (end == le64toh(plp->write_offset))
+		return;
 
-	/* persist the data */
-	if (plp->is_pmem)
-		pmem_persist(plp->addr + old_write_offset, length);
-	else
-		pmem_msync(plp->addr + old_write_offset, length);
+	LOG(1, "torn record at %ju", end);
 
-	/* protect the log space range (debug version only) */
-	RANGE_RO(plp->addr + old_write_offset, length);
+	/* pmemlog_check() maps the pool read-only to report it */
+	if (plp->rdonly)
+		return;
 
-	/* unprotect the pool descriptor (debug version only) */
-	RANGE_RW(plp->addr + sizeof (struct pool_hdr), LOG_FORMAT_DATA_ALIGN);
+	pmemlog_set_offset(plp, &plp->write_offset, end);
+	plp->appendp->tail = end;
+	plp->appendp->published = end;
+}
 
-	/* write the metadata */
-	plp->write_offset = htole64(new_write_offset);
+/*
+ * A log of lanes splits the log space between a number of lanes, each
+ * with a write_offset of its own, in a cache line of its own, so the
+ * threads appending to different lanes don't contend for anything but a
+ * counter of sequence numbers.  A thread always appends to the same lane
+ * (log_lane_enter()), one entry at a time: a struct log_entry header
+ * with the next sequence number, the size of the payload and the
+ * checksum of both, followed by the payload, like a framed record.
+ * pmemlog_walk_records() merges the lanes by sequence number, so the
+ * entries are walked in the order they were appended in.  A torn entry
+ * at the end of a lane is cut off when the pool is opened.
+ */
 
-	/* persist the metadata */
-	if (plp->is_pmem)
-		pmem_persist(&plp->write_offset, sizeof (plp->write_offset));
-	else
-		pmem_msync(&plp->write_offset, sizeof (plp->write_offset));
+static unsigned Next_lane;	/* lanes handed out to threads so far */
+static __thread unsigned Lane;	/* lane of this thread plus one, 0 if none */
 
-	/* set the write-protection again (debug version only) */
-	RANGE_RO(plp->addr + sizeof (struct pool_hdr), LOG_FORMAT_DATA_ALIGN);
+/*
+ * log_entry_stride -- (internal) space taken by an entry
+ */
+static inline uint64_t
+log_entry_stride(uint64_t size)
+{
+	return roundup(sizeof (struct log_entry) + size, LOG_RECORD_ALIGN);
 }
 
 /*
- * pmemlog_append -- add data to a log memory pool
+ * log_entry_valid -- (internal) verify the checksum of an entry
  */
-int
-pmemlog_append(PMEMlogpool *plp, const void *buf, size_t count)
+static int
+log_entry_valid(struct log_entry *ent, uint64_t size)
 {
-	int ret = 0;
-
-	LOG(3, "plp %p buf %p count %zu", plp, buf, count);
+	return util_checksum(ent, sizeof (*ent) + roundup(size, 4),
+			&ent->checksum, 0);
+}
 
-	if (plp->rdonly) {
+/*
+ * log_lane_set_offset -- (internal) persistently update a lane's write_offset
+ */
+static void
+log_lane_set_offset(PMEMlogpool *plp, struct log_lane *lp, uint64_t value)
+{
+#ifdef DEBUG
+	/* grab debug write lock */
+	if ((errno = pthread_mutex_lock(&plp->appendp->write_lock)))
+		LOG(1, "!pthread_mutex_lock");
+#endif
+
+	/* unprotect the lane descriptor (debug version only) */
+	RANGE_RW(lp, sizeof (*lp));
+
+	lp->write_offset = htole64(value);
+	if (plp->is_pmem)
+		pmem_persist(&lp->write_offset, sizeof (lp->write_offset));
+	else
+		pmem_msync(&lp->write_offset, sizeof (lp->write_offset));
+
+	/* protect the lane descriptor (debug version only) */
+	RANGE_RO(lp, sizeof (*lp));
+
+#ifdef DEBUG
+	/* release debug write lock */
+	if ((errno = pthread_mutex_unlock(&plp->appendp->write_lock)))
+		LOG(1, "!pthread_mutex_unlock");
+#endif
+}
+
+/*
+ * log_lanes_layout -- (internal) lay out the lanes of a new log of lanes
+ *
+ * The lane descriptors take the first pages of the log space and the
+ * lanes split the rest evenly.
+ */
+static int
+log_lanes_layout(PMEMlogpool *plp, uint64_t nlanes)
+{
+	uint64_t start = le64toh(plp->start_offset);
+	uint64_t end = le64toh(plp->end_offset);
+	struct log_lane *lanes = (void *)((char *)plp + start);
+	uint64_t table = roundup(nlanes * sizeof (*lanes),
+			LOG_FORMAT_DATA_ALIGN);
+	uint64_t lane_size = 0;
+
+	if (table < end - start)
+		lane_size = (end - start - table) / nlanes /
+				LOG_FORMAT_DATA_ALIGN * LOG_FORMAT_DATA_ALIGN;
+
+	if (lane_size == 0) {
+		LOG(1, "no space for %ju lanes", nlanes);
+		errno = EINVAL;
+		return -1;
+	}
+
+	for (uint64_t i = 0; i < nlanes; i++) {
+		struct log_lane *lp = &lanes[i];
+		uint64_t offset = start + table + i * lane_size;
+
+		lp->start_offset = htole64(offset);
+		lp->end_offset = htole64(offset + lane_size);
+		lp->write_offset = lp->start_offset;
+		util_checksum(lp, offsetof(struct log_lane, write_offset),
+				&lp->checksum, 1);
+	}
+
+	/* store the lane descriptors */
+	pmem_msync(lanes, nlanes * sizeof (*lanes));
+
+	return 0;
+}
+
+/*
+ * log_lanes_valid -- (internal) validate the lane descriptors
+ */
+static int
+log_lanes_valid(PMEMlogpool *plp, uint64_t nlanes)
+{
+	uint64_t start = le64toh(plp->start_offset);
+	uint64_t end = le64toh(plp->end_offset);
+	struct log_lane *lanes = (void *)((char *)plp + start);
+
+	if (nlanes == 0 || nlanes > (end - start) / sizeof (*lanes)) {
+		LOG(1, "wrong number of lanes %ju", nlanes);
+		return 0;
+	}
+
+	/* the lanes follow the descriptors in order */
+	uint64_t prev = start + roundup(nlanes * sizeof (*lanes),
+			LOG_FORMAT_DATA_ALIGN);
+
+	for (uint64_t i = 0; i < nlanes; i++) {
+		struct log_lane *lp = &lanes[i];
+
+		if (!util_checksum(lp, offsetof(struct log_lane,
+				write_offset), &lp->checksum, 0)) {
+			LOG(1, "bad checksum of lane %ju", i);
+			return 0;
+		}
+
+		uint64_t lane_start = le64toh(lp->start_offset);
+		uint64_t lane_end = le64toh(lp->end_offset);
+		uint64_t lane_write = le64toh(lp->write_offset);
+
+		if ((lane_start < prev) || (lane_start > lane_end) ||
+			(lane_end > end) || (lane_write < lane_start) ||
+			(lane_write > lane_end)) {
+			LOG(1, "wrong offsets of lane %ju (start: %ju "
+				"end: %ju write: %ju)", i, lane_start,
+				lane_end, lane_write);
+			return 0;
+		}
+
+		prev = lane_end;
+	}
+
+	return 1;
+}
+
+/*
+ * log_lane_end -- (internal) find the end of the intact entries of a lane
+ *
+ * Works like log_records_end() and also raises *seqp past the sequence
+ * numbers of the entries found.
+ */
+static uint64_t
+log_lane_end(PMEMlogpool *plp, struct log_lane *lp, int all, uint64_t *seqp)
+{
+	uint64_t write_offset = le64toh(lp->write_offset);
+	uint64_t offset = le64toh(lp->start_offset);
+
+	while (offset < write_offset) {
+		struct log_entry *ent = plp->addr + offset;
+		uint64_t left = write_offset - offset;
+		uint64_t size;
+
+		if (left < sizeof (*ent) ||
+				(size = le64toh(ent->size)) > left ||
+				log_entry_stride(size) > left) {
+			LOG(1, "entry at %ju runs past the write offset",
+					offset);
+			break;
+		}
+
+		uint64_t next = offset + log_entry_stride(size);
+
+		if ((all || next == write_offset) &&
+				!log_entry_valid(ent, size)) {
+			LOG(1, "bad checksum of entry at %ju", offset);
+			break;
+		}
+
+		*seqp = MAX(*seqp, le64toh(ent->seq) + 1);
+		offset = next;
+	}
+
+	return offset;
+}
+
+/*
+ * log_lanes_recover -- (internal) cut off torn entries at the end of lanes
+ *
+ * Also picks up the sequence numbers where they left off.  Called at open
+ * time, after the run-time state is set up.
+ */
+static void
+log_lanes_recover(PMEMlogpool *plp)
+{
+	uint64_t seq = 0;
+
+	for (uint64_t i = 0; i < le64toh(plp->nlanes); i++) {
+		struct log_lane *lp = &plp->lanes[i];
+		uint64_t end = log_lane_end(plp, lp, 0, &seq);
+
+		if (end == le64toh(lp->write_offset))
+			continue;
+
+		LOG(1, "torn entry at %ju", end);
+
+		/* pmemlog_check() maps the pool read-only to report it */
+		if (!plp->rdonly)
+			log_lane_set_offset(plp, lp, end);
+	}
+
+	plp->appendp->seq = seq;
+}
+
+/*
+ * log_lanes_nbyte -- (internal) add up the space of the lanes
+ *
+ * Counts the space up to the write_offset of each lane if used is set,
+ * and up to its end otherwise.
+ */
+static uint64_t
+log_lanes_nbyte(PMEMlogpool *plp, int used)
+{
+	uint64_t nbyte = 0;
+
+	for (uint64_t i = 0; i < le64toh(plp->nlanes); i++) {
+		struct log_lane *lp = &plp->lanes[i];
+
+		nbyte += le64toh(used ? lp->write_offset : lp->end_offset) -
+				le64toh(lp->start_offset);
+	}
+
+	return nbyte;
+}
+
+/*
+ * A compressed log is a log of records, each of them a frame: a struct
+ * log_frame header followed by up to LOG_FRAME_SIZE bytes of data
+ * compressed with lz_compress(), or stored as they are if they don't
+ * compress.  Appends are gathered in a volatile stage, and the stage is
+ * compressed into a frame and appended as a record whenever it fills up
+ * or gets flushed (log_stage_flush()).  An append that fits in a frame
+ * is never split between two.  pmemlog_walk() decompresses the frames
+ * and passes their data on as if it had been appended as it is.
+ */
+
+/*
+ * log_frame_data -- (internal) find the data of a frame
+ *
+ * Returns the data of the frame in a record, decompressed into buf
+ * unless it's stored as it is, and its length in *lenp, or NULL if the
+ * frame is broken.
+ */
+static const void *
+log_frame_data(struct log_record *rec, void *buf, size_t *lenp)
+{
+	struct log_frame *frame = (struct log_frame *)(rec + 1);
+	uint64_t size = le64toh(rec->size);
+	size_t length = le32toh(frame->length);
+
+	if (size < sizeof (*frame) || length > LOG_FRAME_SIZE) {
+		LOG(1, "bad frame of %ju bytes", size);
+		return NULL;
+	}
+
+	size -= sizeof (*frame);
+	*lenp = length;
+
+	if (le32toh(frame->flags) & LOG_FRAME_RAW) {
+		if (size != length) {
+			LOG(1, "raw frame of %ju bytes holds %zu", size,
+					length);
+			return NULL;
+		}
+
+		return frame + 1;
+	}
+
+	if (lz_decompress(frame + 1, size, buf, LOG_FRAME_SIZE) !=
+			(ssize_t)length) {
+		LOG(1, "frame of %ju bytes doesn't decompress to %zu", size,
+				length);
+		return NULL;
+	}
+
+	return buf;
+}
+
+/*
+ * log_frames_length -- (internal) add up the data in a compressed log
+ *
+ * If check is set, each frame is decompressed to verify it holds the data
+ * it claims to.  Returns -1 if a frame is broken.
+ */
+static int
+log_frames_length(PMEMlogpool *plp, int check, uint64_t *lengthp)
+{
+	uint64_t write_offset = le64toh(plp->write_offset);
+	uint64_t offset = le64toh(plp->start_offset);
+	char *buf = NULL;
+	int ret = 0;
+
+	if (check && (buf = Malloc(LOG_FRAME_SIZE)) == NULL) {
+		LOG(1, "!Malloc for a frame");
+		return -1;
+	}
+
+	*lengthp = 0;
+
+	while (offset < write_offset) {
+		struct log_record *rec = plp->addr + offset;
+		struct log_frame *frame = (struct log_frame *)(rec + 1);
+		size_t length;
+
+		if (check) {
+			if (log_frame_data(rec, buf, &length) == NULL) {
+				ret = -1;
+				break;
+			}
+		} else
+			length = le32toh(frame->length);
+
+		*lengthp += length;
+		offset += log_record_stride(plp, le64toh(rec->size));
+	}
+
+	Free(buf);
+
+	return ret;
+}
+
+/*
+ * pmemlog_map_common -- (internal) map a log memory pool
+ *
+ * This routine does all the work, but takes a rdonly flag so internal
+ * calls can map a read-only pool if required.
+ *
+ * If empty flag is set, the file is assumed to be a new memory pool, and
+ * a new pool header is created with the given incompat and ro_compat
+ * features, and nlanes lanes if LOG_FORMAT_INCOMPAT_LANES is one of
+ * them.  Otherwise, a valid header must exist.
+ */
+static PMEMlogpool *
+pmemlog_map_common(int fd, size_t poolsize, int rdonly, int empty,
+		uint32_t incompat, uint32_t ro_compat, unsigned nlanes)
+{
+	LOG(3, "fd %d poolsize %zu rdonly %d empty %d incompat %#x "
+			"ro_compat %#x nlanes %u", fd, poolsize, rdonly, empty,
+			incompat, ro_compat, nlanes);
+
+	void *addr;
+	if ((addr = util_map(fd, poolsize, rdonly)) == NULL) {
+		(void) close(fd);
+		return NULL;	/* util_map() set errno, called LOG */
+	}
+
+	(void) close(fd);
+
+	/* check if the mapped region is located in persistent memory */
+	int is_pmem = pmem_is_pmem(addr, poolsize);
+
+	/* opaque info lives at the beginning of mapped memory pool */
+	struct pmemlog *plp = addr;
+
+	if (!empty) {
+		struct pool_hdr hdr;
+
+		memcpy(&hdr, &plp->hdr, sizeof (hdr));
+
+		if (!util_convert_hdr(&hdr)) {
+			errno = EINVAL;
+			goto err;
+		}
+
+		/*
+		 * valid header found
+		 */
+		if (strncmp(hdr.signature, LOG_HDR_SIG, POOL_HDR_SIG_LEN)) {
+			LOG(1, "wrong pool type: \"%s\"", hdr.signature);
+			errno = EINVAL;
+			goto err;
+		}
+
+		if (hdr.major != LOG_FORMAT_MAJOR) {
+			LOG(1, "log pool version %d (library expects %d)",
+				hdr.major, LOG_FORMAT_MAJOR);
+			errno = EINVAL;
+			goto err;
+		}
+
+		uint64_t hdr_start = le64toh(plp->start_offset);
+		uint64_t hdr_end = le64toh(plp->end_offset);
+		uint64_t hdr_write = le64toh(plp->write_offset);
+		uint64_t hdr_head = le64toh(plp->head_offset);
+
+		if ((hdr_start != roundup(sizeof (*plp),
+					LOG_FORMAT_DATA_ALIGN)) ||
+			(hdr_end != poolsize) || (hdr_start > hdr_end)) {
+			LOG(1, "wrong start/end offsets (start: %ju end: %ju), "
+				"pool size %zu",
+				hdr_start, hdr_end, poolsize);
+			errno = EINVAL;
+			goto err;
+		}
+
+		incompat = hdr.incompat_features;
+		ro_compat = hdr.ro_compat_features;
+
+		if (incompat & LOG_FORMAT_INCOMPAT_CIRCULAR) {
+			/* positions in a circular log only grow */
+			if ((hdr_head < hdr_start) || (hdr_write < hdr_head) ||
+				(hdr_write - hdr_head > hdr_end - hdr_start)) {
+				LOG(1, "wrong head/write offsets "
+					"(start: %ju end: %ju head: %ju "
+					"write: %ju)", hdr_start, hdr_end,
+					hdr_head, hdr_write);
+				errno = EINVAL;
+				goto err;
+			}
+		} else if ((hdr_write > hdr_end) || (hdr_write < hdr_start)) {
+			LOG(1, "wrong write offset "
+				"(start: %ju end: %ju write: %ju)",
+				hdr_start, hdr_end, hdr_write);
+			errno = EINVAL;
+			goto err;
+		}
+
+		if ((incompat & LOG_FORMAT_INCOMPAT_LANES) &&
+				!log_lanes_valid(plp, le64toh(plp->nlanes))) {
+			errno = EINVAL;
+			goto err;
+		}
+
+		if ((incompat & LOG_FORMAT_INCOMPAT_COMPRESSED) &&
+				!(ro_compat & LOG_FORMAT_RO_COMPAT_RECORDS)) {
+			LOG(1, "compressed log without records");
+			errno = EINVAL;
+			goto err;
+		}
+
+		LOG(3, "start: %ju, end: %ju, write: %ju",
+			hdr_start, hdr_end, hdr_write);
+
+		int retval = util_feature_check(&hdr, LOG_FORMAT_INCOMPAT,
+							LOG_FORMAT_RO_COMPAT,
+							LOG_FORMAT_COMPAT);
+		if (retval < 0)
+		    goto err;
+		else if (retval == 0)
+		    rdonly = 1;
+	} else {
+		LOG(3, "creating new log memory pool");
+
+		ASSERTeq(rdonly, 0);
+
+		struct pool_hdr *hdrp = &plp->hdr;
+
+		/* check if the pool header is all zero */
+		if (!util_is_zeroed(hdrp, sizeof (*hdrp))) {
+			LOG(1, "Non-empty file detected");
+			errno = EINVAL;
+			goto err;
+		}
+
+		/* create required metadata first */
+		plp->start_offset = htole64(roundup(sizeof (*plp),
+						LOG_FORMAT_DATA_ALIGN));
+		plp->end_offset = htole64(poolsize);
+		plp->write_offset = plp->start_offset;
+		plp->head_offset = plp->start_offset;
+		plp->nlanes = htole64(nlanes);
+		plp->compact_offset = 0;
+
+		if ((incompat & LOG_FORMAT_INCOMPAT_LANES) &&
+				log_lanes_layout(plp, nlanes) < 0)
+			goto err;	/* errno set, LOG called */
+
+		/* store non-volatile part of pool's descriptor */
+		pmem_msync(&plp->start_offset,
+			(uintptr_t)(&plp->compact_offset + 1) -
+			(uintptr_t)&plp->start_offset);
+
+		/* create pool header */
+		strncpy(hdrp->signature, LOG_HDR_SIG, POOL_HDR_SIG_LEN);
+		hdrp->major = htole32(LOG_FORMAT_MAJOR);
+		hdrp->compat_features = htole32(LOG_FORMAT_COMPAT);
+		/* only the features in use lock out older libraries */
+		hdrp->incompat_features = htole32(incompat);
+		hdrp->ro_compat_features = htole32(ro_compat);
+		uuid_generate(hdrp->uuid);
+		hdrp->crtime = htole64((uint64_t)time(NULL));
+		util_checksum(hdrp, sizeof (*hdrp), &hdrp->checksum, 1);
+
+		/* store pool's header */
+		pmem_msync(hdrp, sizeof (*hdrp));
+	}
+
+	/*
+	 * Use some of the memory pool area for run-time info.  This
+	 * run-time state is never loaded from the file, it is always
+	 * created here, so no need to worry about byte-order.
+	 */
+	plp->addr = addr;
+	plp->size = poolsize;
+	plp->rdonly = rdonly;
+	plp->is_pmem = is_pmem;
+	plp->circular = (incompat & LOG_FORMAT_INCOMPAT_CIRCULAR) != 0;
+	plp->compressed = (incompat & LOG_FORMAT_INCOMPAT_COMPRESSED) != 0;
+	plp->record_align = 0;
+	if (ro_compat & LOG_FORMAT_RO_COMPAT_CACHELINE)
+		plp->record_align = LOG_RECORD_CACHELINE;
+	else if (ro_compat & LOG_FORMAT_RO_COMPAT_RECORDS)
+		plp->record_align = LOG_RECORD_ALIGN;
+	plp->lanes = NULL;
+	if (incompat & LOG_FORMAT_INCOMPAT_LANES)
+		plp->lanes = (void *)((char *)addr +
+				le64toh(plp->start_offset));
+
+	if ((plp->rwlockp = Malloc(sizeof (*plp->rwlockp))) == NULL) {
+		LOG(1, "!Malloc for a RW lock");
+		goto err;
+	}
+
+	if ((errno = pthread_rwlock_init(plp->rwlockp, NULL))) {
+		LOG(1, "!pthread_rwlock_init");
+		goto err_free;
+	}
+
+	if (log_append_init(plp) < 0)
+		goto err_rwlock;
+
+	if (!plp->circular && !rdonly && !empty)
+		log_trim_recover(plp);
+
+	if (plp->record_align && !empty)
+		log_records_recover(plp);
+
+	if (plp->lanes != NULL && !empty)
+		log_lanes_recover(plp);
+
+	/* the frames are checked by pmemlog_check() */
+	if (plp->compressed && !empty)
+		(void) log_frames_length(plp, 0, &plp->appendp->logical);
+
+	/*
+	 * If possible, turn off all permissions on the pool header page.
+	 *
+	 * The prototype PMFS doesn't allow this when large pages are in
+	 * use. It is not considered an error if this fails.
+	 */
+	util_range_none(addr, sizeof (struct pool_hdr));
+
+	/* the rest should be kept read-only (debug version only) */
+	RANGE_RO(addr + sizeof (struct pool_hdr),
+			poolsize - sizeof (struct pool_hdr));
+
+	LOG(3, "plp %p", plp);
+	return plp;
+
+err_rwlock:
+	pthread_rwlock_destroy(plp->rwlockp);
+err_free:
+	Free((void *)plp->rwlockp);
+err:
+	LOG(4, "error clean up");
+	int oerrno = errno;
+	pmem_unmap(addr, poolsize);
+	errno = oerrno;
+	return NULL;
+}
+
+/*
+ * pmemlog_create_common -- (internal) create a log memory pool
+ */
+static PMEMlogpool *
+pmemlog_create_common(const char *path, size_t poolsize, mode_t mode,
+		uint32_t incompat, uint32_t ro_compat, unsigned nlanes)
+{
+	int fd;
+	if (poolsize != 0) {
+		/* create a new memory pool file */
+		fd = util_pool_create(path, poolsize, PMEMLOG_MIN_POOL, mode);
+	} else {
+		/* open an existing file */
+		fd = util_pool_open(path, &poolsize, PMEMLOG_MIN_POOL);
+	}
+	if (fd == -1)
+		return NULL;	/* errno set by util_pool_create/open() */
+
+	return pmemlog_map_common(fd, poolsize, 0, 1, incompat, ro_compat,
+			nlanes);
+}
+
+/*
+ * pmemlog_create -- create a log memory pool
+ */
+PMEMlogpool *
+pmemlog_create(const char *path, size_t poolsize, mode_t mode)
+{
+	LOG(3, "path %s poolsize %zu mode %d", path, poolsize, mode);
+
+	return pmemlog_create_common(path, poolsize, mode, 0, 0, 0);
+}
+
+/*
+ * pmemlog_create_circular -- create a circular log memory pool
+ */
+PMEMlogpool *
+pmemlog_create_circular(const char *path, size_t poolsize, mode_t mode)
+{
+	LOG(3, "path %s poolsize %zu mode %d", path, poolsize, mode);
+
+	return pmemlog_create_common(path, poolsize, mode,
+			LOG_FORMAT_INCOMPAT_CIRCULAR, 0, 0);
+}
+
+/*
+ * pmemlog_create_records -- create a log memory pool of framed records
+ */
+PMEMlogpool *
+pmemlog_create_records(const char *path, size_t poolsize, mode_t mode,
+		int flags)
+{
+	LOG(3, "path %s poolsize %zu mode %d flags %#x", path, poolsize, mode,
+			flags);
+
+	uint32_t ro_compat = LOG_FORMAT_RO_COMPAT_RECORDS;
+
+	if (flags & ~PMEMLOG_RECORD_CACHELINE) {
+		LOG(1, "invalid flags %#x", flags);
+		errno = EINVAL;
+		return NULL;
+	}
+
+	if (flags & PMEMLOG_RECORD_CACHELINE)
+		ro_compat |= LOG_FORMAT_RO_COMPAT_CACHELINE;
+
+	return pmemlog_create_common(path, poolsize, mode, 0, ro_compat, 0);
+}
+
+/*
+ * pmemlog_create_compressed -- create a compressed log memory pool
+ */
+PMEMlogpool *
+pmemlog_create_compressed(const char *path, size_t poolsize, mode_t mode)
+{
+	LOG(3, "path %s poolsize %zu mode %d", path, poolsize, mode);
+
+	return pmemlog_create_common(path, poolsize, mode,
+			LOG_FORMAT_INCOMPAT_COMPRESSED,
+			LOG_FORMAT_RO_COMPAT_RECORDS, 0);
+}
+
+/*
+ * pmemlog_create_lanes -- create a log memory pool of nlanes lanes
+ */
+PMEMlogpool *
+pmemlog_create_lanes(const char *path, size_t poolsize, mode_t mode,
+		unsigned nlanes)
+{
+	LOG(3, "path %s poolsize %zu mode %d nlanes %u", path, poolsize, mode,
+			nlanes);
+
+	if (nlanes == 0) {
+		LOG(1, "no lanes");
+		errno = EINVAL;
+		return NULL;
+	}
+
+	return pmemlog_create_common(path, poolsize, mode,
+			LOG_FORMAT_INCOMPAT_LANES, 0, nlanes);
+}
+
+/*
+ * pmemlog_open -- open an existing log memory pool
+ */
+PMEMlogpool *
+pmemlog_open(const char *path)
+{
+	LOG(3, "path %s", path);
+
+	size_t poolsize = 0;
+	int fd;
+
+	if ((fd = util_pool_open(path, &poolsize, PMEMLOG_MIN_POOL)) == -1)
+		return NULL;	/* errno set by util_pool_open() */
+
+	return pmemlog_map_common(fd, poolsize, 0, 0, 0, 0, 0);
+}
+
+/*
+ * pmemlog_close -- close a log memory pool
+ */
+void
+pmemlog_close(PMEMlogpool *plp)
+{
+	LOG(3, "plp %p", plp);
+
+	/* the staged data would be lost */
+	if (plp->compressed && !plp->rdonly && pmemlog_flush(plp) < 0)
+		LOG(1, "!pmemlog_flush");
+
+	log_append_fini(plp);
+	if ((errno = pthread_rwlock_destroy(plp->rwlockp)))
+		LOG(1, "!pthread_rwlock_destroy");
+	Free((void *)plp->rwlockp);
+	pmem_unmap(plp->addr, plp->size);
+}
+
+/*
+ * pmemlog_nbyte -- return usable size of a log memory pool
+ */
+size_t
+pmemlog_nbyte(PMEMlogpool *plp)
+{
+	LOG(3, "plp %p", plp);
+
+	if ((errno = pthread_rwlock_rdlock(plp->rwlockp))) {
+		LOG(1, "!pthread_rwlock_rdlock");
+		return (size_t)-1;
+	}
+
+	size_t size;
+	if (plp->lanes != NULL)
+		size = log_lanes_nbyte(plp, 0);
+	else
+		size = le64toh(plp->end_offset) - le64toh(plp->start_offset);
+	LOG(4, "plp %p nbyte %zu", plp, size);
+
+	if ((errno = pthread_rwlock_unlock(plp->rwlockp)))
+		LOG(1, "!pthread_rwlock_unlock");
+
+	return size;
+}
+
+/*
+ * log_walk_exclude -- (internal) wait for the walks in progress to finish
+ *
+ * Keeps new walks from starting until log_walk_allow() is called, so it
+ * should be called before taking the write lock: walk callbacks may take
+ * the read lock.  See pmemlog_walk().
+ */
+static void
+log_walk_exclude(PMEMlogpool *plp)
+{
+	struct log_append *ap = plp->appendp;
+
+	if ((errno = pthread_mutex_lock(&ap->lock))) {
+		LOG(1, "!pthread_mutex_lock");
+		return;
+	}
+
+	ap->writers++;
+
+	while (ap->walkers) {
+		if ((errno = pthread_cond_wait(&ap->walked, &ap->lock))) {
+			LOG(1, "!pthread_cond_wait");
+			break;
+		}
+	}
+
+	ap->writing++;
+
+	if ((errno = pthread_mutex_unlock(&ap->lock)))
+		LOG(1, "!pthread_mutex_unlock");
+}
+
+/*
+ * log_walk_allow -- (internal) let walks start again
+ */
+static void
+log_walk_allow(PMEMlogpool *plp)
+{
+	struct log_append *ap = plp->appendp;
+	int oerrno = errno;
+
+	if ((errno = pthread_mutex_lock(&ap->lock))) {
+		LOG(1, "!pthread_mutex_lock");
+		errno = oerrno;
+		return;
+	}
+
+	ap->writing--;
+	ap->writers--;
+
+	/* walks started by walk callbacks only wait for ap->writing */
+	if ((errno = pthread_cond_broadcast(&ap->walked)))
+		LOG(1, "!pthread_cond_broadcast");
+
+	if ((errno = pthread_mutex_unlock(&ap->lock)))
+		LOG(1, "!pthread_mutex_unlock");
+
+	errno = oerrno;
+}
+
+/*
+ * Appends from different threads run concurrently.  Each appender holds
+ * the RW lock for reading, which only keeps pmemlog_rewind() out, and:
+ *
+ *  1. reserves space at the end of the log by moving the volatile tail
+ *     forward with compare-and-swap (pmemlog_reserve()),
+ *  2. copies its data there and makes it persistent,
+ *  3. adds its range to the list of completed ranges and waits for the
+ *     write_offset to cover it (pmemlog_publish()).
+ *
+ * Steps 1 and 3 are short, so appenders mostly copy in parallel.  The
+ * write_offset is updated in group commits: whoever finds the completed
+ * ranges to continue right where the write_offset points becomes the
+ * committer and persists a single write_offset covering all of them.
+ * The appends completing meanwhile make up the next group.  Since
+ * only a contiguous run of completed ranges is ever published, the
+ * write_offset never covers data that isn't persistent yet, just like
+ * when appends were serialized.
+ *
+ * The committer may also wait for the appends still in progress to join
+ * its group, for up to Group_commit_usec microseconds.  This trades
+ * the latency of an append for fewer write_offset updates.
+ */
+
+/*
+ * pmemlog_reserve -- (internal) reserve count bytes at the end of the log
+ *
+ * Returns the offset of the reserved space, or 0 with errno set to ENOSPC
+ * if there's not enough space left.  On entry, the read lock should be held.
+ */
+static uint64_t
+pmemlog_reserve(PMEMlogpool *plp, size_t count)
+{
+	struct log_append *ap = plp->appendp;
+	uint64_t end_offset = le64toh(plp->end_offset);
+	uint64_t tail;
+
+	do {
+		tail = ap->tail;
+
+		/* make sure we don't write past the available space */
+		if (tail >= end_offset || count > end_offset - tail) {
+			errno = ENOSPC;
+			return 0;
+		}
+	} while (!__sync_bool_compare_and_swap(&ap->tail, tail, tail + count));
+
+	LOG(4, "reserved %zu bytes at %ju", count, tail);
+
+	return tail;
+}
+
+/*
+ * pmemlog_persist -- (internal) persist the data in a reserved range
+ *
+ * For data copied in with pmemlog_copy() use pmemlog_copied() instead.
+ */
+static void
+pmemlog_persist(PMEMlogpool *plp, uint64_t offset, size_t length)
+{
+	if (plp->is_pmem)
+		pmem_persist(plp->addr + offset, length);
+	else
+		pmem_msync(plp->addr + offset, length);
+}
+
+/*
+ * log_deadline -- (internal) compute the time usec microseconds from now
+ */
+static void
+log_deadline(struct timespec *deadline, unsigned long usec)
+{
+	clock_gettime(CLOCK_REALTIME, deadline);
+	deadline->tv_sec += usec / 1000000;
+	deadline->tv_nsec += (usec % 1000000) * 1000;
+	if (deadline->tv_nsec >= 1000000000) {
+		deadline->tv_sec++;
+		deadline->tv_nsec -= 1000000000;
+	}
+}
+
+/*
+ * pmemlog_commit_wait -- (internal) let the appends in progress join a commit
+ *
+ * Returns when all the reserved ranges are completed or after
+ * Group_commit_usec microseconds, whichever comes first.  On entry,
+ * ap->lock should be held.
+ */
+static void
+pmemlog_commit_wait(struct log_append *ap)
+{
+	struct timespec deadline;
+
+	log_deadline(&deadline, Group_commit_usec);
+
+	for (;;) {
+		/* find how far the completed ranges reach */
+		uint64_t end = ap->published;
+		struct log_range *r;
+		for (r = ap->done; r != NULL && r->offset == end; r = r->next)
+			end = r->end;
+
+		if (end == ap->tail)
+			break;
+
+		errno = pthread_cond_timedwait(&ap->batch, &ap->lock,
+				&deadline);
+		if (errno == ETIMEDOUT)
+			break;
+		if (errno) {
+			LOG(1, "!pthread_cond_timedwait");
+			break;
+		}
+	}
+}
+
+/*
+ * pmemlog_commit -- (internal) persist write_offset past the completed ranges
+ *
+ * Takes the contiguous run of completed ranges starting at the current
+ * write_offset off the list and persists the write_offset pointing past
+ * them.  On entry, ap->lock should be held and no other commit in progress.
+ */
+static void
+pmemlog_commit(PMEMlogpool *plp)
+{
+	struct log_append *ap = plp->appendp;
+
+	ap->committing = 1;
+
+	if (Group_commit_usec)
+		pmemlog_commit_wait(ap);
+
+	uint64_t new_write_offset = ap->published;
+	while (ap->done != NULL && ap->done->offset == new_write_offset) {
+		new_write_offset = ap->done->end;
+		ap->done = ap->done->next;
+	}
+
+	LOG(4, "committing write offset %ju", new_write_offset);
+
+	/* let the appends completing meanwhile form the next group */
+	if ((errno = pthread_mutex_unlock(&ap->lock)))
+		LOG(1, "!pthread_mutex_unlock");
+
+	/* write and persist the metadata */
+	pmemlog_set_offset(plp, &plp->write_offset, new_write_offset);
+
+	if ((errno = pthread_mutex_lock(&ap->lock)))
+		LOG(1, "!pthread_mutex_lock");
+
+	ap->published = new_write_offset;
+	ap->committing = 0;
+
+	if ((errno = pthread_cond_broadcast(&ap->cond)))
+		LOG(1, "!pthread_cond_broadcast");
+
+	if (ap->waiters && (errno = pthread_cond_broadcast(&ap->appended)))
+		LOG(1, "!pthread_cond_broadcast");
+}
+
+/*
+ * pmemlog_publish -- (internal) make the metadata cover a reserved range
+ *
+ * Returns once a group commit has persisted the write_offset past the range.
+ * On entry, the read lock should be held and the data in the range should
+ * be persistent.
+ */
+static void
+pmemlog_publish(PMEMlogpool *plp, uint64_t offset, size_t length)
+{
+	struct log_append *ap = plp->appendp;
+	struct log_range range;
+	struct log_range **rp;
+
+	/* nothing to cover */
+	if (length == 0)
+		return;
+
+	range.offset = offset;
+	range.end = offset + length;
+
+	if ((errno = pthread_mutex_lock(&ap->lock))) {
+		LOG(1, "!pthread_mutex_lock");
+		return;
+	}
+
+	/* keep the completed ranges sorted by offset */
+	for (rp = &ap->done; *rp != NULL && (*rp)->offset < offset;
+			rp = &(*rp)->next)
+		;
+	range.next = *rp;
+	*rp = &range;
+
+	if (ap->committing && (errno = pthread_cond_signal(&ap->batch)))
+		LOG(1, "!pthread_cond_signal");
+
+	while (ap->published < range.end) {
+		if (!ap->committing && ap->done != NULL &&
+				ap->done->offset == ap->published) {
+			pmemlog_commit(plp);
+		} else if ((errno = pthread_cond_wait(&ap->cond, &ap->lock))) {
+			LOG(1, "!pthread_cond_wait");
+			break;
+		}
+	}
+
+	if ((errno = pthread_mutex_unlock(&ap->lock)))
+		LOG(1, "!pthread_mutex_unlock");
+}
+
+/*
+ * pmemlog_copy -- (internal) copy data into a reserved range
+ */
+static void
+pmemlog_copy(PMEMlogpool *plp, uint64_t offset, const void *buf,
+		size_t count)
+{
+	char *data = plp->addr;
+
+#ifdef DEBUG
+	/* grab debug write lock */
+	if ((errno = pthread_mutex_lock(&plp->appendp->write_lock)))
+		LOG(1, "!pthread_mutex_lock");
+#endif
+
+	/*
+	 * unprotect the log space range,
+	 * where the new data will be stored
+	 * (debug version only)
+	 */
+	RANGE_RW(&data[offset], count);
+
+	/*
+	 * on pmem, copy with the libpmem streaming engines, which leave
+	 * nothing to flush but a drain, see pmemlog_copied()
+	 */
+	if (plp->is_pmem)
+		pmem_memcpy_nodrain(&data[offset], buf, count);
+	else
+		memcpy(&data[offset], buf, count);
+
+	/* protect the log space range (debug version only) */
+	RANGE_RO(&data[offset], count);
+
+#ifdef DEBUG
+	/* release debug write lock */
+	if ((errno = pthread_mutex_unlock(&plp->appendp->write_lock)))
+		LOG(1, "!pthread_mutex_unlock");
+#endif
+}
+
+/*
+ * pmemlog_copyv -- (internal) copy gathered data into a reserved range
+ *
+ * On pmem, runs of iovecs too short for the non-temporal stores are
+ * gathered in a cache line aligned staging buffer first, so they are
+ * streamed to the log together instead of each flushing the same cache
+ * lines again.
+ */
+static void
+pmemlog_copyv(PMEMlogpool *plp, uint64_t offset, const struct iovec *iov,
+		int iovcnt)
+{
+	char stage[LOG_COALESCE_SIZE]
+		__attribute__((aligned(LOG_RECORD_CACHELINE)));
+	size_t staged = 0;
+
+	for (int i = 0; i < iovcnt; ++i) {
+		size_t len = iov[i].iov_len;
+
+		if (!plp->is_pmem || len >= LOG_COALESCE_MIN) {
+			if (staged) {
+				pmemlog_copy(plp, offset - staged, stage,
+						staged);
+				staged = 0;
+			}
+			pmemlog_copy(plp, offset, iov[i].iov_base, len);
+		} else {
+			if (staged + len > sizeof (stage)) {
+				pmemlog_copy(plp, offset - staged, stage,
+						staged);
+				staged = 0;
+			}
+			memcpy(stage + staged, iov[i].iov_base, len);
+			staged += len;
+		}
+
+		offset += len;
+	}
+
+	if (staged)
+		pmemlog_copy(plp, offset - staged, stage, staged);
+}
+
+/*
+ * pmemlog_copied -- (internal) persist the data copied into a reserved range
+ */
+static void
+pmemlog_copied(PMEMlogpool *plp, uint64_t offset, size_t length)
+{
+	/* pmemlog_copy() already flushed it from the CPU caches */
+	if (plp->is_pmem)
+		pmem_drain();
+	else
+		pmem_msync(plp->addr + offset, length);
+}
+
+/*
+ * A circular log keeps the oldest data at head_offset and appends at
+ * write_offset, like a linear one.  Both are positions that only grow:
+ * the data at a position lives at
+ *
+ *	start_offset + (position - start_offset) % (end_offset - start_offset)
+ *
+ * so the log is empty when they are equal and full when they are the
+ * size of the log space apart.  An append that doesn't fit first moves
+ * the head forward past the data it's about to overwrite and persists
+ * it, then copies and persists the data, then the write_offset.  A crash
+ * in between loses some of the oldest data, but never leaves the log
+ * pointing at overwritten data.
+ *
+ * Appends to a circular log overwrite data that walkers may be reading,
+ * so they hold the RW lock for writing, are serialized and wait for the
+ * walks in progress to finish.
+ */
+
+/*
+ * log_circular_offset -- (internal) offset of a position in a circular log
+ */
+static inline uint64_t
+log_circular_offset(PMEMlogpool *plp, uint64_t pos)
+{
+	uint64_t start = le64toh(plp->start_offset);
+	uint64_t end = le64toh(plp->end_offset);
+
+	return start + (pos - start) % (end - start);
+}
+
+/*
+ * log_circular_len -- (internal) length of the data stored contiguously
+ *
+ * Returns how many of the count bytes at position pos precede the end of
+ * the log space.
+ */
+static inline size_t
+log_circular_len(PMEMlogpool *plp, uint64_t pos, size_t count)
+{
+	uint64_t left = le64toh(plp->end_offset) -
+			log_circular_offset(plp, pos);
+
+	return MIN(count, left);
+}
+
+/*
+ * log_appended -- (internal) publish the write_offset of a circular log
+ *
+ * Appends to a circular log are serialized and don't go through
+ * pmemlog_commit(), so this does its part for pmemlog_wait().
+ */
+static void
+log_appended(PMEMlogpool *plp, uint64_t write_offset)
+{
+	struct log_append *ap = plp->appendp;
+
+	if ((errno = pthread_mutex_lock(&ap->lock))) {
+		LOG(1, "!pthread_mutex_lock");
+		return;
+	}
+
+	ap->tail = write_offset;
+	ap->published = write_offset;
+
+	if (ap->waiters && (errno = pthread_cond_broadcast(&ap->appended)))
+		LOG(1, "!pthread_cond_broadcast");
+
+	if ((errno = pthread_mutex_unlock(&ap->lock)))
+		LOG(1, "!pthread_mutex_unlock");
+}
+
+/*
+ * pmemlog_append_circular -- (internal) add gathered data to a circular log
+ */
+static int
+pmemlog_append_circular(PMEMlogpool *plp, const struct iovec *iov,
+		int iovcnt)
+{
+	int ret = 0;
+	int oerrno;
+	int i;
+
+	/* the data about to be overwritten may be getting walked */
+	log_walk_exclude(plp);
+
+	if ((errno = pthread_rwlock_wrlock(plp->rwlockp))) {
+		LOG(1, "!pthread_rwlock_wrlock");
+		log_walk_allow(plp);
+		return -1;
+	}
+
+	/* calculate required space */
+	size_t count = 0;
+	for (i = 0; i < iovcnt; ++i)
+		count += iov[i].iov_len;
+
+	uint64_t size = le64toh(plp->end_offset) - le64toh(plp->start_offset);
+	uint64_t head = le64toh(plp->head_offset);
+	uint64_t write_offset = le64toh(plp->write_offset);
+
+	/* the data must fit even if everything else is dropped */
+	if (count > size) {
+		LOG(1, "append of %zu bytes to a log of %ju", count, size);
+		errno = ENOSPC;
+		ret = -1;
+		goto out;
+	}
+
+	/* drop the oldest data before it gets overwritten */
+	if (write_offset + count - head > size) {
+		head = write_offset + count - size;
+		LOG(4, "moving head to %ju", head);
+		pmemlog_set_offset(plp, &plp->head_offset, head);
+	}
+
+	/* append the data, wrapping around at the end of the log space */
+	uint64_t pos = write_offset;
+	for (i = 0; i < iovcnt; ++i) {
+		const char *buf = iov[i].iov_base;
+		size_t left = iov[i].iov_len;
+
+		while (left) {
+			size_t len = log_circular_len(plp, pos, left);
+			pmemlog_copy(plp, log_circular_offset(plp, pos),
+					buf, len);
+			buf += len;
+			left -= len;
+			pos += len;
+		}
+	}
+
+	/* persist the data and the metadata */
+	for (pos = write_offset; pos < write_offset + count; ) {
+		size_t len = log_circular_len(plp, pos,
+				write_offset + count - pos);
+		pmemlog_copied(plp, log_circular_offset(plp, pos), len);
+		pos += len;
+	}
+
+	pmemlog_set_offset(plp, &plp->write_offset, write_offset + count);
+	log_appended(plp, write_offset + count);
+
+out:
+	oerrno = errno;
+	if ((errno = pthread_rwlock_unlock(plp->rwlockp)))
+		LOG(1, "!pthread_rwlock_unlock");
+	errno = oerrno;
+
+	log_walk_allow(plp);
+
+	return ret;
+}
+
+/*
+ * pmemlog_copy_record -- (internal) write a record into a reserved range
+ */
+static void
+pmemlog_copy_record(PMEMlogpool *plp, uint64_t offset,
+		const struct iovec *iov, int iovcnt, size_t size)
+{
+	uint64_t stride = log_record_stride(plp, size);
+	struct log_record *rec = plp->addr + offset;
+	char *payload = (char *)(rec + 1);
+
+#ifdef DEBUG
+	/* grab debug write lock */
+	if ((errno = pthread_mutex_lock(&plp->appendp->write_lock)))
+		LOG(1, "!pthread_mutex_lock");
+#endif
+
+	/* unprotect the record (debug version only) */
+	RANGE_RW(rec, stride);
+
+	rec->size = htole64(size);
+	for (int i = 0; i < iovcnt; ++i) {
+		memcpy(payload, iov[i].iov_base, iov[i].iov_len);
+		payload += iov[i].iov_len;
+	}
+
+	/* the padding is checksummed, so it can't be left over data */
+	memset(payload, 0, (char *)rec + stride - payload);
+
+	util_checksum(rec, sizeof (*rec) + roundup(size, 4),
+			&rec->checksum, 1);
+
+	/* protect the record (debug version only) */
+	RANGE_RO(rec, stride);
+
+#ifdef DEBUG
+	/* release debug write lock */
+	if ((errno = pthread_mutex_unlock(&plp->appendp->write_lock)))
+		LOG(1, "!pthread_mutex_unlock");
+#endif
+}
+
+/*
+ * pmemlog_append_record -- (internal) add a record of gathered data
+ */
+static int
+pmemlog_append_record(PMEMlogpool *plp, const struct iovec *iov,
+		int iovcnt)
+{
+	int ret = 0;
+
+	if ((errno = pthread_rwlock_rdlock(plp->rwlockp))) {
+		LOG(1, "!pthread_rwlock_rdlock");
+		return -1;
+	}
+
+	size_t size = 0;
+	for (int i = 0; i < iovcnt; ++i)
+		size += iov[i].iov_len;
+
+	uint64_t stride = log_record_stride(plp, size);
+	uint64_t offset = pmemlog_reserve(plp, stride);
+
+	if (offset == 0) {
+		/* no space left */
+		ret = -1;
+	} else {
+		pmemlog_copy_record(plp, offset, iov, iovcnt, size);
+
+		/* persist the record and the metadata */
+		pmemlog_persist(plp, offset, stride);
+		pmemlog_publish(plp, offset, stride);
+	}
+
+	int oerrno = errno;
+	if ((errno = pthread_rwlock_unlock(plp->rwlockp)))
+		LOG(1, "!pthread_rwlock_unlock");
+	errno = oerrno;
+
+	return ret;
+}
+
+/*
+ * log_lane_enter -- (internal) acquire the lane of the calling thread
+ *
+ * Threads are handed out lane numbers in turn the first time they append
+ * to a log of lanes and keep them, so as long as there are no more
+ * appending threads than lanes, each has a lane to itself.
+ */
+static int
+log_lane_enter(PMEMlogpool *plp)
+{
+	if (Lane == 0)
+		Lane = __sync_add_and_fetch(&Next_lane, 1);
+
+	int mylane = (Lane - 1) % le64toh(plp->nlanes);
+
+	/* lane selected, grab the per-lane lock */
+	if ((errno = pthread_mutex_lock(&plp->appendp->lane_locks[mylane]))) {
+		LOG(1, "!pthread_mutex_lock");
+		return -1;
+	}
+
+	return mylane;
+}
+
+/*
+ * log_lane_exit -- (internal) drop lane lock
+ */
+static void
+log_lane_exit(PMEMlogpool *plp, int mylane)
+{
+	if ((errno = pthread_mutex_unlock(&plp->appendp->lane_locks[mylane])))
+		LOG(1, "!pthread_mutex_unlock");
+}
+
+/*
+ * pmemlog_copy_entry -- (internal) write an entry at the end of a lane
+ */
+static void
+pmemlog_copy_entry(PMEMlogpool *plp, uint64_t offset, uint64_t seq,
+		const struct iovec *iov, int iovcnt, size_t size)
+{
+	uint64_t stride = log_entry_stride(size);
+	struct log_entry *ent = plp->addr + offset;
+	char *payload = (char *)(ent + 1);
+
+#ifdef DEBUG
+	/* grab debug write lock */
+	if ((errno = pthread_mutex_lock(&plp->appendp->write_lock)))
+		LOG(1, "!pthread_mutex_lock");
+#endif
+
+	/* unprotect the entry (debug version only) */
+	RANGE_RW(ent, stride);
+
+	ent->seq = htole64(seq);
+	ent->size = htole64(size);
+	for (int i = 0; i < iovcnt; ++i) {
+		memcpy(payload, iov[i].iov_base, iov[i].iov_len);
+		payload += iov[i].iov_len;
+	}
+
+	/* the padding is checksummed, so it can't be left over data */
+	memset(payload, 0, (char *)ent + stride - payload);
+
+	util_checksum(ent, sizeof (*ent) + roundup(size, 4),
+			&ent->checksum, 1);
+
+	/* protect the entry (debug version only) */
+	RANGE_RO(ent, stride);
+
+#ifdef DEBUG
+	/* release debug write lock */
+	if ((errno = pthread_mutex_unlock(&plp->appendp->write_lock)))
+		LOG(1, "!pthread_mutex_unlock");
+#endif
+}
+
+/*
+ * pmemlog_append_lane -- (internal) add an entry of gathered data to a lane
+ */
+static int
+pmemlog_append_lane(PMEMlogpool *plp, const struct iovec *iov, int iovcnt)
+{
+	int ret = 0;
+	int oerrno;
+
+	if ((errno = pthread_rwlock_rdlock(plp->rwlockp))) {
+		LOG(1, "!pthread_rwlock_rdlock");
+		return -1;
+	}
+
+	size_t size = 0;
+	for (int i = 0; i < iovcnt; ++i)
+		size += iov[i].iov_len;
+
+	int lane = log_lane_enter(plp);
+
+	if (lane < 0) {
+		ret = -1;
+		goto out;
+	}
+
+	struct log_lane *lp = &plp->lanes[lane];
+	uint64_t offset = le64toh(lp->write_offset);
+	uint64_t stride = log_entry_stride(size);
+
+	/* make sure we don't write past the space of the lane */
+	if (stride > le64toh(lp->end_offset) - offset) {
+		errno = ENOSPC;
+		ret = -1;
+	} else {
+		uint64_t seq = __sync_fetch_and_add(&plp->appendp->seq, 1);
+
+		pmemlog_copy_entry(plp, offset, seq, iov, iovcnt, size);
+
+		/* persist the entry and the metadata */
+		pmemlog_persist(plp, offset, stride);
+		log_lane_set_offset(plp, lp, offset + stride);
+	}
+
+	log_lane_exit(plp, lane);
+
+out:
+	oerrno = errno;
+	if ((errno = pthread_rwlock_unlock(plp->rwlockp)))
+		LOG(1, "!pthread_rwlock_unlock");
+	errno = oerrno;
+
+	return ret;
+}
+
+/*
+ * log_stage_flush -- (internal) append the staged data as a frame
+ *
+ * On entry, ap->stage_lock should be held.
+ */
+static int
+log_stage_flush(PMEMlogpool *plp)
+{
+	struct log_append *ap = plp->appendp;
+	struct log_frame frame;
+	struct iovec iov[2];
+
+	if (ap->staged == 0)
+		return 0;
+
+	/* only data that gets smaller is worth decompressing */
+	size_t size = lz_compress(ap->stage, ap->staged, ap->frame,
+			ap->staged - 1);
+
+	frame.length = htole32((uint32_t)ap->staged);
+	iov[0].iov_base = &frame;
+	iov[0].iov_len = sizeof (frame);
+
+	if (size) {
+		frame.flags = 0;
+		iov[1].iov_base = ap->frame;
+		iov[1].iov_len = size;
+	} else {
+		frame.flags = htole32(LOG_FRAME_RAW);
+		iov[1].iov_base = ap->stage;
+		iov[1].iov_len = ap->staged;
+	}
+
+	LOG(4, "frame of %zu bytes compressed to %zu", ap->staged, size);
+
+	if (pmemlog_append_record(plp, iov, 2) < 0)
+		return -1;
+
+	ap->staged = 0;
+
+	return 0;
+}
+
+/*
+ * pmemlog_append_compressed -- (internal) stage gathered data for a frame
+ */
+static int
+pmemlog_append_compressed(PMEMlogpool *plp, const struct iovec *iov,
+		int iovcnt)
+{
+	struct log_append *ap = plp->appendp;
+	int ret = 0;
+	int oerrno;
+
+	if ((errno = pthread_mutex_lock(&ap->stage_lock))) {
+		LOG(1, "!pthread_mutex_lock");
+		return -1;
+	}
+
+	size_t count = 0;
+	for (int i = 0; i < iovcnt; ++i)
+		count += iov[i].iov_len;
+
+	/*
+	 * Make sure there's room for every frame this append fills up,
+	 * counting each as stored raw, so none of it gets written unless
+	 * all of it can be.  Only appends to a compressed log reserve space
+	 * and they all hold the stage lock, so the room can't shrink.
+	 */
+	size_t staged = ap->staged;
+	uint64_t need = 0;
+
+	if (count > LOG_FRAME_SIZE - staged) {
+		if (staged)
+			need += log_record_stride(plp,
+					sizeof (struct log_frame) + staged);
+		staged = 0;
+	}
+	need += (staged + count) / LOG_FRAME_SIZE * log_record_stride(plp,
+			sizeof (struct log_frame) + LOG_FRAME_SIZE);
+
+	uint64_t end_offset = le64toh(plp->end_offset);
+	if (ap->tail > end_offset || need > end_offset - ap->tail) {
+		LOG(4, "%zu bytes need up to %ju bytes of frames", count, need);
+		errno = ENOSPC;
+		ret = -1;
+		goto out;
+	}
+
+	/* keep an append that fits in a frame in a single one */
+	if (count > LOG_FRAME_SIZE - ap->staged && log_stage_flush(plp) < 0) {
+		ret = -1;
+		goto out;
+	}
+
+	for (int i = 0; i < iovcnt; ++i) {
+		const char *buf = iov[i].iov_base;
+		size_t left = iov[i].iov_len;
+
+		while (left) {
+			size_t len = MIN(left, LOG_FRAME_SIZE - ap->staged);
+
+			memcpy(ap->stage + ap->staged, buf, len);
+			ap->staged += len;
+			ap->logical += len;
+			buf += len;
+			left -= len;
+
+			if (ap->staged == LOG_FRAME_SIZE &&
+					log_stage_flush(plp) < 0) {
+				ret = -1;
+				goto out;
+			}
+		}
+	}
+
+out:
+	oerrno = errno;
+	if ((errno = pthread_mutex_unlock(&ap->stage_lock)))
+		LOG(1, "!pthread_mutex_unlock");
+	errno = oerrno;
+
+	return ret;
+}
+
+/*
+ * pmemlog_flush -- make the data appended to a log memory pool persistent
+ *
+ * Appends to a compressed log are staged until a frame fills up; this
+ * appends the staged data as a frame right away.  Other appends are
+ * persistent by the time they return, so there's nothing to do for them.
+ */
+int
+pmemlog_flush(PMEMlogpool *plp)
+{
+	LOG(3, "plp %p", plp);
+
+	if (!plp->compressed)
+		return 0;
+
+	if (plp->rdonly) {
+		LOG(1, "can't flush read-only log");
+		errno = EROFS;
+		return -1;
+	}
+
+	struct log_append *ap = plp->appendp;
+
+	if ((errno = pthread_mutex_lock(&ap->stage_lock))) {
+		LOG(1, "!pthread_mutex_lock");
+		return -1;
+	}
+
+	int ret = log_stage_flush(plp);
+
+	int oerrno = errno;
+	if ((errno = pthread_mutex_unlock(&ap->stage_lock)))
+		LOG(1, "!pthread_mutex_unlock");
+	errno = oerrno;
+
+	return ret;
+}
+
+/*
+ * pmemlog_append -- add data to a log memory pool
+ */
+int
+pmemlog_append(PMEMlogpool *plp, const void *buf, size_t count)
+{
+	int ret = 0;
+
+	LOG(3, "plp %p buf %p count %zu", plp, buf, count);
+
+	if (plp->rdonly) {
 		LOG(1, "can't append to read-only log");
 		errno = EROFS;
 		return -1;
 	}
 
-	if ((errno = pthread_rwlock_wrlock(plp->rwlockp))) {
-		LOG(1, "!pthread_rwlock_wrlock");
+	if (plp->lanes != NULL) {
+		struct iovec iov = {
+			.iov_base = (void *)buf,
+			.iov_len = count
+		};
+
+		return pmemlog_append_lane(plp, &iov, 1);
+	}
+
+	if (plp->compressed) {
+		struct iovec iov = {
+			.iov_base = (void *)buf,
+			.iov_len = count
+		};
+
+		return pmemlog_append_compressed(plp, &iov, 1);
+	}
+
+	if (plp->circular) {
+		struct iovec iov = {
+			.iov_base = (void *)buf,
+			.iov_len = count
+		};
+
+		return pmemlog_append_circular(plp, &iov, 1);
+	}
+
+	if (plp->record_align) {
+		struct iovec iov = {
+			.iov_base = (void *)buf,
+			.iov_len = count
+		};
+
+		return pmemlog_append_record(plp, &iov, 1);
+	}
+
+	if ((errno = pthread_rwlock_rdlock(plp->rwlockp))) {
+		LOG(1, "!pthread_rwlock_rdlock");
 		return -1;
 	}
 
-	/* get the current values */
-	uint64_t end_offset = le64toh(plp->end_offset);
-	uint64_t write_offset = le64toh(plp->write_offset);
+	uint64_t offset = pmemlog_reserve(plp, count);
 
-	if (write_offset >= end_offset) {
+	if (offset == 0) {
 		/* no space left */
-		errno = ENOSPC;
 		ret = -1;
 	} else {
-		/* make sure we don't write past the available space */
-		if (count > (end_offset - write_offset)) {
-			errno = ENOSPC;
-			ret = -1;
-		} else {
-			char *data = plp->addr;
+		pmemlog_copy(plp, offset, buf, count);
+
+		/* persist the data and the metadata */
+		pmemlog_copied(plp, offset, count);
+		pmemlog_publish(plp, offset, count);
+	}
+
+	int oerrno = errno;
+	if ((errno = pthread_rwlock_unlock(plp->rwlockp)))
+		LOG(1, "!pthread_rwlock_unlock");
+	errno = oerrno;
+
+	return ret;
+}
+
+/*
+ * pmemlog_appendv -- add gathered data to a log memory pool
+ */
+int
+pmemlog_appendv(PMEMlogpool *plp, const struct iovec *iov, int iovcnt)
+{
+	LOG(3, "plp %p iovec %p iovcnt %d", plp, iov, iovcnt);
+
+	int ret = 0; // success
+	int i;
+
+	ASSERT(iovcnt > 0);
+
+	if (plp->rdonly) {
+		LOG(1, "can't append to read-only log");
+		errno = EROFS;
+		return -1;
+	}
+
+	if (plp->lanes != NULL)
+		return pmemlog_append_lane(plp, iov, iovcnt);
+
+	if (plp->compressed)
+		return pmemlog_append_compressed(plp, iov, iovcnt);
+
+	if (plp->circular)
+		return pmemlog_append_circular(plp, iov, iovcnt);
+
+	if (plp->record_align)
+		return pmemlog_append_record(plp, iov, iovcnt);
+
+	if ((errno = pthread_rwlock_rdlock(plp->rwlockp))) {
+		LOG(1, "!pthread_rwlock_rdlock");
+		return -1;
+	}
+
+	/* calculate required space */
+	size_t count = 0;
+	for (i = 0; i < iovcnt; ++i)
+		count += iov[i].iov_len;
+
+	uint64_t offset = pmemlog_reserve(plp, count);
+
+	if (offset == 0) {
+		/* no space left */
+		ret = -1;
+	} else {
+		/* append the data */
+		pmemlog_copyv(plp, offset, iov, iovcnt);
+
+		/* persist the data and the metadata */
+		pmemlog_copied(plp, offset, count);
+		pmemlog_publish(plp, offset, count);
+	}
+
+	int oerrno = errno;
+	if ((errno = pthread_rwlock_unlock(plp->rwlockp)))
+		LOG(1, "!pthread_rwlock_unlock");
+	errno = oerrno;
+
+	return ret;
+}
+
+/*
+ * pmemlog_tell -- return current write point in a log memory pool
+ *
+ * The write point is a position, as pmemlog_read_from() takes it, so it
+ * doesn't go back when a log is trimmed or wraps around.
+ */
+off_t
+pmemlog_tell(PMEMlogpool *plp)
+{
+	LOG(3, "plp %p", plp);
+
+	/* the data of a compressed log is counted before compression */
+	if (plp->compressed) {
+		struct pmemlog_usage usage;
+
+		if (pmemlog_usage(plp, &usage) < 0)
+			return (off_t)-1;
+
+		return (off_t)usage.logical;
+	}
+
+	if ((errno = pthread_rwlock_rdlock(plp->rwlockp))) {
+		LOG(1, "!pthread_rwlock_rdlock");
+		return (off_t)-1;
+	}
+
+	off_t wp;
+	if (plp->lanes != NULL)
+		wp = log_lanes_nbyte(plp, 1);
+	else
+		wp = le64toh(plp->write_offset) - le64toh(plp->start_offset);
+	LOG(4, "write offset %lld", (long long)wp);
+
+	if ((errno = pthread_rwlock_unlock(plp->rwlockp)))
+		LOG(1, "!pthread_rwlock_unlock");
+
+	return wp;
+}
+
+/*
+ * pmemlog_usage -- report how much data a log memory pool holds
+ *
+ * Tells the data appended to a compressed log before compression from the
+ * space it takes in the pool.
+ */
+int
+pmemlog_usage(PMEMlogpool *plp, struct pmemlog_usage *usage)
+{
+	LOG(3, "plp %p usage %p", plp, usage);
+
+	struct log_append *ap = plp->appendp;
+
+	/* appends to a compressed log take the stage lock first */
+	if (plp->compressed && (errno = pthread_mutex_lock(&ap->stage_lock))) {
+		LOG(1, "!pthread_mutex_lock");
+		return -1;
+	}
+
+	if ((errno = pthread_rwlock_rdlock(plp->rwlockp))) {
+		LOG(1, "!pthread_rwlock_rdlock");
+		if (plp->compressed)
+			pthread_mutex_unlock(&ap->stage_lock);
+		return -1;
+	}
+
+	if (plp->lanes != NULL) {
+		usage->nbyte = log_lanes_nbyte(plp, 0);
+		usage->used = log_lanes_nbyte(plp, 1);
+	} else {
+		usage->nbyte = le64toh(plp->end_offset) -
+				le64toh(plp->start_offset);
+		usage->used = le64toh(plp->write_offset) - log_head(plp);
+	}
+
+	if (plp->compressed) {
+		usage->logical = ap->logical;
+		usage->staged = ap->staged;
+	} else {
+		usage->logical = usage->used;
+		usage->staged = 0;
+	}
+
+	LOG(4, "nbyte %zu used %zu logical %zu staged %zu", usage->nbyte,
+			usage->used, usage->logical, usage->staged);
+
+	if ((errno = pthread_rwlock_unlock(plp->rwlockp)))
+		LOG(1, "!pthread_rwlock_unlock");
+
+	if (plp->compressed && (errno = pthread_mutex_unlock(&ap->stage_lock)))
+		LOG(1, "!pthread_mutex_unlock");
+
+	return 0;
+}
+
+/*
+ * pmemlog_rewind -- discard all data, resetting a log memory pool to empty
+ */
+void
+pmemlog_rewind(PMEMlogpool *plp)
+{
+	LOG(3, "plp %p", plp);
+
+	if (plp->rdonly) {
+		LOG(1, "can't rewind read-only log");
+		errno = EROFS;
+		return;
+	}
 
-			/*
-			 * unprotect the log space range,
-			 * where the new data will be stored
-			 * (debug version only)
-			 */
-			RANGE_RW(&data[write_offset], count);
+	struct log_append *ap = plp->appendp;
 
-			memcpy(&data[write_offset], buf, count);
+	log_walk_exclude(plp);
 
-			/* protect the log space range (debug version only) */
-			RANGE_RO(&data[write_offset], count);
+	/* appends to a compressed log take the stage lock first */
+	if (plp->compressed && (errno = pthread_mutex_lock(&ap->stage_lock))) {
+		LOG(1, "!pthread_mutex_lock");
+		goto out_walk;
+	}
 
-			write_offset += count;
-		}
+	if ((errno = pthread_rwlock_wrlock(plp->rwlockp))) {
+		LOG(1, "!pthread_rwlock_wrlock");
+		goto out;
+	}
+
+	if (plp->lanes != NULL) {
+		/* the sequence numbers just go on */
+		for (uint64_t i = 0; i < le64toh(plp->nlanes); i++)
+			log_lane_set_offset(plp, &plp->lanes[i],
+					le64toh(plp->lanes[i].start_offset));
+	} else if (plp->circular) {
+		/* a single update of the head empties a circular log */
+		pmemlog_set_offset(plp, &plp->head_offset,
+				le64toh(plp->write_offset));
+	} else {
+		/* emptied by the first update, see log_head() */
+		pmemlog_set_offset(plp, &plp->write_offset,
+				le64toh(plp->start_offset));
+		pmemlog_set_offset(plp, &plp->head_offset,
+				le64toh(plp->start_offset));
 	}
 
-	/* persist the data and the metadata only if there was no error */
-	if (ret == 0)
-		pmemlog_persist(plp, write_offset);
+	/* no appends are in progress while the write lock is held */
+	if (!plp->circular) {
+		ap->tail = le64toh(plp->start_offset);
+		ap->published = ap->tail;
+		ap->done = NULL;
+	}
+
+	/* the staged data goes too */
+	ap->staged = 0;
+	ap->logical = 0;
 
-	int oerrno = errno;
 	if ((errno = pthread_rwlock_unlock(plp->rwlockp)))
 		LOG(1, "!pthread_rwlock_unlock");
-	errno = oerrno;
 
-	return ret;
+out:
+	if (plp->compressed && (errno = pthread_mutex_unlock(&ap->stage_lock)))
+		LOG(1, "!pthread_mutex_unlock");
+
+out_walk:
+	log_walk_allow(plp);
 }
 
 /*
- * pmemlog_appendv -- add gathered data to a log memory pool
+ * pmemlog_trim -- discard the data before a position in a log memory pool
+ *
+ * Returns the position the data kept starts at: offset, unless the data
+ * was moved to the beginning of a linear log, in which case it's zero.
  */
-int
-pmemlog_appendv(PMEMlogpool *plp, const struct iovec *iov, int iovcnt)
+off_t
+pmemlog_trim(PMEMlogpool *plp, off_t offset)
 {
-	LOG(3, "plp %p iovec %p iovcnt %d", plp, iov, iovcnt);
-
-	int ret = 0; // success
-	int i;
+	LOG(3, "plp %p offset %lld", plp, (long long)offset);
 
-	ASSERT(iovcnt > 0);
+	if (offset < 0) {
+		LOG(1, "negative offset %lld", (long long)offset);
+		errno = EINVAL;
+		return -1;
+	}
 
 	if (plp->rdonly) {
-		LOG(1, "can't append to read-only log");
+		LOG(1, "can't trim read-only log");
 		errno = EROFS;
 		return -1;
 	}
 
+	if (plp->lanes != NULL || plp->compressed) {
+		LOG(1, "log of lanes or compressed log has no positions");
+		errno = EINVAL;
+		return -1;
+	}
+
+	struct log_append *ap = plp->appendp;
+	int excluded = 0;	/* walks are kept out */
+	int oerrno;
+
+again:
 	if ((errno = pthread_rwlock_wrlock(plp->rwlockp))) {
 		LOG(1, "!pthread_rwlock_wrlock");
+		if (excluded)
+			log_walk_allow(plp);
 		return -1;
 	}
 
-	/* get the current values */
-	uint64_t end_offset = le64toh(plp->end_offset);
+	uint64_t start = le64toh(plp->start_offset);
 	uint64_t write_offset = le64toh(plp->write_offset);
-
-	if (write_offset >= end_offset) {
-		/* no space left */
-		errno = ENOSPC;
+	uint64_t head = log_head(plp);
+	uint64_t pos = start + (uint64_t)offset;
+	off_t ret = offset;
+
+	if (pos > write_offset) {
+		LOG(1, "offset %lld past the end of the log",
+				(long long)offset);
+		errno = EINVAL;
 		ret = -1;
-	} else {
-		char *data = plp->addr;
-		uint64_t count = 0;
-		char *buf;
+		goto out;
+	}
 
-		/* calculate required space */
-		for (i = 0; i < iovcnt; ++i)
-			count += iov[i].iov_len;
+	/* the data is gone already */
+	if (pos <= head)
+		goto out;
 
-		/* check if there is enough free space */
-		if (count > (end_offset - write_offset)) {
-			errno = ENOSPC;
+	/* a log of records can only be trimmed between records */
+	if (plp->record_align) {
+		uint64_t off = head;
+
+		while (off < pos) {
+			struct log_record *rec = plp->addr + off;
+			off += log_record_stride(plp, le64toh(rec->size));
+		}
+
+		if (off != pos) {
+			LOG(1, "offset %lld not at a record",
+					(long long)offset);
+			errno = EINVAL;
 			ret = -1;
-		} else {
-			/* append the data */
-			for (i = 0; i < iovcnt; ++i) {
-				buf = iov[i].iov_base;
-				count = iov[i].iov_len;
-
-				/*
-				 * unprotect the log space range,
-				 * where the new data will be stored
-				 * (debug version only)
-				 */
-				RANGE_RW(&data[write_offset], count);
-
-				memcpy(&data[write_offset], buf, count);
-
-				/*
-				 * protect the log space range
-				 * (debug version only)
-				 */
-				RANGE_RO(&data[write_offset], count);
-
-				write_offset += count;
-			}
+			goto out;
 		}
 	}
 
-	/* persist the data and the metadata only if there was no error */
-	if (ret == 0)
-		pmemlog_persist(plp, write_offset);
+	uint64_t kept = write_offset - pos;
 
-	int oerrno = errno;
+	/* the space gets reused as a circular log wraps around */
+	if (plp->circular || kept > pos - start) {
+		pmemlog_set_offset(plp, &plp->head_offset, pos);
+		goto out;
+	}
+
+	/*
+	 * The data kept is no more than the data discarded, so it can be
+	 * moved to the beginning of a linear log without overwriting any of
+	 * it, once the data before pos is discarded for good.  Walks may be
+	 * reading it, and their callbacks may take the read lock, so they
+	 * are waited for without the write lock and the log checked again.
+	 */
+	if (!excluded) {
+		if ((errno = pthread_rwlock_unlock(plp->rwlockp)))
+			LOG(1, "!pthread_rwlock_unlock");
+		log_walk_exclude(plp);
+		excluded = 1;
+		goto again;
+	}
+
+	pmemlog_set_offset(plp, &plp->head_offset, pos);
+	pmemlog_set_offset(plp, &plp->compact_offset, start + kept);
+	log_compact(plp);
+
+	/* no appends are in progress while the write lock is held */
+	ap->tail = start + kept;
+	ap->published = ap->tail;
+	ap->done = NULL;
+	ret = 0;
+
+out:
+	oerrno = errno;
 	if ((errno = pthread_rwlock_unlock(plp->rwlockp)))
 		LOG(1, "!pthread_rwlock_unlock");
 	errno = oerrno;
 
+	if (excluded)
+		log_walk_allow(plp);
+
 	return ret;
 }
 
 /*
- * pmemlog_tell -- return current write point in a log memory pool
+ * Walks don't hold the RW lock while calling back, so a slow walker
+ * doesn't hold up appends.  A walk registers itself in ap->walkers and
+ * takes the read lock just long enough to take a snapshot of where the
+ * data begins and ends.  Appends to a linear log never touch the data
+ * below the write_offset, so the snapshot stays valid while the walk
+ * goes on unlocked.  The operations that do change such data, rewinds,
+ * compacting trims and appends to circular logs, register themselves in
+ * ap->writers, which keeps new walks out, and wait for the walks in
+ * progress to finish before they take the write lock (log_walk_exclude()),
+ * so walk callbacks can still take the read lock, in pmemlog_tell() for
+ * one.  A walk started by a walk callback only waits for the writers
+ * done waiting, as the others wait for the walk calling back.
  */
-off_t
-pmemlog_tell(PMEMlogpool *plp)
+
+static __thread unsigned Walks;	/* walks in progress in this thread */
+
+/*
+ * log_walk_end -- (internal) let the data walked be changed again
+ */
+static void
+log_walk_end(PMEMlogpool *plp)
 {
-	LOG(3, "plp %p", plp);
+	struct log_append *ap = plp->appendp;
+
+	Walks--;
+
+	if ((errno = pthread_mutex_lock(&ap->lock)))
+		LOG(1, "!pthread_mutex_lock");
+
+	if (--ap->walkers == 0 &&
+			(errno = pthread_cond_broadcast(&ap->walked)))
+		LOG(1, "!pthread_cond_broadcast");
+
+	if ((errno = pthread_mutex_unlock(&ap->lock)))
+		LOG(1, "!pthread_mutex_unlock");
+}
+
+/*
+ * log_walk_begin -- (internal) take a snapshot of the data to walk
+ */
+static int
+log_walk_begin(PMEMlogpool *plp, uint64_t *headp, uint64_t *write_offsetp)
+{
+	struct log_append *ap = plp->appendp;
+
+	if ((errno = pthread_mutex_lock(&ap->lock))) {
+		LOG(1, "!pthread_mutex_lock");
+		return -1;
+	}
+
+	while (ap->writing || (ap->writers && Walks == 0)) {
+		if ((errno = pthread_cond_wait(&ap->walked, &ap->lock))) {
+			LOG(1, "!pthread_cond_wait");
+			break;
+		}
+	}
+
+	ap->walkers++;
+	Walks++;
+
+	if ((errno = pthread_mutex_unlock(&ap->lock)))
+		LOG(1, "!pthread_mutex_unlock");
 
 	if ((errno = pthread_rwlock_rdlock(plp->rwlockp))) {
 		LOG(1, "!pthread_rwlock_rdlock");
-		return (off_t)-1;
+		int oerrno = errno;
+		log_walk_end(plp);
+		errno = oerrno;
+		return -1;
 	}
 
-	off_t wp = le64toh(plp->write_offset) - le64toh(plp->start_offset);
-	LOG(4, "write offset %lld", (long long)wp);
+	*headp = log_head(plp);
+	*write_offsetp = le64toh(plp->write_offset);
 
 	if ((errno = pthread_rwlock_unlock(plp->rwlockp)))
 		LOG(1, "!pthread_rwlock_unlock");
 
-	return wp;
+	return 0;
 }
 
 /*
- * pmemlog_rewind -- discard all data, resetting a log memory pool to empty
+ * log_walk_frames -- (internal) walk through the data of a compressed log
+ *
+ * Decompresses one frame at a time.  The chunks spanning frames are put
+ * together in a buffer of their own.
  */
-void
-pmemlog_rewind(PMEMlogpool *plp)
+static void
+log_walk_frames(PMEMlogpool *plp, size_t chunksize,
+	int (*process_chunk)(const void *buf, size_t len, void *arg), void *arg)
 {
-	LOG(3, "plp %p", plp);
-
-	if (plp->rdonly) {
-		LOG(1, "can't rewind read-only log");
-		errno = EROFS;
+	char *buf;
+	char *chunk = NULL;
+	size_t filled = 0;
+	uint64_t write_offset;
+	uint64_t offset;
+
+	if ((buf = Malloc(LOG_FRAME_SIZE)) == NULL) {
+		LOG(1, "!Malloc for a frame");
 		return;
 	}
 
-	if ((errno = pthread_rwlock_wrlock(plp->rwlockp))) {
-		LOG(1, "!pthread_rwlock_wrlock");
+	if (chunksize && (chunk = Malloc(chunksize)) == NULL) {
+		LOG(1, "!Malloc for a chunk");
+		Free(buf);
 		return;
 	}
 
-	/* unprotect the pool descriptor (debug version only) */
-	RANGE_RW(plp->addr + sizeof (struct pool_hdr), LOG_FORMAT_DATA_ALIGN);
+	if (log_walk_begin(plp, &offset, &write_offset) < 0)
+		goto out;
 
-	plp->write_offset = plp->start_offset;
-	if (plp->is_pmem)
-		pmem_persist(&plp->write_offset, sizeof (uint64_t));
-	else
-		pmem_msync(&plp->write_offset, sizeof (uint64_t));
+	while (offset < write_offset) {
+		struct log_record *rec = plp->addr + offset;
+		const char *data;
+		size_t len;
 
-	/* set the write-protection again (debug version only) */
-	RANGE_RO(plp->addr + sizeof (struct pool_hdr), LOG_FORMAT_DATA_ALIGN);
+		if ((data = log_frame_data(rec, buf, &len)) == NULL)
+			break;
 
-	if ((errno = pthread_rwlock_unlock(plp->rwlockp)))
-		LOG(1, "!pthread_rwlock_unlock");
+		offset += log_record_stride(plp, le64toh(rec->size));
+
+		if (chunksize == 0) {
+			if (!(*process_chunk)(data, len, arg))
+				goto end;
+			continue;
+		}
+
+		while (len) {
+			/* whole chunks within the frame need no copying */
+			if (filled == 0 && len >= chunksize) {
+				if (!(*process_chunk)(data, chunksize, arg))
+					goto end;
+				data += chunksize;
+				len -= chunksize;
+				continue;
+			}
+
+			size_t n = MIN(len, chunksize - filled);
+
+			memcpy(chunk + filled, data, n);
+			filled += n;
+			data += n;
+			len -= n;
+
+			if (filled == chunksize) {
+				filled = 0;
+				if (!(*process_chunk)(chunk, chunksize, arg))
+					goto end;
+			}
+		}
+	}
+
+	/* the last chunk may be short */
+	if (filled)
+		(*process_chunk)(chunk, filled, arg);
+
+end:
+	log_walk_end(plp);
+out:
+	Free(chunk);
+	Free(buf);
 }
 
 /*
  * pmemlog_walk -- walk through all data in a log memory pool
  *
  * chunksize of 0 means process_chunk gets called once for all data
- * as a single chunk.
+ * as a single chunk.  The data of a circular log is walked from the oldest
+ * to the newest, and the chunk that would cross the end of the log space
+ * is cut short there, so with chunksize of 0 process_chunk gets called
+ * once more for the data that wrapped around.
  */
 void
 pmemlog_walk(PMEMlogpool *plp, size_t chunksize,
@@ -558,21 +2707,40 @@ pmemlog_walk(PMEMlogpool *plp, size_t chunksize,
 	 * in place. We prevent everyone from changing the data behind our back
 	 * until we are done with processing it.
 	 */
-	if ((errno = pthread_rwlock_rdlock(plp->rwlockp))) {
-		LOG(1, "!pthread_rwlock_rdlock");
+	char *data = plp->addr;
+	uint64_t write_offset;
+	uint64_t data_offset;
+	size_t len;
+
+	if (plp->lanes != NULL) {
+		LOG(1, "log of lanes can only be walked by records");
+		errno = EINVAL;
 		return;
 	}
 
-	char *data = plp->addr;
-	uint64_t write_offset = le64toh(plp->write_offset);
-	uint64_t data_offset = le64toh(plp->start_offset);
-	size_t len;
+	if (plp->compressed) {
+		/* walk the staged data too */
+		if (!plp->rdonly && pmemlog_flush(plp) < 0)
+			LOG(1, "!pmemlog_flush");
+
+		log_walk_frames(plp, chunksize, process_chunk, arg);
+		return;
+	}
+
+	if (log_walk_begin(plp, &data_offset, &write_offset) < 0)
+		return;
 
 	if (chunksize == 0) {
 		/* most common case: process everything at once */
-		len = write_offset - data_offset;
-		LOG(3, "length %zu", len);
-		(*process_chunk)(&data[data_offset], len, arg);
+		do {
+			len = log_circular_len(plp, data_offset,
+					write_offset - data_offset);
+			LOG(3, "length %zu", len);
+			if (!(*process_chunk)(&data[log_circular_offset(plp,
+					data_offset)], len, arg))
+				break;
+			data_offset += len;
+		} while (data_offset < write_offset);
 	} else {
 		/*
 		 * Walk through the complete record, chunk by chunk.
@@ -580,14 +2748,265 @@ pmemlog_walk(PMEMlogpool *plp, size_t chunksize,
 		 */
 		while (data_offset < write_offset) {
 			len = MIN(chunksize, write_offset - data_offset);
-			if (!(*process_chunk)(&data[data_offset], len, arg))
+			len = log_circular_len(plp, data_offset, len);
+			if (!(*process_chunk)(&data[log_circular_offset(plp,
+					data_offset)], len, arg))
 				break;
-			data_offset += chunksize;
+			data_offset += len;
 		}
 	}
 
-	if ((errno = pthread_rwlock_unlock(plp->rwlockp)))
-		LOG(1, "!pthread_rwlock_unlock");
+	log_walk_end(plp);
+}
+
+/*
+ * log_walk_lanes -- (internal) walk through the entries of all the lanes
+ *
+ * Merges the lanes by sequence number: the next entry walked is the one
+ * with the lowest sequence number among the next entries of the lanes.
+ * Looking at each lane for it is cheap for the number of lanes that makes
+ * sense, about one per appending thread.
+ */
+static int
+log_walk_lanes(PMEMlogpool *plp,
+	int (*process_record)(const void *buf, size_t len, void *arg),
+	void *arg)
+{
+	uint64_t nlanes = le64toh(plp->nlanes);
+	struct log_range *ranges;
+	uint64_t write_offset;
+	uint64_t head;
+
+	if ((ranges = Malloc(nlanes * sizeof (*ranges))) == NULL) {
+		LOG(1, "!Malloc for lane ranges");
+		return -1;
+	}
+
+	if (log_walk_begin(plp, &head, &write_offset) < 0) {
+		Free(ranges);
+		return -1;
+	}
+
+	/* appends only add entries past the write_offsets seen here */
+	for (uint64_t i = 0; i < nlanes; i++) {
+		ranges[i].offset = le64toh(plp->lanes[i].start_offset);
+		ranges[i].end = le64toh(plp->lanes[i].write_offset);
+	}
+
+	for (;;) {
+		struct log_range *next = NULL;
+		uint64_t seq = 0;
+
+		for (uint64_t i = 0; i < nlanes; i++) {
+			if (ranges[i].offset == ranges[i].end)
+				continue;
+
+			struct log_entry *ent = plp->addr + ranges[i].offset;
+
+			if (next == NULL || le64toh(ent->seq) < seq) {
+				next = &ranges[i];
+				seq = le64toh(ent->seq);
+			}
+		}
+
+		/* all the lanes walked */
+		if (next == NULL)
+			break;
+
+		struct log_entry *ent = plp->addr + next->offset;
+		uint64_t size = le64toh(ent->size);
+
+		next->offset += log_entry_stride(size);
+
+		if (!(*process_record)(ent + 1, size, arg))
+			break;
+	}
+
+	log_walk_end(plp);
+	Free(ranges);
+
+	return 0;
+}
+
+/*
+ * pmemlog_walk_records -- walk through all records in a log memory pool
+ *
+ * The payloads are passed to process_record where they are in the pool,
+ * without copying.  The entries of a log of lanes are walked in the order
+ * they were appended in.
+ */
+int
+pmemlog_walk_records(PMEMlogpool *plp,
+	int (*process_record)(const void *buf, size_t len, void *arg),
+	void *arg)
+{
+	LOG(3, "plp %p", plp);
+
+	if (plp->lanes != NULL)
+		return log_walk_lanes(plp, process_record, arg);
+
+	if (plp->compressed) {
+		LOG(1, "compressed log can only be walked by chunks");
+		errno = EINVAL;
+		return -1;
+	}
+
+	if (!plp->record_align) {
+		LOG(1, "log doesn't hold framed records");
+		errno = EINVAL;
+		return -1;
+	}
+
+	uint64_t write_offset;
+	uint64_t offset;
+
+	/* appends only add records past the write_offset of the snapshot */
+	if (log_walk_begin(plp, &offset, &write_offset) < 0)
+		return -1;
+
+	while (offset < write_offset) {
+		struct log_record *rec = plp->addr + offset;
+		uint64_t size = le64toh(rec->size);
+
+		if (!(*process_record)(rec + 1, size, arg))
+			break;
+
+		offset += log_record_stride(plp, size);
+	}
+
+	log_walk_end(plp);
+
+	return 0;
+}
+
+/*
+ * pmemlog_read_from -- copy data from a position in a log memory pool
+ *
+ * Positions count the bytes appended since the log was created, last
+ * rewound or compacted by pmemlog_trim(), like pmemlog_tell() does, so a
+ * reader can keep a cursor and follow the log as it grows.
+ */
+ssize_t
+pmemlog_read_from(PMEMlogpool *plp, off_t offset, void *buf, size_t count)
+{
+	LOG(3, "plp %p offset %lld buf %p count %zu", plp, (long long)offset,
+			buf, count);
+
+	if (offset < 0) {
+		LOG(1, "negative offset %lld", (long long)offset);
+		errno = EINVAL;
+		return -1;
+	}
+
+	if (plp->lanes != NULL || plp->compressed) {
+		LOG(1, "log of lanes or compressed log has no positions");
+		errno = EINVAL;
+		return -1;
+	}
+
+	uint64_t head;
+	uint64_t write_offset;
+
+	/* the data is copied from a snapshot, like a walk does */
+	if (log_walk_begin(plp, &head, &write_offset) < 0)
+		return -1;
+
+	uint64_t pos = le64toh(plp->start_offset) + (uint64_t)offset;
+	ssize_t ret = 0;
+
+	if (pos < head) {
+		LOG(1, "data at %lld has been overwritten", (long long)offset);
+		errno = ENODATA;
+		ret = -1;
+	} else if (pos < write_offset) {
+		count = MIN(count, write_offset - pos);
+
+		/* the data of a circular log may wrap around */
+		for (size_t copied = 0; copied < count; ) {
+			size_t len = log_circular_len(plp, pos, count - copied);
+			memcpy((char *)buf + copied,
+				(char *)plp->addr + log_circular_offset(plp,
+					pos), len);
+			copied += len;
+			pos += len;
+		}
+
+		ret = (ssize_t)count;
+	}
+
+	int oerrno = errno;
+	log_walk_end(plp);
+	errno = oerrno;
+
+	return ret;
+}
+
+/*
+ * pmemlog_wait -- wait for data to be appended past a position in a log
+ *
+ * Returns the position where the log ends once that's past offset, or -1
+ * with errno set to ETIMEDOUT if it isn't within timeout milliseconds.  A
+ * negative timeout means waiting as long as it takes.
+ */
+off_t
+pmemlog_wait(PMEMlogpool *plp, off_t offset, int timeout)
+{
+	LOG(3, "plp %p offset %lld timeout %d", plp, (long long)offset,
+			timeout);
+
+	struct log_append *ap = plp->appendp;
+	uint64_t start = le64toh(plp->start_offset);
+	struct timespec deadline;
+	off_t ret = -1;
+
+	if (plp->lanes != NULL || plp->compressed) {
+		LOG(1, "log of lanes or compressed log has no positions");
+		errno = EINVAL;
+		return -1;
+	}
+
+	if (timeout > 0)
+		log_deadline(&deadline, (unsigned long)timeout * 1000);
+
+	if ((errno = pthread_mutex_lock(&ap->lock))) {
+		LOG(1, "!pthread_mutex_lock");
+		return -1;
+	}
+
+	ap->waiters++;
+
+	for (;;) {
+		off_t end = (off_t)(ap->published - start);
+
+		if (end > offset) {
+			ret = end;
+			break;
+		}
+
+		if (timeout == 0)
+			errno = ETIMEDOUT;
+		else if (timeout < 0)
+			errno = pthread_cond_wait(&ap->appended, &ap->lock);
+		else
+			errno = pthread_cond_timedwait(&ap->appended,
+					&ap->lock, &deadline);
+
+		if (errno == ETIMEDOUT)
+			break;
+		if (errno) {
+			LOG(1, "!pthread_cond_wait");
+			break;
+		}
+	}
+
+	ap->waiters--;
+
+	int oerrno = errno;
+	if ((errno = pthread_mutex_unlock(&ap->lock)))
+		LOG(1, "!pthread_mutex_unlock");
+	errno = oerrno;
+
+	return ret;
 }
 
 /*
@@ -608,7 +3027,7 @@ pmemlog_check(const char *path)
 		return -1;	/* errno set by util_pool_open() */
 
 	/* map the pool read-only */
-	PMEMlogpool *plp = pmemlog_map_common(fd, poolsize, 1, 0);
+	PMEMlogpool *plp = pmemlog_map_common(fd, poolsize, 1, 0, 0, 0, 0);
 
 	if (plp == NULL)
 		return -1;	/* errno set by pmemlog_map_common() */
@@ -635,13 +3054,60 @@ pmemlog_check(const char *path)
 		consistent = 0;
 	}
 
-	if (hdr_start > hdr_write) {
-		LOG(1, "start_offset greater than write_offset");
+	if (plp->circular) {
+		uint64_t hdr_head = le64toh(plp->head_offset);
+
+		if (hdr_start > hdr_head) {
+			LOG(1, "start_offset greater than head_offset");
+			consistent = 0;
+		}
+
+		if (hdr_head > hdr_write) {
+			LOG(1, "head_offset greater than write_offset");
+			consistent = 0;
+		} else if (hdr_write - hdr_head > hdr_end - hdr_start) {
+			LOG(1, "more data than fits between head_offset "
+				"and write_offset");
+			consistent = 0;
+		}
+	} else {
+		/* see log_head_valid() for the head_offset of a linear log */
+		if (hdr_start > hdr_write) {
+			LOG(1, "start_offset greater than write_offset");
+			consistent = 0;
+		}
+
+		if (hdr_write > hdr_end) {
+			LOG(1, "write_offset greater than end_offset");
+			consistent = 0;
+		}
+	}
+
+	if (consistent && plp->record_align &&
+			log_records_end(plp, 1) != hdr_write) {
+		LOG(1, "records don't end at write_offset");
 		consistent = 0;
 	}
 
-	if (hdr_write > hdr_end) {
-		LOG(1, "write_offset greater than end_offset");
+	if (consistent && plp->lanes != NULL) {
+		uint64_t seq = 0;
+
+		for (uint64_t i = 0; i < le64toh(plp->nlanes); i++) {
+			struct log_lane *lp = &plp->lanes[i];
+
+			if (log_lane_end(plp, lp, 1, &seq) !=
+					le64toh(lp->write_offset)) {
+				LOG(1, "entries of lane %ju don't end at "
+					"its write_offset", i);
+				consistent = 0;
+			}
+		}
+	}
+
+	uint64_t length;
+	if (consistent && plp->compressed &&
+			log_frames_length(plp, 1, &length) < 0) {
+		LOG(1, "broken frames");
 		consistent = 0;
 	}
 
@@ -42,8 +42,16 @@
 #define	LOG_HDR_SIG "PMEMLOG"	/* must be 8 bytes including '\0' */
 #define	LOG_FORMAT_MAJOR 1
 #define	LOG_FORMAT_COMPAT 0x0000
-#define	LOG_FORMAT_INCOMPAT 0x0000
-#define	LOG_FORMAT_RO_COMPAT 0x0000
+#define	LOG_FORMAT_INCOMPAT_CIRCULAR 0x0001	/* the log wraps around */
+#define	LOG_FORMAT_INCOMPAT_LANES 0x0002	/* one write point per lane */
+#define	LOG_FORMAT_INCOMPAT_COMPRESSED 0x0004	/* records are frames */
+#define	LOG_FORMAT_INCOMPAT (LOG_FORMAT_INCOMPAT_CIRCULAR |\
+				LOG_FORMAT_INCOMPAT_LANES |\
+				LOG_FORMAT_INCOMPAT_COMPRESSED)
+#define	LOG_FORMAT_RO_COMPAT_RECORDS 0x0001	/* appends are framed */
+#define	LOG_FORMAT_RO_COMPAT_CACHELINE 0x0002	/* records cache line aligned */
+#define	LOG_FORMAT_RO_COMPAT (LOG_FORMAT_RO_COMPAT_RECORDS |\
+				LOG_FORMAT_RO_COMPAT_CACHELINE)
 
 struct pmemlog {
 	struct pool_hdr hdr;	/* memory pool header */
@@ -53,13 +61,133 @@ struct pmemlog {
 	uint64_t end_offset;	/* maximum offset of the usable log space */
 	uint64_t write_offset;	/* current write point for the log */
 
+	/*
+	 * Libraries predating the fields below keep their run-time state
+	 * here, storing it in the pool on every open, so this space can't
+	 * hold anything persistent.
+	 */
+	uint64_t unused[4];	/* run-time state of older libraries */
+	uint64_t head_offset;	/* oldest data in the log */
+	uint64_t nlanes;	/* number of lanes in a log of lanes */
+	uint64_t compact_offset; /* write_offset a compaction moves to */
+
 	/* some run-time state, allocated out of memory pool... */
 	void *addr;			/* mapped region */
 	size_t size;			/* size of mapped region */
 	int is_pmem;			/* true if pool is PMEM */
 	int rdonly;			/* true if pool is opened read-only */
+	int circular;			/* true if the log wraps around */
+	int compressed;			/* true if appends are compressed */
+	size_t record_align;		/* alignment of records, 0 if none */
+	struct log_lane *lanes;		/* lane descriptors, NULL if none */
 	pthread_rwlock_t *rwlockp;	/* pointer to RW lock */
+	struct log_append *appendp;	/* state of concurrent appends */
+};
+
+/*
+ * a range of the log whose data is persistent, waiting for write_offset
+ * to cover it (lives on the stack of the appending thread)
+ */
+struct log_range {
+	uint64_t offset;		/* start of the range */
+	uint64_t end;			/* end of the range */
+	struct log_range *next;		/* next range by offset */
 };
 
+/*
+ * run-time state shared by the threads appending to and walking a log,
+ * see pmemlog_append() and pmemlog_walk().  It's allocated separately,
+ * so it isn't write protected along with the pool descriptor in the
+ * debug version and doesn't share cache lines with the persistent
+ * write_offset.
+ */
+struct log_append {
+	uint64_t tail;			/* end of the space reserved so far */
+	uint64_t published;		/* write_offset last made persistent */
+	struct log_range *done;		/* completed ranges, not published */
+	int committing;			/* write_offset is being persisted */
+	unsigned walkers;		/* walks in progress */
+	unsigned writers;		/* changes of walked data to come */
+	unsigned writing;		/* ...of them no longer waiting */
+	unsigned waiters;		/* threads in pmemlog_wait() */
+	uint64_t seq;			/* next sequence number of an entry */
+	pthread_mutex_t *lane_locks;	/* one per lane, NULL if no lanes */
+	pthread_mutex_t lock;		/* protects all of the above */
+	pthread_cond_t cond;		/* signaled when a commit finishes */
+	pthread_cond_t batch;		/* signaled when a range completes */
+	pthread_cond_t walked;		/* signaled when walks or writers end */
+	pthread_cond_t appended;	/* signaled when published moves */
+
+	/* staging of the appends to a compressed log */
+	char *stage;			/* data appended, not compressed yet */
+	size_t staged;			/* bytes in the stage */
+	char *frame;			/* the compressed data of a frame */
+	uint64_t logical;		/* bytes appended, before compression */
+	pthread_mutex_t stage_lock;	/* protects the staging state */
+
+#ifdef DEBUG
+	/* held during write mprotected sections */
+	pthread_mutex_t write_lock;
+#endif
+};
+
+/* longest time a commit waits for more appends to join it (microseconds) */
+extern unsigned long Group_commit_usec;
+
+/*
+ * header of each record in a log of framed records, followed by the
+ * payload and padding up to the record alignment
+ */
+struct log_record {
+	uint64_t size;		/* length of the payload */
+	uint64_t checksum;	/* checksum of the header and the payload */
+};
+
+#define	LOG_RECORD_ALIGN 8		/* default alignment of records */
+#define	LOG_RECORD_CACHELINE 64		/* PMEMLOG_RECORD_CACHELINE alignment */
+
+/*
+ * descriptor of a lane in a log of lanes.  The descriptors make up a
+ * table at the start of the log space, each in a cache line of its own,
+ * followed by the space of the lanes.
+ */
+struct log_lane {
+	uint64_t start_offset;	/* start offset of the lane's space */
+	uint64_t end_offset;	/* end offset of the lane's space */
+	uint64_t checksum;	/* checksum of the above fields */
+	uint64_t write_offset;	/* current write point for the lane */
+	unsigned char unused[32];	/* pads the lane to a cache line */
+};
+
+/*
+ * header of each entry in a lane, followed by the payload and padding
+ * up to LOG_RECORD_ALIGN
+ */
+struct log_entry {
+	uint64_t seq;		/* orders the entries of all the lanes */
+	uint64_t size;		/* length of the payload */
+	uint64_t checksum;	/* checksum of the header and the payload */
+};
+
+/*
+ * header of the frame making up the payload of each record in a
+ * compressed log, followed by the compressed data
+ */
+struct log_frame {
+	uint32_t length;	/* length of the data, uncompressed */
+	uint32_t flags;		/* LOG_FRAME_RAW if not compressed */
+};
+
+#define	LOG_FRAME_RAW 0x1		/* data stored as it is */
+#define	LOG_FRAME_SIZE 65536		/* data in a frame, LZ_MAX_INPUT max */
+
+/*
+ * iovecs shorter than LOG_COALESCE_MIN appended to pmem are gathered in
+ * a staging buffer of LOG_COALESCE_SIZE bytes and copied to the log
+ * together, see pmemlog_copyv()
+ */
+#define	LOG_COALESCE_MIN 256		/* libpmem's default movnt threshold */
+#define	LOG_COALESCE_SIZE 4096
+
 /* data area starts at this alignment after the struct pmemlog above */
 #define	LOG_FORMAT_DATA_ALIGN 4096
@@ -0,0 +1,305 @@
+/*
+ * Copyright (c) 2014-2015, Intel Corporation
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in
+ *       the documentation and/or other materials provided with the
+ *       distribution.
+ *
+ *     * Neither the name of Intel Corporation nor the names of its
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY LOG OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * lz.c -- fast block codec for compressed logs
+ *
+ * A simple member of the LZ77 family, in the spirit of LZ4: it trades
+ * compression ratio for speed, finding matches through a single hash
+ * table lookup per position.  A compressed block is a series of
+ * sequences, each of them a token byte, literals and a match:
+ *
+ *	token		high 4 bits: number of literals,
+ *			low 4 bits: length of the match minus LZ_MIN_MATCH,
+ *			15 in either meaning more length bytes follow
+ *	[length bytes]	added to the number of literals, until one isn't 255
+ *	literals	copied to the output as they are
+ *	offset		2 bytes, little endian: how far back the match starts
+ *	[length bytes]	added to the length of the match, as above
+ *
+ * The last sequence ends right after its literals, with no match.  The
+ * matches always end at least LZ_LAST_LITERALS bytes before the end of
+ * the block, so that sequence is never empty for a block that long.
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/param.h>
+
+#include "lz.h"
+
+#define	LZ_MIN_MATCH 4		/* shortest match encoded */
+#define	LZ_LAST_LITERALS 5	/* literals that end each block */
+#define	LZ_HASH_BITS 12		/* size of the match finder's table */
+#define	LZ_SKIP_TRIGGER 6	/* speeds up the search for a match */
+#define	LZ_MAX_OFFSET 65535	/* farthest a match can start back */
+
+/*
+ * lz_read32 -- (internal) load 4 bytes from an unaligned address
+ */
+static inline uint32_t
+lz_read32(const uint8_t *p)
+{
+	uint32_t v;
+
+	memcpy(&v, p, sizeof (v));
+	return v;
+}
+
+/*
+ * lz_hash -- (internal) hash 4 bytes to a slot in the match finder's table
+ */
+static inline unsigned
+lz_hash(uint32_t v)
+{
+	return (v * 2654435761U) >> (32 - LZ_HASH_BITS);
+}
+
+/*
+ * lz_put_length -- (internal) store the bytes extending a length
+ *
+ * Returns the position past them, or NULL if they don't fit before end.
+ */
+static uint8_t *
+lz_put_length(uint8_t *op, uint8_t *end, size_t len)
+{
+	for (; len >= 255; len -= 255) {
+		if (op == end)
+			return NULL;
+		*op++ = 255;
+	}
+
+	if (op == end)
+		return NULL;
+	*op++ = (uint8_t)len;
+
+	return op;
+}
+
+/*
+ * lz_put_sequence -- (internal) store literals and the match following them
+ *
+ * A match of length 0 stores the last sequence of a block.  Returns the
+ * position past the sequence, or NULL if it doesn't fit before end.
+ */
+static uint8_t *
+lz_put_sequence(uint8_t *op, uint8_t *end, const uint8_t *lit,
+		size_t litlen, size_t offset, size_t mlen)
+{
+	if (op == end)
+		return NULL;
+
+	uint8_t *token = op++;
+	size_t mcode = mlen ? mlen - LZ_MIN_MATCH : 0;
+
+	*token = (uint8_t)(MIN(litlen, 15) << 4 | MIN(mcode, 15));
+
+	if (litlen >= 15 && (op = lz_put_length(op, end, litlen - 15)) == NULL)
+		return NULL;
+
+	if ((size_t)(end - op) < litlen)
+		return NULL;
+	memcpy(op, lit, litlen);
+	op += litlen;
+
+	if (mlen == 0)
+		return op;
+
+	if (end - op < 2)
+		return NULL;
+	*op++ = (uint8_t)offset;
+	*op++ = (uint8_t)(offset >> 8);
+
+	if (mcode >= 15 && (op = lz_put_length(op, end, mcode - 15)) == NULL)
+		return NULL;
+
+	return op;
+}
+
+/*
+ * lz_compress -- compress a block of up to LZ_MAX_INPUT bytes
+ *
+ * Returns the size of the compressed block stored in dst, or 0 if it
+ * doesn't fit in dstlen bytes.
+ */
+size_t
+lz_compress(const void *src, size_t srclen, void *dst, size_t dstlen)
+{
+	const uint8_t *base = src;
+	const uint8_t *ip = base;
+	const uint8_t *anchor = base;
+	const uint8_t *end = base + srclen;
+	uint8_t *op = dst;
+	uint8_t *oend = op + dstlen;
+
+	/* positions in a block fit in 16 bits */
+	uint16_t table[1 << LZ_HASH_BITS];
+
+	if (srclen > LZ_MAX_INPUT)
+		return 0;
+
+	if (srclen < LZ_MIN_MATCH + LZ_LAST_LITERALS + 1)
+		goto last;
+
+	memset(table, 0, sizeof (table));
+
+	/* a match can't start any later and still end early enough */
+	const uint8_t *mflimit = end - LZ_MIN_MATCH - LZ_LAST_LITERALS;
+	const uint8_t *matchlimit = end - LZ_LAST_LITERALS;
+	unsigned searches = 1 << LZ_SKIP_TRIGGER;
+
+	while (ip < mflimit) {
+		uint32_t v = lz_read32(ip);
+		unsigned h = lz_hash(v);
+		const uint8_t *ref = base + table[h];
+
+		table[h] = (uint16_t)(ip - base);
+
+		if (ref >= ip || ip - ref > LZ_MAX_OFFSET ||
+				lz_read32(ref) != v) {
+			/* step further the longer no match is found */
+			ip += searches++ >> LZ_SKIP_TRIGGER;
+			continue;
+		}
+
+		searches = 1 << LZ_SKIP_TRIGGER;
+
+		/* extend the match backwards over the literals... */
+		while (ip > anchor && ref > base && ip[-1] == ref[-1]) {
+			ip--;
+			ref--;
+		}
+
+		/* ...and forwards */
+		const uint8_t *mp = ip + LZ_MIN_MATCH;
+		const uint8_t *rp = ref + LZ_MIN_MATCH;
+		while (mp < matchlimit && *mp == *rp) {
+			mp++;
+			rp++;
+		}
+
+		if ((op = lz_put_sequence(op, oend, anchor, ip - anchor,
+				ip - ref, mp - ip)) == NULL)
+			return 0;
+
+		ip = mp;
+		anchor = ip;
+	}
+
+last:
+	if ((op = lz_put_sequence(op, oend, anchor, end - anchor, 0, 0))
+			== NULL)
+		return 0;
+
+	return op - (uint8_t *)dst;
+}
+
+/*
+ * lz_get_length -- (internal) add up the bytes extending a length
+ *
+ * Returns the position past them, or NULL if they run past end.
+ */
+static const uint8_t *
+lz_get_length(const uint8_t *ip, const uint8_t *end, size_t *lenp)
+{
+	uint8_t b;
+
+	do {
+		if (ip == end)
+			return NULL;
+		b = *ip++;
+		*lenp += b;
+	} while (b == 255);
+
+	return ip;
+}
+
+/*
+ * lz_decompress -- decompress a block into dst
+ *
+ * Returns the size of the decompressed data, or -1 if the block is
+ * malformed or its data doesn't fit in dstlen bytes.
+ */
+ssize_t
+lz_decompress(const void *src, size_t srclen, void *dst, size_t dstlen)
+{
+	const uint8_t *ip = src;
+	const uint8_t *end = ip + srclen;
+	uint8_t *base = dst;
+	uint8_t *op = base;
+	uint8_t *oend = base + dstlen;
+
+	for (;;) {
+		if (ip == end)
+			return -1;
+
+		unsigned token = *ip++;
+		size_t litlen = token >> 4;
+
+		if (litlen == 15 && (ip = lz_get_length(ip, end,
+				&litlen)) == NULL)
+			return -1;
+
+		if ((size_t)(end - ip) < litlen ||
+				(size_t)(oend - op) < litlen)
+			return -1;
+		memcpy(op, ip, litlen);
+		ip += litlen;
+		op += litlen;
+
+		/* the last sequence has no match */
+		if (ip == end)
+			break;
+
+		if (end - ip < 2)
+			return -1;
+		size_t offset = ip[0] | (size_t)ip[1] << 8;
+		ip += 2;
+
+		size_t mlen = token & 15;
+		if (mlen == 15 && (ip = lz_get_length(ip, end, &mlen)) == NULL)
+			return -1;
+		mlen += LZ_MIN_MATCH;
+
+		if (offset == 0 || offset > (size_t)(op - base) ||
+				(size_t)(oend - op) < mlen)
+			return -1;
+
+		/* the match may overlap the data it copies */
+		const uint8_t *ref = op - offset;
+		while (mlen--)
+			*op++ = *ref++;
+	}
+
+	return op - base;
+}
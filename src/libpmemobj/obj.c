@@ -193,7 +193,7 @@ pmemobj_map_common(int fd, const char *layout, size_t poolsize, int rdonly,
 err:
 	LOG(4, "error clean up");
 	int oerrno = errno;
-	util_unmap(addr, poolsize);
+	pmem_unmap(addr, poolsize);
 	errno = oerrno;
 	return NULL;
 }
@@ -249,7 +249,7 @@ pmemobj_close(PMEMobjpool *pop)
 
 	/* XXX stub */
 
-	util_unmap(pop->addr, pop->size);
+	pmem_unmap(pop->addr, pop->size);
 }
 
 /*
@@ -0,0 +1,336 @@
+/*
+ * Copyright (c) 2015, Intel Corporation
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in
+ *       the documentation and/or other materials provided with the
+ *       distribution.
+ *
+ *     * Neither the name of Intel Corporation nor the names of its
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * blk_map.c -- unit test for pmemblk_map_block/unmap_block
+ *
+ * usage: blk_map bsize file operation:lba...
+ *
+ * operations are 'r', 'w', 'z' or 'e' like in blk_rw, plus:
+ *	m	map the block and keep it mapped
+ *	u	unmap the block mapped last (lba is ignored)
+ *	W	write the block from another thread
+ *	M	map the block until it fails, read it, then unmap all of it
+ *	U	unmap an address outside of the pool (lba is ignored)
+ *	S	make writes from other threads sleep on mapped blocks
+ */
+
+#include "unittest.h"
+
+#define	MAX_MAPPED 1024
+#define	NSLEEPERS 2	/* no more than the lanes of any pool */
+#define	NFREE 256	/* blocks mapped or read at once, default layout */
+
+size_t Bsize;
+PMEMblkpool *Handle;
+
+/*
+ * construct -- build a buffer for writing
+ */
+void
+construct(unsigned char *buf)
+{
+	static int ord = 1;
+
+	for (int i = 0; i < Bsize; i++)
+		buf[i] = ord;
+
+	ord++;
+
+	if (ord > 255)
+		ord = 1;
+}
+
+/*
+ * ident -- identify what a buffer holds
+ */
+char *
+ident(const unsigned char *buf)
+{
+	static char descr[100];
+	unsigned val = *buf;
+
+	for (int i = 1; i < Bsize; i++)
+		if (buf[i] != val) {
+			sprintf(descr, "{%u} TORN at byte %d", val, i);
+			return descr;
+		}
+
+	sprintf(descr, "{%u}", val);
+	return descr;
+}
+
+/*
+ * writer -- write a block from another thread
+ */
+void *
+writer(void *arg)
+{
+	off_t lba = *(off_t *)arg;
+	unsigned char buf[Bsize];
+
+	construct(buf);
+	if (pmemblk_write(Handle, buf, lba) < 0)
+		OUT("!write     lba %zu", lba);
+	else
+		OUT("write     lba %zu: %s (other thread)", lba, ident(buf));
+
+	return NULL;
+}
+
+/*
+ * a thread whose write sleeps on a mapped block, see sleeper()
+ */
+struct sleeper {
+	pthread_t thread;
+	off_t lba;			/* the block mapped and written */
+	const void *addr;		/* where it's mapped */
+	unsigned char *buf[2];		/* what's written */
+};
+
+static unsigned Armed;		/* sleepers about to write again */
+static unsigned Woken;		/* sleepers done writing */
+
+/*
+ * sleeper -- map a block, write it, then write another block
+ *
+ * After the first write, the block mapped is the free block of the lane
+ * of the thread, so the second write in the lane has to wait until the
+ * block is unmapped.
+ */
+void *
+sleeper(void *arg)
+{
+	struct sleeper *sp = arg;
+
+	if ((sp->addr = pmemblk_map_block(Handle, sp->lba)) == NULL)
+		FATAL("!map       lba %zu", sp->lba);
+
+	if (pmemblk_write(Handle, sp->buf[0], sp->lba) < 0)
+		FATAL("!write     lba %zu", sp->lba);
+
+	__sync_fetch_and_add(&Armed, 1);
+
+	if (pmemblk_write(Handle, sp->buf[1], sp->lba + NSLEEPERS) < 0)
+		FATAL("!write     lba %zu", sp->lba + NSLEEPERS);
+
+	__sync_fetch_and_add(&Woken, 1);
+
+	return NULL;
+}
+
+/*
+ * do_sleep -- put writes to sleep on mapped blocks and wake them up
+ */
+void
+do_sleep(off_t lba)
+{
+	struct sleeper sleepers[NSLEEPERS];
+	unsigned char buf[Bsize];
+
+	for (int i = 0; i < NSLEEPERS; i++) {
+		sleepers[i].lba = lba + i;
+		for (int j = 0; j < 2; j++) {
+			sleepers[i].buf[j] = MALLOC(Bsize);
+			construct(sleepers[i].buf[j]);
+		}
+	}
+
+	Armed = 0;
+	Woken = 0;
+
+	for (int i = 0; i < NSLEEPERS; i++)
+		PTHREAD_CREATE(&sleepers[i].thread, NULL, sleeper,
+				&sleepers[i]);
+
+	while (Armed < NSLEEPERS)
+		usleep(1000);
+
+	/* long enough for the writes to give up spinning */
+	usleep(100000);
+
+	OUT("sleeping  lba %zu: %u of %d writes done", lba, Woken,
+			NSLEEPERS);
+
+	for (int i = 0; i < NSLEEPERS; i++) {
+		OUT("unmap     %s", ident(sleepers[i].addr));
+		if (pmemblk_unmap_block(Handle, sleepers[i].addr) < 0)
+			OUT("!unmap");
+	}
+
+	for (int i = 0; i < NSLEEPERS; i++)
+		PTHREAD_JOIN(sleepers[i].thread, NULL);
+
+	OUT("woken     lba %zu: %u of %d writes done", lba, Woken,
+			NSLEEPERS);
+
+	for (off_t l = lba; l < lba + 2 * NSLEEPERS; l++) {
+		if (pmemblk_read(Handle, buf, l) < 0)
+			OUT("!read      lba %zu", l);
+		else
+			OUT("read      lba %zu: %s", l, ident(buf));
+	}
+
+	for (int i = 0; i < NSLEEPERS; i++)
+		for (int j = 0; j < 2; j++)
+			FREE(sleepers[i].buf[j]);
+}
+
+int
+main(int argc, char *argv[])
+{
+	START(argc, argv, "blk_map");
+
+	if (argc < 4)
+		FATAL("usage: %s bsize file op:lba...", argv[0]);
+
+	Bsize = strtoul(argv[1], NULL, 0);
+
+	const char *path = argv[2];
+
+	if ((Handle = pmemblk_create(path, Bsize, 0, S_IWUSR)) == NULL)
+		FATAL("!%s: pmemblk_create", path);
+
+	OUT("%s block size %zu usable blocks %zu",
+			argv[1], Bsize, pmemblk_nblock(Handle));
+
+	const void *mapped[MAX_MAPPED];
+	int nmapped = 0;
+
+	for (int arg = 3; arg < argc; arg++) {
+		if (strchr("rwzemuWMUS", argv[arg][0]) == NULL ||
+				argv[arg][1] != ':')
+			FATAL("op must be one of rwzemuWMUS followed by :");
+		off_t lba = strtoul(&argv[arg][2], NULL, 0);
+
+		unsigned char buf[Bsize];
+		const void *addr;
+		pthread_t thread;
+		int n;
+
+		switch (argv[arg][0]) {
+		case 'r':
+			if (pmemblk_read(Handle, buf, lba) < 0)
+				OUT("!read      lba %zu", lba);
+			else
+				OUT("read      lba %zu: %s", lba, ident(buf));
+			break;
+
+		case 'w':
+			construct(buf);
+			if (pmemblk_write(Handle, buf, lba) < 0)
+				OUT("!write     lba %zu", lba);
+			else
+				OUT("write     lba %zu: %s", lba, ident(buf));
+			break;
+
+		case 'z':
+			if (pmemblk_set_zero(Handle, lba) < 0)
+				OUT("!set_zero  lba %zu", lba);
+			else
+				OUT("set_zero  lba %zu", lba);
+			break;
+
+		case 'e':
+			if (pmemblk_set_error(Handle, lba) < 0)
+				OUT("!set_error lba %zu", lba);
+			else
+				OUT("set_error lba %zu", lba);
+			break;
+
+		case 'm':
+			ASSERT(nmapped < MAX_MAPPED);
+			if ((addr = pmemblk_map_block(Handle, lba)) == NULL)
+				OUT("!map       lba %zu", lba);
+			else {
+				OUT("map       lba %zu: %s", lba, ident(addr));
+				mapped[nmapped++] = addr;
+			}
+			break;
+
+		case 'u':
+			ASSERT(nmapped > 0);
+			addr = mapped[--nmapped];
+			OUT("unmap     %s", ident(addr));
+			if (pmemblk_unmap_block(Handle, addr) < 0)
+				OUT("!unmap");
+			break;
+
+		case 'W':
+			PTHREAD_CREATE(&thread, NULL, writer, &lba);
+			PTHREAD_JOIN(thread, NULL);
+			break;
+
+		case 'M':
+			for (n = 0; n < MAX_MAPPED; n++)
+				if ((mapped[n] = pmemblk_map_block(Handle,
+						lba)) == NULL)
+					break;
+			OUT("!mapped    lba %zu up to the limit", lba);
+
+			/* some of the slots are kept for reads, see README */
+			ASSERT(n >= NFREE / 2 && n < NFREE);
+			if (pmemblk_read(Handle, buf, lba) < 0)
+				OUT("!read      lba %zu", lba);
+			else
+				OUT("read      lba %zu: %s", lba, ident(buf));
+
+			while (n > 0)
+				if (pmemblk_unmap_block(Handle, mapped[--n]))
+					OUT("!unmap");
+			break;
+
+		case 'U':
+			if (pmemblk_unmap_block(Handle, buf) < 0)
+				OUT("!unmap     outside of pool");
+			else
+				OUT("unmap     outside of pool");
+			break;
+
+		case 'S':
+			do_sleep(lba);
+			break;
+		}
+	}
+
+	ASSERTeq(nmapped, 0);
+
+	pmemblk_close(Handle);
+
+	int result = pmemblk_check(path);
+	if (result < 0)
+		OUT("!%s: pmemblk_check", path);
+	else if (result == 0)
+		OUT("%s: pmemblk_check: not consistent", path);
+
+	DONE(NULL);
+}
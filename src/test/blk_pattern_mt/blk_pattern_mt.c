@@ -0,0 +1,249 @@
+/*
+ * Copyright (c) 2015, Intel Corporation
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in
+ *       the documentation and/or other materials provided with the
+ *       distribution.
+ *
+ *     * Neither the name of Intel Corporation nor the names of its
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * blk_pattern_mt.c -- unit test for MT reads of blocks being rewritten
+ *
+ * usage: blk_pattern_mt bsize file seed nwriters nreaders nops
+ *
+ * Each writer owns the LBAs equal to its number modulo nwriters and keeps
+ * rewriting them with a pattern made of the LBA and a version that grows
+ * with each write, so the free blocks of the lanes keep getting reused.
+ * The readers check every block they read holds the pattern of the LBA
+ * read, in full, and that the versions they see of an LBA never go back.
+ * Every other read maps the block instead and yields while it's mapped,
+ * which on a single CPU gives the writers a chance to reuse it too early.
+ */
+
+#include "unittest.h"
+
+#define	NBLOCK 64	/* all I/O below this LBA (increases collisions) */
+
+/*
+ * header of the pattern written to a block, followed by bytes filled with
+ * the sum of the LBA and the version
+ */
+struct pattern {
+	uint64_t lba;
+	uint64_t version;
+};
+
+size_t Bsize;
+unsigned Seed;
+unsigned Nwriters;
+unsigned Nops;
+PMEMblkpool *Handle;
+uint64_t Versions[NBLOCK];	/* last version written, by the owner */
+
+/*
+ * construct -- build the pattern of a version of an LBA
+ */
+void
+construct(unsigned char *buf, off_t lba, uint64_t version)
+{
+	struct pattern *pp = (struct pattern *)buf;
+
+	pp->lba = (uint64_t)lba;
+	pp->version = version;
+	memset(buf + sizeof (*pp), (int)(lba + version),
+			Bsize - sizeof (*pp));
+}
+
+/*
+ * verify -- check a block read holds the pattern of the LBA
+ *
+ * A block never written reads as zeros, which is version 0.  Returns the
+ * version found.
+ */
+uint64_t
+verify(const unsigned char *buf, off_t lba)
+{
+	const struct pattern *pp = (const struct pattern *)buf;
+
+	if (pp->version == 0 && pp->lba == 0) {
+		for (size_t i = sizeof (*pp); i < Bsize; i++)
+			if (buf[i] != 0)
+				FATAL("lba %zu: version 0 not zeroed", lba);
+		return 0;
+	}
+
+	if (pp->lba != (uint64_t)lba)
+		FATAL("lba %zu: data of lba %ju", lba, pp->lba);
+
+	unsigned char fill = (unsigned char)(lba + pp->version);
+
+	for (size_t i = sizeof (*pp); i < Bsize; i++)
+		if (buf[i] != fill)
+			FATAL("lba %zu version %ju: TORN at byte %zu", lba,
+					pp->version, i);
+
+	return pp->version;
+}
+
+/*
+ * writer -- keep rewriting the LBAs the thread owns
+ */
+void *
+writer(void *arg)
+{
+	unsigned mytid = (unsigned)(long)arg;
+	unsigned myseed = Seed + mytid;
+	unsigned nowned = (NBLOCK - mytid + Nwriters - 1) / Nwriters;
+	unsigned char buf[Bsize];
+
+	for (unsigned i = 0; i < Nops; i++) {
+		off_t lba = mytid + Nwriters * (rand_r(&myseed) % nowned);
+		uint64_t version = Versions[lba] + 1;
+
+		construct(buf, lba, version);
+		if (pmemblk_write(Handle, buf, lba) < 0)
+			FATAL("!write     lba %zu", lba);
+
+		Versions[lba] = version;
+	}
+
+	return NULL;
+}
+
+/*
+ * reader -- read random LBAs and check the patterns
+ */
+void *
+reader(void *arg)
+{
+	unsigned mytid = (unsigned)(long)arg;
+	unsigned myseed = Seed + mytid;
+	uint64_t seen[NBLOCK];
+	unsigned char buf[Bsize];
+
+	memset(seen, 0, sizeof (seen));
+
+	for (unsigned i = 0; i < Nops; i++) {
+		off_t lba = rand_r(&myseed) % NBLOCK;
+
+		uint64_t version;
+
+		if (i % 2) {
+			if (pmemblk_read(Handle, buf, lba) < 0)
+				FATAL("!read      lba %zu", lba);
+
+			version = verify(buf, lba);
+		} else {
+			const unsigned char *addr;
+
+			if ((addr = pmemblk_map_block(Handle, lba)) == NULL)
+				FATAL("!map       lba %zu", lba);
+
+			/* let the writers run while the block is mapped */
+			version = verify(addr, lba);
+			sched_yield();
+			if (verify(addr, lba) != version)
+				FATAL("lba %zu: mapped block rewritten", lba);
+
+			if (pmemblk_unmap_block(Handle, addr) < 0)
+				FATAL("!unmap     lba %zu", lba);
+		}
+
+		if (version < seen[lba])
+			FATAL("lba %zu: version %ju after %ju", lba, version,
+					seen[lba]);
+		seen[lba] = version;
+	}
+
+	return NULL;
+}
+
+int
+main(int argc, char *argv[])
+{
+	START(argc, argv, "blk_pattern_mt");
+
+	if (argc != 7)
+		FATAL("usage: %s bsize file seed nwriters nreaders nops",
+				argv[0]);
+
+	Bsize = strtoul(argv[1], NULL, 0);
+
+	const char *path = argv[2];
+
+	Seed = strtoul(argv[3], NULL, 0);
+	Nwriters = strtoul(argv[4], NULL, 0);
+	unsigned nreaders = strtoul(argv[5], NULL, 0);
+	Nops = strtoul(argv[6], NULL, 0);
+
+	if (Bsize < sizeof (struct pattern) || Nwriters == 0 ||
+			Nwriters > NBLOCK)
+		FATAL("bsize or nwriters out of range");
+
+	if ((Handle = pmemblk_create(path, Bsize, 0, S_IWUSR)) == NULL)
+		FATAL("!%s: pmemblk_create", path);
+
+	OUT("%s block size %zu, %u writers, %u readers", argv[1], Bsize,
+			Nwriters, nreaders);
+
+	unsigned nthread = Nwriters + nreaders;
+	pthread_t threads[nthread];
+
+	for (unsigned i = 0; i < nthread; i++)
+		PTHREAD_CREATE(&threads[i], NULL,
+				i < Nwriters ? writer : reader,
+				(void *)(long)i);
+
+	for (unsigned i = 0; i < nthread; i++)
+		PTHREAD_JOIN(threads[i], NULL);
+
+	/* the last version written of each LBA is what's left */
+	unsigned char buf[Bsize];
+
+	for (off_t lba = 0; lba < NBLOCK; lba++) {
+		if (pmemblk_read(Handle, buf, lba) < 0)
+			FATAL("!read      lba %zu", lba);
+
+		uint64_t version = verify(buf, lba);
+
+		if (version != Versions[lba])
+			FATAL("lba %zu: version %ju instead of %ju", lba,
+					version, Versions[lba]);
+	}
+
+	OUT("%d blocks verified", NBLOCK);
+
+	pmemblk_close(Handle);
+
+	int result = pmemblk_check(path);
+	if (result < 0)
+		OUT("!%s: pmemblk_check", path);
+	else if (result == 0)
+		OUT("%s: pmemblk_check: not consistent", path);
+
+	DONE(NULL);
+}
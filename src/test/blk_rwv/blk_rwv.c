@@ -0,0 +1,252 @@
+/*
+ * Copyright (c) 2015, Intel Corporation
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in
+ *       the documentation and/or other materials provided with the
+ *       distribution.
+ *
+ *     * Neither the name of Intel Corporation nor the names of its
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * blk_rwv.c -- unit test for pmemblk_readv/writev
+ *
+ * usage: blk_rwv bsize file operation:lba[,lba]...
+ *
+ * operations are 'r' or 'w' for a single block, 'R' or 'W' for
+ * a vector of blocks, and 'T' to run threads, 'T:nthread,nops'
+ */
+
+#include "unittest.h"
+
+#define	MAX_IOV 512
+#define	NBLOCK_MT 100	/* threads only use blocks below this LBA */
+#define	MAX_IOV_MT 16	/* and vectors up to this size */
+
+size_t Bsize;
+PMEMblkpool *Handle;
+
+/*
+ * construct -- build a buffer for writing
+ */
+void
+construct(int *ordp, unsigned char *buf)
+{
+	for (int i = 0; i < Bsize; i++)
+		buf[i] = *ordp;
+
+	(*ordp)++;
+
+	if (*ordp > 255)
+		*ordp = 1;
+}
+
+/*
+ * ident -- identify what a buffer holds
+ */
+char *
+ident(unsigned char *buf)
+{
+	static char descr[100];
+	unsigned val = *buf;
+
+	for (int i = 1; i < Bsize; i++)
+		if (buf[i] != val) {
+			sprintf(descr, "{%u} TORN at byte %d", val, i);
+			return descr;
+		}
+
+	sprintf(descr, "{%u}", val);
+	return descr;
+}
+
+/*
+ * check -- check for torn buffers
+ */
+void
+check(unsigned char *buf)
+{
+	unsigned val = *buf;
+
+	for (int i = 1; i < Bsize; i++)
+		if (buf[i] != val) {
+			OUT("{%u} TORN at byte %d", val, i);
+			break;
+		}
+}
+
+/*
+ * worker -- write and read random vectors of blocks
+ */
+void *
+worker(void *arg)
+{
+	unsigned *nopsp = arg;
+	unsigned seed = (unsigned)(uintptr_t)pthread_self();
+	unsigned char *bufs = MALLOC(MAX_IOV_MT * Bsize);
+	struct pmemblk_iovec iov[MAX_IOV_MT];
+	int ord = 1;
+
+	for (int i = 0; i < *nopsp; i++) {
+		int iovcnt = 1 + rand_r(&seed) % MAX_IOV_MT;
+
+		for (int j = 0; j < iovcnt; j++) {
+			iov[j].buf = bufs + j * Bsize;
+			iov[j].blockno = rand_r(&seed) % NBLOCK_MT;
+		}
+
+		if (rand_r(&seed) % 2) {
+			if (pmemblk_readv(Handle, iov, iovcnt) < 0)
+				OUT("!readv");
+			for (int j = 0; j < iovcnt; j++)
+				check(iov[j].buf);
+		} else {
+			for (int j = 0; j < iovcnt; j++)
+				construct(&ord, iov[j].buf);
+			if (pmemblk_writev(Handle, iov, iovcnt) < 0)
+				OUT("!writev");
+		}
+	}
+
+	FREE(bufs);
+	return NULL;
+}
+
+int
+main(int argc, char *argv[])
+{
+	START(argc, argv, "blk_rwv");
+
+	if (argc < 4)
+		FATAL("usage: %s bsize file op:lba[,lba]...", argv[0]);
+
+	Bsize = strtoul(argv[1], NULL, 0);
+
+	const char *path = argv[2];
+
+	if ((Handle = pmemblk_create(path, Bsize, 0, S_IWUSR)) == NULL)
+		FATAL("!%s: pmemblk_create", path);
+
+	OUT("%s block size %zu usable blocks %zu",
+			argv[1], Bsize, pmemblk_nblock(Handle));
+
+	unsigned char *bufs = MALLOC(MAX_IOV * Bsize);
+	struct pmemblk_iovec iov[MAX_IOV];
+	int ord = 1;
+
+	for (int arg = 3; arg < argc; arg++) {
+		if (strchr("rwRWT", argv[arg][0]) == NULL ||
+				argv[arg][1] != ':')
+			FATAL("op must be r: w: R: W: or T:");
+
+		/* parse the list of LBAs */
+		int iovcnt = 0;
+		char *lbas = STRDUP(&argv[arg][2]);
+		char *saveptr;
+		for (char *lba = strtok_r(lbas, ",", &saveptr); lba != NULL;
+				lba = strtok_r(NULL, ",", &saveptr)) {
+			ASSERT(iovcnt < MAX_IOV);
+			iov[iovcnt].buf = bufs + iovcnt * Bsize;
+			iov[iovcnt].blockno = strtol(lba, NULL, 0);
+			iovcnt++;
+		}
+		FREE(lbas);
+
+		char descr[MAX_IOV * 8] = "";
+
+		switch (argv[arg][0]) {
+		case 'r':
+			if (pmemblk_read(Handle, iov[0].buf,
+					iov[0].blockno) < 0)
+				OUT("!read      lba %zu", iov[0].blockno);
+			else
+				OUT("read      lba %zu: %s", iov[0].blockno,
+						ident(iov[0].buf));
+			break;
+
+		case 'w':
+			construct(&ord, iov[0].buf);
+			if (pmemblk_write(Handle, iov[0].buf,
+					iov[0].blockno) < 0)
+				OUT("!write     lba %zu", iov[0].blockno);
+			else
+				OUT("write     lba %zu: %s", iov[0].blockno,
+						ident(iov[0].buf));
+			break;
+
+		case 'R':
+			if (pmemblk_readv(Handle, iov, iovcnt) < 0) {
+				OUT("!readv     %d blocks", iovcnt);
+				break;
+			}
+			for (int i = 0; i < iovcnt; i++) {
+				strcat(descr, " ");
+				strcat(descr, ident(iov[i].buf));
+			}
+			OUT("readv     %d blocks:%s", iovcnt, descr);
+			break;
+
+		case 'W':
+			for (int i = 0; i < iovcnt; i++) {
+				construct(&ord, iov[i].buf);
+				strcat(descr, " ");
+				strcat(descr, ident(iov[i].buf));
+			}
+			if (pmemblk_writev(Handle, iov, iovcnt) < 0)
+				OUT("!writev    %d blocks", iovcnt);
+			else
+				OUT("writev    %d blocks:%s", iovcnt, descr);
+			break;
+
+		case 'T': {
+			ASSERTeq(iovcnt, 2);
+			unsigned nthread = iov[0].blockno;
+			unsigned nops = iov[1].blockno;
+			pthread_t threads[nthread];
+
+			for (int i = 0; i < nthread; i++)
+				PTHREAD_CREATE(&threads[i], NULL, worker,
+						&nops);
+			for (int i = 0; i < nthread; i++)
+				PTHREAD_JOIN(threads[i], NULL);
+
+			OUT("threads   %u x %u vectors", nthread, nops);
+			break;
+		}
+		}
+	}
+
+	FREE(bufs);
+
+	pmemblk_close(Handle);
+
+	int result = pmemblk_check(path);
+	if (result < 0)
+		OUT("!%s: pmemblk_check", path);
+	else if (result == 0)
+		OUT("%s: pmemblk_check: not consistent", path);
+
+	DONE(NULL);
+}
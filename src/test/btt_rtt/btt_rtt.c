@@ -0,0 +1,216 @@
+/*
+ * Copyright (c) 2015, Intel Corporation
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in
+ *       the documentation and/or other materials provided with the
+ *       distribution.
+ *
+ *     * Neither the name of Intel Corporation nor the names of its
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * btt_rtt.c -- unit test for the read tracking table of the btt
+ *
+ * usage: btt_rtt
+ *
+ * Runs the btt on a namespace in memory, with a read callback that
+ * rewrites the block being mapped right when the map is re-checked, and
+ * starts a write that has to wait for the block read so far.  The map
+ * then retries with the new block, and the write must still complete
+ * while the new block stays mapped.
+ */
+
+#include "unittest.h"
+#include "btt.h"
+
+#define	NS_SIZE ((1 << 20) * 16)	/* smallest namespace a btt takes */
+#define	LBASIZE 512
+
+static char *Ns;			/* the namespace */
+static struct btt *Bttp;
+static int Armed;			/* rewrite the block on a map re-check */
+static unsigned Map_reads;		/* map entries read without a lane */
+static pthread_t Writer;
+static int volatile Written;		/* the waiting write is done */
+
+/*
+ * fill -- write a block filled with val
+ */
+static void
+fill(uint64_t lba, int val)
+{
+	unsigned char buf[LBASIZE];
+
+	memset(buf, val, sizeof (buf));
+	if (btt_write(Bttp, 0, lba, buf) < 0)
+		FATAL("!btt_write lba %ju", lba);
+}
+
+/*
+ * writer -- write lba 1 from another thread, through the free block
+ */
+static void *
+writer(void *arg)
+{
+	fill(1, 3);
+	Written = 1;
+
+	return NULL;
+}
+
+/*
+ * rewrite -- rewrite lba 0 behind the map, start a write waiting for it
+ *
+ * The write of lba 0 frees the block the map has pinned so far, and the
+ * write of lba 1 then gets it from the lane to reuse, so it has to wait
+ * for the map to move on.
+ */
+static void
+rewrite(void)
+{
+	fill(0, 2);
+
+	PTHREAD_CREATE(&Writer, NULL, writer, NULL);
+
+	/* long enough for the write to give up spinning */
+	usleep(100000);
+
+	OUT("rewritten lba 0, write of lba 1 %s",
+			Written ? "done" : "waiting");
+}
+
+/*
+ * ns_read -- read section of the namespace, rewriting lba 0 if armed
+ */
+static int
+ns_read(void *ns, int lane, void *buf, size_t count, off_t off)
+{
+	/* the second map entry read of a map is the re-check */
+	if (lane < 0 && count == sizeof (uint32_t) && Armed &&
+			++Map_reads == 2) {
+		Armed = 0;
+		rewrite();
+	}
+
+	memcpy(buf, Ns + off, count);
+	return 0;
+}
+
+/*
+ * ns_write -- write section of the namespace
+ */
+static int
+ns_write(void *ns, int lane, const void *buf, size_t count, off_t off)
+{
+	memcpy(Ns + off, buf, count);
+	return 0;
+}
+
+/*
+ * ns_zero -- zero section of the namespace
+ */
+static int
+ns_zero(void *ns, int lane, size_t count, off_t off)
+{
+	memset(Ns + off, 0, count);
+	return 0;
+}
+
+/*
+ * ns_map -- map a section of the namespace
+ */
+static ssize_t
+ns_map(void *ns, int lane, void **addrp, size_t len, off_t off)
+{
+	*addrp = Ns + off;
+	return (ssize_t)len;
+}
+
+/*
+ * ns_sync -- nothing to flush in a namespace in memory
+ */
+static void
+ns_sync(void *ns, int lane, void *addr, size_t len)
+{
+}
+
+static struct ns_callback ns_cb = {
+	.nsread = ns_read,
+	.nswrite = ns_write,
+	.nszero = ns_zero,
+	.nsmap = ns_map,
+	.nssync = ns_sync,
+	.ns_is_zeroed = 1,
+};
+
+int
+main(int argc, char *argv[])
+{
+	START(argc, argv, "btt_rtt");
+
+	if (argc != 1)
+		FATAL("usage: %s", argv[0]);
+
+	uint8_t uuid[16];
+	memset(uuid, 1, sizeof (uuid));
+
+	Ns = ZALLOC(NS_SIZE);
+
+	/* a single lane, so both writes use the same free block */
+	if ((Bttp = btt_init(NS_SIZE, LBASIZE, uuid, 1, Ns, &ns_cb)) == NULL)
+		FATAL("!btt_init");
+
+	fill(0, 1);
+	fill(1, 1);
+
+	Armed = 1;
+
+	unsigned char *addr;
+	if (btt_map_block(Bttp, 0, (void **)&addr) < 0)
+		FATAL("!btt_map_block");
+
+	/* long enough for a woken write to finish */
+	usleep(100000);
+
+	OUT("mapped lba 0 holding %u, write of lba 1 %s", *addr,
+			Written ? "done" : "waiting");
+
+	if (btt_unmap_block(Bttp, (char *)addr - Ns) < 0)
+		FATAL("!btt_unmap_block");
+
+	PTHREAD_JOIN(Writer, NULL);
+
+	unsigned char buf[LBASIZE];
+	for (uint64_t lba = 0; lba < 2; lba++) {
+		if (btt_read(Bttp, lba, buf) < 0)
+			FATAL("!btt_read lba %ju", lba);
+		OUT("read lba %ju holding %u", lba, buf[0]);
+	}
+
+	btt_fini(Bttp);
+	FREE(Ns);
+
+	DONE(NULL);
+}
@@ -0,0 +1,190 @@
+/*
+ * Copyright (c) 2015, Intel Corporation
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in
+ *       the documentation and/or other materials provided with the
+ *       distribution.
+ *
+ *     * Neither the name of Intel Corporation nor the names of its
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * btt_writev.c -- unit test for btt_writev() failing in the middle
+ *
+ * usage: btt_writev
+ *
+ * Runs the btt on a namespace in memory, with a write callback that
+ * fails to make the last flog entry of a batch active.  The blocks of
+ * the batch whose flog entries did get active must be mapped all the
+ * same, so the blocks their lanes get to write next aren't live.
+ */
+
+#include "unittest.h"
+#include "btt.h"
+
+#define	NS_SIZE ((1 << 20) * 16)	/* smallest namespace a btt takes */
+#define	LBASIZE 512
+#define	NLANE 2
+
+static char *Ns;			/* the namespace */
+static int Armed;			/* fail the last flog activation */
+static unsigned Flog_writes;		/* flog halves written once armed */
+
+/*
+ * ns_read -- read section of the namespace
+ */
+static int
+ns_read(void *ns, int lane, void *buf, size_t count, off_t off)
+{
+	memcpy(buf, Ns + off, count);
+	return 0;
+}
+
+/*
+ * ns_write -- write section of the namespace, failing a flog write if armed
+ *
+ * A batch of NLANE blocks writes the first halves of the flog entries,
+ * then the second halves making them active, all of them 8 bytes.
+ */
+static int
+ns_write(void *ns, int lane, const void *buf, size_t count, off_t off)
+{
+	if (Armed && count == sizeof (uint32_t) * 2 &&
+			++Flog_writes == NLANE * 2) {
+		Armed = 0;
+		errno = EIO;
+		return -1;
+	}
+
+	memcpy(Ns + off, buf, count);
+	return 0;
+}
+
+/*
+ * ns_zero -- zero section of the namespace
+ */
+static int
+ns_zero(void *ns, int lane, size_t count, off_t off)
+{
+	memset(Ns + off, 0, count);
+	return 0;
+}
+
+/*
+ * ns_map -- map a section of the namespace
+ */
+static ssize_t
+ns_map(void *ns, int lane, void **addrp, size_t len, off_t off)
+{
+	*addrp = Ns + off;
+	return (ssize_t)len;
+}
+
+/*
+ * ns_sync -- nothing to flush in a namespace in memory
+ */
+static void
+ns_sync(void *ns, int lane, void *addr, size_t len)
+{
+}
+
+static struct ns_callback ns_cb = {
+	.nsread = ns_read,
+	.nswrite = ns_write,
+	.nszero = ns_zero,
+	.nsmap = ns_map,
+	.nssync = ns_sync,
+	.ns_is_zeroed = 1,
+};
+
+/*
+ * fill -- write a block filled with val through the given lane
+ */
+static void
+fill(struct btt *bttp, int lane, uint64_t lba, int val)
+{
+	unsigned char buf[LBASIZE];
+
+	memset(buf, val, sizeof (buf));
+	if (btt_write(bttp, lane, lba, buf) < 0)
+		FATAL("!btt_write lba %ju", lba);
+}
+
+int
+main(int argc, char *argv[])
+{
+	START(argc, argv, "btt_writev");
+
+	if (argc != 1)
+		FATAL("usage: %s", argv[0]);
+
+	uint8_t uuid[16];
+	memset(uuid, 1, sizeof (uuid));
+
+	Ns = ZALLOC(NS_SIZE);
+
+	struct btt *bttp = btt_init(NS_SIZE, LBASIZE, uuid, NLANE, Ns, &ns_cb);
+	if (bttp == NULL)
+		FATAL("!btt_init");
+
+	/* lba 16 takes the next map lock, so it comes last in the batch */
+	uint64_t lbas[NLANE] = { 0, 16 };
+	for (int i = 0; i < NLANE; i++)
+		fill(bttp, i, lbas[i], 1);
+
+	unsigned char data[NLANE][LBASIZE];
+	struct btt_iovec iov[NLANE];
+	int lanes[NLANE];
+	for (int i = 0; i < NLANE; i++) {
+		memset(data[i], 2, LBASIZE);
+		iov[i].lba = lbas[i];
+		iov[i].buf = data[i];
+		lanes[i] = i;
+	}
+
+	Armed = 1;
+
+	if (btt_writev(bttp, lanes, NLANE, iov, NLANE) < 0)
+		OUT("!btt_writev");
+
+	/* every lane writes its next free block */
+	for (int i = 0; i < NLANE; i++)
+		fill(bttp, i, 1, 3);
+
+	unsigned char buf[LBASIZE];
+	for (int i = 0; i < NLANE; i++) {
+		if (btt_read(bttp, lbas[i], buf) < 0)
+			FATAL("!btt_read lba %ju", lbas[i]);
+		OUT("read lba %ju holding %u", lbas[i], buf[0]);
+	}
+
+	if (btt_check(bttp) <= 0)
+		OUT("btt_check: not consistent");
+
+	btt_fini(bttp);
+	FREE(Ns);
+
+	DONE(NULL);
+}
@@ -0,0 +1,187 @@
+/*
+ * Copyright (c) 2015, Intel Corporation
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in
+ *       the documentation and/or other materials provided with the
+ *       distribution.
+ *
+ *     * Neither the name of Intel Corporation nor the names of its
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * log_append_mt.c -- unit test for concurrent appends
+ *
+ * usage: log_append_mt file nthread nops
+ *
+ * Each of nthread threads appends nops records to the log, odd threads
+ * using pmemlog_appendv(), until the log is full.  The log is then walked
+ * to check that every record made it in one piece and that the records
+ * of each thread appear in the order they were appended.
+ */
+
+#include "unittest.h"
+
+#define	MAX_THREADS 32
+
+struct record {
+	uint32_t thread;
+	uint32_t seq;
+	char data[56];
+};
+
+static PMEMlogpool *Handle;
+static unsigned Nthread;
+static unsigned Nops;
+static unsigned Appended[MAX_THREADS];	/* records appended by each thread */
+static unsigned Walked[MAX_THREADS];	/* records found by the walk */
+static unsigned Bad;			/* corrupted or reordered records */
+
+/*
+ * worker -- the work each thread performs
+ */
+static void *
+worker(void *arg)
+{
+	uint32_t mytid = (uint32_t)(long)arg;
+	struct record rec;
+
+	for (uint32_t i = 0; i < Nops; i++) {
+		rec.thread = mytid;
+		rec.seq = i;
+		memset(rec.data, (int)(mytid + i), sizeof (rec.data));
+
+		int ret;
+		if (mytid % 2) {
+			struct iovec iov[2] = {
+				{ .iov_base = &rec, .iov_len = 8 },
+				{ .iov_base = (char *)&rec + 8,
+					.iov_len = sizeof (rec) - 8 },
+			};
+			ret = pmemlog_appendv(Handle, iov, 2);
+		} else
+			ret = pmemlog_append(Handle, &rec, sizeof (rec));
+
+		if (ret < 0) {
+			if (errno != ENOSPC)
+				OUT("!append thread %u seq %u", mytid, i);
+			break;
+		}
+
+		Appended[mytid]++;
+	}
+
+	return NULL;
+}
+
+/*
+ * check_record -- walker callback checking one record
+ */
+static int
+check_record(const void *buf, size_t len, void *arg)
+{
+	const struct record *rec = buf;
+
+	if (len != sizeof (*rec) || rec->thread >= Nthread ||
+			rec->seq != Walked[rec->thread]) {
+		Bad++;
+		return 1;
+	}
+
+	for (size_t i = 0; i < sizeof (rec->data); i++)
+		if (rec->data[i] != (char)(rec->thread + rec->seq)) {
+			Bad++;
+			return 1;
+		}
+
+	Walked[rec->thread]++;
+
+	return 1;
+}
+
+int
+main(int argc, char *argv[])
+{
+	START(argc, argv, "log_append_mt");
+
+	if (argc != 4)
+		FATAL("usage: %s file nthread nops", argv[0]);
+
+	const char *path = argv[1];
+	Nthread = strtoul(argv[2], NULL, 0);
+	Nops = strtoul(argv[3], NULL, 0);
+
+	if (Nthread == 0 || Nthread > MAX_THREADS)
+		FATAL("invalid number of threads: %s", argv[2]);
+
+	if ((Handle = pmemlog_create(path, PMEMLOG_MIN_POOL, S_IWUSR)) ==
+			NULL)
+		FATAL("!%s: pmemlog_create", path);
+
+	pthread_t threads[Nthread];
+
+	/* kick off nthread threads */
+	for (unsigned i = 0; i < Nthread; i++)
+		PTHREAD_CREATE(&threads[i], NULL, worker, (void *)(long)i);
+
+	/* wait for all the threads to complete */
+	for (unsigned i = 0; i < Nthread; i++)
+		PTHREAD_JOIN(threads[i], NULL);
+
+	unsigned total = 0;
+	for (unsigned i = 0; i < Nthread; i++)
+		total += Appended[i];
+
+	OUT("appended %u records", total);
+
+	if (pmemlog_tell(Handle) != (off_t)(total * sizeof (struct record)))
+		OUT("tell %lld doesn't match the records appended",
+			(long long)pmemlog_tell(Handle));
+
+	pmemlog_close(Handle);
+
+	/* walk the reopened log record by record */
+	if ((Handle = pmemlog_open(path)) == NULL)
+		FATAL("!%s: pmemlog_open", path);
+
+	pmemlog_walk(Handle, sizeof (struct record), check_record, NULL);
+
+	for (unsigned i = 0; i < Nthread; i++)
+		if (Walked[i] != Appended[i])
+			OUT("thread %u appended %u records, %u found", i,
+				Appended[i], Walked[i]);
+
+	if (Bad)
+		OUT("%u bad records", Bad);
+
+	pmemlog_close(Handle);
+
+	int result = pmemlog_check(path);
+	if (result < 0)
+		OUT("!%s: pmemlog_check", path);
+	else if (result == 0)
+		OUT("%s: pmemlog_check: not consistent", path);
+
+	DONE(NULL);
+}
@@ -0,0 +1,147 @@
+/*
+ * Copyright (c) 2015, Intel Corporation
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in
+ *       the documentation and/or other materials provided with the
+ *       distribution.
+ *
+ *     * Neither the name of Intel Corporation nor the names of its
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * log_appendv.c -- unit test for appending iovecs of mixed sizes
+ *
+ * usage: log_appendv file nrounds
+ *
+ * Each round appends a gathered run of short and long iovecs with
+ * pmemlog_appendv() and a single buffer with pmemlog_append(), then the
+ * whole log is walked and every byte checked.  Run on pmem, the short
+ * iovecs get coalesced before they are copied to the log.
+ */
+
+#include "unittest.h"
+
+#define	NIOV 600
+
+static const size_t Sizes[] = { 1, 3, 8, 17, 64, 255, 13, 5, 256, 2, 1000, 4 };
+#define	NSIZES (sizeof (Sizes) / sizeof (Sizes[0]))
+
+static size_t Walked;
+
+/*
+ * pattern -- the byte expected at a given position in the log
+ */
+static char
+pattern(size_t pos)
+{
+	return (char)(pos * 7 + pos / 251);
+}
+
+/*
+ * fill -- fill a buffer with the pattern for the given position
+ */
+static void
+fill(char *buf, size_t len, size_t pos)
+{
+	for (size_t i = 0; i < len; i++)
+		buf[i] = pattern(pos + i);
+}
+
+/*
+ * check_chunk -- walk callback checking the data against the pattern
+ */
+static int
+check_chunk(const void *buf, size_t len, void *arg)
+{
+	const char *data = buf;
+
+	for (size_t i = 0; i < len; i++)
+		if (data[i] != pattern(Walked + i))
+			FATAL("bad data at %zu", Walked + i);
+
+	Walked += len;
+
+	return 1;
+}
+
+int
+main(int argc, char *argv[])
+{
+	PMEMlogpool *plp;
+
+	START(argc, argv, "log_appendv");
+
+	if (argc != 3)
+		FATAL("usage: %s file nrounds", argv[0]);
+
+	const char *path = argv[1];
+	unsigned nrounds = strtoul(argv[2], NULL, 0);
+
+	if ((plp = pmemlog_create(path, PMEMLOG_MIN_POOL, S_IWUSR)) == NULL)
+		FATAL("!%s: pmemlog_create", path);
+
+	struct iovec iov[NIOV];
+	char *buf = MALLOC(NIOV * 1000);
+	size_t pos = 0;
+
+	for (unsigned r = 0; r < nrounds; r++) {
+		int iovcnt = 1 + (r * 37) % NIOV;
+		size_t len = 0;
+
+		for (int i = 0; i < iovcnt; i++) {
+			iov[i].iov_base = buf + len;
+			iov[i].iov_len = Sizes[(r + i) % NSIZES];
+			len += iov[i].iov_len;
+		}
+
+		fill(buf, len, pos);
+		if (pmemlog_appendv(plp, iov, iovcnt) < 0)
+			FATAL("!pmemlog_appendv");
+		pos += len;
+
+		len = Sizes[r % NSIZES];
+		fill(buf, len, pos);
+		if (pmemlog_append(plp, buf, len) < 0)
+			FATAL("!pmemlog_append");
+		pos += len;
+	}
+
+	FREE(buf);
+
+	OUT("appended %zu bytes", pos);
+	OUT("tell %lld", (long long)pmemlog_tell(plp));
+
+	pmemlog_close(plp);
+
+	if ((plp = pmemlog_open(path)) == NULL)
+		FATAL("!%s: pmemlog_open", path);
+
+	pmemlog_walk(plp, 4096, check_chunk, NULL);
+	OUT("walked %zu bytes", Walked);
+
+	pmemlog_close(plp);
+
+	DONE(NULL);
+}
@@ -0,0 +1,215 @@
+/*
+ * Copyright (c) 2015, Intel Corporation
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in
+ *       the documentation and/or other materials provided with the
+ *       distribution.
+ *
+ *     * Neither the name of Intel Corporation nor the names of its
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * log_circular.c -- unit test for circular logs
+ *
+ * usage: log_circular file nrecords
+ *
+ * Appends a 16-byte header and nrecords 64-byte records, odd records
+ * using pmemlog_appendv(), to a newly created circular log.  The log is
+ * then read at both ends, reopened and walked to check that it holds the
+ * newest data, from the oldest to the newest, and finally rewound.
+ */
+
+#include "unittest.h"
+
+#define	HEADER "log_circular hdr"
+
+struct record {
+	uint64_t seq;
+	char data[56];
+};
+
+static char *Walked;		/* data found by the walk */
+static size_t Walked_len;
+static int Chunks;		/* calls to the walk callback */
+
+/*
+ * do_append -- append a record with the given sequence number
+ */
+static void
+do_append(PMEMlogpool *plp, uint64_t seq)
+{
+	struct record rec;
+	int ret;
+
+	rec.seq = seq;
+	memset(rec.data, (int)seq, sizeof (rec.data));
+
+	if (seq % 2) {
+		struct iovec iov[2] = {
+			{ .iov_base = &rec, .iov_len = 8 },
+			{ .iov_base = (char *)&rec + 8,
+				.iov_len = sizeof (rec) - 8 },
+		};
+		ret = pmemlog_appendv(plp, iov, 2);
+	} else
+		ret = pmemlog_append(plp, &rec, sizeof (rec));
+
+	if (ret < 0)
+		FATAL("!append %ju", seq);
+}
+
+/*
+ * gather -- walker callback collecting all the data
+ */
+static int
+gather(const void *buf, size_t len, void *arg)
+{
+	memcpy(Walked + Walked_len, buf, len);
+	Walked_len += len;
+	Chunks++;
+
+	return 1;
+}
+
+/*
+ * do_walk -- walk the log and check the records found
+ */
+static void
+do_walk(PMEMlogpool *plp)
+{
+	struct pmemlog_usage usage;
+
+	if (pmemlog_usage(plp, &usage) < 0)
+		FATAL("!pmemlog_usage");
+
+	Walked = MALLOC(usage.used + 1);
+	Walked_len = 0;
+	Chunks = 0;
+
+	pmemlog_walk(plp, 0, gather, NULL);
+
+	OUT("walked %zu bytes in %d chunks", Walked_len, Chunks);
+
+	/* whole records are at the end of the data, newest last */
+	size_t nrec = Walked_len / sizeof (struct record);
+	size_t rest = Walked_len % sizeof (struct record);
+	struct record *rec = (struct record *)(Walked + rest);
+
+	for (size_t i = 0; i < nrec; i++) {
+		if (rec[i].seq != rec[0].seq + i)
+			FATAL("record %zu: seq %ju", i, rec[i].seq);
+		for (size_t j = 0; j < sizeof (rec[i].data); j++)
+			if (rec[i].data[j] != (char)rec[i].seq)
+				FATAL("record %zu: bad data", i);
+	}
+
+	if (nrec)
+		OUT("records %ju..%ju", rec[0].seq, rec[nrec - 1].seq);
+
+	if (rest == strlen(HEADER) && strncmp(Walked, HEADER, rest) == 0)
+		OUT("header");
+	else if (rest)
+		OUT("%zu bytes of older data", rest);
+
+	FREE(Walked);
+}
+
+int
+main(int argc, char *argv[])
+{
+	PMEMlogpool *plp;
+
+	START(argc, argv, "log_circular");
+
+	if (argc != 3)
+		FATAL("usage: %s file nrecords", argv[0]);
+
+	const char *path = argv[1];
+	uint64_t nrecords = strtoull(argv[2], NULL, 0);
+
+	if ((plp = pmemlog_create_circular(path, PMEMLOG_MIN_POOL,
+			S_IWUSR)) == NULL)
+		FATAL("!%s: pmemlog_create_circular", path);
+
+	size_t nbyte = pmemlog_nbyte(plp);
+	OUT("usable size: %zu", nbyte);
+
+	/* more than the whole log can never fit */
+	char *big = MALLOC(nbyte + 1);
+	if (pmemlog_append(plp, big, nbyte + 1) == 0)
+		OUT("append of %zu bytes succeeded", nbyte + 1);
+	else if (errno != ENOSPC)
+		OUT("!append of %zu bytes", nbyte + 1);
+	FREE(big);
+
+	if (pmemlog_append(plp, HEADER, strlen(HEADER)) < 0)
+		FATAL("!append header");
+
+	for (uint64_t seq = 0; seq < nrecords; seq++)
+		do_append(plp, seq);
+
+	OUT("tell %lld", (long long)pmemlog_tell(plp));
+
+	/* the header is still there unless the log wrapped around */
+	char hdr[sizeof (HEADER)];
+	if (pmemlog_read_from(plp, 0, hdr, strlen(HEADER)) < 0)
+		OUT("!read_from 0");
+	else if (strncmp(hdr, HEADER, strlen(HEADER)) == 0)
+		OUT("read_from 0: header");
+
+	/* positions keep growing when the log wraps around */
+	struct record last;
+	off_t end = pmemlog_wait(plp, 0, 0);
+	if (pmemlog_read_from(plp, end - sizeof (last), &last,
+			sizeof (last)) != sizeof (last))
+		OUT("!read_from %lld", (long long)(end - sizeof (last)));
+	else
+		OUT("end %lld, last record %ju", (long long)end, last.seq);
+
+	pmemlog_close(plp);
+
+	if ((plp = pmemlog_open(path)) == NULL)
+		FATAL("!%s: pmemlog_open", path);
+
+	do_walk(plp);
+
+	pmemlog_rewind(plp);
+	OUT("rewind");
+
+	do_append(plp, nrecords);
+	OUT("tell %lld", (long long)pmemlog_tell(plp));
+
+	do_walk(plp);
+
+	pmemlog_close(plp);
+
+	int result = pmemlog_check(path);
+	if (result < 0)
+		OUT("!%s: pmemlog_check", path);
+	else if (result == 0)
+		OUT("%s: pmemlog_check: not consistent", path);
+
+	DONE(NULL);
+}
@@ -0,0 +1,212 @@
+/*
+ * Copyright (c) 2015, Intel Corporation
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in
+ *       the documentation and/or other materials provided with the
+ *       distribution.
+ *
+ *     * Neither the name of Intel Corporation nor the names of its
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * log_compat.c -- unit test for opening log pools of older libraries
+ *
+ * usage: log_compat file
+ *
+ * A linear log is made to look like the pools of the libraries predating
+ * trims, circular logs and lanes: no head_offset, no nlanes and their
+ * run-time state stored in the pool.  It's opened, appended to, trimmed
+ * and then opened again after an older library stored its run-time state
+ * once more.
+ */
+
+#include "unittest.h"
+#include "util.h"
+#include "log.h"
+
+#define	NRECORDS 100
+
+struct record {
+	uint64_t seq;
+	char data[56];
+};
+
+static uint64_t Next;		/* sequence number of the next record */
+static uint64_t Walked;		/* sequence number expected by the walk */
+static uint64_t Nwalked;	/* records walked */
+
+/*
+ * do_append -- append count records
+ */
+static void
+do_append(PMEMlogpool *plp, unsigned count)
+{
+	struct record rec;
+
+	for (unsigned i = 0; i < count; i++) {
+		rec.seq = Next++;
+		memset(rec.data, (char)rec.seq, sizeof (rec.data));
+
+		if (pmemlog_append(plp, &rec, sizeof (rec)) < 0)
+			FATAL("!append %ju", rec.seq);
+	}
+}
+
+/*
+ * check_record -- walk callback checking the records come in order
+ */
+static int
+check_record(const void *buf, size_t len, void *arg)
+{
+	const struct record *rec = buf;
+
+	if (len != sizeof (*rec))
+		FATAL("record of %zu bytes", len);
+
+	if (Nwalked == 0)
+		Walked = rec->seq;
+	else if (rec->seq != Walked)
+		FATAL("record %ju instead of %ju", rec->seq, Walked);
+
+	for (size_t j = 0; j < sizeof (rec->data); j++)
+		if (rec->data[j] != (char)rec->seq)
+			FATAL("record %ju: bad data", rec->seq);
+
+	Walked++;
+	Nwalked++;
+
+	return 1;
+}
+
+/*
+ * do_open -- open the log and print what's in it
+ */
+static PMEMlogpool *
+do_open(const char *path)
+{
+	int result = pmemlog_check(path);
+
+	if (result < 0)
+		OUT("!%s: pmemlog_check", path);
+	else if (result == 0)
+		OUT("%s: pmemlog_check: not consistent", path);
+
+	PMEMlogpool *plp = pmemlog_open(path);
+
+	if (plp == NULL)
+		FATAL("!%s: pmemlog_open", path);
+
+	Nwalked = 0;
+	pmemlog_walk(plp, sizeof (struct record), check_record, NULL);
+
+	OUT("tell %lld, records %ju..%ju", (long long)pmemlog_tell(plp),
+			Walked - Nwalked, Walked - 1);
+
+	return plp;
+}
+
+/*
+ * set_field -- store a value in the pool descriptor of a closed log
+ */
+static void
+set_field(const char *path, off_t offset, uint64_t value)
+{
+	int fd = OPEN(path, O_RDWR);
+
+	value = htole64(value);
+	LSEEK(fd, offset, SEEK_SET);
+	WRITE(fd, &value, sizeof (value));
+	CLOSE(fd);
+}
+
+/*
+ * old_open -- store the run-time state of an older library in the pool
+ *
+ * The libraries predating trims keep their addr, size, is_pmem, rdonly
+ * and rwlockp fields right after the write_offset.
+ */
+static void
+old_open(const char *path)
+{
+	off_t unused = offsetof(struct pmemlog, unused);
+
+	set_field(path, unused, 0x10000000000);
+	set_field(path, unused + 8, PMEMLOG_MIN_POOL);
+	set_field(path, unused + 16, 1);
+	set_field(path, unused + 24, 0x7f0000001000);
+}
+
+int
+main(int argc, char *argv[])
+{
+	PMEMlogpool *plp;
+
+	START(argc, argv, "log_compat");
+
+	if (argc != 2)
+		FATAL("usage: %s file", argv[0]);
+
+	const char *path = argv[1];
+
+	if ((plp = pmemlog_create(path, PMEMLOG_MIN_POOL, S_IWUSR)) == NULL)
+		FATAL("!%s: create", path);
+
+	do_append(plp, NRECORDS);
+	pmemlog_close(plp);
+
+	/* a pool of an older library, as it looks after its first open */
+	set_field(path, offsetof(struct pmemlog, head_offset), 0);
+	set_field(path, offsetof(struct pmemlog, nlanes), 0);
+	old_open(path);
+
+	plp = do_open(path);
+	do_append(plp, 1);
+
+	off_t ret = pmemlog_trim(plp, NRECORDS / 2 * sizeof (struct record));
+	if (ret < 0)
+		FATAL("!pmemlog_trim");
+
+	OUT("trim: %lld", (long long)ret);
+	pmemlog_close(plp);
+
+	/* an older library doesn't overwrite the head_offset */
+	old_open(path);
+
+	plp = do_open(path);
+	pmemlog_close(plp);
+
+	/* a head_offset outside of the data can't come from a trim */
+	set_field(path, offsetof(struct pmemlog, head_offset), 0x10000000000);
+	set_field(path, offsetof(struct pmemlog, nlanes), 0x10000000000);
+
+	plp = do_open(path);
+	do_append(plp, 1);
+	pmemlog_close(plp);
+
+	plp = do_open(path);
+	pmemlog_close(plp);
+
+	DONE(NULL);
+}
@@ -0,0 +1,423 @@
+/*
+ * Copyright (c) 2015, Intel Corporation
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in
+ *       the documentation and/or other materials provided with the
+ *       distribution.
+ *
+ *     * Neither the name of Intel Corporation nor the names of its
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * log_compress.c -- unit test for compressed logs
+ *
+ * usage: log_compress file op
+ *
+ * op is 's' for a single thread appending lines of text, a block bigger
+ * than a frame and data that doesn't compress, checking the data walked
+ * matches the data appended, 'f' for appending blocks bigger than a
+ * frame until the log is full, checking the one that doesn't fit leaves
+ * nothing behind, or 't' for threads appending records concurrently,
+ * checking each thread's records come back whole and in order.
+ */
+
+#include "unittest.h"
+
+#define	MAX_DATA (1024 * 1024)	/* data appended in the 's' test */
+#define	BIG_SIZE 100000		/* more than a frame holds */
+#define	FULL_SIZE 131072	/* two frames of data */
+#define	NTHREAD 8
+#define	NOPS 2000
+
+static PMEMlogpool *Handle;
+static char *Data;		/* all the data appended */
+static size_t Ndata;
+static size_t Nwalked;		/* data walked so far */
+static size_t Nchunks;
+static size_t Chunksize;
+static unsigned Bad;		/* chunks not matching the data */
+
+struct record {
+	uint32_t thread;
+	uint32_t seq;
+	char text[56];
+};
+
+static uint32_t Walked[NTHREAD];	/* records found by the walk */
+
+/*
+ * append -- append data to the log and keep a copy
+ */
+static void
+append(const void *buf, size_t len, int vector)
+{
+	int ret;
+
+	if (vector && len > 1) {
+		struct iovec iov[2] = {
+			{ .iov_base = (void *)buf, .iov_len = len / 2 },
+			{ .iov_base = (char *)buf + len / 2,
+				.iov_len = len - len / 2 },
+		};
+		ret = pmemlog_appendv(Handle, iov, 2);
+	} else
+		ret = pmemlog_append(Handle, buf, len);
+
+	if (ret < 0)
+		FATAL("!append of %zu bytes", len);
+
+	ASSERT(Ndata + len <= MAX_DATA);
+	memcpy(Data + Ndata, buf, len);
+	Ndata += len;
+}
+
+/*
+ * check_chunk -- walker callback comparing a chunk with the data appended
+ */
+static int
+check_chunk(const void *buf, size_t len, void *arg)
+{
+	if (Nwalked + len > Ndata || memcmp(buf, Data + Nwalked, len))
+		Bad++;
+
+	/* only the last chunk may be short */
+	if (Chunksize && Nwalked + len < Ndata && len != Chunksize)
+		Bad++;
+
+	Nwalked += len;
+	Nchunks++;
+
+	return 1;
+}
+
+/*
+ * do_walk -- walk the data in chunks of chunksize and print the result
+ */
+static void
+do_walk(size_t chunksize)
+{
+	Nwalked = 0;
+	Nchunks = 0;
+	Chunksize = chunksize;
+	Bad = 0;
+
+	pmemlog_walk(Handle, chunksize, check_chunk, NULL);
+
+	OUT("walked %zu bytes in chunks of %zu", Nwalked, chunksize);
+	if (Bad)
+		OUT("%u bad chunks", Bad);
+}
+
+/*
+ * do_usage -- print how much data the log holds
+ */
+static void
+do_usage(void)
+{
+	struct pmemlog_usage usage;
+
+	if (pmemlog_usage(Handle, &usage) < 0)
+		FATAL("!pmemlog_usage");
+
+	OUT("tell %lld logical %zu staged %zu", (long long)pmemlog_tell(Handle),
+			usage.logical, usage.staged);
+
+	ASSERTeq(usage.nbyte, pmemlog_nbyte(Handle));
+	if (usage.used > usage.logical)
+		OUT("used %zu", usage.used);
+}
+
+/*
+ * do_check -- run the consistency check & print the result
+ */
+static void
+do_check(const char *path)
+{
+	int result = pmemlog_check(path);
+	if (result < 0)
+		OUT("!%s: pmemlog_check", path);
+	else if (result == 0)
+		OUT("%s: pmemlog_check: not consistent", path);
+}
+
+/*
+ * test_single -- append text, a big block and random data
+ */
+static void
+test_single(const char *path)
+{
+	char line[100];
+
+	Data = MALLOC(MAX_DATA);
+
+	for (unsigned i = 0; i < 5000; i++) {
+		int len = sprintf(line, "time=%u cpu=%u temp=%u.%u status=%s\n",
+				1000000 + i * 10, i % 4, 40 + i % 7, i % 10,
+				i % 13 ? "ok" : "throttled");
+		append(line, (size_t)len, i % 2);
+	}
+
+	do_usage();
+
+	/* text compresses to less than half */
+	struct pmemlog_usage usage;
+	pmemlog_usage(Handle, &usage);
+	if (usage.used > usage.logical / 2)
+		OUT("used %zu of %zu", usage.used, usage.logical);
+
+	/* a compressed log has neither records nor positions */
+	if (pmemlog_walk_records(Handle, check_chunk, NULL) < 0)
+		OUT("!pmemlog_walk_records");
+	if (pmemlog_read_from(Handle, 0, line, 1) < 0)
+		OUT("!pmemlog_read_from");
+
+	do_walk(0);
+	do_walk(1000);
+	do_usage();
+
+	pmemlog_close(Handle);
+
+	do_check(path);
+
+	if ((Handle = pmemlog_open(path)) == NULL)
+		FATAL("!%s: pmemlog_open", path);
+
+	do_usage();
+	do_walk(4096);
+
+	/* a block bigger than a frame gets split */
+	char *big = MALLOC(BIG_SIZE);
+	for (size_t i = 0; i < BIG_SIZE; i++)
+		big[i] = (char)(i / 1000);
+	append(big, BIG_SIZE, 0);
+
+	/* data that doesn't compress is stored as it is */
+	srand(1);
+	for (size_t i = 0; i < BIG_SIZE; i++)
+		big[i] = (char)rand();
+	append(big, BIG_SIZE, 1);
+	FREE(big);
+
+	do_usage();
+
+	if (pmemlog_flush(Handle) < 0)
+		FATAL("!pmemlog_flush");
+
+	do_usage();
+	do_walk(0);
+	do_walk(333);
+
+	pmemlog_close(Handle);
+
+	do_check(path);
+
+	if ((Handle = pmemlog_open(path)) == NULL)
+		FATAL("!%s: pmemlog_open", path);
+
+	do_walk(0);
+
+	pmemlog_rewind(Handle);
+	Ndata = 0;
+
+	do_usage();
+	do_walk(0);
+
+	pmemlog_close(Handle);
+
+	do_check(path);
+
+	FREE(Data);
+}
+
+/*
+ * test_full -- append data that doesn't compress until the log is full
+ *
+ * Each append fills up two frames, so the one that fails may still have
+ * room for the first of them.
+ */
+static void
+test_full(const char *path)
+{
+	char *big = MALLOC(FULL_SIZE);
+	struct pmemlog_usage before;
+	struct pmemlog_usage after;
+
+	/* stored raw, the data takes more room in the log than it has */
+	Data = MALLOC(pmemlog_nbyte(Handle));
+
+	srand(1);
+	for (;;) {
+		for (size_t i = 0; i < FULL_SIZE; i++)
+			big[i] = (char)rand();
+
+		if (pmemlog_usage(Handle, &before) < 0)
+			FATAL("!pmemlog_usage");
+
+		if (pmemlog_append(Handle, big, FULL_SIZE) < 0)
+			break;
+
+		memcpy(Data + Ndata, big, FULL_SIZE);
+		Ndata += FULL_SIZE;
+	}
+	OUT("!append of %d bytes", FULL_SIZE);
+	FREE(big);
+
+	/* the append that didn't fit left nothing behind */
+	if (pmemlog_usage(Handle, &after) < 0)
+		FATAL("!pmemlog_usage");
+	if (after.logical != before.logical ||
+			after.staged != before.staged ||
+			after.used != before.used)
+		OUT("failed append changed the log");
+
+	do_usage();
+
+	if (pmemlog_flush(Handle) < 0)
+		OUT("!pmemlog_flush");
+
+	pmemlog_close(Handle);
+
+	do_check(path);
+
+	if ((Handle = pmemlog_open(path)) == NULL)
+		FATAL("!%s: pmemlog_open", path);
+
+	do_usage();
+	do_walk(0);
+
+	pmemlog_close(Handle);
+
+	FREE(Data);
+}
+
+/*
+ * worker -- the work each thread performs
+ */
+static void *
+worker(void *arg)
+{
+	uint32_t mytid = (uint32_t)(long)arg;
+	struct record rec;
+
+	for (uint32_t i = 0; i < NOPS; i++) {
+		rec.thread = mytid;
+		rec.seq = i;
+		memset(rec.text, 0, sizeof (rec.text));
+		sprintf(rec.text, "thread %u record %u", mytid, i);
+
+		if (pmemlog_append(Handle, &rec, sizeof (rec)) < 0)
+			FATAL("!append thread %u seq %u", mytid, i);
+	}
+
+	return NULL;
+}
+
+/*
+ * check_record -- walker callback checking one record
+ */
+static int
+check_record(const void *buf, size_t len, void *arg)
+{
+	const struct record *rec = buf;
+	char text[sizeof (rec->text)];
+
+	if (len != sizeof (*rec) || rec->thread >= NTHREAD ||
+			rec->seq != Walked[rec->thread]) {
+		Bad++;
+		return 1;
+	}
+
+	memset(text, 0, sizeof (text));
+	sprintf(text, "thread %u record %u", rec->thread, rec->seq);
+	if (memcmp(text, rec->text, sizeof (text)))
+		Bad++;
+
+	Walked[rec->thread]++;
+	Nwalked++;
+
+	return 1;
+}
+
+/*
+ * test_threads -- append records concurrently
+ */
+static void
+test_threads(const char *path)
+{
+	pthread_t threads[NTHREAD];
+
+	/* kick off the threads */
+	for (unsigned i = 0; i < NTHREAD; i++)
+		PTHREAD_CREATE(&threads[i], NULL, worker, (void *)(long)i);
+
+	/* wait for all the threads to complete */
+	for (unsigned i = 0; i < NTHREAD; i++)
+		PTHREAD_JOIN(threads[i], NULL);
+
+	OUT("appended %u records, tell %lld", NTHREAD * NOPS,
+			(long long)pmemlog_tell(Handle));
+
+	pmemlog_close(Handle);
+
+	do_check(path);
+
+	if ((Handle = pmemlog_open(path)) == NULL)
+		FATAL("!%s: pmemlog_open", path);
+
+	/* each record is walked as a chunk of its own */
+	pmemlog_walk(Handle, sizeof (struct record), check_record, NULL);
+
+	OUT("walked %zu records", Nwalked);
+	if (Bad)
+		OUT("%u bad records", Bad);
+
+	pmemlog_close(Handle);
+}
+
+int
+main(int argc, char *argv[])
+{
+	START(argc, argv, "log_compress");
+
+	if (argc != 3 || strchr("sft", argv[2][0]) == NULL)
+		FATAL("usage: %s file op", argv[0]);
+
+	const char *path = argv[1];
+
+	if ((Handle = pmemlog_create_compressed(path, PMEMLOG_MIN_POOL,
+			S_IWUSR)) == NULL)
+		FATAL("!%s: pmemlog_create_compressed", path);
+
+	OUT("nbyte %zu", pmemlog_nbyte(Handle));
+
+	if (argv[2][0] == 's')
+		test_single(path);
+	else if (argv[2][0] == 'f')
+		test_full(path);
+	else
+		test_threads(path);
+
+	DONE(NULL);
+}
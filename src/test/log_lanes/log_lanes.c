@@ -0,0 +1,279 @@
+/*
+ * Copyright (c) 2015, Intel Corporation
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in
+ *       the documentation and/or other materials provided with the
+ *       distribution.
+ *
+ *     * Neither the name of Intel Corporation nor the names of its
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * log_lanes.c -- unit test for logs of lanes
+ *
+ * usage: log_lanes file nlanes nthread nops serial
+ *
+ * Each of nthread threads appends nops records of varying size to a log
+ * of nlanes lanes, odd threads using pmemlog_appendv().  If serial is 1,
+ * the threads take turns and number their records in the order they are
+ * appended in.  The merged walk has to find each thread's records in
+ * order, and if serial is 1, all the records in order.  Then the last
+ * record gets corrupted as if the append was torn, the log is reopened
+ * to check the torn record is cut off and one more record is appended,
+ * which has to be walked last.
+ */
+
+#include "unittest.h"
+
+#define	MAX_THREADS 32
+
+struct record {
+	uint32_t thread;
+	uint32_t seq;
+	uint32_t ticket;	/* order of the appends if serial */
+	char data[];
+};
+
+static PMEMlogpool *Handle;
+static unsigned Nthread;
+static unsigned Nops;
+static int Serial;
+static pthread_mutex_t Lock = PTHREAD_MUTEX_INITIALIZER;
+static uint32_t Ticket;			/* next ticket to hand out */
+static unsigned Walked[MAX_THREADS + 1];	/* records found by the walk */
+static unsigned Nwalked;
+static unsigned Bad;			/* corrupted or reordered records */
+static uint32_t Last_ticket;		/* ticket of the last record found */
+static int Marker;			/* main thread's record found */
+static off_t Last;			/* offset of the last record found */
+
+/*
+ * record_size -- size of the record with the given sequence number
+ */
+static size_t
+record_size(uint32_t seq)
+{
+	return sizeof (struct record) + (seq * 13) % 120;
+}
+
+/*
+ * append_record -- append the record of a thread with a sequence number
+ */
+static void
+append_record(uint32_t mytid, uint32_t seq)
+{
+	char buf[sizeof (struct record) + 120];
+	struct record *rec = (struct record *)buf;
+	size_t size = record_size(seq);
+
+	rec->thread = mytid;
+	rec->seq = seq;
+	memset(rec->data, (int)(mytid + seq), size - sizeof (*rec));
+
+	if (Serial)
+		pthread_mutex_lock(&Lock);
+
+	rec->ticket = Ticket++;
+
+	int ret;
+	if (mytid % 2) {
+		struct iovec iov[2] = {
+			{ .iov_base = rec, .iov_len = 4 },
+			{ .iov_base = buf + 4, .iov_len = size - 4 },
+		};
+		ret = pmemlog_appendv(Handle, iov, 2);
+	} else
+		ret = pmemlog_append(Handle, rec, size);
+
+	if (ret < 0)
+		FATAL("!append thread %u seq %u", mytid, seq);
+
+	if (Serial)
+		pthread_mutex_unlock(&Lock);
+}
+
+/*
+ * worker -- the work each thread performs
+ */
+static void *
+worker(void *arg)
+{
+	uint32_t mytid = (uint32_t)(long)arg;
+
+	for (uint32_t i = 0; i < Nops; i++)
+		append_record(mytid, i);
+
+	return NULL;
+}
+
+/*
+ * check_record -- walker callback checking one record
+ */
+static int
+check_record(const void *buf, size_t len, void *arg)
+{
+	const struct record *rec = buf;
+
+	Last = (const char *)buf - (const char *)Handle;
+
+	if (rec->thread > Nthread || rec->seq != Walked[rec->thread] ||
+			len != record_size(rec->seq)) {
+		Bad++;
+		return 1;
+	}
+
+	for (size_t i = 0; i < len - sizeof (*rec); i++)
+		if (rec->data[i] != (char)(rec->thread + rec->seq)) {
+			Bad++;
+			return 1;
+		}
+
+	/* nothing follows the record of the main thread */
+	if (Marker || (Serial && Nwalked && rec->ticket <= Last_ticket))
+		Bad++;
+
+	if (rec->thread == Nthread)
+		Marker = 1;
+
+	Walked[rec->thread]++;
+	Last_ticket = rec->ticket;
+	Nwalked++;
+
+	return 1;
+}
+
+/*
+ * do_walk -- walk the records and print how many were found
+ */
+static void
+do_walk(void)
+{
+	memset(Walked, 0, sizeof (Walked));
+	Nwalked = 0;
+	Bad = 0;
+	Marker = 0;
+
+	if (pmemlog_walk_records(Handle, check_record, NULL) < 0)
+		FATAL("!pmemlog_walk_records");
+
+	OUT("walked %u records", Nwalked);
+	if (Bad)
+		OUT("%u bad records", Bad);
+}
+
+/*
+ * do_check -- run the consistency check & print the result
+ */
+static void
+do_check(const char *path)
+{
+	int result = pmemlog_check(path);
+	if (result < 0)
+		OUT("!%s: pmemlog_check", path);
+	else if (result == 0)
+		OUT("%s: pmemlog_check: not consistent", path);
+}
+
+int
+main(int argc, char *argv[])
+{
+	START(argc, argv, "log_lanes");
+
+	if (argc != 6)
+		FATAL("usage: %s file nlanes nthread nops serial", argv[0]);
+
+	const char *path = argv[1];
+	unsigned nlanes = strtoul(argv[2], NULL, 0);
+	Nthread = strtoul(argv[3], NULL, 0);
+	Nops = strtoul(argv[4], NULL, 0);
+	Serial = atoi(argv[5]);
+
+	if (Nthread == 0 || Nthread > MAX_THREADS)
+		FATAL("invalid number of threads: %s", argv[3]);
+
+	if ((Handle = pmemlog_create_lanes(path, PMEMLOG_MIN_POOL, S_IWUSR,
+			nlanes)) == NULL)
+		FATAL("!%s: pmemlog_create_lanes", path);
+
+	OUT("nbyte %zu", pmemlog_nbyte(Handle));
+
+	pthread_t threads[Nthread];
+
+	/* kick off nthread threads */
+	for (unsigned i = 0; i < Nthread; i++)
+		PTHREAD_CREATE(&threads[i], NULL, worker, (void *)(long)i);
+
+	/* wait for all the threads to complete */
+	for (unsigned i = 0; i < Nthread; i++)
+		PTHREAD_JOIN(threads[i], NULL);
+
+	OUT("appended %u records, tell %lld", Nthread * Nops,
+			(long long)pmemlog_tell(Handle));
+
+	/* a log of lanes can only be walked by records */
+	pmemlog_walk(Handle, 0, check_record, NULL);
+	OUT("pmemlog_walk: %s", strerror(errno));
+
+	do_walk();
+
+	pmemlog_close(Handle);
+
+	do_check(path);
+
+	/* tear the last record */
+	int fd = OPEN(path, O_RDWR);
+	char c;
+	LSEEK(fd, Last, SEEK_SET);
+	READ(fd, &c, 1);
+	c = ~c;
+	LSEEK(fd, Last, SEEK_SET);
+	WRITE(fd, &c, 1);
+	CLOSE(fd);
+
+	do_check(path);
+
+	/* the torn record gets cut off */
+	if ((Handle = pmemlog_open(path)) == NULL)
+		FATAL("!%s: pmemlog_open", path);
+
+	do_walk();
+
+	/* the sequence numbers go on where they left off */
+	append_record(Nthread, 0);
+
+	do_walk();
+
+	pmemlog_rewind(Handle);
+
+	OUT("rewound, tell %lld", (long long)pmemlog_tell(Handle));
+
+	do_walk();
+
+	pmemlog_close(Handle);
+
+	do_check(path);
+
+	DONE(NULL);
+}
@@ -0,0 +1,138 @@
+/*
+ * Copyright (c) 2015, Intel Corporation
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in
+ *       the documentation and/or other materials provided with the
+ *       distribution.
+ *
+ *     * Neither the name of Intel Corporation nor the names of its
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * log_tail.c -- unit test for following a log as it grows
+ *
+ * usage: log_tail file nrecords
+ *
+ * A producer thread appends nrecords 64-byte records to a newly created
+ * log, pausing now and then, while the main thread follows the log with
+ * pmemlog_wait() and pmemlog_read_from(), checking each record it reads.
+ */
+
+#include "unittest.h"
+
+struct record {
+	uint64_t seq;
+	char data[56];
+};
+
+static PMEMlogpool *Handle;
+static unsigned Nrecords;
+
+/*
+ * producer -- append the records
+ */
+static void *
+producer(void *arg)
+{
+	struct record rec;
+
+	for (uint64_t seq = 0; seq < Nrecords; seq++) {
+		rec.seq = seq;
+		memset(rec.data, (int)seq, sizeof (rec.data));
+
+		if (pmemlog_append(Handle, &rec, sizeof (rec)) < 0)
+			FATAL("!append %ju", seq);
+
+		/* let the consumer catch up now and then */
+		if (seq % 16 == 0)
+			usleep(100);
+	}
+
+	return NULL;
+}
+
+int
+main(int argc, char *argv[])
+{
+	START(argc, argv, "log_tail");
+
+	if (argc != 3)
+		FATAL("usage: %s file nrecords", argv[0]);
+
+	const char *path = argv[1];
+	Nrecords = strtoul(argv[2], NULL, 0);
+
+	if ((Handle = pmemlog_create(path, PMEMLOG_MIN_POOL, S_IWUSR)) ==
+			NULL)
+		FATAL("!%s: pmemlog_create", path);
+
+	/* nothing to wait for yet */
+	if (pmemlog_wait(Handle, 0, 10) < 0 && errno == ETIMEDOUT)
+		OUT("wait timed out");
+
+	pthread_t thread;
+	PTHREAD_CREATE(&thread, NULL, producer, NULL);
+
+	struct record recs[64];
+	off_t pos = 0;
+	uint64_t seq = 0;
+
+	while (seq < Nrecords) {
+		if (pmemlog_wait(Handle, pos, -1) <= pos)
+			FATAL("!pmemlog_wait");
+
+		ssize_t len = pmemlog_read_from(Handle, pos, recs,
+				sizeof (recs));
+		if (len <= 0 || len % sizeof (recs[0]))
+			FATAL("!pmemlog_read_from %zd", len);
+
+		for (size_t i = 0; i < len / sizeof (recs[0]); i++, seq++) {
+			if (recs[i].seq != seq)
+				FATAL("record %ju: seq %ju", seq, recs[i].seq);
+			for (size_t j = 0; j < sizeof (recs[i].data); j++)
+				if (recs[i].data[j] != (char)seq)
+					FATAL("record %ju: bad data", seq);
+		}
+
+		pos += len;
+	}
+
+	PTHREAD_JOIN(thread, NULL);
+
+	OUT("followed %ju records", seq);
+
+	if (pmemlog_read_from(Handle, pos, recs, sizeof (recs)) == 0)
+		OUT("read_from the end returned nothing");
+
+	if (pmemlog_wait(Handle, pos, 10) < 0 && errno == ETIMEDOUT)
+		OUT("wait timed out");
+
+	if (pmemlog_read_from(Handle, -1, recs, sizeof (recs)) < 0)
+		OUT("!read_from -1");
+
+	pmemlog_close(Handle);
+
+	DONE(NULL);
+}
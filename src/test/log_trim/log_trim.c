@@ -0,0 +1,370 @@
+/*
+ * Copyright (c) 2015, Intel Corporation
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in
+ *       the documentation and/or other materials provided with the
+ *       distribution.
+ *
+ *     * Neither the name of Intel Corporation nor the names of its
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * log_trim.c -- unit test for pmemlog_trim
+ *
+ * usage: log_trim file type
+ *
+ * type is 'l' for a linear log, 'c' for a circular one and 'r' for a log
+ * of records.  64-byte records are appended, trimmed off and walked, with
+ * the data kept getting moved to the beginning of a linear log.  Then
+ * the log is kept trimmed while many times its size is appended.  For
+ * linear logs, a rewind interrupted by a crash is simulated at the end by
+ * setting the head_offset past the write_offset, and then compactions
+ * interrupted by a crash, after a trim that didn't move the data.
+ */
+
+#include <sys/param.h>
+#include "unittest.h"
+#include "util.h"
+#include "log.h"
+
+struct record {
+	uint64_t seq;
+	char data[56];
+};
+
+static char Type;
+static size_t Stride;		/* space a record takes in the log */
+static uint64_t Next;		/* sequence number of the next record */
+static uint64_t Walked;		/* sequence number expected by the walk */
+static uint64_t Nwalked;	/* records walked */
+
+/*
+ * do_append -- append count records
+ */
+static void
+do_append(PMEMlogpool *plp, unsigned count)
+{
+	struct record rec;
+
+	for (unsigned i = 0; i < count; i++) {
+		rec.seq = Next++;
+		memset(rec.data, (char)rec.seq, sizeof (rec.data));
+
+		if (pmemlog_append(plp, &rec, sizeof (rec)) < 0)
+			FATAL("!append %ju", rec.seq);
+	}
+}
+
+/*
+ * check_record -- walk callback checking the records come in order
+ */
+static int
+check_record(const void *buf, size_t len, void *arg)
+{
+	const struct record *rec = buf;
+
+	if (len != sizeof (*rec))
+		FATAL("record of %zu bytes", len);
+
+	if (Nwalked == 0)
+		Walked = rec->seq;
+	else if (rec->seq != Walked)
+		FATAL("record %ju instead of %ju", rec->seq, Walked);
+
+	for (size_t j = 0; j < sizeof (rec->data); j++)
+		if (rec->data[j] != (char)rec->seq)
+			FATAL("record %ju: bad data", rec->seq);
+
+	Walked++;
+	Nwalked++;
+
+	return 1;
+}
+
+/*
+ * do_walk -- walk the log and print the range of records found
+ */
+static void
+do_walk(PMEMlogpool *plp)
+{
+	Nwalked = 0;
+
+	if (Type == 'r') {
+		if (pmemlog_walk_records(plp, check_record, NULL) < 0)
+			FATAL("!pmemlog_walk_records");
+	} else
+		pmemlog_walk(plp, sizeof (struct record), check_record, NULL);
+
+	if (Nwalked)
+		OUT("records %ju..%ju", Walked - Nwalked, Walked - 1);
+	else
+		OUT("no records");
+}
+
+/*
+ * do_read -- print the record at a position
+ */
+static void
+do_read(PMEMlogpool *plp, off_t pos)
+{
+	char buf[sizeof (struct log_record) + sizeof (struct record)];
+	struct record *rec = (struct record *)buf;
+
+	if (Type == 'r')
+		rec = (struct record *)(buf + sizeof (struct log_record));
+
+	if (pmemlog_read_from(plp, pos, buf, Stride) < 0)
+		OUT("!read_from %lld", (long long)pos);
+	else
+		OUT("read_from %lld: record %ju", (long long)pos, rec->seq);
+}
+
+/*
+ * do_trim -- trim the log and print where the data kept starts
+ */
+static off_t
+do_trim(PMEMlogpool *plp, off_t offset)
+{
+	off_t ret = pmemlog_trim(plp, offset);
+
+	if (ret < 0)
+		OUT("!trim %lld", (long long)offset);
+	else
+		OUT("trim %lld: %lld, tell %lld", (long long)offset,
+				(long long)ret, (long long)pmemlog_tell(plp));
+
+	return ret;
+}
+
+/*
+ * get_offset -- read an offset from the pool descriptor
+ */
+static uint64_t
+get_offset(int fd, off_t field)
+{
+	uint64_t offset;
+
+	LSEEK(fd, field, SEEK_SET);
+	READ(fd, &offset, sizeof (offset));
+
+	return le64toh(offset);
+}
+
+/*
+ * set_offset -- write an offset to the pool descriptor
+ */
+static void
+set_offset(int fd, off_t field, uint64_t offset)
+{
+	offset = htole64(offset);
+
+	LSEEK(fd, field, SEEK_SET);
+	WRITE(fd, &offset, sizeof (offset));
+}
+
+/*
+ * do_crash -- leave the pool as a crash in the middle of a compaction would
+ *
+ * The compaction trims the log at position pos.  copied is how much of the
+ * data kept got moved to the start of the log, and if moved is true, the
+ * write_offset got updated too.
+ */
+static void
+do_crash(const char *path, off_t pos, size_t copied, int moved)
+{
+	int fd = OPEN(path, O_RDWR);
+	uint64_t start = get_offset(fd, offsetof(struct pmemlog,
+			start_offset));
+	uint64_t write_offset = get_offset(fd, offsetof(struct pmemlog,
+			write_offset));
+	uint64_t head = start + (uint64_t)pos;
+	uint64_t kept = write_offset - head;
+
+	set_offset(fd, offsetof(struct pmemlog, head_offset), head);
+	set_offset(fd, offsetof(struct pmemlog, compact_offset),
+			start + kept);
+
+	char *buf = MALLOC(copied);
+
+	LSEEK(fd, (off_t)head, SEEK_SET);
+	READ(fd, buf, copied);
+	LSEEK(fd, (off_t)start, SEEK_SET);
+	WRITE(fd, buf, copied);
+
+	FREE(buf);
+
+	if (moved)
+		set_offset(fd, offsetof(struct pmemlog, write_offset),
+				start + kept);
+
+	CLOSE(fd);
+}
+
+/*
+ * do_check -- print the result of a consistency check
+ */
+static void
+do_check(const char *path)
+{
+	int result = pmemlog_check(path);
+
+	if (result < 0)
+		OUT("!%s: pmemlog_check", path);
+	else if (result == 0)
+		OUT("%s: pmemlog_check: not consistent", path);
+	else
+		OUT("%s: consistent", path);
+}
+
+int
+main(int argc, char *argv[])
+{
+	PMEMlogpool *plp;
+
+	START(argc, argv, "log_trim");
+
+	if (argc != 3 || strchr("lcr", argv[2][0]) == NULL)
+		FATAL("usage: %s file l|c|r", argv[0]);
+
+	const char *path = argv[1];
+	Type = argv[2][0];
+
+	Stride = sizeof (struct record);
+	if (Type == 'l')
+		plp = pmemlog_create(path, PMEMLOG_MIN_POOL, S_IWUSR);
+	else if (Type == 'c')
+		plp = pmemlog_create_circular(path, PMEMLOG_MIN_POOL, S_IWUSR);
+	else {
+		plp = pmemlog_create_records(path, PMEMLOG_MIN_POOL, S_IWUSR,
+				0);
+		Stride = roundup(sizeof (struct log_record) + Stride,
+				LOG_RECORD_ALIGN);
+	}
+
+	if (plp == NULL)
+		FATAL("!%s: create", path);
+
+	do_append(plp, 1000);
+	OUT("tell %lld", (long long)pmemlog_tell(plp));
+
+	/* more data kept than discarded, nothing moves */
+	do_trim(plp, 100 * Stride);
+	do_read(plp, 0);
+	do_read(plp, 100 * Stride);
+	do_walk(plp);
+
+	/* less data kept than discarded, moved in a linear log */
+	off_t pos = do_trim(plp, 600 * Stride);
+	do_read(plp, pos);
+	do_walk(plp);
+
+	/* trimming before the data kept does nothing */
+	do_trim(plp, 0);
+
+	/* past the end of the log */
+	do_trim(plp, pos + 400 * Stride + 1);
+
+	/* a log of records is trimmed between records only */
+	if (Type == 'r')
+		do_trim(plp, pos + 1);
+
+	pmemlog_close(plp);
+
+	if ((plp = pmemlog_open(path)) == NULL)
+		FATAL("!%s: pmemlog_open", path);
+
+	OUT("tell %lld", (long long)pmemlog_tell(plp));
+	do_walk(plp);
+
+	/* keep the last 100 records, appending more than the log holds */
+	for (int i = 0; i < 200; i++) {
+		do_append(plp, 500);
+
+		off_t end = pmemlog_wait(plp, 0, 0);
+		off_t keep = end - 100 * (off_t)Stride;
+
+		if ((pos = pmemlog_trim(plp, keep)) < 0)
+			FATAL("!trim %lld", (long long)keep);
+	}
+
+	OUT("appended %ju records", Next);
+	OUT("tell %lld", (long long)pmemlog_tell(plp));
+	do_read(plp, pos);
+	do_walk(plp);
+
+	pmemlog_close(plp);
+
+	if (Type != 'c') {
+		/* a crash between the updates of a rewind */
+		int fd = OPEN(path, O_RDWR);
+		uint64_t write_offset = get_offset(fd,
+				offsetof(struct pmemlog, write_offset));
+
+		set_offset(fd, offsetof(struct pmemlog, head_offset),
+				write_offset + 50 * Stride);
+		CLOSE(fd);
+
+		do_check(path);
+
+		if ((plp = pmemlog_open(path)) == NULL)
+			FATAL("!%s: pmemlog_open", path);
+
+		do_walk(plp);
+		do_append(plp, 1);
+		do_walk(plp);
+
+		/* a trim that doesn't move the data comes first */
+		pmemlog_rewind(plp);
+		do_append(plp, 1000);
+		do_trim(plp, 100 * Stride);
+		pmemlog_close(plp);
+
+		/* half of the data kept copied over the data trimmed off */
+		do_crash(path, 600 * Stride, 200 * Stride, 0);
+		do_check(path);
+
+		if ((plp = pmemlog_open(path)) == NULL)
+			FATAL("!%s: pmemlog_open", path);
+
+		OUT("tell %lld", (long long)pmemlog_tell(plp));
+		do_walk(plp);
+		pmemlog_close(plp);
+
+		/* as much data kept as trimmed off, all of it moved */
+		do_crash(path, 200 * Stride, 200 * Stride, 1);
+		do_check(path);
+
+		if ((plp = pmemlog_open(path)) == NULL)
+			FATAL("!%s: pmemlog_open", path);
+
+		OUT("tell %lld", (long long)pmemlog_tell(plp));
+		do_walk(plp);
+		pmemlog_close(plp);
+	}
+
+	do_check(path);
+
+	DONE(NULL);
+}
@@ -0,0 +1,225 @@
+/*
+ * Copyright (c) 2015, Intel Corporation
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in
+ *       the documentation and/or other materials provided with the
+ *       distribution.
+ *
+ *     * Neither the name of Intel Corporation nor the names of its
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * log_walk_mt.c -- unit test for walks running alongside appends
+ *
+ * usage: log_walk_mt file nbefore nduring r|t
+ *
+ * Appends nbefore records, then starts a walk which stalls in its first
+ * callback.  While it's stalled, nduring more records get appended and
+ * another thread rewinds the log (r) or trims all of it but the last
+ * record (t).  The appends have to complete, the rewind or trim has to
+ * wait for the walk, the walk has to be able to tell the position in
+ * the log meanwhile, and it has to see exactly the records appended
+ * before it started.
+ */
+
+#include "unittest.h"
+
+struct record {
+	uint64_t seq;
+	char data[56];
+};
+
+static PMEMlogpool *Handle;
+static unsigned Walked;
+static int Stalled;		/* the walk is in its first callback */
+static int Resume;		/* the walk may go on */
+static int Changed;		/* the rewind or trim has completed */
+static char Op;			/* r to rewind, t to trim */
+static unsigned Nrecords;	/* records in the log before the change */
+static pthread_mutex_t Lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t Cond = PTHREAD_COND_INITIALIZER;
+
+/*
+ * do_append -- append a record with the given sequence number
+ */
+static void
+do_append(uint64_t seq)
+{
+	struct record rec;
+
+	rec.seq = seq;
+	memset(rec.data, (int)seq, sizeof (rec.data));
+
+	if (pmemlog_append(Handle, &rec, sizeof (rec)) < 0)
+		FATAL("!append %ju", seq);
+}
+
+/*
+ * set_flag -- set a flag and wake up whoever waits for it
+ */
+static void
+set_flag(int *flag)
+{
+	pthread_mutex_lock(&Lock);
+	*flag = 1;
+	pthread_cond_broadcast(&Cond);
+	pthread_mutex_unlock(&Lock);
+}
+
+/*
+ * wait_flag -- wait for a flag to be set
+ */
+static void
+wait_flag(int *flag)
+{
+	pthread_mutex_lock(&Lock);
+	while (!*flag)
+		pthread_cond_wait(&Cond, &Lock);
+	pthread_mutex_unlock(&Lock);
+}
+
+/*
+ * check_record -- walker callback, stalls on the first record
+ */
+static int
+check_record(const void *buf, size_t len, void *arg)
+{
+	const struct record *rec = buf;
+
+	if (Walked == 0) {
+		set_flag(&Stalled);
+		wait_flag(&Resume);
+
+		/* the log waits for the walk to change, but can be read */
+		OUT("tell %lld nbyte %zu during the walk",
+				(long long)pmemlog_tell(Handle),
+				pmemlog_nbyte(Handle));
+	}
+
+	if (len != sizeof (*rec) || rec->seq != Walked)
+		FATAL("bad record %u", Walked);
+
+	Walked++;
+
+	return 1;
+}
+
+/*
+ * walker -- walk the log record by record
+ */
+static void *
+walker(void *arg)
+{
+	pmemlog_walk(Handle, sizeof (struct record), check_record, NULL);
+
+	return NULL;
+}
+
+/*
+ * changer -- rewind the log or trim all of it but the last record
+ */
+static void *
+changer(void *arg)
+{
+	if (Op == 'r')
+		pmemlog_rewind(Handle);
+	else {
+		off_t last = (off_t)(Nrecords - 1) * sizeof (struct record);
+		off_t ret = pmemlog_trim(Handle, last);
+		if (ret < 0)
+			FATAL("!pmemlog_trim");
+		OUT("trimmed to %lld", (long long)ret);
+	}
+
+	set_flag(&Changed);
+
+	return NULL;
+}
+
+int
+main(int argc, char *argv[])
+{
+	START(argc, argv, "log_walk_mt");
+
+	if (argc != 5 || strchr("rt", argv[4][0]) == NULL ||
+			argv[4][1] != '\0')
+		FATAL("usage: %s file nbefore nduring r|t", argv[0]);
+
+	const char *path = argv[1];
+	unsigned nbefore = strtoul(argv[2], NULL, 0);
+	unsigned nduring = strtoul(argv[3], NULL, 0);
+	Op = argv[4][0];
+	Nrecords = nbefore + nduring;
+
+	if (nbefore == 0)
+		FATAL("nbefore has to be at least 1");
+
+	if ((Handle = pmemlog_create(path, PMEMLOG_MIN_POOL, S_IWUSR)) ==
+			NULL)
+		FATAL("!%s: pmemlog_create", path);
+
+	for (unsigned i = 0; i < nbefore; i++)
+		do_append(i);
+
+	pthread_t walk_thread;
+	pthread_t change_thread;
+
+	PTHREAD_CREATE(&walk_thread, NULL, walker, NULL);
+	wait_flag(&Stalled);
+
+	/* appends don't wait for the walk */
+	for (unsigned i = 0; i < nduring; i++)
+		do_append(nbefore + i);
+
+	OUT("appended %u records during the walk", nduring);
+
+	/* rewinds and trims moving the data do */
+	PTHREAD_CREATE(&change_thread, NULL, changer, NULL);
+	usleep(100000);
+
+	pthread_mutex_lock(&Lock);
+	if (Changed)
+		OUT("%s didn't wait for the walk",
+				Op == 'r' ? "rewind" : "trim");
+	pthread_mutex_unlock(&Lock);
+
+	set_flag(&Resume);
+
+	PTHREAD_JOIN(walk_thread, NULL);
+	PTHREAD_JOIN(change_thread, NULL);
+
+	OUT("walked %u records", Walked);
+	OUT("tell %lld", (long long)pmemlog_tell(Handle));
+
+	pmemlog_close(Handle);
+
+	int result = pmemlog_check(path);
+	if (result < 0)
+		OUT("!%s: pmemlog_check", path);
+	else if (result == 0)
+		OUT("%s: pmemlog_check: not consistent", path);
+
+	DONE(NULL);
+}
@@ -0,0 +1,109 @@
+/*
+ * Copyright (c) 2015, Intel Corporation
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in
+ *       the documentation and/or other materials provided with the
+ *       distribution.
+ *
+ *     * Neither the name of Intel Corporation nor the names of its
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * pmem_domain.c -- unit test for persist domains
+ *
+ * usage: pmem_domain file op...
+ *
+ * ops:
+ *	b		pmem_domain_begin()
+ *	f:off:len	store to the range, then pmem_domain_flush() it
+ *	s:off		store a single byte, without flushing it
+ *	c		pmem_domain_commit()
+ */
+
+#include "unittest.h"
+
+int
+main(int argc, char *argv[])
+{
+	START(argc, argv, "pmem_domain");
+
+	if (argc < 3)
+		FATAL("usage: %s file op...", argv[0]);
+
+	int fd = OPEN(argv[1], O_RDWR);
+
+	struct stat stbuf;
+	FSTAT(fd, &stbuf);
+
+	char *dest = pmem_map(fd);
+	if (dest == NULL)
+		FATAL("!Could not mmap %s\n", argv[1]);
+
+	char c = 'A';
+	for (int arg = 2; arg < argc; arg++) {
+		size_t off;
+		size_t len;
+
+		switch (argv[arg][0]) {
+		case 'b':
+			pmem_domain_begin();
+			break;
+		case 'f':
+			if (sscanf(argv[arg], "f:%zu:%zu", &off, &len) != 2 ||
+					off + len > stbuf.st_size)
+				FATAL("invalid op: %s", argv[arg]);
+			memset(dest + off, c++, len);
+			pmem_domain_flush(dest + off, len);
+			break;
+		case 's':
+			if (sscanf(argv[arg], "s:%zu", &off) != 1 ||
+					off >= stbuf.st_size)
+				FATAL("invalid op: %s", argv[arg]);
+			dest[off] = c++;
+			break;
+		case 'c':
+			pmem_domain_commit();
+			break;
+		default:
+			FATAL("invalid op: %s", argv[arg]);
+		}
+		OUT("%s", argv[arg]);
+	}
+
+	/* the file contents must match what was stored */
+	char *buf = MALLOC(stbuf.st_size);
+	LSEEK(fd, (off_t)0, SEEK_SET);
+	if (READ(fd, buf, stbuf.st_size) != stbuf.st_size)
+		FATAL("short read from %s", argv[1]);
+
+	if (memcmp(buf, dest, stbuf.st_size))
+		ERR("%s: file contents do not match", argv[1]);
+
+	FREE(buf);
+	pmem_unmap(dest, stbuf.st_size);
+	CLOSE(fd);
+
+	DONE(NULL);
+}
@@ -34,15 +34,20 @@
  * pmem_is_pmem_proc.c -- unit test for pmem_is_pmem() /proc parsing
  *
  * usage: pmem_is_pmem_proc file addr len [addr len]...
+ *
+ * An addr of "file" switches to the fake smaps file given as len.
  */
 
 #define	_GNU_SOURCE
 #include "unittest.h"
 
 #include <dlfcn.h>
+#include <sys/sysmacros.h>
 
 char *Sfile;
 
+#define	MAP_FILES "/proc/self/map_files/"
+
 /*
  * fopen -- interpose on libc fopen()
  *
@@ -65,6 +70,57 @@ fopen(const char *path, const char *mode)
 	return (*fopen_ptr)(path, mode);
 }
 
+/*
+ * stat -- interpose on libc stat()
+ *
+ * This catches lookups of /proc/self/map_files entries and answers them
+ * from the fake smaps file, as if its ranges were mapped.
+ */
+int
+stat(const char *path, struct stat *buf)
+{
+	static int (*stat_ptr)(const char *path, struct stat *buf);
+
+	if (strncmp(path, MAP_FILES, sizeof (MAP_FILES) - 1) == 0) {
+		uintptr_t lo, hi;
+		if (sscanf(path + sizeof (MAP_FILES) - 1, "%lx-%lx",
+				&lo, &hi) != 2) {
+			errno = ENOENT;
+			return -1;
+		}
+
+		FILE *fp = fopen(Sfile, "r");
+		if (fp == NULL)
+			return -1;
+
+		char line[2048];
+		while (fgets(line, sizeof (line), fp) != NULL) {
+			uintptr_t slo, shi;
+			unsigned major, minor;
+			unsigned long ino;
+
+			if (sscanf(line, "%lx-%lx %*s %*s %x:%x %lu", &slo,
+					&shi, &major, &minor, &ino) == 5 &&
+					slo == lo && shi == hi && ino != 0) {
+				fclose(fp);
+				memset(buf, 0, sizeof (*buf));
+				buf->st_dev = makedev(major, minor);
+				buf->st_ino = ino;
+				return 0;
+			}
+		}
+
+		fclose(fp);
+		errno = ENOENT;
+		return -1;
+	}
+
+	if (stat_ptr == NULL)
+		stat_ptr = dlsym(RTLD_NEXT, "stat");
+
+	return (*stat_ptr)(path, buf);
+}
+
 int
 main(int argc, char *argv[])
 {
@@ -79,6 +135,13 @@ main(int argc, char *argv[])
 		void *addr;
 		size_t len;
 
+		/* "file smaps-file" switches to another fake smaps file */
+		if (strcmp(argv[arg], "file") == 0) {
+			Sfile = argv[arg + 1];
+			OUT("mappings are now %s", Sfile);
+			continue;
+		}
+
 		addr = (void *)strtoull(argv[arg], NULL, 16);
 		len = (size_t)strtoull(argv[arg + 1], NULL, 10);
 		OUT("addr %p, len %zu: %d", addr, len, pmem_is_pmem(addr, len));
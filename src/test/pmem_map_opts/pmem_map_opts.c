@@ -0,0 +1,97 @@
+/*
+ * Copyright (c) 2015, Intel Corporation
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in
+ *       the documentation and/or other materials provided with the
+ *       distribution.
+ *
+ *     * Neither the name of Intel Corporation nor the names of its
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * pmem_map_opts.c -- unit test for the mapping options
+ *
+ * usage: pmem_map_opts file align
+ *
+ * Maps the file with the PMEM_MAP_* options taken from the environment,
+ * checks that the mapping is aligned to align bytes and that the file
+ * contents are visible through it.
+ */
+
+#include "unittest.h"
+
+#define	CHECK_BYTES 4096	/* bytes to compare before/after map call */
+
+int
+main(int argc, char *argv[])
+{
+	START(argc, argv, "pmem_map_opts");
+
+	if (argc != 3)
+		FATAL("usage: %s file align", argv[0]);
+
+	size_t align = (size_t)strtoull(argv[2], NULL, 0);
+
+	int fd = OPEN(argv[1], O_RDWR);
+
+	struct stat stbuf;
+	FSTAT(fd, &stbuf);
+
+	char pat[CHECK_BYTES];
+	char buf[CHECK_BYTES];
+
+	/* write some pattern to the end of the file */
+	memset(pat, 0x5A, CHECK_BYTES);
+	LSEEK(fd, stbuf.st_size - CHECK_BYTES, SEEK_SET);
+	WRITE(fd, pat, CHECK_BYTES);
+
+	char *addr = pmem_map(fd);
+	if (addr == NULL)
+		FATAL("!pmem_map");
+
+	if ((uintptr_t)addr & (align - 1))
+		OUT("mapping %p not aligned to %zu", addr, align);
+
+	char *end = addr + stbuf.st_size - CHECK_BYTES;
+	if (memcmp(pat, end, CHECK_BYTES))
+		OUT("%s: last %d bytes do not match", argv[1], CHECK_BYTES);
+
+	/* fill up the end of the mapped region with new pattern */
+	memset(pat, 0xA5, CHECK_BYTES);
+	memcpy(end, pat, CHECK_BYTES);
+
+	pmem_unmap(addr, stbuf.st_size);
+
+	LSEEK(fd, stbuf.st_size - CHECK_BYTES, SEEK_SET);
+	if (READ(fd, buf, CHECK_BYTES) == CHECK_BYTES) {
+		if (memcmp(pat, buf, CHECK_BYTES))
+			OUT("%s: last %d bytes do not match",
+				argv[1], CHECK_BYTES);
+	}
+
+	CLOSE(fd);
+
+	DONE(NULL);
+}
@@ -0,0 +1,94 @@
+/*
+ * Copyright (c) 2015, Intel Corporation
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in
+ *       the documentation and/or other materials provided with the
+ *       distribution.
+ *
+ *     * Neither the name of Intel Corporation nor the names of its
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * pmem_memcpy_mt.c -- unit test for pmem_memcpy_persist_mt()
+ *
+ * usage: pmem_memcpy_mt file dest_off len nthreads
+ */
+
+#include "unittest.h"
+
+int
+main(int argc, char *argv[])
+{
+	START(argc, argv, "pmem_memcpy_mt");
+
+	if (argc != 5)
+		FATAL("usage: %s file dest_off len nthreads", argv[0]);
+
+	int fd = OPEN(argv[1], O_RDWR);
+	size_t dest_off = strtoul(argv[2], NULL, 0);
+	size_t len = strtoul(argv[3], NULL, 0);
+	unsigned nthreads = strtoul(argv[4], NULL, 0);
+
+	struct stat stbuf;
+	FSTAT(fd, &stbuf);
+
+	if (dest_off + len > stbuf.st_size)
+		FATAL("%s: file too small", argv[1]);
+
+	char *dest = pmem_map(fd);
+	if (dest == NULL)
+		FATAL("!Could not mmap %s\n", argv[1]);
+
+	/* a pattern that differs in every page */
+	char *src = MALLOC(len);
+	for (size_t i = 0; i < len; i++)
+		src[i] = (char)(i ^ (i >> 12));
+
+	memset(dest, 0, stbuf.st_size);
+
+	void *ret = pmem_memcpy_persist_mt(dest + dest_off, src, len,
+			nthreads);
+	if (ret != dest + dest_off)
+		ERR("pmem_memcpy_persist_mt returned %p, expected %p",
+			ret, dest + dest_off);
+
+	if (memcmp(dest + dest_off, src, len))
+		ERR("%s: copied bytes do not match", argv[1]);
+
+	char *buf = MALLOC(len);
+	LSEEK(fd, (off_t)dest_off, SEEK_SET);
+	if (READ(fd, buf, len) != len)
+		FATAL("short read from %s", argv[1]);
+
+	if (memcmp(buf, src, len))
+		ERR("%s: file contents do not match", argv[1]);
+
+	FREE(buf);
+	FREE(src);
+	pmem_unmap(dest, stbuf.st_size);
+	CLOSE(fd);
+
+	DONE(NULL);
+}
@@ -0,0 +1,101 @@
+/*
+ * Copyright (c) 2015, Intel Corporation
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in
+ *       the documentation and/or other materials provided with the
+ *       distribution.
+ *
+ *     * Neither the name of Intel Corporation nor the names of its
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * pmem_persist_v.c -- unit test for pmem_flush_v() and pmem_persist_v()
+ *
+ * usage: pmem_persist_v file off:len...
+ */
+
+#include "unittest.h"
+
+#define	MAX_IOV 64
+
+int
+main(int argc, char *argv[])
+{
+	START(argc, argv, "pmem_persist_v");
+
+	if (argc < 3 || argc - 2 > MAX_IOV)
+		FATAL("usage: %s file off:len...", argv[0]);
+
+	int fd = OPEN(argv[1], O_RDWR);
+
+	struct stat stbuf;
+	FSTAT(fd, &stbuf);
+
+	char *dest = pmem_map(fd);
+	if (dest == NULL)
+		FATAL("!Could not mmap %s\n", argv[1]);
+
+	memset(dest, 0, stbuf.st_size);
+
+	struct iovec iov[MAX_IOV];
+	int iovcnt = 0;
+	for (int arg = 2; arg < argc; arg++) {
+		size_t off;
+		size_t len;
+
+		if (sscanf(argv[arg], "%zu:%zu", &off, &len) != 2)
+			FATAL("invalid range: %s", argv[arg]);
+		if (off + len > stbuf.st_size)
+			FATAL("range past end of file: %s", argv[arg]);
+
+		memset(dest + off, 'A' + iovcnt, len);
+
+		iov[iovcnt].iov_base = dest + off;
+		iov[iovcnt].iov_len = len;
+		iovcnt++;
+	}
+
+	pmem_persist_v(iov, iovcnt);
+
+	/* the file contents must match what was stored in each range */
+	char *buf = MALLOC(stbuf.st_size);
+	LSEEK(fd, (off_t)0, SEEK_SET);
+	if (READ(fd, buf, stbuf.st_size) != stbuf.st_size)
+		FATAL("short read from %s", argv[1]);
+
+	if (memcmp(buf, dest, stbuf.st_size))
+		ERR("%s: file contents do not match", argv[1]);
+
+	for (int i = 0; i < iovcnt; i++)
+		OUT("range %d: off %zu len %zu", i,
+			(size_t)((char *)iov[i].iov_base - dest),
+			iov[i].iov_len);
+
+	FREE(buf);
+	pmem_unmap(dest, stbuf.st_size);
+	CLOSE(fd);
+
+	DONE(NULL);
+}
@@ -0,0 +1,123 @@
+/*
+ * Copyright (c) 2015, Intel Corporation
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in
+ *       the documentation and/or other materials provided with the
+ *       distribution.
+ *
+ *     * Neither the name of Intel Corporation nor the names of its
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * pmem_stats.c -- unit test for pmem_stats_get()
+ *
+ * usage: pmem_stats file op...
+ *
+ * Runs the ops on the memory mapped file, then prints the statistics.
+ * The bytes copied by the movnt engines are summed up, since the engine
+ * used depends on the CPU.
+ *
+ * ops:
+ *	f:off:len	pmem_flush() the range
+ *	d		pmem_drain()
+ *	m:off:len	pmem_memcpy_nodrain() to the range
+ *	s:off:len	pmem_memset_nodrain() the range
+ *	y:off:len	pmem_msync() the range
+ */
+
+#include "unittest.h"
+
+int
+main(int argc, char *argv[])
+{
+	START(argc, argv, "pmem_stats");
+
+	if (argc < 3)
+		FATAL("usage: %s file op...", argv[0]);
+
+	int fd = OPEN(argv[1], O_RDWR);
+
+	struct stat stbuf;
+	FSTAT(fd, &stbuf);
+	size_t size = stbuf.st_size;
+
+	char *dest = pmem_map(fd);
+	if (dest == NULL)
+		FATAL("!Could not mmap %s\n", argv[1]);
+
+	char *src = MALLOC(size);
+	memset(src, 0x5a, size);
+
+	for (int i = 2; i < argc; i++) {
+		size_t off = 0;
+		size_t len = 0;
+
+		if (argv[i][0] != 'd') {
+			if (sscanf(argv[i] + 1, ":%zu:%zu", &off, &len) != 2 ||
+					off + len > size)
+				FATAL("invalid op: %s", argv[i]);
+		}
+
+		switch (argv[i][0]) {
+		case 'f':
+			pmem_flush(dest + off, len);
+			break;
+		case 'd':
+			pmem_drain();
+			break;
+		case 'm':
+			pmem_memcpy_nodrain(dest + off, src, len);
+			break;
+		case 's':
+			pmem_memset_nodrain(dest + off, 0x5a, len);
+			break;
+		case 'y':
+			pmem_msync(dest + off, len);
+			break;
+		default:
+			FATAL("invalid op: %s", argv[i]);
+		}
+	}
+
+	struct pmem_stats s;
+	s.size = sizeof (s);
+	pmem_stats_get(&s);
+
+	OUT("flushes %llu lines %llu drains %llu",
+		s.flushes, s.flush_lines, s.drains);
+	OUT("msyncs %llu bytes %llu", s.msyncs, s.msync_bytes);
+	OUT("memmove normal %llu movnt %llu", s.memmove_normal_bytes,
+		s.memmove_sse2_bytes + s.memmove_avx2_bytes +
+		s.memmove_avx512f_bytes);
+	OUT("memset normal %llu movnt %llu", s.memset_normal_bytes,
+		s.memset_sse2_bytes + s.memset_avx2_bytes +
+		s.memset_avx512f_bytes);
+
+	FREE(src);
+	pmem_unmap(dest, size);
+	CLOSE(fd);
+
+	DONE(NULL);
+}
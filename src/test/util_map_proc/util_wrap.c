@@ -44,5 +44,5 @@
 char *
 util_map_hint_wrap(size_t len)
 {
-	return util_map_hint(len);
+	return util_map_hint(len, GIGABYTE);
 }
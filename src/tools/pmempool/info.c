@@ -698,7 +698,7 @@ pmempool_info_btt_data(struct pmem_info *pip, int v,
 
 			/* compute block's data address */
 			off_t block_off = arena_off + infop->dataoff +
-				map_entry * infop->internal_lbasize;
+				(off_t)map_entry * infop->internal_lbasize;
 
 			if (pmempool_info_read(pip, block_buff,
 					infop->external_lbasize, block_off)) {